@@ -57,6 +57,8 @@ struct _MetaCompositor
                              MetaWindow     *window);
   void (*unmaximize_window) (MetaCompositor *compositor,
                              MetaWindow     *window);
+
+  gint64 (*get_frame_interval) (MetaCompositor *compositor);
 };
 
 #endif
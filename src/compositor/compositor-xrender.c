@@ -84,6 +84,18 @@ typedef enum _MetaShadowType
   LAST_SHADOW_TYPE
 } MetaShadowType;
 
+typedef struct _MetaCompFrameStats
+{
+  guint frames;
+  guint missed_frames;
+  gint64 paint_time;
+  gint64 max_paint_time;
+
+  /* X requests issued and round trips made by the compositor */
+  gulong requests;
+  guint round_trips;
+} MetaCompFrameStats;
+
 typedef struct _MetaCompositorXRender
 {
   MetaCompositor compositor;
@@ -109,7 +121,17 @@ typedef struct _MetaCompositorXRender
 
 #ifdef USE_IDLE_REPAINT
   guint repaint_id;
+
+  /* Repaint clock.  All times are monotonic microseconds; last_vblank is
+     taken from Present CompleteNotify when available and otherwise
+     estimated from the refresh rate of the primary monitor */
+  gint64 frame_interval;
+  gint64 last_vblank;
+  guint64 last_msc;
+  gint64 frame_deadline;
+  gint64 paint_budget;
 #endif
+  MetaCompFrameStats stats;
   guint enabled : 1;
   guint show_redraw : 1;
   guint debug : 1;
@@ -133,7 +155,29 @@ typedef struct _shadow
   guchar *shadow_top;
 } shadow;
 
-#define NUM_BUFFER      2
+/* Pre-rendered pieces of a shadow, from which a shadow of any size can be
+   assembled on the server as a nine-slice: the corners are taken from the
+   template and the repeating edge strips are stretched along the sides */
+typedef struct _shadow_tiles
+{
+  MetaShadowType type;
+  int opacity;
+  int msize;
+  guchar centre;
+
+  Picture template;
+  Picture top;
+  Picture bottom;
+  Picture left;
+  Picture right;
+} shadow_tiles;
+
+#define MAX_SHADOW_TILES 16
+
+/* Maximum number of root buffers; the number actually used defaults to
+   DEFAULT_NUM_BUFFER and can be set with MARCO_COMPOSITOR_BUFFERS */
+#define NUM_BUFFER      4
+#define DEFAULT_NUM_BUFFER 2
 typedef struct _MetaCompScreen
 {
   MetaScreen *screen;
@@ -146,18 +190,21 @@ typedef struct _MetaCompScreen
 
   gboolean have_shadows;
   shadow *shadows[LAST_SHADOW_TYPE];
+  /* shadow_tiles, most recently used first */
+  GQueue *shadow_tiles;
 
   Picture root_picture;
   Picture root_buffers[NUM_BUFFER];
   Pixmap  root_pixmaps[NUM_BUFFER];
   int root_current;
+  int num_buffers;
+  /* Damage accumulated since each root buffer was last painted */
+  cairo_region_t *buffer_damage[NUM_BUFFER];
   Picture black_picture;
   Picture trans_black_picture;
   Picture root_tile;
   XserverRegion all_damage;
 #ifdef HAVE_PRESENT
-  XserverRegion prev_damage;
-
   XID present_eid;
   gboolean use_present;
   gboolean present_pending;
@@ -166,6 +213,7 @@ typedef struct _MetaCompScreen
   guint overlays;
   gboolean compositor_active;
   gboolean clip_changed;
+  gboolean extents_pending;
 
   GSList *dock_windows;
 } MetaCompScreen;
@@ -202,7 +250,12 @@ typedef struct _MetaCompWindow
   MetaShadowType shadow_type;
   Picture shadow_pict;
 
-  XserverRegion border_size;
+  /* Bounding region of the window in root coordinates, computed on the
+     client side so that occlusion can be resolved before any request is
+     sent.  shape_region caches the window-relative bounding shape of
+     shaped windows without a frame, the only case that needs a round trip */
+  cairo_region_t *border_size;
+  cairo_region_t *shape_region;
   XserverRegion extents;
 
   Picture shadow;
@@ -213,10 +266,14 @@ typedef struct _MetaCompWindow
 
   guint opacity;
 
-  XserverRegion border_clip;
+  cairo_region_t *border_clip;
 
   gboolean updates_frozen;
   gboolean update_pending;
+
+  /* Set while the extents are out of date because the window was moved,
+     resized or reshaped since the last frame */
+  gboolean extents_pending;
 } MetaCompWindow;
 
 #define OPAQUE 0xffffffff
@@ -241,6 +298,20 @@ typedef struct _MetaCompWindow
 
 #define DISPLAY_COMPOSITOR(display) ((MetaCompositorXRender *) meta_display_get_compositor (display))
 
+/* Marks a request that waits for a reply from the server */
+#define COUNT_ROUND_TRIP(display) (DISPLAY_COMPOSITOR (display)->stats.round_trips++)
+
+/* Finding out whether the trapped requests failed means waiting for
+ * the server to process them.  meta_error_trap_pop() doesn't wait, it
+ * only has the errors ignored when they arrive, so it isn't counted.
+ */
+static int
+error_trap_pop_with_return (MetaDisplay *display)
+{
+  COUNT_ROUND_TRIP (display);
+  return meta_error_trap_pop_with_return (display, FALSE);
+}
+
 /* Gaussian stuff for creating the shadows */
 static double
 gaussian (double r,
@@ -633,6 +704,79 @@ cairo_region_to_xserver_region (Display        *xdisplay,
   return xregion;
 }
 
+static cairo_region_t *
+xrectangles_to_cairo_region (XRectangle *rects,
+                             int         n_rects)
+{
+  cairo_rectangle_int_t *crects;
+  cairo_region_t *region;
+  int i;
+
+  if (rects == NULL || n_rects <= 0)
+    return cairo_region_create ();
+
+  crects = g_new (cairo_rectangle_int_t, n_rects);
+
+  for (i = 0; i < n_rects; i++)
+    {
+      crects[i].x = rects[i].x;
+      crects[i].y = rects[i].y;
+      crects[i].width = rects[i].width;
+      crects[i].height = rects[i].height;
+    }
+
+  region = cairo_region_create_rectangles (crects, n_rects);
+  g_free (crects);
+
+  return region;
+}
+
+static cairo_region_t *
+xserver_region_to_cairo_region (Display      *xdisplay,
+                                XserverRegion xregion)
+{
+  cairo_region_t *region;
+  XRectangle *rects;
+  int n_rects;
+
+  rects = XFixesFetchRegion (xdisplay, xregion, &n_rects);
+  region = xrectangles_to_cairo_region (rects, n_rects);
+
+  if (rects)
+    XFree (rects);
+
+  return region;
+}
+
+/* Sets the clip of picture straight from a client side region, without
+   creating a server side region for it */
+static void
+set_picture_clip_region (Display        *xdisplay,
+                         Picture         picture,
+                         cairo_region_t *region)
+{
+  int n_rects, i;
+  XRectangle *rects;
+
+  n_rects = cairo_region_num_rectangles (region);
+  rects = g_new (XRectangle, MAX (n_rects, 1));
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      cairo_region_get_rectangle (region, i, &rect);
+
+      rects[i].x = rect.x;
+      rects[i].y = rect.y;
+      rects[i].width = rect.width;
+      rects[i].height = rect.height;
+    }
+
+  XRenderSetPictureClipRectangles (xdisplay, picture, 0, 0, rects, n_rects);
+  g_free (rects);
+}
+
 static void
 shadow_picture_clip (Display          *xdisplay,
                      Picture           shadow_picture,
@@ -677,6 +821,208 @@ shadow_picture_clip (Display          *xdisplay,
   XFixesDestroyRegion (xdisplay, region2);
 }
 
+static void
+free_shadow_tiles (Display      *xdisplay,
+                   shadow_tiles *tiles)
+{
+  XRenderFreePicture (xdisplay, tiles->template);
+  XRenderFreePicture (xdisplay, tiles->top);
+  XRenderFreePicture (xdisplay, tiles->bottom);
+  XRenderFreePicture (xdisplay, tiles->left);
+  XRenderFreePicture (xdisplay, tiles->right);
+  g_free (tiles);
+}
+
+static Picture
+shadow_tile_strip (Display           *xdisplay,
+                   Window             xroot,
+                   XRenderPictFormat *format,
+                   Picture            template,
+                   int                x,
+                   int                y,
+                   int                width,
+                   int                height)
+{
+  XRenderPictureAttributes pa;
+  Pixmap pixmap;
+  Picture strip;
+
+  pixmap = XCreatePixmap (xdisplay, xroot, width, height, 8);
+  g_return_val_if_fail (pixmap != None, None);
+
+  pa.repeat = True;
+  strip = XRenderCreatePicture (xdisplay, pixmap, format, CPRepeat, &pa);
+  XFreePixmap (xdisplay, pixmap);
+
+  if (strip != None)
+    XRenderComposite (xdisplay, PictOpSrc, template, None, strip,
+                      x, y, 0, 0, 0, 0, width, height);
+
+  return strip;
+}
+
+static shadow_tiles *
+make_shadow_tiles (MetaDisplay   *display,
+                   MetaScreen    *screen,
+                   MetaShadowType shadow_type,
+                   double         opacity)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  Window xroot = meta_screen_get_xroot (screen);
+  XRenderPictFormat *format;
+  shadow_tiles *tiles;
+  XImage *image;
+  Pixmap pixmap;
+  GC gc;
+  int msize;
+
+  msize = info->shadows[shadow_type]->gaussian_map->size;
+
+  /* The shadow of a window one pixel wider than the gaussian map has
+     full corners and exactly one column and row of each edge */
+  image = make_shadow (display, screen, shadow_type, opacity,
+                       msize + 1, msize + 1);
+  if (!image)
+    return NULL;
+
+  pixmap = XCreatePixmap (xdisplay, xroot, image->width, image->height, 8);
+  if (!pixmap)
+    {
+      XDestroyImage (image);
+      return NULL;
+    }
+
+  gc = XCreateGC (xdisplay, pixmap, 0, 0);
+  XPutImage (xdisplay, pixmap, gc, image, 0, 0, 0, 0,
+             image->width, image->height);
+  XFreeGC (xdisplay, gc);
+  XDestroyImage (image);
+
+  format = XRenderFindStandardFormat (xdisplay, PictStandardA8);
+
+  tiles = g_new0 (shadow_tiles, 1);
+  tiles->type = shadow_type;
+  tiles->opacity = (int) (opacity * 25);
+  tiles->msize = msize;
+  tiles->centre = info->shadows[shadow_type]->shadow_top[tiles->opacity * (msize + 1) + msize];
+
+  tiles->template = XRenderCreatePicture (xdisplay, pixmap, format, 0, NULL);
+  XFreePixmap (xdisplay, pixmap);
+
+  tiles->top = shadow_tile_strip (xdisplay, xroot, format, tiles->template,
+                                  msize, 0, 1, msize);
+  tiles->bottom = shadow_tile_strip (xdisplay, xroot, format, tiles->template,
+                                     msize, msize + 1, 1, msize);
+  tiles->left = shadow_tile_strip (xdisplay, xroot, format, tiles->template,
+                                   0, msize, msize, 1);
+  tiles->right = shadow_tile_strip (xdisplay, xroot, format, tiles->template,
+                                    msize + 1, msize, msize, 1);
+
+  return tiles;
+}
+
+static shadow_tiles *
+get_shadow_tiles (MetaDisplay   *display,
+                  MetaScreen    *screen,
+                  MetaShadowType shadow_type,
+                  double         opacity)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  shadow_tiles *tiles;
+  int opacity_int = (int) (opacity * 25);
+  GList *l;
+
+  for (l = info->shadow_tiles->head; l; l = l->next)
+    {
+      tiles = l->data;
+
+      if (tiles->type == shadow_type && tiles->opacity == opacity_int)
+        {
+          if (l != info->shadow_tiles->head)
+            {
+              g_queue_unlink (info->shadow_tiles, l);
+              g_queue_push_head_link (info->shadow_tiles, l);
+            }
+
+          return tiles;
+        }
+    }
+
+  tiles = make_shadow_tiles (display, screen, shadow_type, opacity);
+  if (tiles == NULL)
+    return NULL;
+
+  g_queue_push_head (info->shadow_tiles, tiles);
+
+  while (g_queue_get_length (info->shadow_tiles) > MAX_SHADOW_TILES)
+    free_shadow_tiles (xdisplay, g_queue_pop_tail (info->shadow_tiles));
+
+  return tiles;
+}
+
+/* Assembles a shadow of any size from cached tiles without transferring
+   any image data; only valid once the shadow is large enough for its
+   corners not to overlap */
+static Picture
+tiled_shadow_picture (Display      *xdisplay,
+                      Window        xroot,
+                      shadow_tiles *tiles,
+                      int           width,
+                      int           height)
+{
+  XRenderColor c;
+  Pixmap pixmap;
+  Picture picture;
+  int msize = tiles->msize;
+  int swidth = width + msize;
+  int sheight = height + msize;
+  int x_diff = swidth - msize * 2;
+  int y_diff = sheight - msize * 2;
+
+  pixmap = XCreatePixmap (xdisplay, xroot, swidth, sheight, 8);
+  if (!pixmap)
+    return None;
+
+  picture = XRenderCreatePicture (xdisplay, pixmap,
+                                  XRenderFindStandardFormat (xdisplay, PictStandardA8),
+                                  0, 0);
+  XFreePixmap (xdisplay, pixmap);
+
+  if (!picture)
+    return None;
+
+  /* corners */
+  XRenderComposite (xdisplay, PictOpSrc, tiles->template, None, picture,
+                    0, 0, 0, 0, 0, 0, msize, msize);
+  XRenderComposite (xdisplay, PictOpSrc, tiles->template, None, picture,
+                    msize + 1, 0, 0, 0, swidth - msize, 0, msize, msize);
+  XRenderComposite (xdisplay, PictOpSrc, tiles->template, None, picture,
+                    0, msize + 1, 0, 0, 0, sheight - msize, msize, msize);
+  XRenderComposite (xdisplay, PictOpSrc, tiles->template, None, picture,
+                    msize + 1, msize + 1, 0, 0,
+                    swidth - msize, sheight - msize, msize, msize);
+
+  /* edges */
+  XRenderComposite (xdisplay, PictOpSrc, tiles->top, None, picture,
+                    0, 0, 0, 0, msize, 0, x_diff, msize);
+  XRenderComposite (xdisplay, PictOpSrc, tiles->bottom, None, picture,
+                    0, 0, 0, 0, msize, sheight - msize, x_diff, msize);
+  XRenderComposite (xdisplay, PictOpSrc, tiles->left, None, picture,
+                    0, 0, 0, 0, 0, msize, msize, y_diff);
+  XRenderComposite (xdisplay, PictOpSrc, tiles->right, None, picture,
+                    0, 0, 0, 0, swidth - msize, msize, msize, y_diff);
+
+  /* centre */
+  c.red = c.green = c.blue = 0;
+  c.alpha = tiles->centre * 0x101;
+  XRenderFillRectangle (xdisplay, PictOpSrc, picture, &c,
+                        msize, msize, x_diff, y_diff);
+
+  return picture;
+}
+
 static Picture
 shadow_picture (MetaDisplay      *display,
                 MetaScreen       *screen,
@@ -693,8 +1039,26 @@ shadow_picture (MetaDisplay      *display,
   Pixmap shadow_pixmap;
   Picture shadow_picture;
   Window xroot = meta_screen_get_xroot (screen);
+  shadow_tiles *tiles;
   GC gc;
 
+  tiles = get_shadow_tiles (display, screen, cw->shadow_type, opacity);
+  if (tiles != NULL && width > tiles->msize && height > tiles->msize)
+    {
+      shadow_picture = tiled_shadow_picture (xdisplay, xroot, tiles,
+                                             width, height);
+      if (shadow_picture != None)
+        {
+          *wp = width + tiles->msize;
+          *hp = height + tiles->msize;
+
+          shadow_picture_clip (xdisplay, shadow_picture, cw, borders,
+                               *wp, *hp);
+
+          return shadow_picture;
+        }
+    }
+
   shadow_image = make_shadow (display, screen, cw->shadow_type,
                               opacity, width, height);
   if (!shadow_image)
@@ -779,6 +1143,7 @@ find_window_for_child_window_in_display (MetaDisplay *display,
   Window parent;
   guint ignored_children;
 
+  COUNT_ROUND_TRIP (display);
   XQueryTree (meta_display_get_xdisplay (display), xwindow, &ignored1,
               &parent, &ignored2, &ignored_children);
 
@@ -880,6 +1245,7 @@ root_tile (MetaScreen *screen)
       gulong nitems, bytes_after;
       guchar *prop;
 
+      COUNT_ROUND_TRIP (display);
       if (XGetWindowProperty (xdisplay, xroot,
                               background_atoms[p],
                               0, 4, FALSE, AnyPropertyType,
@@ -1160,45 +1526,65 @@ win_extents (MetaCompWindow *cw)
   return XFixesCreateRegion (xdisplay, &r, 1);
 }
 
-static XserverRegion
-border_size (MetaCompWindow *cw)
+static cairo_region_t *
+get_shape_region (MetaCompWindow *cw)
 {
-  MetaScreen *screen = cw->screen;
-  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaDisplay *display = meta_screen_get_display (cw->screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
-  cairo_region_t *visible_region;
-  XserverRegion visible = None;
-  XserverRegion border;
-
-  if (cw->window)
-    {
-      visible_region = meta_window_get_frame_bounds (cw->window);
+  XRectangle *rects;
+  int n_rects, ordering;
 
-      if (visible_region != NULL)
-        visible = cairo_region_to_xserver_region (xdisplay, visible_region);
-    }
+  if (cw->shape_region)
+    return cw->shape_region;
 
+  COUNT_ROUND_TRIP (display);
   meta_error_trap_push (display);
-  border = XFixesCreateRegionFromWindow (xdisplay, cw->id,
-                                         WindowRegionBounding);
+  rects = XShapeGetRectangles (xdisplay, cw->id, ShapeBounding,
+                               &n_rects, &ordering);
   meta_error_trap_pop (display, FALSE);
 
-  g_return_val_if_fail (border != None, None);
-  XFixesTranslateRegion (xdisplay, border,
-                         cw->attrs.x + cw->attrs.border_width,
-                         cw->attrs.y + cw->attrs.border_width);
+  cw->shape_region = xrectangles_to_cairo_region (rects, n_rects);
 
-  if (visible != None)
-    {
-      XFixesTranslateRegion (xdisplay, visible,
-                         cw->attrs.x + cw->attrs.border_width,
-                         cw->attrs.y + cw->attrs.border_width);
+  if (rects)
+    XFree (rects);
 
-      XFixesIntersectRegion (xdisplay, visible, visible, border);
-      XFixesDestroyRegion (xdisplay, border);
+  return cw->shape_region;
+}
 
-      return visible;
+static cairo_region_t *
+border_size (MetaCompWindow *cw)
+{
+  cairo_region_t *visible_region;
+  cairo_region_t *border;
+  cairo_rectangle_int_t rect;
+
+  visible_region = NULL;
+  if (cw->window)
+    visible_region = meta_window_get_frame_bounds (cw->window);
+
+  /* The frame bounds already describe the shape we set on the frame,
+     unless the client has a shape of its own, which the frame shape
+     is cut to; then only the server knows the real shape */
+  if (cw->shaped &&
+      (visible_region == NULL || meta_window_has_shape (cw->window)))
+    {
+      border = cairo_region_copy (get_shape_region (cw));
     }
+  else
+    {
+      rect.x = -cw->attrs.border_width;
+      rect.y = -cw->attrs.border_width;
+      rect.width = cw->attrs.width + cw->attrs.border_width * 2;
+      rect.height = cw->attrs.height + cw->attrs.border_width * 2;
+      border = cairo_region_create_rectangle (&rect);
+    }
+
+  if (visible_region != NULL)
+    cairo_region_intersect (border, visible_region);
+
+  cairo_region_translate (border,
+                          cw->attrs.x + cw->attrs.border_width,
+                          cw->attrs.y + cw->attrs.border_width);
 
   return border;
 }
@@ -1237,7 +1623,7 @@ get_window_picture (MetaCompWindow *cw)
   if (cw->back_pixmap == None)
     cw->back_pixmap = XCompositeNameWindowPixmap (xdisplay, cw->id);
 
-  error_code = meta_error_trap_pop_with_return (display, FALSE);
+  error_code = error_trap_pop_with_return (display);
   if (error_code != 0)
     cw->back_pixmap = None;
 
@@ -1262,9 +1648,9 @@ get_window_picture (MetaCompWindow *cw)
 }
 
 static void
-paint_dock_shadows (MetaScreen   *screen,
-                    Picture       root_buffer,
-                    XserverRegion region)
+paint_dock_shadows (MetaScreen     *screen,
+                    Picture         root_buffer,
+                    cairo_region_t *region)
 {
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
@@ -1279,23 +1665,26 @@ paint_dock_shadows (MetaScreen   *screen,
   for (d = info->dock_windows; d; d = d->next)
     {
       MetaCompWindow *cw = d->data;
-      XserverRegion shadow_clip;
+      cairo_region_t *shadow_clip;
 
-      if (cw->shadow)
+      if (cw->shadow && cw->border_clip)
         {
-          shadow_clip = XFixesCreateRegion (xdisplay, NULL, 0);
-          XFixesIntersectRegion (xdisplay, shadow_clip,
-                                 cw->border_clip, region);
-
-          XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0, shadow_clip);
-
-          XRenderComposite (xdisplay, PictOpOver, info->black_picture,
-                            cw->shadow, root_buffer,
-                            0, 0, 0, 0,
-                            cw->attrs.x + cw->shadow_dx,
-                            cw->attrs.y + cw->shadow_dy,
-                            cw->shadow_width, cw->shadow_height);
-          XFixesDestroyRegion (xdisplay, shadow_clip);
+          shadow_clip = cairo_region_copy (cw->border_clip);
+          cairo_region_intersect (shadow_clip, region);
+
+          if (!cairo_region_is_empty (shadow_clip))
+            {
+              set_picture_clip_region (xdisplay, root_buffer, shadow_clip);
+
+              XRenderComposite (xdisplay, PictOpOver, info->black_picture,
+                                cw->shadow, root_buffer,
+                                0, 0, 0, 0,
+                                cw->attrs.x + cw->shadow_dx,
+                                cw->attrs.y + cw->shadow_dy,
+                                cw->shadow_width, cw->shadow_height);
+            }
+
+          cairo_region_destroy (shadow_clip);
         }
     }
 }
@@ -1323,7 +1712,7 @@ present_flip (MetaScreen *screen, XserverRegion region, Pixmap pixmap)
                  0, 1, 0, NULL, 0);
 
   int error_code;
-  error_code = meta_error_trap_pop_with_return (display, FALSE);
+  error_code = error_trap_pop_with_return (display);
   if (error_code)
     {
       debug = DISPLAY_COMPOSITOR (display)->debug;
@@ -1346,12 +1735,20 @@ present_flip (MetaScreen *screen, XserverRegion region, Pixmap pixmap)
 }
 #endif /* HAVE_PRESENT */
 
+/*
+ * Occlusion is resolved entirely on the client side: every window's
+ * visible part of the damaged area is computed with local region math,
+ * windows that end up fully covered are skipped and only the final clip
+ * of each painted window is sent to the server.  Translucent windows are
+ * only recomposited where they intersect the damage of this buffer.
+ */
 static void
-paint_windows (MetaScreen   *screen,
-               GList        *windows,
-               Picture       root_buffer,
-               Pixmap        root_pixmap,
-               XserverRegion region)
+paint_windows (MetaScreen     *screen,
+               GList          *windows,
+               Picture         root_buffer,
+               Pixmap          root_pixmap,
+               cairo_region_t *damage,
+               XserverRegion   region)
 {
   MetaDisplay *display = meta_screen_get_display (screen);
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
@@ -1359,7 +1756,8 @@ paint_windows (MetaScreen   *screen,
   GList *index, *last;
   int screen_width, screen_height;
   MetaCompWindow *cw;
-  XserverRegion paint_region, desktop_region;
+  cairo_region_t *paint_region, *desktop_region, *clip;
+  cairo_rectangle_int_t rect;
 
   if (info == NULL)
     {
@@ -1368,22 +1766,8 @@ paint_windows (MetaScreen   *screen,
 
   meta_screen_get_size (screen, &screen_width, &screen_height);
 
-  if (region == None)
-    {
-      XRectangle r;
-      r.x = 0;
-      r.y = 0;
-      r.width = screen_width;
-      r.height = screen_height;
-      paint_region = XFixesCreateRegion (xdisplay, &r, 1);
-    }
-  else
-    {
-      paint_region = XFixesCreateRegion (xdisplay, NULL, 0);
-      XFixesCopyRegion (xdisplay, paint_region, region);
-    }
-
-  desktop_region = None;
+  paint_region = cairo_region_copy (damage);
+  desktop_region = NULL;
 
   /*
    * Painting from top to bottom, reducing the clipping area at
@@ -1405,39 +1789,15 @@ paint_windows (MetaScreen   *screen,
       if (cw->attrs.map_state != IsViewable)
         continue;
 
-#if 0
-      if ((cw->attrs.x + cw->attrs.width < 1) ||
-          (cw->attrs.y + cw->attrs.height < 1) ||
-          (cw->attrs.x >= screen_width) || (cw->attrs.y >= screen_height))
-        {
-          /* Off screen */
-          continue;
-        }
-#endif
-
-      if (cw->picture == None)
-        cw->picture = get_window_picture (cw);
-
       /* If the clip region of the screen has been changed
          then we need to recreate the extents of the window */
-      if (info->clip_changed)
+      if (info->clip_changed && cw->border_size)
         {
-          if (cw->border_size)
-            {
-              XFixesDestroyRegion (xdisplay, cw->border_size);
-              cw->border_size = None;
-            }
-
-#if 0
-          if (cw->extents)
-            {
-              XFixesDestroyRegion (xdisplay, cw->extents);
-              cw->extents = None;
-            }
-#endif
+          cairo_region_destroy (cw->border_size);
+          cw->border_size = NULL;
         }
 
-      if (cw->border_size == None)
+      if (cw->border_size == NULL)
         cw->border_size = border_size (cw);
 
       if (cw->extents == None)
@@ -1445,50 +1805,56 @@ paint_windows (MetaScreen   *screen,
 
       if (cw->mode == WINDOW_SOLID)
         {
-          int x, y, wid, hei;
+          clip = cairo_region_copy (paint_region);
+          cairo_region_intersect (clip, cw->border_size);
 
-          x = cw->attrs.x;
-          y = cw->attrs.y;
-          wid = cw->attrs.width + cw->attrs.border_width * 2;
-          hei = cw->attrs.height + cw->attrs.border_width * 2;
+          /* Fully occluded windows are not painted at all */
+          if (!cairo_region_is_empty (clip))
+            {
+              int x, y, wid, hei;
 
-          XFixesSetPictureClipRegion (xdisplay, root_buffer,
-                                      0, 0, paint_region);
-          XRenderComposite (xdisplay, PictOpSrc, cw->picture,
-                            None, root_buffer, 0, 0, 0, 0,
-                            x, y, wid, hei);
+              if (cw->picture == None)
+                cw->picture = get_window_picture (cw);
+
+              x = cw->attrs.x;
+              y = cw->attrs.y;
+              wid = cw->attrs.width + cw->attrs.border_width * 2;
+              hei = cw->attrs.height + cw->attrs.border_width * 2;
+
+              set_picture_clip_region (xdisplay, root_buffer, clip);
+              XRenderComposite (xdisplay, PictOpSrc, cw->picture,
+                                None, root_buffer, 0, 0, 0, 0,
+                                x, y, wid, hei);
+            }
+
+          cairo_region_destroy (clip);
 
           if (cw->type == META_COMP_WINDOW_DESKTOP)
             {
-              if(desktop_region)
-              {
-                XFixesUnionRegion (xdisplay, desktop_region, desktop_region, paint_region);
-              }
+              if (desktop_region)
+                cairo_region_union (desktop_region, paint_region);
               else
-              {
-                desktop_region = XFixesCreateRegion (xdisplay, 0, 0);
-                XFixesCopyRegion (xdisplay, desktop_region, paint_region);
-              }
+                desktop_region = cairo_region_copy (paint_region);
             }
 
-          XFixesSubtractRegion (xdisplay, paint_region,
-                                paint_region, cw->border_size);
+          cairo_region_subtract (paint_region, cw->border_size);
         }
-
-      if (!cw->border_clip)
+      else if (cw->picture == None)
         {
-          cw->border_clip = XFixesCreateRegion (xdisplay, 0, 0);
-          XFixesCopyRegion (xdisplay, cw->border_clip, paint_region);
+          cw->picture = get_window_picture (cw);
         }
+
+      if (!cw->border_clip)
+        cw->border_clip = cairo_region_copy (paint_region);
     }
 
-  XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0, paint_region);
+  set_picture_clip_region (xdisplay, root_buffer, paint_region);
   paint_root (screen, root_buffer);
 
-  paint_dock_shadows (screen, root_buffer, desktop_region == None ?
+  paint_dock_shadows (screen, root_buffer, desktop_region == NULL ?
                       paint_region : desktop_region);
-  if (desktop_region != None)
-    XFixesDestroyRegion (xdisplay, desktop_region);
+  if (desktop_region != NULL)
+    cairo_region_destroy (desktop_region);
 
   /*
    * Painting from bottom to top, translucent windows and shadows are painted
@@ -1497,48 +1863,53 @@ paint_windows (MetaScreen   *screen,
     {
       cw = (MetaCompWindow *) index->data;
 
-      if (cw->picture)
+      if (cw->picture && cw->border_clip)
         {
           if (cw->shadow && cw->type != META_COMP_WINDOW_DOCK)
             {
-              XserverRegion shadow_clip;
+              rect.x = cw->attrs.x + cw->shadow_dx;
+              rect.y = cw->attrs.y + cw->shadow_dy;
+              rect.width = cw->shadow_width;
+              rect.height = cw->shadow_height;
 
-              shadow_clip = XFixesCreateRegion (xdisplay, NULL, 0);
-              XFixesSubtractRegion (xdisplay, shadow_clip, cw->border_clip,
-                                    cw->border_size);
-              XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0,
-                                          shadow_clip);
+              clip = cairo_region_copy (cw->border_clip);
+              cairo_region_intersect_rectangle (clip, &rect);
+              cairo_region_subtract (clip, cw->border_size);
 
-              XRenderComposite (xdisplay, PictOpOver, info->black_picture,
-                                cw->shadow, root_buffer,
-                                0, 0, 0, 0,
-                                cw->attrs.x + cw->shadow_dx,
-                                cw->attrs.y + cw->shadow_dy,
-                                cw->shadow_width, cw->shadow_height);
-              if (shadow_clip)
-                XFixesDestroyRegion (xdisplay, shadow_clip);
-            }
+              if (!cairo_region_is_empty (clip))
+                {
+                  set_picture_clip_region (xdisplay, root_buffer, clip);
+
+                  XRenderComposite (xdisplay, PictOpOver, info->black_picture,
+                                    cw->shadow, root_buffer,
+                                    0, 0, 0, 0,
+                                    cw->attrs.x + cw->shadow_dx,
+                                    cw->attrs.y + cw->shadow_dy,
+                                    cw->shadow_width, cw->shadow_height);
+                }
 
-          if ((cw->opacity != (guint) OPAQUE) && !(cw->alpha_pict))
-            {
-              cw->alpha_pict = solid_picture (display, screen, FALSE,
-                                              (double) cw->opacity / OPAQUE,
-                                              0, 0, 0);
+              cairo_region_destroy (clip);
             }
 
-          XFixesIntersectRegion (xdisplay, cw->border_clip, cw->border_clip,
-                                 cw->border_size);
-          XFixesSetPictureClipRegion (xdisplay, root_buffer, 0, 0,
-                                      cw->border_clip);
-          if (cw->mode == WINDOW_ARGB)
+          cairo_region_intersect (cw->border_clip, cw->border_size);
+
+          if (cw->mode == WINDOW_ARGB && !cairo_region_is_empty (cw->border_clip))
             {
               int x, y, wid, hei;
 
+              if ((cw->opacity != (guint) OPAQUE) && !(cw->alpha_pict))
+                {
+                  cw->alpha_pict = solid_picture (display, screen, FALSE,
+                                                  (double) cw->opacity / OPAQUE,
+                                                  0, 0, 0);
+                }
+
               x = cw->attrs.x;
               y = cw->attrs.y;
               wid = cw->attrs.width + cw->attrs.border_width * 2;
               hei = cw->attrs.height + cw->attrs.border_width * 2;
 
+              set_picture_clip_region (xdisplay, root_buffer, cw->border_clip);
               XRenderComposite (xdisplay, PictOpOver, cw->picture,
                                 cw->alpha_pict, root_buffer, 0, 0, 0, 0,
                                 x, y, wid, hei);
@@ -1547,8 +1918,8 @@ paint_windows (MetaScreen   *screen,
 
       if (cw->border_clip)
         {
-          XFixesDestroyRegion (xdisplay, cw->border_clip);
-          cw->border_clip = None;
+          cairo_region_destroy (cw->border_clip);
+          cw->border_clip = NULL;
         }
     }
 
@@ -1567,21 +1938,24 @@ paint_windows (MetaScreen   *screen,
     }
 
   XFlush (xdisplay);
-  XFixesDestroyRegion (xdisplay, paint_region);
+  cairo_region_destroy (paint_region);
 }
 
 static void
-paint_all (MetaScreen   *screen,
-           XserverRegion region,
-           int           b)
+paint_all (MetaScreen     *screen,
+           cairo_region_t *damage,
+           int             b)
 {
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
   int screen_width, screen_height;
+  XserverRegion region;
 
   meta_screen_get_size (screen, &screen_width, &screen_height);
 
+  region = cairo_region_to_xserver_region (xdisplay, damage);
+
   if (DISPLAY_COMPOSITOR (display)->show_redraw)
     {
       Picture overlay;
@@ -1610,58 +1984,136 @@ paint_all (MetaScreen   *screen,
   if (info->root_buffers[b] == None)
     info->root_buffers[b] = create_root_buffer (screen, info->root_pixmaps[b]);
 
-  paint_windows (screen, info->windows, info->root_buffers[b], info->root_pixmaps[b], region);
+  paint_windows (screen, info->windows, info->root_buffers[b], info->root_pixmaps[b],
+                 damage, region);
+
+  XFixesDestroyRegion (xdisplay, region);
 }
 
+static void accumulate_damage (MetaScreen   *screen,
+                               XserverRegion damage);
+
+/* Rebuilds the extents of the windows that were configured since the last
+   frame and damages the area they now cover */
 static void
-repair_screen (MetaScreen *screen)
+flush_pending_extents (MetaScreen *screen)
 {
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
+  GList *index;
 
-  g_return_if_fail(info != NULL);
+  if (!info->extents_pending)
+    return;
 
-  if (info->all_damage != None)
+  for (index = info->windows; index; index = index->next)
     {
-#ifdef HAVE_PRESENT
-      if (info->use_present)
+      MetaCompWindow *cw = (MetaCompWindow *) index->data;
+      XserverRegion damage;
+
+      if (!cw->extents_pending)
+        continue;
+
+      cw->extents_pending = FALSE;
+
+      if (cw->extents)
         {
-          if (!info->present_pending)
-            {
-              XserverRegion damage = info->all_damage;
-              meta_error_trap_push (display);
-              if (info->prev_damage)
-                {
-                  XFixesUnionRegion(xdisplay, info->prev_damage, info->prev_damage, damage);
-                  damage = info->prev_damage;
-                }
+          XFixesDestroyRegion (xdisplay, cw->extents);
+          cw->extents = None;
+        }
 
-              paint_all (screen, damage, info->root_current);
+      if (cw->attrs.map_state != IsViewable)
+        continue;
 
-              if (++info->root_current >= NUM_BUFFER)
-                info->root_current = 0;
+      cw->extents = win_extents (cw);
 
-              if (info->prev_damage)
-                XFixesDestroyRegion (xdisplay, info->prev_damage);
+      damage = XFixesCreateRegion (xdisplay, &cw->shape_bounds, 1);
+      XFixesUnionRegion (xdisplay, damage, damage, cw->extents);
 
-              info->prev_damage = info->all_damage;
-              info->all_damage = None;
-              info->clip_changed = FALSE;
-              meta_error_trap_pop (display, FALSE);
-            }
-        }
-      else
+      dump_xserver_region ("flush_pending_extents", display, damage);
+      accumulate_damage (screen, damage);
+    }
+
+  info->extents_pending = FALSE;
+}
+
+static void
+repair_screen (MetaScreen *screen)
+{
+  MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+  MetaDisplay *display = meta_screen_get_display (screen);
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  cairo_region_t *damage;
+  int num_buffers, b;
+
+  g_return_if_fail(info != NULL);
+
+  num_buffers = 1;
+#ifdef HAVE_PRESENT
+  if (info->use_present)
+    {
+      if (info->present_pending)
+        return;
+
+      num_buffers = info->num_buffers;
+    }
 #endif /* HAVE_PRESENT */
-        {
-          meta_error_trap_push (display);
-          paint_all (screen, info->all_damage, info->root_current);
-          XFixesDestroyRegion (xdisplay, info->all_damage);
-          info->all_damage = None;
-          info->clip_changed = FALSE;
-          meta_error_trap_pop (display, FALSE);
-        }
+
+  meta_error_trap_push (display);
+
+  flush_pending_extents (screen);
+
+  if (info->all_damage == None)
+    {
+      meta_error_trap_pop (display, FALSE);
+      return;
+    }
+
+  COUNT_ROUND_TRIP (display);
+  damage = xserver_region_to_cairo_region (xdisplay, info->all_damage);
+  XFixesDestroyRegion (xdisplay, info->all_damage);
+  info->all_damage = None;
+
+  /* Every buffer in the rotation has to catch up with this frame's
+     damage the next time it is painted */
+  if (num_buffers > 1)
+    {
+      for (b = 0; b < num_buffers; b++)
+        cairo_region_union (info->buffer_damage[b], damage);
+    }
+  else
+    {
+      cairo_region_union (info->buffer_damage[info->root_current], damage);
+    }
+
+  cairo_region_destroy (damage);
+
+  b = info->root_current;
+
+  /* A buffer that doesn't exist yet has no valid contents at all */
+  if (info->root_buffers[b] == None)
+    {
+      cairo_rectangle_int_t rect;
+      int width, height;
+
+      meta_screen_get_size (screen, &width, &height);
+      rect.x = 0;
+      rect.y = 0;
+      rect.width = width;
+      rect.height = height;
+      cairo_region_union_rectangle (info->buffer_damage[b], &rect);
     }
+
+  paint_all (screen, info->buffer_damage[b], b);
+
+  cairo_region_destroy (info->buffer_damage[b]);
+  info->buffer_damage[b] = cairo_region_create ();
+
+  if (num_buffers > 1 && ++info->root_current >= num_buffers)
+    info->root_current = 0;
+
+  info->clip_changed = FALSE;
+  meta_error_trap_pop (display, FALSE);
 }
 
 static void
@@ -1683,41 +2135,142 @@ repair_display (MetaDisplay *display)
 }
 
 #ifdef USE_IDLE_REPAINT
+/* Number of frames between two reports of the frame statistics */
+#define FRAME_STATS_INTERVAL 300
+
+/* Slack added on top of the average paint time when deciding how early
+   before the vblank a frame has to be started */
+#define FRAME_BUDGET_SLACK 1000
+
+static gint64
+get_refresh_interval (MetaDisplay *display)
+{
+  Display *xdisplay = meta_display_get_xdisplay (display);
+  GdkDisplay *gdk_display = gdk_x11_lookup_xdisplay (xdisplay);
+  GdkMonitor *monitor;
+  int refresh_rate = 0;
+
+  monitor = gdk_display_get_primary_monitor (gdk_display);
+  if (monitor == NULL)
+    monitor = gdk_display_get_monitor (gdk_display, 0);
+
+  if (monitor != NULL)
+    refresh_rate = gdk_monitor_get_refresh_rate (monitor);
+
+  /* The refresh rate is in milli-Hertz; assume 60Hz if it is unknown */
+  if (refresh_rate <= 0)
+    refresh_rate = 60000;
+
+  return (G_USEC_PER_SEC * (gint64) 1000) / refresh_rate;
+}
+
+static gint64
+next_vblank (MetaCompositorXRender *compositor,
+             gint64                 now)
+{
+  gint64 frames;
+
+  /* Without any reference point yet, the first frame starts the clock */
+  if (compositor->last_vblank == 0)
+    {
+      compositor->last_vblank = now;
+      return now;
+    }
+
+  frames = (now - compositor->last_vblank) / compositor->frame_interval + 1;
+
+  return compositor->last_vblank + frames * compositor->frame_interval;
+}
+
+static void
+update_frame_stats (MetaCompositorXRender *compositor,
+                    gint64                 start,
+                    gint64                 end)
+{
+  MetaCompFrameStats *stats = &compositor->stats;
+  gint64 paint_time = end - start;
+
+  stats->frames++;
+  stats->paint_time += paint_time;
+  stats->max_paint_time = MAX (stats->max_paint_time, paint_time);
+
+  if (end > compositor->frame_deadline)
+    stats->missed_frames++;
+
+  /* Keep the budget at a running average of the paint time, but never
+     let it take a whole frame */
+  compositor->paint_budget = (compositor->paint_budget * 7 + paint_time) / 8;
+  compositor->paint_budget = MIN (compositor->paint_budget,
+                                  compositor->frame_interval - FRAME_BUDGET_SLACK);
+
+  if (stats->frames == FRAME_STATS_INTERVAL)
+    {
+      if (compositor->debug)
+        fprintf (stderr, "%u frames: %u missed, paint time %" G_GINT64_FORMAT
+                 " us average, %" G_GINT64_FORMAT " us max, frame interval %"
+                 G_GINT64_FORMAT " us, %lu requests and %u round trips"
+                 " per frame\n",
+                 stats->frames, stats->missed_frames,
+                 stats->paint_time / stats->frames, stats->max_paint_time,
+                 compositor->frame_interval,
+                 stats->requests / stats->frames,
+                 stats->round_trips / stats->frames);
+
+      memset (stats, 0, sizeof (MetaCompFrameStats));
+    }
+}
+
 static gboolean
 compositor_idle_cb (gpointer data)
 {
   MetaCompositorXRender *compositor = (MetaCompositorXRender *) data;
+  Display *xdisplay = meta_display_get_xdisplay (compositor->display);
+  gulong serial;
+  gint64 start;
 
   compositor->repaint_id = 0;
+
+  start = g_get_monotonic_time ();
+  serial = NextRequest (xdisplay);
+
   repair_display (compositor->display);
 
+  compositor->stats.requests += NextRequest (xdisplay) - serial;
+  update_frame_stats (compositor, start, g_get_monotonic_time ());
+
   return FALSE;
 }
 
+/* All damage that arrives before a frame is started is coalesced into it;
+   the frame is started just early enough to be ready for the next vblank */
 static void
 add_repair (MetaDisplay *display)
 {
   MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
+  gint64 now, delay;
 
   if (compositor->repaint_id > 0)
     return;
 
-#if 1
-  compositor->repaint_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
-                                            compositor_idle_cb, compositor,
-                                            NULL);
-#else
-  /* Limit it to 50fps */
-  compositor->repaint_id = g_timeout_add_full (G_PRIORITY_HIGH, 20,
-                                               compositor_idle_cb, compositor,
-                                               NULL);
-#endif
+  now = g_get_monotonic_time ();
+  compositor->frame_deadline = next_vblank (compositor, now);
+  delay = compositor->frame_deadline - now
+          - compositor->paint_budget - FRAME_BUDGET_SLACK;
+
+  if (delay < 1000)
+    compositor->repaint_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                                              compositor_idle_cb, compositor,
+                                              NULL);
+  else
+    compositor->repaint_id = g_timeout_add_full (G_PRIORITY_HIGH, delay / 1000,
+                                                 compositor_idle_cb, compositor,
+                                                 NULL);
 }
 #endif
 
 static void
-add_damage (MetaScreen     *screen,
-            XserverRegion   damage)
+accumulate_damage (MetaScreen   *screen,
+                   XserverRegion damage)
 {
   MetaDisplay *display = meta_screen_get_display (screen);
   Display *xdisplay = meta_display_get_xdisplay (display);
@@ -1737,9 +2290,16 @@ add_damage (MetaScreen     *screen,
           info->all_damage = damage;
         }
     }
+}
+
+static void
+add_damage (MetaScreen     *screen,
+            XserverRegion   damage)
+{
+  accumulate_damage (screen, damage);
 
 #ifdef USE_IDLE_REPAINT
-  add_repair (display);
+  add_repair (meta_screen_get_display (screen));
 #endif
 }
 
@@ -1838,17 +2398,9 @@ free_win (MetaCompWindow *cw,
       cw->shadow_pict = None;
     }
 
-  if (cw->border_size)
-    {
-      XFixesDestroyRegion (xdisplay, cw->border_size);
-      cw->border_size = None;
-    }
-
-  if (cw->border_clip)
-    {
-      XFixesDestroyRegion (xdisplay, cw->border_clip);
-      cw->border_clip = None;
-    }
+  g_clear_pointer (&cw->border_size, cairo_region_destroy);
+  g_clear_pointer (&cw->shape_region, cairo_region_destroy);
+  g_clear_pointer (&cw->border_clip, cairo_region_destroy);
 
   if (cw->extents)
     {
@@ -2074,6 +2626,7 @@ is_shaped (MetaDisplay *display,
 
   if (meta_display_has_shape (display))
     {
+      COUNT_ROUND_TRIP (display);
       XShapeQueryExtents (xdisplay, xwindow, &bounding_shaped,
                           &xws, &yws, &wws, &hws, &clip_shaped,
                           &xbs, &ybs, &wbs, &hbs);
@@ -2096,6 +2649,7 @@ get_window_type (MetaDisplay    *display,
   n_atoms = 0;
   atoms = NULL;
 
+  COUNT_ROUND_TRIP (display);
   meta_prop_get_atom_list (display, cw->id,
                            compositor->atom_net_wm_window_type,
                            &atoms, &n_atoms);
@@ -2166,6 +2720,7 @@ add_win (MetaScreen *screen,
   cw->window = window;
   cw->id = xwindow;
 
+  COUNT_ROUND_TRIP (display);
   if (!XGetWindowAttributes (xdisplay, xwindow, &cw->attrs))
     {
       g_free (cw);
@@ -2197,7 +2752,8 @@ add_win (MetaScreen *screen,
 
   cw->alpha_pict = None;
   cw->shadow_pict = None;
-  cw->border_size = None;
+  cw->border_size = NULL;
+  cw->shape_region = NULL;
   cw->extents = None;
   cw->shadow = None;
   cw->shadow_dx = 0;
@@ -2212,7 +2768,7 @@ add_win (MetaScreen *screen,
 
   cw->opacity = OPAQUE;
 
-  cw->border_clip = None;
+  cw->border_clip = NULL;
 
   determine_mode (display, screen, cw);
   cw->needs_shadow = window_has_shadow (cw);
@@ -2320,6 +2876,10 @@ restack_win (MetaCompWindow *cw,
     }
 }
 
+/* Rebuilding the extents of a window takes several requests, so a burst
+   of configure events for a window only damages the area the window had
+   on screen at the first one, and the extents are rebuilt once when the
+   next frame is painted, see flush_pending_extents() */
 static void
 resize_win (MetaCompWindow *cw,
             int             x,
@@ -2334,34 +2894,21 @@ resize_win (MetaCompWindow *cw,
   Display *xdisplay = meta_display_get_xdisplay (display);
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
   XserverRegion damage;
-  XserverRegion shape;
-  gboolean debug;
-
-  debug = DISPLAY_COMPOSITOR (display)->debug;
 
-  if (cw->extents)
+  if (!cw->extents_pending)
     {
-      damage = XFixesCreateRegion (xdisplay, NULL, 0);
-      XFixesCopyRegion (xdisplay, damage, cw->extents);
-    }
-  else
-    {
-      damage = None;
-      if (debug)
-        fprintf (stderr, "no extents to damage !\n");
-    }
+      damage = XFixesCreateRegion (xdisplay, &cw->shape_bounds, 1);
 
-  /*  { // Damage whole screen each time ! ;-)
-    XRectangle r;
+      if (cw->extents)
+        XFixesUnionRegion (xdisplay, damage, damage, cw->extents);
+      else if (DISPLAY_COMPOSITOR (display)->debug)
+        fprintf (stderr, "no extents to damage !\n");
 
-    r.x = 0;
-    r.y = 0;
-    meta_screen_get_size (screen, &r.width, &r.height);
-    fprintf (stderr, "Damage whole screen %d,%d (%d %d)\n",
-             r.x, r.y, r.width, r.height);
+      dump_xserver_region ("resize_win", display, damage);
+      add_damage (screen, damage);
 
-    damage = XFixesCreateRegion (xdisplay, &r, 1);
-    } */
+      cw->extents_pending = TRUE;
+    }
 
   cw->attrs.x = x;
   cw->attrs.y = y;
@@ -2401,6 +2948,8 @@ resize_win (MetaCompWindow *cw,
           XRenderFreePicture (xdisplay, cw->shadow);
           cw->shadow = None;
         }
+
+      g_clear_pointer (&cw->shape_region, cairo_region_destroy);
     }
 
   cw->attrs.width = width;
@@ -2408,35 +2957,15 @@ resize_win (MetaCompWindow *cw,
   cw->attrs.border_width = border_width;
   cw->attrs.override_redirect = override_redirect;
 
-  if (cw->extents)
-    XFixesDestroyRegion (xdisplay, cw->extents);
-
-  cw->extents = win_extents (cw);
-
-  if (damage)
-    {
-      if (debug)
-        fprintf (stderr, "Inexplicable intersection with new extents!\n");
-
-      XFixesUnionRegion (xdisplay, damage, damage, cw->extents);
-    }
-  else
-    {
-      damage = XFixesCreateRegion (xdisplay, NULL, 0);
-      XFixesCopyRegion (xdisplay, damage, cw->extents);
-    }
-
-  shape = XFixesCreateRegion (xdisplay, &cw->shape_bounds, 1);
-  XFixesUnionRegion (xdisplay, damage, damage, shape);
-  XFixesDestroyRegion (xdisplay, shape);
-
-  dump_xserver_region ("resize_win", display, damage);
-  add_damage (screen, damage);
-
   if (info != NULL)
     {
       info->clip_changed = TRUE;
+      info->extents_pending = TRUE;
     }
+
+#ifdef USE_IDLE_REPAINT
+  add_repair (display);
+#endif
 }
 
 /* event processors must all be called with an error trap in place */
@@ -2605,6 +3134,7 @@ process_property_notify (MetaCompositorXRender *compositor,
       if (!cw)
         return;
 
+      COUNT_ROUND_TRIP (display);
       if (!meta_prop_get_cardinal (display, event->window,
                                    compositor->atom_net_wm_window_opacity,
                                    &value))
@@ -2786,6 +3316,8 @@ process_shape (MetaCompositorXRender *compositor,
 
   if (event->kind == ShapeBounding)
     {
+      g_clear_pointer (&cw->shape_region, cairo_region_destroy);
+
       if (!event->shaped && cw->shaped)
         cw->shaped = FALSE;
 
@@ -2819,9 +3351,36 @@ xrender_present_complete(MetaScreen *screen,
                          XPresentCompleteNotifyEvent *ce)
 {
   MetaCompScreen *info = meta_screen_get_compositor_data (screen);
+#ifdef USE_IDLE_REPAINT
+  MetaDisplay *display = meta_screen_get_display (screen);
+  MetaCompositorXRender *compositor = DISPLAY_COMPOSITOR (display);
+#endif
 
   info->present_pending = False;
-  repair_screen(screen);
+
+#ifdef USE_IDLE_REPAINT
+  /* Resynchronise the repaint clock on the real vblank and refine the
+     estimate of the refresh interval */
+  if (ce->kind == PresentCompleteKindPixmap && ce->ust > 0)
+    {
+      if (compositor->last_msc != 0 && ce->msc > compositor->last_msc &&
+          (gint64) ce->ust > compositor->last_vblank)
+        {
+          gint64 interval = ((gint64) ce->ust - compositor->last_vblank)
+                            / (gint64) (ce->msc - compositor->last_msc);
+
+          compositor->frame_interval = (compositor->frame_interval * 3 + interval) / 4;
+        }
+
+      compositor->last_vblank = ce->ust;
+      compositor->last_msc = ce->msc;
+    }
+
+  if (info->all_damage != None)
+    add_repair (display);
+#else
+  repair_screen (screen);
+#endif
 }
 #endif /* HAVE_PRESENT */
 
@@ -2956,6 +3515,7 @@ xrender_manage_screen (MetaCompositor *compositor,
   gdk_x11_display_error_trap_push (gdk_display);
   XCompositeRedirectSubwindows (xdisplay, xroot, CompositeRedirectManual);
   XSync (xdisplay, FALSE);
+  COUNT_ROUND_TRIP (display);
 
   if (gdk_x11_display_error_trap_pop (gdk_display))
     {
@@ -2989,9 +3549,15 @@ xrender_manage_screen (MetaCompositor *compositor,
       return;
     }
 
+  info->num_buffers = DEFAULT_NUM_BUFFER;
+  if (g_getenv ("MARCO_COMPOSITOR_BUFFERS") != NULL)
+    info->num_buffers = CLAMP (atoi (g_getenv ("MARCO_COMPOSITOR_BUFFERS")),
+                               1, NUM_BUFFER);
+
   for (b = 0; b < NUM_BUFFER; b++) {
     info->root_buffers[b] = None;
     info->root_pixmaps[b] = None;
+    info->buffer_damage[b] = cairo_region_create ();
   }
   info->black_picture = solid_picture (display, screen, TRUE, 1, 0, 0, 0);
 
@@ -3012,6 +3578,7 @@ xrender_manage_screen (MetaCompositor *compositor,
     {
       meta_verbose ("Enabling shadows\n");
       generate_shadows (info);
+      info->shadow_tiles = g_queue_new ();
     }
   else
     meta_verbose ("Disabling shadows\n");
@@ -3050,6 +3617,7 @@ xrender_unmanage_screen (MetaCompositor *compositor,
   MetaCompScreen *info;
   Window xroot = meta_screen_get_xroot (screen);
   GList *index;
+  int b;
 
   info = meta_screen_get_compositor_data (screen);
 
@@ -3071,6 +3639,17 @@ xrender_unmanage_screen (MetaCompositor *compositor,
   if (info->root_picture)
     XRenderFreePicture (xdisplay, info->root_picture);
 
+  for (b = 0; b < NUM_BUFFER; b++)
+    {
+      if (info->root_buffers[b])
+        {
+          XRenderFreePicture (xdisplay, info->root_buffers[b]);
+          XFreePixmap (xdisplay, info->root_pixmaps[b]);
+        }
+
+      cairo_region_destroy (info->buffer_damage[b]);
+    }
+
   if (info->black_picture)
     XRenderFreePicture (xdisplay, info->black_picture);
 
@@ -3078,6 +3657,10 @@ xrender_unmanage_screen (MetaCompositor *compositor,
     {
       MetaShadowType t;
 
+      while (!g_queue_is_empty (info->shadow_tiles))
+        free_shadow_tiles (xdisplay, g_queue_pop_head (info->shadow_tiles));
+      g_queue_free (info->shadow_tiles);
+
       for (t = META_SHADOW_SMALL; t < LAST_SHADOW_TYPE; t++)
         {
           g_free (info->shadows[t]->gaussian_map);
@@ -3191,6 +3774,8 @@ xrender_process_event (MetaCompositor *compositor,
 {
 #ifdef HAVE_COMPOSITE_EXTENSIONS
   MetaCompositorXRender *xrc = (MetaCompositorXRender *) compositor;
+  Display *xdisplay = meta_display_get_xdisplay (xrc->display);
+  gulong serial = NextRequest (xdisplay);
   /*
    * This trap is so that none of the compositor functions cause
    * X errors. This is really a hack, but I'm afraid I don't understand
@@ -3254,6 +3839,7 @@ xrender_process_event (MetaCompositor *compositor,
       break;
     }
 
+  xrc->stats.requests += NextRequest (xdisplay) - serial;
   meta_error_trap_pop (xrc->display, FALSE);
 #ifndef USE_IDLE_REPAINT
   repair_display (xrc->display);
@@ -3476,6 +4062,18 @@ xrender_unmaximize_window (MetaCompositor *compositor,
 #endif
 }
 
+static gint64
+xrender_get_frame_interval (MetaCompositor *compositor)
+{
+#ifdef USE_IDLE_REPAINT
+  MetaCompositorXRender *xrc = (MetaCompositorXRender *) compositor;
+
+  if (xrc->enabled)
+    return xrc->frame_interval;
+#endif
+  return 0;
+}
+
 static MetaCompositor comp_info = {
   xrender_destroy,
   xrender_manage_screen,
@@ -3489,6 +4087,7 @@ static MetaCompositor comp_info = {
   xrender_free_window,
   xrender_maximize_window,
   xrender_unmaximize_window,
+  xrender_get_frame_interval,
 };
 
 MetaCompositor *
@@ -3552,7 +4151,13 @@ meta_compositor_xrender_new (MetaDisplay *display)
 #ifdef USE_IDLE_REPAINT
   meta_verbose ("Using idle repaint\n");
   xrc->repaint_id = 0;
+  xrc->frame_interval = get_refresh_interval (display);
+  xrc->last_vblank = 0;
+  xrc->last_msc = 0;
+  xrc->frame_deadline = 0;
+  xrc->paint_budget = 0;
 #endif
+  memset (&xrc->stats, 0, sizeof (MetaCompFrameStats));
 
   xrc->enabled = TRUE;
   g_timeout_add (2000, (GSourceFunc) timeout_debug, xrc);
@@ -181,3 +181,16 @@ meta_compositor_unmaximize_window (MetaCompositor *compositor,
     compositor->unmaximize_window (compositor, window);
 #endif
 }
+
+/* Returns the time between two frames in microseconds, or 0 if the
+ * compositor doesn't know it
+ */
+gint64
+meta_compositor_get_frame_interval (MetaCompositor *compositor)
+{
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+  if (compositor && compositor->get_frame_interval)
+    return compositor->get_frame_interval (compositor);
+#endif
+  return 0;
+}
@@ -73,6 +73,23 @@ struct _AgGetPropertyTask
   Bool have_reply;
 };
 
+struct _AgGetAttributesTask
+{
+  ListNode node;
+
+  AgPerDisplayData *dd;
+  Window window;
+
+  /* XGetWindowAttributes() is really two requests */
+  unsigned long attr_seq;
+  unsigned long geom_seq;
+  int error;
+
+  XWindowAttributes attrs;
+
+  Bool have_reply;
+};
+
 struct _AgPerDisplayData
 {
   ListNode node;
@@ -85,6 +102,10 @@ struct _AgPerDisplayData
   ListNode *completed_tasks_tail;
   int n_tasks_pending;
   int n_tasks_completed;
+  ListNode *pending_attr_tasks;
+  ListNode *pending_attr_tasks_tail;
+  ListNode *completed_attr_tasks;
+  ListNode *completed_attr_tasks_tail;
 };
 
 static ListNode *display_datas = NULL;
@@ -202,30 +223,144 @@ find_pending_by_request_sequence (AgPerDisplayData *dd,
   return NULL;
 }
 
+static AgGetAttributesTask*
+find_pending_attributes_by_request_sequence (AgPerDisplayData *dd,
+                                             unsigned long     request_seq)
+{
+  ListNode *node;
+
+  {
+    AgGetAttributesTask *task = (AgGetAttributesTask*) dd->pending_attr_tasks_tail;
+    if (task == NULL || task->geom_seq < request_seq)
+      return NULL;
+  }
+
+  /* Replies come back in the order we sent the requests, so
+   * this normally stops at the head of the list.
+   */
+  node = dd->pending_attr_tasks;
+  while (node != NULL)
+    {
+      AgGetAttributesTask *task = (AgGetAttributesTask*) node;
+
+      if (task->attr_seq == request_seq ||
+          task->geom_seq == request_seq)
+        return task;
+
+      node = node->next;
+    }
+
+  return NULL;
+}
+
 static Bool
-async_get_property_handler (Display *dpy,
-                            xReply  *rep,
-                            char    *buf,
-                            int      len,
-                            XPointer data)
+async_get_attributes_handler (Display             *dpy,
+                              xReply              *rep,
+                              char                *buf,
+                              int                  len,
+                              AgPerDisplayData    *dd,
+                              AgGetAttributesTask *task)
 {
-  xGetPropertyReply  replbuf;
-  xGetPropertyReply *reply;
-  AgGetPropertyTask *task;
-  AgPerDisplayData *dd;
-  int bytes_read;
+  if (rep->generic.type == X_Error)
+    {
+      xError errbuf;
 
-  dd = (void*) data;
+      /* If GetWindowAttributes failed, GetGeometry will fail
+       * too; keep the first error and eat both.
+       */
+      if (task->error == Success)
+        task->error = rep->error.errorCode;
 
-#if 0
-  printf ("%s: seeing request seq %ld buflen %d\n", __FUNCTION__,
-          dpy->last_request_read, len);
-#endif
+      _XGetAsyncReply (dpy, (char *)&errbuf, rep, buf, len,
+                       (SIZEOF (xError) - SIZEOF (xReply)) >> 2,
+                       False);
+    }
+  else if (dpy->last_request_read == task->attr_seq)
+    {
+      xGetWindowAttributesReply  replbuf;
+      xGetWindowAttributesReply *reply;
+      XWindowAttributes *attr;
+
+      /* This is all copied from _XWAttrsHandler() in Xlib */
+      reply = (xGetWindowAttributesReply *) (void *)
+        _XGetAsyncReply (dpy, (char *)&replbuf, rep, buf, len,
+                         (SIZEOF (xGetWindowAttributesReply) - SIZEOF (xReply)) >> 2,
+                         True);
+
+      attr = &task->attrs;
+      attr->class = reply->class;
+      attr->bit_gravity = reply->bitGravity;
+      attr->win_gravity = reply->winGravity;
+      attr->backing_store = reply->backingStore;
+      attr->backing_planes = reply->backingBitPlanes;
+      attr->backing_pixel = reply->backingPixel;
+      attr->save_under = reply->saveUnder;
+      attr->colormap = reply->colormap;
+      attr->map_installed = reply->mapInstalled;
+      attr->map_state = reply->mapState;
+      attr->all_event_masks = reply->allEventMasks;
+      attr->your_event_mask = reply->yourEventMask;
+      attr->do_not_propagate_mask = reply->doNotPropagateMask;
+      attr->override_redirect = reply->override;
+      attr->visual = _XVIDtoVisual (dpy, reply->visualID);
+    }
+  else
+    {
+      xGetGeometryReply  replbuf;
+      xGetGeometryReply *reply;
+      XWindowAttributes *attr;
+      int i;
+
+      reply = (xGetGeometryReply *) (void *)
+        _XGetAsyncReply (dpy, (char *)&replbuf, rep, buf, len,
+                         (SIZEOF (xGetGeometryReply) - SIZEOF (xReply)) >> 2,
+                         True);
+
+      attr = &task->attrs;
+      attr->x = cvtINT16toInt (reply->x);
+      attr->y = cvtINT16toInt (reply->y);
+      attr->width = reply->width;
+      attr->height = reply->height;
+      attr->border_width = reply->borderWidth;
+      attr->depth = reply->depth;
+      attr->root = reply->root;
+
+      for (i = 0; i < dpy->nscreens; i++)
+        {
+          if (dpy->screens[i].root == attr->root)
+            {
+              attr->screen = &dpy->screens[i];
+              break;
+            }
+        }
+    }
 
-  task = find_pending_by_request_sequence (dd, dpy->last_request_read);
+  if (dpy->last_request_read == task->geom_seq)
+    {
+      task->have_reply = True;
+
+      remove_from_list (&dd->pending_attr_tasks,
+                        &dd->pending_attr_tasks_tail,
+                        &task->node);
+      append_to_list (&dd->completed_attr_tasks,
+                      &dd->completed_attr_tasks_tail,
+                      &task->node);
+    }
 
-  if (task == NULL)
-    return False;
+  return True;
+}
+
+static Bool
+async_get_property_handler (Display           *dpy,
+                            xReply            *rep,
+                            char              *buf,
+                            int                len,
+                            AgPerDisplayData  *dd,
+                            AgGetPropertyTask *task)
+{
+  xGetPropertyReply  replbuf;
+  xGetPropertyReply *reply;
+  int bytes_read;
 
   assert (dpy->last_request_read == task->request_seq);
 
@@ -462,6 +597,35 @@ async_get_property_handler (Display *dpy,
   return True;
 }
 
+static Bool
+async_handler (Display *dpy,
+               xReply  *rep,
+               char    *buf,
+               int      len,
+               XPointer data)
+{
+  AgPerDisplayData *dd;
+  AgGetPropertyTask *task;
+  AgGetAttributesTask *attr_task;
+
+  dd = (void*) data;
+
+#if 0
+  printf ("%s: seeing request seq %ld buflen %d\n", __FUNCTION__,
+          dpy->last_request_read, len);
+#endif
+
+  task = find_pending_by_request_sequence (dd, dpy->last_request_read);
+  if (task != NULL)
+    return async_get_property_handler (dpy, rep, buf, len, dd, task);
+
+  attr_task = find_pending_attributes_by_request_sequence (dd, dpy->last_request_read);
+  if (attr_task != NULL)
+    return async_get_attributes_handler (dpy, rep, buf, len, dd, attr_task);
+
+  return False;
+}
+
 static AgPerDisplayData*
 get_display_data (Display *display,
                   Bool     create)
@@ -489,7 +653,7 @@ get_display_data (Display *display,
 
   dd->display = display;
   dd->async.next = display->async_handlers;
-  dd->async.handler = async_get_property_handler;
+  dd->async.handler = async_handler;
   dd->async.data = (XPointer) dd;
   dd->display->async_handlers = &dd->async;
 
@@ -504,7 +668,9 @@ static void
 maybe_free_display_data (AgPerDisplayData *dd)
 {
   if (dd->pending_tasks == NULL &&
-      dd->completed_tasks == NULL)
+      dd->completed_tasks == NULL &&
+      dd->pending_attr_tasks == NULL &&
+      dd->completed_attr_tasks == NULL)
     {
       DeqAsyncHandler (dd->display, &dd->async);
       remove_from_list (&display_datas, &display_datas_tail,
@@ -667,6 +833,85 @@ ag_get_next_completed_task (Display *display)
   return (AgGetPropertyTask*) dd->completed_tasks;
 }
 
+AgGetAttributesTask*
+ag_attributes_task_create (Display *dpy,
+                           Window   window)
+{
+  AgGetAttributesTask *task;
+  xResourceReq *req;
+  AgPerDisplayData *dd;
+
+  LockDisplay (dpy);
+
+  dd = get_display_data (dpy, True);
+  if (dd == NULL)
+    {
+      UnlockDisplay (dpy);
+      return NULL;
+    }
+
+  task = Xcalloc (1, sizeof (AgGetAttributesTask));
+  if (task == NULL)
+    {
+      UnlockDisplay (dpy);
+      return NULL;
+    }
+
+  /* Same pair of requests XGetWindowAttributes() sends */
+  GetResReq (GetWindowAttributes, window, req);
+  task->attr_seq = dpy->request;
+
+  GetResReq (GetGeometry, window, req);
+  task->geom_seq = dpy->request;
+
+  task->dd = dd;
+  task->window = window;
+
+  append_to_list (&dd->pending_attr_tasks,
+                  &dd->pending_attr_tasks_tail,
+                  &task->node);
+
+  UnlockDisplay (dpy);
+
+  SyncHandle ();
+
+  return task;
+}
+
+Status
+ag_attributes_task_get_reply_and_free (AgGetAttributesTask *task,
+                                       XWindowAttributes   *attrs)
+{
+  AgPerDisplayData *dd;
+  Status s;
+
+  dd = task->dd;
+
+  if (task->error != Success)
+    s = task->error;
+  else if (!task->have_reply)
+    s = BadAlloc; /* not Success */
+  else
+    {
+      *attrs = task->attrs;
+      s = Success;
+    }
+
+  if (task->have_reply)
+    remove_from_list (&dd->completed_attr_tasks,
+                      &dd->completed_attr_tasks_tail,
+                      &task->node);
+  else
+    remove_from_list (&dd->pending_attr_tasks,
+                      &dd->pending_attr_tasks_tail,
+                      &task->node);
+
+  maybe_free_display_data (dd);
+  XFree (task);
+
+  return s;
+}
+
 void*
 ag_Xmalloc (unsigned long bytes)
 {
@@ -56,6 +56,16 @@ Display* ag_task_get_display  (AgGetPropertyTask *task);
 
 AgGetPropertyTask* ag_get_next_completed_task (Display *display);
 
+/* Same thing for XGetWindowAttributes(); errors are reported
+ * through the returned Status rather than the X error handler.
+ */
+typedef struct _AgGetAttributesTask AgGetAttributesTask;
+
+AgGetAttributesTask* ag_attributes_task_create             (Display             *display,
+                                                            Window               window);
+Status               ag_attributes_task_get_reply_and_free (AgGetAttributesTask *task,
+                                                            XWindowAttributes   *attrs);
+
 /* so other headers don't have to include internal Xlib goo */
 void*    ag_Xmalloc  (unsigned long bytes);
 void*    ag_Xmalloc0 (unsigned long bytes);
@@ -69,6 +69,7 @@ item(_MATE_PANEL_ACTION_RUN_DIALOG)
 item(_GNOME_WM_STRUT_AREA)
 item(_MARCO_SENTINEL)
 item(_MARCO_VERSION)
+item(_MARCO_RELOAD_PING)
 item(WM_CLIENT_MACHINE)
 item(MANAGER)
 item(TARGETS)
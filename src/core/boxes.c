@@ -375,130 +375,224 @@ meta_rectangle_resize_with_gravity (const MetaRectangle *old_rect,
   rect->height = new_height;
 }
 
-/* Not so simple helper function for get_minimal_spanning_set_for_region() */
-static GList*
-merge_spanning_rects_in_region (GList *region)
+/* The spanning set code below works on GArrays of MetaRectangles rather
+ * than lists of allocated rectangles, so that splitting and merging
+ * rectangles doesn't allocate anything; only the final result is turned
+ * into a list.
+ */
+
+static gint
+compare_rects_by_row (gconstpointer a, gconstpointer b)
 {
-  /* NOTE FOR ANY OPTIMIZATION PEOPLE OUT THERE: Please see the
-   * documentation of get_minimal_spanning_set_for_region() for performance
-   * considerations that also apply to this function.
-   */
+  const MetaRectangle *a_rect = a;
+  const MetaRectangle *b_rect = b;
+
+  if (a_rect->y != b_rect->y)
+    return a_rect->y < b_rect->y ? -1 : 1;
+  if (a_rect->height != b_rect->height)
+    return a_rect->height < b_rect->height ? -1 : 1;
+  if (a_rect->x != b_rect->x)
+    return a_rect->x < b_rect->x ? -1 : 1;
+  return 0;
+}
 
-  GList* compare;
-  compare = region;
+static gint
+compare_rects_by_column (gconstpointer a, gconstpointer b)
+{
+  const MetaRectangle *a_rect = a;
+  const MetaRectangle *b_rect = b;
+
+  if (a_rect->x != b_rect->x)
+    return a_rect->x < b_rect->x ? -1 : 1;
+  if (a_rect->width != b_rect->width)
+    return a_rect->width < b_rect->width ? -1 : 1;
+  if (a_rect->y != b_rect->y)
+    return a_rect->y < b_rect->y ? -1 : 1;
+  return 0;
+}
 
-  if (region == NULL)
+/* Sorts by decreasing area; ties are broken by position so that the
+ * order of the spanning set doesn't depend on the order of the struts.
+ */
+static gint
+compare_rect_areas (gconstpointer a, gconstpointer b)
+{
+  const MetaRectangle *a_rect = a;
+  const MetaRectangle *b_rect = b;
+
+  int a_area = meta_rectangle_area (a_rect);
+  int b_area = meta_rectangle_area (b_rect);
+
+  if (a_area != b_area)
+    return a_area > b_area ? -1 : 1;
+
+  return compare_rects_by_row (a, b);
+}
+
+/* Sweeps over the rectangles sorted by rows (or columns), merging
+ * neighbours in the same row (or column) that overlap or touch.
+ * Returns whether anything was merged.
+ */
+static gboolean
+merge_rects_along (GArray   *rects,
+                   gboolean  horizontal)
+{
+  MetaRectangle *r;
+  guint i, n_kept;
+
+  if (rects->len < 2)
+    return FALSE;
+
+  g_array_sort (rects,
+                horizontal ? compare_rects_by_row : compare_rects_by_column);
+
+  r = (MetaRectangle *) rects->data;
+  n_kept = 1;
+  for (i = 1; i < rects->len; i++)
     {
-      meta_warning ("Region to merge was empty!  Either you have a some "
-                    "pathological STRUT list or there's a bug somewhere!\n");
-      return NULL;
+      MetaRectangle *last = &r[n_kept - 1];
+      MetaRectangle *cur  = &r[i];
+
+      if (horizontal &&
+          cur->y == last->y && cur->height == last->height &&
+          cur->x <= BOX_RIGHT (*last))
+        {
+          last->width = MAX (BOX_RIGHT (*last), BOX_RIGHT (*cur)) - last->x;
+        }
+      else if (!horizontal &&
+               cur->x == last->x && cur->width == last->width &&
+               cur->y <= BOX_BOTTOM (*last))
+        {
+          last->height = MAX (BOX_BOTTOM (*last), BOX_BOTTOM (*cur)) - last->y;
+        }
+      else
+        {
+          r[n_kept++] = *cur;
+        }
     }
 
-  while (compare && compare->next)
-    {
-      MetaRectangle *a = compare->data;
-      GList *other = compare->next;
+  if (n_kept == rects->len)
+    return FALSE;
 
-      g_assert (a->width > 0 && a->height > 0);
+  g_array_set_size (rects, n_kept);
+  return TRUE;
+}
 
-      while (other)
-        {
-          MetaRectangle *b = other->data;
-          GList *delete_me = NULL;
+/* Removes rectangles contained in others, leaving the rest sorted by
+ * decreasing area.  Returns whether anything was removed.
+ */
+static gboolean
+remove_contained_rects (GArray *rects)
+{
+  MetaRectangle *r;
+  guint i, j, n_kept;
 
-          g_assert (b->width > 0 && b->height > 0);
+  g_array_sort (rects, compare_rect_areas);
 
-          /* If a contains b, just remove b */
-          if (meta_rectangle_contains_rect (a, b))
-            {
-              delete_me = other;
-            }
-          /* If b contains a, just remove a */
-          else if (meta_rectangle_contains_rect (b, a))
-            {
-              delete_me = compare;
-            }
-          /* If a and b might be mergeable horizontally */
-          else if (a->y == b->y && a->height == b->height)
-            {
-              /* If a and b overlap */
-              if (meta_rectangle_overlap (a, b))
-                {
-                  int new_x = MIN (a->x, b->x);
-                  a->width = MAX (a->x + a->width, b->x + b->width) - new_x;
-                  a->x = new_x;
-                  delete_me = other;
-                }
-              /* If a and b are adjacent */
-              else if (a->x + a->width == b->x || a->x == b->x + b->width)
-                {
-                  int new_x = MIN (a->x, b->x);
-                  a->width = MAX (a->x + a->width, b->x + b->width) - new_x;
-                  a->x = new_x;
-                  delete_me = other;
-                }
-            }
-          /* If a and b might be mergeable vertically */
-          else if (a->x == b->x && a->width == b->width)
-            {
-              /* If a and b overlap */
-              if (meta_rectangle_overlap (a, b))
-                {
-                  int new_y = MIN (a->y, b->y);
-                  a->height = MAX (a->y + a->height, b->y + b->height) - new_y;
-                  a->y = new_y;
-                  delete_me = other;
-                }
-              /* If a and b are adjacent */
-              else if (a->y + a->height == b->y || a->y == b->y + b->height)
-                {
-                  int new_y = MIN (a->y, b->y);
-                  a->height = MAX (a->y + a->height, b->y + b->height) - new_y;
-                  a->y = new_y;
-                  delete_me = other;
-                }
-            }
+  /* A rectangle can only be contained in one at least as large, i.e.
+   * one before it.
+   */
+  r = (MetaRectangle *) rects->data;
+  n_kept = 0;
+  for (i = 0; i < rects->len; i++)
+    {
+      for (j = 0; j < n_kept; j++)
+        if (meta_rectangle_contains_rect (&r[j], &r[i]))
+          break;
 
-          other = other->next;
+      if (j == n_kept)
+        r[n_kept++] = r[i];
+    }
 
-          /* Delete any rectangle in the list that is no longer wanted */
-          if (delete_me != NULL)
-            {
-              /* Deleting the rect we compare others to is a little tricker */
-              if (compare == delete_me)
-                {
-                  compare = compare->next;
-                  other = compare->next;
-                  a = compare->data;
-                }
+  if (n_kept == rects->len)
+    return FALSE;
 
-              /* avoid false positive warning in Clang static analyzer */
-              g_assert (a != delete_me->data);
+  g_array_set_size (rects, n_kept);
+  return TRUE;
+}
 
-              /* Okay, we can free it now */
-              g_free (delete_me->data);
-              region = g_list_delete_link (region, delete_me);
-            }
+/* Not so simple helper function for get_minimal_spanning_set_for_region() */
+static void
+merge_spanning_rects_in_region (GArray *region)
+{
+  gboolean changed;
 
-        }
+  g_assert (region->len > 0);
 
-      compare = compare->next;
+  /* Merging two rectangles can make a third one mergeable with the
+   * result or contained in it, so keep going until nothing changes;
+   * that normally takes one or two rounds.
+   */
+  do
+    {
+      changed = merge_rects_along (region, TRUE);
+      changed = merge_rects_along (region, FALSE) || changed;
+      changed = remove_contained_rects (region) || changed;
     }
-
-  return region;
+  while (changed);
 }
 
-/* Simple helper function for get_minimal_spanning_set_for_region()... */
-static gint
-compare_rect_areas (gconstpointer a, gconstpointer b)
+/* Replaces each rectangle of rects overlapping strut_rect with the
+ * (maximal, possibly overlapping) parts of it that lie to the left of,
+ * right of, above and below the strut.  scratch is used as the new
+ * array, and swapped with rects.
+ */
+static void
+remove_strut_from_rects (GArray              **rects,
+                         GArray              **scratch,
+                         const MetaRectangle  *strut_rect)
 {
-  const MetaRectangle *a_rect = (gconstpointer) a;
-  const MetaRectangle *b_rect = (gconstpointer) b;
+  GArray *old = *rects;
+  GArray *new = *scratch;
+  guint i;
 
-  int a_area = meta_rectangle_area (a_rect);
-  int b_area = meta_rectangle_area (b_rect);
+  g_array_set_size (new, 0);
+
+  for (i = 0; i < old->len; i++)
+    {
+      const MetaRectangle *rect = &g_array_index (old, MetaRectangle, i);
+      MetaRectangle temp_rect;
 
-  return b_area - a_area; /* positive ret value denotes b > a, ... */
+      if (!meta_rectangle_overlap (rect, strut_rect))
+        {
+          g_array_append_val (new, *rect);
+          continue;
+        }
+
+      /* If there is area in rect left of strut */
+      if (BOX_LEFT (*rect) < BOX_LEFT (*strut_rect))
+        {
+          temp_rect = *rect;
+          temp_rect.width = BOX_LEFT (*strut_rect) - BOX_LEFT (*rect);
+          g_array_append_val (new, temp_rect);
+        }
+      /* If there is area in rect right of strut */
+      if (BOX_RIGHT (*rect) > BOX_RIGHT (*strut_rect))
+        {
+          temp_rect = *rect;
+          temp_rect.x = BOX_RIGHT (*strut_rect);
+          temp_rect.width = BOX_RIGHT (*rect) - temp_rect.x;
+          g_array_append_val (new, temp_rect);
+        }
+      /* If there is area in rect above strut */
+      if (BOX_TOP (*rect) < BOX_TOP (*strut_rect))
+        {
+          temp_rect = *rect;
+          temp_rect.height = BOX_TOP (*strut_rect) - BOX_TOP (*rect);
+          g_array_append_val (new, temp_rect);
+        }
+      /* If there is area in rect below strut */
+      if (BOX_BOTTOM (*rect) > BOX_BOTTOM (*strut_rect))
+        {
+          temp_rect = *rect;
+          temp_rect.y = BOX_BOTTOM (*strut_rect);
+          temp_rect.height = BOX_BOTTOM (*rect) - temp_rect.y;
+          g_array_append_val (new, temp_rect);
+        }
+    }
+
+  *rects = new;
+  *scratch = old;
 }
 
 /* This function is trying to find a "minimal spanning set (of rectangles)"
@@ -514,8 +608,8 @@ compare_rect_areas (gconstpointer a, gconstpointer b)
  * the region if and only if it is contained within at least one of the
  * rectangles.
  *
- * The GList* returned will be a list of (allocated) MetaRectangles.
- * The list will need to be freed by calling
+ * The GList* returned will be a list of (allocated) MetaRectangles, sorted
+ * by decreasing area.  The list will need to be freed by calling
  * meta_rectangle_free_spanning_set() on it (or by manually
  * implementing that function...)
  */
@@ -526,46 +620,19 @@ meta_rectangle_get_minimal_spanning_set_for_region (
   gboolean             skip_middle_struts)
 
 {
-  /* NOTE FOR OPTIMIZERS: This function *might* be somewhat slow,
-   * especially due to the call to merge_spanning_rects_in_region() (which
-   * is O(n^2) where n is the size of the list generated in this function).
-   * This is made more onerous due to the fact that it involves a fair
-   * number of memory allocation and deallocation calls.  However, n is 1
-   * for default installations of Mate (because partial struts aren't used
-   * by default and only partial struts increase the size of the spanning
-   * set generated).  With one partial strut, n will be 2 or 3.  With 2
-   * partial struts, n will probably be 4 or 5.  So, n probably isn't large
-   * enough to make this worth bothering.  Further, it is only called from
-   * workspace.c:ensure_work_areas_validated (at least as of the time of
-   * writing this comment), which in turn should only be called if the
-   * strut list changes or the screen or xinerama size changes.  If it ever
-   * does show up on profiles (most likely because people start using
-   * ridiculously huge numbers of partial struts), possible optimizations
-   * include:
-   *
-   * (1) rewrite merge_spanning_rects_in_region() to be O(n) or O(nlogn).
-   *     I'm not totally sure it's possible, but with a couple copies of
-   *     the list and sorting them appropriately, I believe it might be.
-   * (2) only call merge_spanning_rects_in_region() with a subset of the
-   *     full list of rectangles.  I believe from some of my preliminary
-   *     debugging and thinking about it that it is possible to figure out
-   *     apriori groups of rectangles which are only merge candidates with
-   *     each other.  (See testboxes.c:get_screen_region() when which==2
-   *     and track the steps of this function carefully to see what gave
-   *     me the hint that this might work)
-   * (3) figure out how to avoid merge_spanning_rects_in_region().  I think
-   *     it might be possible to modify this function to make that
-   *     possible, and I spent just a little while thinking about it, but n
-   *     wasn't large enough to convince me to care yet.
-   * (4) Some of the stuff Rob mentioned at http://mail.gnome.org/archives\
-   *     /marco-devel-list/2005-November/msg00028.html.  (Sorry for the
-   *     URL splitting.)
+  /* Each strut splits the rectangles it overlaps into at most four, so
+   * with many partial struts the set grows quickly before merging.  The
+   * splitting is linear in the size of the set, and merging sorts the
+   * set by rows and by columns and sweeps over it, so that rectangles
+   * only get compared with their neighbours; only the removal of
+   * contained rectangles compares against all larger ones, and by then
+   * the set is small.
    */
 
   GList         *ret;
-  GList         *tmp_list;
+  GArray        *rects, *scratch;
   const GSList  *strut_iter;
-  MetaRectangle *temp_rect;
+  guint          i;
 
   /* The algorithm is basically as follows:
    *   Initialize rectangle_set to basic_rect
@@ -576,15 +643,15 @@ meta_rectangle_get_minimal_spanning_set_for_region (
    *       - Remove the old (pre-split) rectangle from the rectangle_set,
    *         and replace it with the new rectangles generated from the
    *         splitting
+   *   Merge the rectangles of rectangle_set where possible
    */
 
-  temp_rect = g_new (MetaRectangle, 1);
-  *temp_rect = *basic_rect;
-  ret = g_list_prepend (NULL, temp_rect);
+  rects   = g_array_sized_new (FALSE, FALSE, sizeof (MetaRectangle), 16);
+  scratch = g_array_sized_new (FALSE, FALSE, sizeof (MetaRectangle), 16);
+  g_array_append_val (rects, *basic_rect);
 
   for (strut_iter = all_struts; strut_iter; strut_iter = strut_iter->next)
     {
-      GList *rect_iter;
       MetaStrut *strut = (MetaStrut *) strut_iter->data;
       MetaRectangle *strut_rect = &strut->rect;
 
@@ -603,66 +670,36 @@ meta_rectangle_get_minimal_spanning_set_for_region (
             }
         }
 
-      tmp_list = ret;
-      ret = NULL;
-      rect_iter = tmp_list;
-      while (rect_iter)
+      /* Struts on other xineramas can't split anything */
+      if (!meta_rectangle_overlap (basic_rect, strut_rect))
+        continue;
+
+      remove_strut_from_rects (&rects, &scratch, strut_rect);
+    }
+
+  ret = NULL;
+  if (rects->len == 0)
+    {
+      meta_warning ("Region to merge was empty!  Either you have a some "
+                    "pathological STRUT list or there's a bug somewhere!\n");
+    }
+  else
+    {
+      /* Merge rectangles if possible so that the list really is minimal;
+       * this also sorts them by area.
+       */
+      merge_spanning_rects_in_region (rects);
+
+      for (i = rects->len; i > 0; i--)
         {
-          MetaRectangle *rect = (MetaRectangle*) rect_iter->data;
-          if (!meta_rectangle_overlap (rect, strut_rect))
-            ret = g_list_prepend (ret, rect);
-          else
-            {
-              /* If there is area in rect left of strut */
-              if (BOX_LEFT (*rect) < BOX_LEFT (*strut_rect))
-                {
-                  temp_rect = g_new (MetaRectangle, 1);
-                  *temp_rect = *rect;
-                  temp_rect->width = BOX_LEFT (*strut_rect) - BOX_LEFT (*rect);
-                  ret = g_list_prepend (ret, temp_rect);
-                }
-              /* If there is area in rect right of strut */
-              if (BOX_RIGHT (*rect) > BOX_RIGHT (*strut_rect))
-                {
-                  int new_x;
-                  temp_rect = g_new (MetaRectangle, 1);
-                  *temp_rect = *rect;
-                  new_x = BOX_RIGHT (*strut_rect);
-                  temp_rect->width = BOX_RIGHT(*rect) - new_x;
-                  temp_rect->x = new_x;
-                  ret = g_list_prepend (ret, temp_rect);
-                }
-              /* If there is area in rect above strut */
-              if (BOX_TOP (*rect) < BOX_TOP (*strut_rect))
-                {
-                  temp_rect = g_new (MetaRectangle, 1);
-                  *temp_rect = *rect;
-                  temp_rect->height = BOX_TOP (*strut_rect) - BOX_TOP (*rect);
-                  ret = g_list_prepend (ret, temp_rect);
-                }
-              /* If there is area in rect below strut */
-              if (BOX_BOTTOM (*rect) > BOX_BOTTOM (*strut_rect))
-                {
-                  int new_y;
-                  temp_rect = g_new (MetaRectangle, 1);
-                  *temp_rect = *rect;
-                  new_y = BOX_BOTTOM (*strut_rect);
-                  temp_rect->height = BOX_BOTTOM (*rect) - new_y;
-                  temp_rect->y = new_y;
-                  ret = g_list_prepend (ret, temp_rect);
-                }
-              g_free (rect);
-            }
-          rect_iter = rect_iter->next;
+          MetaRectangle *rect = g_new (MetaRectangle, 1);
+          *rect = g_array_index (rects, MetaRectangle, i - 1);
+          ret = g_list_prepend (ret, rect);
         }
-      g_list_free (tmp_list);
     }
 
-  /* Sort by maximal area, just because I feel like it... */
-  ret = g_list_sort (ret, compare_rect_areas);
-
-  /* Merge rectangles if possible so that the list really is minimal */
-  ret = merge_spanning_rects_in_region (ret);
+  g_array_free (rects, TRUE);
+  g_array_free (scratch, TRUE);
 
   return ret;
 }
@@ -1169,110 +1206,87 @@ meta_rectangle_edge_aligns (const MetaRectangle *rect, const MetaEdge *edge)
     }
 }
 
-static GList*
-get_rect_minus_overlap (const GList   *rect_in_list,
-                        MetaRectangle *overlap)
+/* Appends the parts of rect that lie outside overlap (which must be
+ * inside rect) to rects; the parts above and below only span overlap
+ * horizontally so that they don't overlap the parts to the sides.
+ */
+static void
+append_rect_minus_overlap (GArray              *rects,
+                           const MetaRectangle *rect,
+                           const MetaRectangle *overlap)
 {
-  MetaRectangle *temp;
-  MetaRectangle *rect = rect_in_list->data;
-  GList *ret = NULL;
+  MetaRectangle temp;
 
-  if (BOX_LEFT (*rect) < BOX_LEFT (*overlap))
+  if (BOX_BOTTOM (*rect) > BOX_BOTTOM (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
-      *temp = *rect;
-      temp->width = BOX_LEFT (*overlap) - BOX_LEFT (*rect);
-      ret = g_list_prepend (ret, temp);
+      temp.x      = overlap->x;
+      temp.width  = overlap->width;
+      temp.y      = BOX_BOTTOM (*overlap);
+      temp.height = BOX_BOTTOM (*rect) - BOX_BOTTOM (*overlap);
+      g_array_append_val (rects, temp);
     }
-  if (BOX_RIGHT (*rect) > BOX_RIGHT (*overlap))
+  if (BOX_TOP (*rect) < BOX_TOP (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
-      *temp = *rect;
-      temp->x = BOX_RIGHT (*overlap);
-      temp->width = BOX_RIGHT (*rect) - BOX_RIGHT (*overlap);
-      ret = g_list_prepend (ret, temp);
+      temp.x      = overlap->x;
+      temp.width  = overlap->width;
+      temp.y      = BOX_TOP (*rect);
+      temp.height = BOX_TOP (*overlap) - BOX_TOP (*rect);
+      g_array_append_val (rects, temp);
     }
-  if (BOX_TOP (*rect) < BOX_TOP (*overlap))
+  if (BOX_RIGHT (*rect) > BOX_RIGHT (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
-      temp->x      = overlap->x;
-      temp->width  = overlap->width;
-      temp->y      = BOX_TOP (*rect);
-      temp->height = BOX_TOP (*overlap) - BOX_TOP (*rect);
-      ret = g_list_prepend (ret, temp);
+      temp = *rect;
+      temp.x = BOX_RIGHT (*overlap);
+      temp.width = BOX_RIGHT (*rect) - BOX_RIGHT (*overlap);
+      g_array_append_val (rects, temp);
     }
-  if (BOX_BOTTOM (*rect) > BOX_BOTTOM (*overlap))
+  if (BOX_LEFT (*rect) < BOX_LEFT (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
-      temp->x      = overlap->x;
-      temp->width  = overlap->width;
-      temp->y      = BOX_BOTTOM (*overlap);
-      temp->height = BOX_BOTTOM (*rect) - BOX_BOTTOM (*overlap);
-      ret = g_list_prepend (ret, temp);
+      temp = *rect;
+      temp.width = BOX_LEFT (*overlap) - BOX_LEFT (*rect);
+      g_array_append_val (rects, temp);
     }
-
-  return ret;
 }
 
-static GList*
-replace_rect_with_list (GList *old_element,
-                        GList *new_list)
+/* Replaces the rectangle at index in rects with the replacements,
+ * returning the number of those.
+ */
+static guint
+replace_rect_with_array (GArray *rects,
+                         guint   index,
+                         GArray *replacements)
 {
-  GList *ret;
-  g_assert (old_element != NULL);
-
-  if (!new_list)
-    {
-      /* If there is no new list, just remove the old_element */
-      ret = g_list_remove_link (old_element, old_element);
-    }
-  else
-    {
-      /* Fix up the prev and next pointers everywhere */
-      ret = new_list;
-      if (old_element->prev)
-        {
-          old_element->prev->next = new_list;
-          new_list->prev = old_element->prev;
-        }
-      if (old_element->next)
-        {
-          GList *tmp = g_list_last (new_list);
-          old_element->next->prev = tmp;
-          tmp->next = old_element->next;
-        }
-    }
+  g_array_remove_index (rects, index);
+  if (replacements->len > 0)
+    g_array_insert_vals (rects, index,
+                         replacements->data, replacements->len);
 
-  /* Free the old_element and return the appropriate "next" point */
-  g_free (old_element->data);
-  g_list_free_1 (old_element);
-  return ret;
+  return replacements->len;
 }
 
 /* Make a copy of the strut list, make sure that copy only contains parts
  * of the old_struts that intersect with the region rect, and then do some
  * magic to make all the new struts disjoint (okay, we we break up struts
  * that aren't disjoint in a way that the overlapping part is only included
- * once, so it's not really magic...).
+ * once, so it's not really magic...).  Returns an array of MetaRectangles.
  */
-static GList*
+static GArray*
 get_disjoint_strut_rect_list_in_region (const GSList        *old_struts,
                                         const MetaRectangle *region)
 {
-  GList *strut_rects;
-  GList *tmp;
+  GArray *strut_rects;
+  GArray *cur_leftover, *comp_leftover;
+  guint cur, comp;
 
-  /* First, copy the list */
-  strut_rects = NULL;
+  /* First, copy the list (the newest strut first, as it always was) */
+  strut_rects = g_array_new (FALSE, FALSE, sizeof (MetaRectangle));
   while (old_struts)
     {
-      MetaRectangle *cur = &((MetaStrut*)old_struts->data)->rect;
-      MetaRectangle *copy = g_new (MetaRectangle, 1);
-      *copy = *cur;
-      if (meta_rectangle_intersect (copy, region, copy))
-        strut_rects = g_list_prepend (strut_rects, copy);
-      else
-        g_free (copy);
+      MetaRectangle copy;
+
+      if (meta_rectangle_intersect (&((MetaStrut*)old_struts->data)->rect,
+                                    region, &copy))
+        g_array_prepend_val (strut_rects, copy);
 
       old_struts = old_struts->next;
     }
@@ -1280,54 +1294,51 @@ get_disjoint_strut_rect_list_in_region (const GSList        *old_struts,
   /* Now, loop over the list and check for intersections, fixing things up
    * where they do intersect.
    */
-  tmp = strut_rects;
-  while (tmp)
+  cur_leftover  = g_array_new (FALSE, FALSE, sizeof (MetaRectangle));
+  comp_leftover = g_array_new (FALSE, FALSE, sizeof (MetaRectangle));
+  for (cur = 0; cur < strut_rects->len; cur++)
     {
-      GList *compare;
-
-      MetaRectangle *cur = tmp->data;
-
-      compare = tmp->next;
-      while (compare)
+      comp = cur + 1;
+      while (comp < strut_rects->len)
         {
-          MetaRectangle *comp = compare->data;
-          MetaRectangle overlap;
+          MetaRectangle cur_rect, comp_rect, overlap;
 
-          if (meta_rectangle_intersect (cur, comp, &overlap))
-            {
-              /* Get a list of rectangles for each strut that don't overlap
-               * the intersection region.
-               */
-              GList *cur_leftover  = get_rect_minus_overlap (tmp,  &overlap);
-              GList *comp_leftover = get_rect_minus_overlap (compare, &overlap);
+          cur_rect  = g_array_index (strut_rects, MetaRectangle, cur);
+          comp_rect = g_array_index (strut_rects, MetaRectangle, comp);
 
-              /* Add the intersection region to cur_leftover */
-              MetaRectangle *overlap_allocated = g_new (MetaRectangle, 1);
-              *overlap_allocated = overlap;
-              cur_leftover = g_list_prepend (cur_leftover, overlap_allocated);
-
-              /* Fix up tmp, compare, and cur -- maybe struts too */
-              if (strut_rects == tmp)
-                {
-                  strut_rects = replace_rect_with_list (tmp, cur_leftover);
-                  tmp = strut_rects;
-                }
-              else
-                tmp   = replace_rect_with_list (tmp,     cur_leftover);
-              compare = replace_rect_with_list (compare, comp_leftover);
+          if (meta_rectangle_intersect (&cur_rect, &comp_rect, &overlap))
+            {
+              guint n_cur;
 
-              if (compare == NULL)
+              /* Get the parts of each strut that don't overlap the
+               * intersection region, and keep the intersection itself
+               * with the first one.
+               */
+              g_array_set_size (cur_leftover, 0);
+              g_array_set_size (comp_leftover, 0);
+              g_array_append_val (cur_leftover, overlap);
+              append_rect_minus_overlap (cur_leftover, &cur_rect, &overlap);
+              append_rect_minus_overlap (comp_leftover, &comp_rect, &overlap);
+
+              /* comp comes after cur, so replace it first */
+              replace_rect_with_array (strut_rects, comp, comp_leftover);
+              n_cur = replace_rect_with_array (strut_rects, cur, cur_leftover);
+
+              /* Go on after the first replacement of comp, or after the
+               * strut that followed it if comp vanished.
+               */
+              comp += n_cur - 1;
+              if (comp >= strut_rects->len)
                 break;
-
-              cur = tmp->data;
             }
 
-          compare = compare->next;
+          comp++;
         }
-
-      tmp = tmp->next;
     }
 
+  g_array_free (cur_leftover, TRUE);
+  g_array_free (comp_leftover, TRUE);
+
   return strut_rects;
 }
 
@@ -1720,9 +1731,9 @@ meta_rectangle_find_onscreen_edges (const MetaRectangle *basic_rect,
                                     const GSList        *all_struts)
 {
   GList        *ret;
-  GList        *fixed_strut_rects;
+  GArray       *fixed_strut_rects;
   GList        *edge_iter;
-  const GList  *strut_rect_iter;
+  guint         i;
 
   /* The algorithm is basically as follows:
    *   Make sure the struts are disjoint
@@ -1746,10 +1757,10 @@ meta_rectangle_find_onscreen_edges (const MetaRectangle *basic_rect,
   /* Start off the list with the edges of basic_rect */
   ret = add_edges (NULL, basic_rect, TRUE);
 
-  strut_rect_iter = fixed_strut_rects;
-  while (strut_rect_iter)
+  for (i = 0; i < fixed_strut_rects->len; i++)
     {
-      MetaRectangle *strut_rect = (MetaRectangle*) strut_rect_iter->data;
+      MetaRectangle *strut_rect =
+        &g_array_index (fixed_strut_rects, MetaRectangle, i);
 
       /* Get the new possible edges we may need to add from the strut */
       GList *new_strut_edges = add_edges (NULL, strut_rect, FALSE);
@@ -1785,14 +1796,13 @@ meta_rectangle_find_onscreen_edges (const MetaRectangle *basic_rect,
         }
 
       ret = g_list_concat (new_strut_edges, ret);
-      strut_rect_iter = strut_rect_iter->next;
     }
 
   /* Sort the list */
   ret = g_list_sort (ret, meta_rectangle_edge_cmp);
 
-  /* Free the fixed struts list */
-  g_list_free_full (fixed_strut_rects, g_free);
+  /* Free the fixed struts */
+  g_array_free (fixed_strut_rects, TRUE);
 
   return ret;
 }
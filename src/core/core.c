@@ -62,6 +62,56 @@ get_window (Display *xdisplay,
   return window;
 }
 
+/* The parts of a frame, in frame coordinates, that windows stacked
+ * above it cover, or NULL if nothing does.  Only the client areas of
+ * those windows are counted, since their frames may have rounded
+ * corners.  When compositing, what is underneath other windows still
+ * has to be drawn, so nothing counts as covered then.
+ */
+static cairo_region_t *
+get_frame_obscured_region (MetaWindow *window)
+{
+  MetaStack *stack;
+  MetaWindow *above;
+  cairo_region_t *region;
+
+  if (window->display->compositor != NULL &&
+      meta_prefs_get_compositing_manager ())
+    return NULL;
+
+  stack = window->screen->stack;
+  region = NULL;
+
+  for (above = meta_stack_get_top (stack);
+       above != NULL && above != window;
+       above = meta_stack_get_below (stack, above, FALSE))
+    {
+      MetaRectangle rect;
+      cairo_rectangle_int_t area;
+
+      if (!(above->frame ? above->frame->mapped : above->mapped) ||
+          above->shaded || above->has_shape)
+        continue;
+
+      meta_window_get_client_root_coords (above, &rect);
+
+      if (!meta_rectangle_overlap (&rect, &window->frame->rect))
+        continue;
+
+      area.x = rect.x - window->frame->rect.x;
+      area.y = rect.y - window->frame->rect.y;
+      area.width = rect.width;
+      area.height = rect.height;
+
+      if (region == NULL)
+        region = cairo_region_create ();
+
+      cairo_region_union_rectangle (region, &area);
+    }
+
+  return region;
+}
+
 void
 meta_core_get (Display *xdisplay,
     Window xwindow,
@@ -211,6 +261,9 @@ meta_core_get (Display *xdisplay,
       case META_CORE_GET_SCREEN_HEIGHT:
         *((gint*)answer) = window->screen->rect.height;
         break;
+      case META_CORE_GET_FRAME_OBSCURED_REGION:
+        *((cairo_region_t**)answer) = get_frame_obscured_region (window);
+        break;
 
       default:
         meta_warning(_("Unknown window information request: %d"), request);
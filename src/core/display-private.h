@@ -136,6 +136,12 @@ struct _MetaDisplay {
 	GSList* screens;
 	MetaScreen* active_screen;
 	GHashTable* window_ids;
+	/* Every MetaWindow, once each, from when its client window is
+	 * registered until it is unregistered.
+	 */
+	GQueue* managed_windows;
+	/* How many times meta_display_list_windows() has run */
+	guint n_window_lists;
 	int error_traps;
 	int (*error_trap_handler) (Display* display, XErrorEvent* error);
 	int server_grab_count;
@@ -214,6 +220,8 @@ struct _MetaDisplay {
 	/* Keybindings stuff */
 	MetaKeyBinding* key_bindings;
 	int             n_key_bindings;
+	/* Bindings by keycode and mask, see rebuild_binding_index() */
+	GHashTable*     key_binding_index;
 	int             min_keycode;
 	int             max_keycode;
 	KeySym* keymap;
@@ -255,6 +263,8 @@ struct _MetaDisplay {
 	/* Managed by window-props.c */
 	gpointer* prop_hooks_table;
 	GHashTable* prop_hooks;
+	GQueue* pending_prop_reloads;
+	unsigned long prop_reload_ping_serial;
 
 	/* Managed by group-props.c */
 	MetaGroupPropHooks* group_prop_hooks;
@@ -379,6 +389,10 @@ void        meta_display_register_x_window   (MetaDisplay *display,
                                               MetaWindow  *window);
 void        meta_display_unregister_x_window (MetaDisplay *display,
                                               Window       xwindow);
+void        meta_display_add_managed_window    (MetaDisplay *display,
+                                                MetaWindow  *window);
+void        meta_display_remove_managed_window (MetaDisplay *display,
+                                                MetaWindow  *window);
 /* Return whether the xwindow is a no focus window for any of the screens */
 gboolean    meta_display_xwindow_is_a_no_focus_window (MetaDisplay *display,
                                                        Window xwindow);
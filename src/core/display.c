@@ -155,6 +155,8 @@ static void   meta_spew_event           (MetaDisplay    *display,
                                          XEvent         *event);
 #endif
 
+static gboolean event_can_be_dropped    (XEvent         *event,
+                                         gpointer        data);
 static gboolean event_callback          (XEvent         *event,
                                          gpointer        data);
 static Window event_get_modified_window (MetaDisplay    *display,
@@ -455,6 +457,8 @@ meta_display_open (void)
 
   the_display->window_ids = g_hash_table_new (meta_unsigned_long_hash,
                                           meta_unsigned_long_equal);
+  the_display->managed_windows = g_queue_new ();
+  the_display->n_window_lists = 0;
 
   i = 0;
   while (i < N_IGNORED_SERIALS)
@@ -649,6 +653,18 @@ meta_display_open (void)
   meta_verbose ("Not compiled with Composite support\n");
 #endif /* !HAVE_COMPOSITE_EXTENSIONS */
 
+#ifdef HAVE_COMPOSITE_EXTENSIONS
+  if (the_display->have_damage)
+    the_display->events =
+      meta_event_queue_new (the_display->xdisplay,
+                            the_display->damage_event_base + XDamageNotify,
+                            event_can_be_dropped, the_display);
+  else
+#endif
+    the_display->events =
+      meta_event_queue_new (the_display->xdisplay, 0,
+                            event_can_be_dropped, the_display);
+
 #ifdef HAVE_XCURSOR
   {
     XcursorSetTheme (the_display->xdisplay, meta_prefs_get_cursor_theme ());
@@ -810,73 +826,17 @@ meta_display_open (void)
   return TRUE;
 }
 
-static void
-listify_func (gpointer key, gpointer value, gpointer data)
-{
-  GSList **listp;
-
-  listp = data;
-  *listp = g_slist_prepend (*listp, value);
-}
-
-static gint
-ptrcmp (gconstpointer a, gconstpointer b)
-{
-  if (a < b)
-    return -1;
-  else if (a > b)
-    return 1;
-  else
-    return 0;
-}
-
 GSList*
 meta_display_list_windows (MetaDisplay *display)
 {
   GSList *winlist;
-  GSList *tmp;
-  GSList *prev;
-
-  winlist = NULL;
-  g_hash_table_foreach (display->window_ids,
-                        listify_func,
-                        &winlist);
-
-  /* Uniquify the list, since both frame windows and plain
-   * windows are in the hash
-   */
-  winlist = g_slist_sort (winlist, ptrcmp);
-
-  prev = NULL;
-  tmp = winlist;
-  while (tmp != NULL)
-    {
-      GSList *next;
-
-      next = tmp->next;
-
-      if (next &&
-          next->data == tmp->data)
-        {
-          /* Delete tmp from list */
-
-          if (prev)
-            prev->next = next;
-
-          if (tmp == winlist)
-            winlist = next;
+  GList *tmp;
 
-          g_slist_free_1 (tmp);
+  display->n_window_lists += 1;
 
-          /* leave prev unchanged */
-        }
-      else
-        {
-          prev = tmp;
-        }
-
-      tmp = next;
-    }
+  winlist = NULL;
+  for (tmp = display->managed_windows->tail; tmp != NULL; tmp = tmp->prev)
+    winlist = g_slist_prepend (winlist, tmp->data);
 
   return winlist;
 }
@@ -911,6 +871,8 @@ meta_display_close (MetaDisplay *display,
   meta_ui_remove_event_func (display->xdisplay,
                              event_callback,
                              display);
+  meta_event_queue_free (display->events);
+  display->events = NULL;
 
   /* Free all screens */
   tmp = display->screens;
@@ -936,6 +898,7 @@ meta_display_close (MetaDisplay *display,
    * unregister windows
    */
   g_hash_table_destroy (display->window_ids);
+  g_queue_free (display->managed_windows);
 
   if (display->leader_window != None)
     XDestroyWindow (display->xdisplay, display->leader_window);
@@ -1226,6 +1189,18 @@ meta_display_get_current_time (MetaDisplay *display)
   return display->current_time;
 }
 
+static Bool
+find_timestamp_ping (Display  *xdisplay,
+                     XEvent   *event,
+                     XPointer  arg)
+{
+  MetaDisplay *display = (MetaDisplay *) arg;
+
+  return event->type == PropertyNotify &&
+         event->xproperty.window == display->timestamp_pinging_window &&
+         event->xproperty.atom == XA_PRIMARY;
+}
+
 /* Get a timestamp, even if it means a roundtrip */
 guint32
 meta_display_get_current_time_roundtrip (MetaDisplay *display)
@@ -1244,10 +1219,12 @@ meta_display_get_current_time_roundtrip (MetaDisplay *display)
                        display->timestamp_pinging_window,
                        XA_PRIMARY, XA_STRING, 8,
                        PropModeAppend, NULL, 0);
-      XWindowEvent (display->xdisplay,
-                    display->timestamp_pinging_window,
-                    PropertyChangeMask,
-                    &property_event);
+      /* Only take our own PropertyNotify; the window also gets
+       * the ones for property reload pings, which have to reach
+       * event_callback().
+       */
+      XIfEvent (display->xdisplay, &property_event,
+                find_timestamp_ping, (XPointer) display);
       timestamp = property_event.xproperty.time;
     }
 
@@ -1650,6 +1627,30 @@ mouse_event_is_in_tab_popup (MetaDisplay *display,
   return FALSE;
 }
 
+/* Decides whether an event which a later queued one supersedes may be
+ * dropped.  We wait for PropertyNotify on our own windows to get
+ * timestamps, so only client window properties, which get reloaded
+ * anyway, are skipped.
+ */
+static gboolean
+event_can_be_dropped (XEvent   *event,
+                      gpointer  data)
+{
+  MetaDisplay *display = data;
+
+  if (event->type == PropertyNotify)
+    {
+      MetaWindow *window;
+
+      window = meta_display_lookup_x_window (display,
+                                             event->xproperty.window);
+
+      return window != NULL && window->xwindow == event->xproperty.window;
+    }
+
+  return TRUE;
+}
+
 /**
  * This is the most important function in the whole program. It is the heart,
  * it is the nexus, it is the Grand Central Station of Marco's world.
@@ -1676,6 +1677,11 @@ static gboolean event_callback(XEvent* event, gpointer data)
 
   display = data;
 
+  /* Skip events that a later queued event supersedes */
+  if (display->events != NULL &&
+      meta_event_queue_drop_event (display->events, event))
+    return TRUE;
+
 #ifdef WITH_VERBOSE_MODE
   if (dump_events)
     meta_spew_event (display, event);
@@ -1689,6 +1695,8 @@ static gboolean event_callback(XEvent* event, gpointer data)
   display->current_time = event_get_time (display, event);
   display->xinerama_cache_invalidated = TRUE;
 
+  meta_display_dispatch_property_reloads (display);
+
   modified = event_get_modified_window (display, event);
 
   if (event->type == ButtonPress)
@@ -3354,6 +3362,26 @@ meta_display_unregister_x_window (MetaDisplay *display,
   remove_pending_pings_for_window (display, xwindow);
 }
 
+void
+meta_display_add_managed_window (MetaDisplay *display,
+                                 MetaWindow  *window)
+{
+  g_return_if_fail (window->managed_link == NULL);
+
+  g_queue_push_tail (display->managed_windows, window);
+  window->managed_link = display->managed_windows->tail;
+}
+
+void
+meta_display_remove_managed_window (MetaDisplay *display,
+                                    MetaWindow  *window)
+{
+  g_return_if_fail (window->managed_link != NULL);
+
+  g_queue_delete_link (display->managed_windows, window->managed_link);
+  window->managed_link = NULL;
+}
+
 gboolean
 meta_display_xwindow_is_a_no_focus_window (MetaDisplay *display,
                                            Window xwindow)
@@ -4723,30 +4751,13 @@ find_tab_backward (MetaDisplay   *display,
   return NULL;
 }
 
-static int
-mru_cmp (gconstpointer a,
-         gconstpointer b)
-{
-  guint32 time_a, time_b;
-
-  time_a = meta_window_get_user_time ((MetaWindow *)a);
-  time_b = meta_window_get_user_time ((MetaWindow *)b);
-
-  if (time_a > time_b)
-    return -1;
-  else if (time_a < time_b)
-    return 1;
-  else
-    return 0;
-}
-
 GList*
 meta_display_get_tab_list (MetaDisplay   *display,
                            MetaTabList    type,
                            MetaScreen    *screen,
                            MetaWorkspace *active_workspace)
 {
-  GList *tab_list, *window_list, *l;
+  GList *tab_list, *l;
   GList *start_list, *mru_list, *end_list;
   MetaMinimizedWindowPlacement minimized_placement;
   MetaUrgentWindowPlacement urgent_placement;
@@ -4763,35 +4774,22 @@ meta_display_get_tab_list (MetaDisplay   *display,
   if (all_workspaces)
     type = META_TAB_LIST_NORMAL;
 
-  /* Build a complete window list from all windows */
-  GSList *windows = meta_display_list_windows (display);
-  GSList *w;
-
-  window_list = NULL;
-  for (w = windows; w; w = w->next)
-    {
-      MetaWindow *window = w->data;
-      if (window->screen == screen)
-        window_list = g_list_prepend (window_list, window);
-    }
-  window_list = g_list_sort (window_list, mru_cmp);
-
-  g_slist_free (windows);
-
   /* Initialize placement buckets */
   start_list = NULL;
   mru_list = NULL;
   end_list = NULL;
 
   /* Windows sellout mode - MRU order. Collect windows into placement
-   * buckets to sort based on user preferences.
+   * buckets to sort based on user preferences.  The screen keeps its
+   * windows in MRU order, so the buckets are built backwards and
+   * reversed at the end.
    */
-  for (l = window_list; l != NULL; l = l->next)
+  for (l = screen->mru_windows->head; l != NULL; l = l->next)
     {
       MetaWindow *window = l->data;
       gboolean include_window;
 
-      if (window->screen != screen || !IN_TAB_CHAIN (window, type))
+      if (!IN_TAB_CHAIN (window, type))
         continue;
 
       /* Determine if window should be included based on workspace */
@@ -4802,31 +4800,30 @@ meta_display_get_tab_list (MetaDisplay   *display,
       if (window->minimized && include_window)
         {
           if (minimized_placement == META_MINIMIZED_WINDOW_PLACEMENT_MRU)
-            mru_list = g_list_append (mru_list, window);
+            mru_list = g_list_prepend (mru_list, window);
           else if (minimized_placement == META_MINIMIZED_WINDOW_PLACEMENT_END)
-            end_list = g_list_append (end_list, window);
+            end_list = g_list_prepend (end_list, window);
           /* HIDDEN: skip */
         }
       /* Handle urgent windows */
       else if (window->wm_state_demands_attention)
         {
           if (urgent_placement == META_URGENT_WINDOW_PLACEMENT_START)
-            start_list = g_list_append (start_list, window);
+            start_list = g_list_prepend (start_list, window);
           else
-            mru_list = g_list_append (mru_list, window);
+            mru_list = g_list_prepend (mru_list, window);
         }
       /* Handle normal unminimized windows */
       else if (include_window)
         {
-          mru_list = g_list_append (mru_list, window);
+          mru_list = g_list_prepend (mru_list, window);
         }
     }
 
   /* Concatenate buckets: start + MRU + end */
-  tab_list = g_list_concat (start_list, mru_list);
-  tab_list = g_list_concat (tab_list, end_list);
-
-  g_list_free (window_list);
+  tab_list = g_list_concat (g_list_reverse (start_list),
+                            g_list_reverse (mru_list));
+  tab_list = g_list_concat (tab_list, g_list_reverse (end_list));
 
   return tab_list;
 }
@@ -5424,6 +5421,7 @@ sanity_check_timestamps (MetaDisplay *display,
                             "with a timestamp of %u.  Working around...\n",
                             window->desc, window->net_wm_user_time);
               window->net_wm_user_time = timestamp;
+              meta_screen_update_mru_window (window->screen, window);
             }
 
           tmp = tmp->next;
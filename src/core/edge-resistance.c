@@ -28,16 +28,68 @@
 #include "workspace.h"
 
 /* A simple macro for whether a given window's edges are potentially
- * relevant for resistance/snapping during a move/resize operation
+ * relevant for resistance/snapping during a move/resize operation.  The
+ * window being moved is left out when the grab starts, see
+ * compute_resistance_and_snapping_edges().
  */
-#define WINDOW_EDGES_RELEVANT(window, display) \
+#define WINDOW_EDGES_RELEVANT(window) \
   meta_window_should_be_showing (window) &&    \
-  window->screen == display->grab_screen &&    \
-  window         != display->grab_window &&    \
   window->type   != META_WINDOW_DESKTOP &&     \
   window->type   != META_WINDOW_MENU    &&     \
   window->type   != META_WINDOW_SPLASHSCREEN
 
+typedef struct
+{
+  MetaWindow    *window;
+  MetaRectangle  rect;
+} EdgeIndexWindow;
+
+typedef struct
+{
+  MetaWindow    *window;
+  MetaRectangle  rect;
+
+  /* Where the window is in the index's windows */
+  guint          position;
+
+  /* The windows above this one that may clip its edges, bottom to top */
+  GArray        *obscurers;
+
+  /* This window's edges, with the obscured parts removed */
+  GList         *edges;
+} EdgeIndexEntry;
+
+/* The window edges of the active workspace of a screen.  They only
+ * change when windows are configured, restacked, shown or hidden, so
+ * they are kept between grabs and brought up to date in an idle.  The
+ * window pointers are only ever compared, never followed, so the index
+ * may lag behind unmanaged windows until the next rebuild.
+ */
+struct MetaEdgeIndex
+{
+  MetaRectangle  screen_rect;
+
+  /* EdgeIndexWindow of the windows with relevant edges, docks
+   * included, bottom to top
+   */
+  GArray        *windows;
+
+  /* EdgeIndexEntry, bottom to top */
+  GPtrArray     *entries;
+
+  /* Windows which were moved or resized since the index was last
+   * brought up to date; the index is only rebuilt when dirty.
+   */
+  GHashTable    *moved;
+
+  /* All window edges, sorted with meta_rectangle_edge_cmp_ignore_type() */
+  GArray        *vertical_edges;
+  GArray        *horizontal_edges;
+
+  guint          dirty : 1;
+  guint          idle_id;
+};
+
 struct ResistanceDataForAnEdge
 {
   gboolean     timeout_setup;
@@ -52,6 +104,14 @@ typedef struct ResistanceDataForAnEdge ResistanceDataForAnEdge;
 
 struct MetaEdgeResistanceData
 {
+  MetaScreen *screen;
+
+  /* Edges of windows that were clipped by the window being moved,
+   * recomputed without it; the other edges belong to the edge index or
+   * the workspace.
+   */
+  GList *temp_edges;
+
   GArray *left_edges;
   GArray *right_edges;
   GArray *top_edges;
@@ -668,63 +728,33 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
   return modified;
 }
 
+static gboolean
+edge_index_in_use (MetaScreen *screen)
+{
+  MetaEdgeResistanceData *edge_data;
+
+  edge_data = screen->display->grab_edge_resistance_data;
+
+  return edge_data != NULL && edge_data->screen == screen;
+}
+
+static void edge_index_queue_idle (MetaScreen *screen);
+
 void
 meta_display_cleanup_edges (MetaDisplay *display)
 {
-  guint i,j;
   MetaEdgeResistanceData *edge_data = display->grab_edge_resistance_data;
-  GHashTable *edges_to_be_freed;
+  MetaScreen *screen;
 
   if (edge_data == NULL) /* Not currently cached */
     return;
 
-  /* We first need to clean out any window edges */
-  edges_to_be_freed = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-                                             g_free, NULL);
-  for (i = 0; i < 4; i++)
-    {
-      GArray *tmp = NULL;
-      MetaSide side;
-      switch (i)
-        {
-        case 0:
-          tmp = edge_data->left_edges;
-          side = META_SIDE_LEFT;
-          break;
-        case 1:
-          tmp = edge_data->right_edges;
-          side = META_SIDE_RIGHT;
-          break;
-        case 2:
-          tmp = edge_data->top_edges;
-          side = META_SIDE_TOP;
-          break;
-        case 3:
-          tmp = edge_data->bottom_edges;
-          side = META_SIDE_BOTTOM;
-          break;
-        default:
-          g_assert_not_reached ();
-        }
-
-      for (j = 0; j < tmp->len; j++)
-        {
-          MetaEdge *edge = g_array_index (tmp, MetaEdge*, j);
-          if (edge->edge_type == META_EDGE_WINDOW &&
-              edge->side_type == side)
-            {
-              /* The same edge will appear in two arrays, and we can't free
-               * it yet we still need to compare edge->side_type for the other
-               * array that it is in.  So store it in a hash table for later
-               * freeing.  Could also do this in a simple linked list.
-               */
-              g_hash_table_insert (edges_to_be_freed, edge, edge);
-            }
-        }
-    }
+  screen = edge_data->screen;
 
-  /* Now free all the window edges (the key destroy function is g_free) */
-  g_hash_table_destroy (edges_to_be_freed);
+  /* Only the recomputed window edges are ours; the rest belong to the
+   * edge index or to the workspace.
+   */
+  g_list_free_full (edge_data->temp_edges, g_free);
 
   /* Now free the arrays and data */
   g_array_free (edge_data->left_edges, TRUE);
@@ -752,6 +782,12 @@ meta_display_cleanup_edges (MetaDisplay *display)
 
   g_free (display->grab_edge_resistance_data);
   display->grab_edge_resistance_data = NULL;
+
+  /* The index was left alone while the grab used its edges */
+  if (screen->edge_index != NULL &&
+      (screen->edge_index->dirty ||
+       g_hash_table_size (screen->edge_index->moved) > 0))
+    edge_index_queue_idle (screen);
 }
 
 static int
@@ -763,168 +799,579 @@ stupid_sort_requiring_extra_pointer_dereference (gconstpointer a,
   return meta_rectangle_edge_cmp_ignore_type (*a_edge, *b_edge);
 }
 
+/* Whether rect2 can clip the edges of rect1; edges lying along a side
+ * of rect2 are clipped too, so touching counts.
+ */
+static gboolean
+rects_touch (const MetaRectangle *rect1,
+             const MetaRectangle *rect2)
+{
+  return !((BOX_RIGHT (*rect1)  < rect2->x) ||
+           (BOX_RIGHT (*rect2)  < rect1->x) ||
+           (BOX_BOTTOM (*rect1) < rect2->y) ||
+           (BOX_BOTTOM (*rect2) < rect1->y));
+}
+
+static GList*
+compute_window_edges (const MetaRectangle *rect,
+                      const MetaRectangle *screen_rect,
+                      GArray              *obscurers,
+                      MetaWindow          *ignore)
+{
+  GList *new_edges;
+  GSList *obscuring_rects;
+  MetaEdge *new_edge;
+  MetaRectangle reduced;
+  guint i;
+
+  /* We don't care about snapping to any portion of the window that
+   * is offscreen (we also don't care about parts of edges covered
+   * by other windows or DOCKS, but that's handled below).
+   */
+  meta_rectangle_intersect (rect, screen_rect, &reduced);
+
+  new_edges = NULL;
+
+  /* Left side of this window is resistance for the right edge of
+   * the window being moved.
+   */
+  new_edge = g_new (MetaEdge, 1);
+  new_edge->rect = reduced;
+  new_edge->rect.width = 0;
+  new_edge->side_type = META_SIDE_RIGHT;
+  new_edge->edge_type = META_EDGE_WINDOW;
+  new_edges = g_list_prepend (new_edges, new_edge);
+
+  /* Right side of this window is resistance for the left edge of
+   * the window being moved.
+   */
+  new_edge = g_new (MetaEdge, 1);
+  new_edge->rect = reduced;
+  new_edge->rect.x += new_edge->rect.width;
+  new_edge->rect.width = 0;
+  new_edge->side_type = META_SIDE_LEFT;
+  new_edge->edge_type = META_EDGE_WINDOW;
+  new_edges = g_list_prepend (new_edges, new_edge);
+
+  /* Top side of this window is resistance for the bottom edge of
+   * the window being moved.
+   */
+  new_edge = g_new (MetaEdge, 1);
+  new_edge->rect = reduced;
+  new_edge->rect.height = 0;
+  new_edge->side_type = META_SIDE_BOTTOM;
+  new_edge->edge_type = META_EDGE_WINDOW;
+  new_edges = g_list_prepend (new_edges, new_edge);
+
+  /* Top side of this window is resistance for the bottom edge of
+   * the window being moved.
+   */
+  new_edge = g_new (MetaEdge, 1);
+  new_edge->rect = reduced;
+  new_edge->rect.y += new_edge->rect.height;
+  new_edge->rect.height = 0;
+  new_edge->side_type = META_SIDE_TOP;
+  new_edge->edge_type = META_EDGE_WINDOW;
+  new_edges = g_list_prepend (new_edges, new_edge);
+
+  /* Remove edge portions overlapped by windows and docks above it */
+  obscuring_rects = NULL;
+  for (i = obscurers->len; i > 0; i--)
+    {
+      EdgeIndexWindow *obscurer;
+
+      obscurer = &g_array_index (obscurers, EdgeIndexWindow, i - 1);
+      if (obscurer->window != ignore)
+        obscuring_rects = g_slist_prepend (obscuring_rects, &obscurer->rect);
+    }
+
+  new_edges =
+    meta_rectangle_remove_intersections_with_boxes_from_edges (
+      new_edges,
+      obscuring_rects);
+
+  g_slist_free (obscuring_rects);
+
+  return new_edges;
+}
+
+static gboolean
+obscurers_equal (GArray *a,
+                 GArray *b)
+{
+  guint i;
+
+  if (a->len != b->len)
+    return FALSE;
+
+  for (i = 0; i < a->len; i++)
+    if (!meta_rectangle_equal (&g_array_index (a, EdgeIndexWindow, i).rect,
+                               &g_array_index (b, EdgeIndexWindow, i).rect))
+      return FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+obscured_by (EdgeIndexEntry *entry,
+             MetaWindow     *window)
+{
+  guint i;
+
+  for (i = 0; i < entry->obscurers->len; i++)
+    if (g_array_index (entry->obscurers, EdgeIndexWindow, i).window == window)
+      return TRUE;
+
+  return FALSE;
+}
+
 static void
-cache_edges (MetaDisplay *display,
-             GList *window_edges,
-             GList *xinerama_edges,
-             GList *screen_edges)
+free_edge_index_entry (gpointer data)
+{
+  EdgeIndexEntry *entry = data;
+
+  if (entry == NULL)
+    return;
+
+  g_array_free (entry->obscurers, TRUE);
+  g_list_free_full (entry->edges, g_free);
+  g_free (entry);
+}
+
+/* Sorts the edges of all entries by position for quick merging at
+ * grab time.
+ */
+static void
+edge_index_sort_edges (MetaEdgeIndex *edge_index)
 {
-  MetaEdgeResistanceData *edge_data;
   GList *tmp;
-  int num_left, num_right, num_top, num_bottom;
-  int i;
+  guint i;
+
+  g_array_set_size (edge_index->vertical_edges, 0);
+  g_array_set_size (edge_index->horizontal_edges, 0);
+  for (i = 0; i < edge_index->entries->len; i++)
+    {
+      EdgeIndexEntry *entry = g_ptr_array_index (edge_index->entries, i);
+
+      for (tmp = entry->edges; tmp != NULL; tmp = tmp->next)
+        {
+          MetaEdge *edge = tmp->data;
+
+          if (edge->side_type == META_SIDE_LEFT ||
+              edge->side_type == META_SIDE_RIGHT)
+            g_array_append_val (edge_index->vertical_edges, edge);
+          else
+            g_array_append_val (edge_index->horizontal_edges, edge);
+        }
+    }
+  g_array_sort (edge_index->vertical_edges,
+                stupid_sort_requiring_extra_pointer_dereference);
+  g_array_sort (edge_index->horizontal_edges,
+                stupid_sort_requiring_extra_pointer_dereference);
+}
+
+static void
+edge_index_rebuild (MetaScreen *screen)
+{
+  MetaEdgeIndex *edge_index = screen->edge_index;
+  GPtrArray *old_entries;
+  GHashTable *old_by_window;
+  GArray *visible;
+  GList *stacked_windows, *tmp;
+  gboolean screen_changed;
+  int n_reused;
+  guint i, j;
+  gint64 start;
+
+  g_assert (!edge_index_in_use (screen));
+
+  start = g_get_monotonic_time ();
+
+  edge_index->dirty = FALSE;
+  g_hash_table_remove_all (edge_index->moved);
+
+  old_entries = edge_index->entries;
+  old_by_window = g_hash_table_new (NULL, NULL);
+  for (i = 0; i < old_entries->len; i++)
+    {
+      EdgeIndexEntry *entry = g_ptr_array_index (old_entries, i);
+      g_hash_table_insert (old_by_window, entry->window, GUINT_TO_POINTER (i));
+    }
+
+  screen_changed = !meta_rectangle_equal (&edge_index->screen_rect, &screen->rect);
+  edge_index->screen_rect = screen->rect;
 
   /*
-   * 0th: Print debugging information to the log about the edges
+   * 1st: Get the relevant windows and their positions, bottom to top
    */
-#ifdef WITH_VERBOSE_MODE
-  if (meta_is_verbose())
-    {
-      int max_edges = MAX (MAX( g_list_length (window_edges),
-                                g_list_length (xinerama_edges)),
-                           g_list_length (screen_edges));
-      char big_buffer[(EDGE_LENGTH+2)*max_edges];
+  stacked_windows = meta_stack_list_windows (screen->stack,
+                                             screen->active_workspace);
 
-      meta_rectangle_edge_list_to_string (window_edges, ", ", big_buffer);
-      meta_topic (META_DEBUG_EDGE_RESISTANCE,
-                  "Window edges for resistance  : %s\n", big_buffer);
+  visible = g_array_new (FALSE, FALSE, sizeof (EdgeIndexWindow));
+  for (tmp = stacked_windows; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWindow *window = tmp->data;
+      EdgeIndexWindow visible_window;
 
-      meta_rectangle_edge_list_to_string (xinerama_edges, ", ", big_buffer);
-      meta_topic (META_DEBUG_EDGE_RESISTANCE,
-                  "Xinerama edges for resistance: %s\n", big_buffer);
+      if (!(WINDOW_EDGES_RELEVANT (window)))
+        continue;
 
-      meta_rectangle_edge_list_to_string (screen_edges, ", ", big_buffer);
-      meta_topic (META_DEBUG_EDGE_RESISTANCE,
-                  "Screen edges for resistance  : %s\n", big_buffer);
+      visible_window.window = window;
+      meta_window_get_outer_rect (window, &visible_window.rect);
+      g_array_append_val (visible, visible_window);
     }
-#endif
+  g_list_free (stacked_windows);
 
   /*
-   * 1st: Get the total number of each kind of edge
+   * 2nd: Find the windows above each window that may clip its edges, and
+   * only recompute the edges when those or the window itself moved.  Dock
+   * edges are screen edges, which are handled separately, so docks only
+   * obscure.
    */
-  num_left = num_right = num_top = num_bottom = 0;
-  for (i = 0; i < 3; i++)
+  edge_index->entries = g_ptr_array_new_with_free_func (free_edge_index_entry);
+  n_reused = 0;
+  for (i = 0; i < visible->len; i++)
     {
-      tmp = NULL;
-      switch (i)
+      EdgeIndexWindow *visible_window;
+      EdgeIndexEntry *entry;
+      GArray *obscurers;
+      gpointer old_index;
+
+      visible_window = &g_array_index (visible, EdgeIndexWindow, i);
+      if (visible_window->window->type == META_WINDOW_DOCK)
+        continue;
+
+      obscurers = g_array_new (FALSE, FALSE, sizeof (EdgeIndexWindow));
+      for (j = i + 1; j < visible->len; j++)
         {
-        case 0:
-          tmp = window_edges;
-          break;
-        case 1:
-          tmp = xinerama_edges;
-          break;
-        case 2:
-          tmp = screen_edges;
-          break;
-        default:
-          g_assert_not_reached ();
+          EdgeIndexWindow *above = &g_array_index (visible, EdgeIndexWindow, j);
+
+          if (rects_touch (&visible_window->rect, &above->rect))
+            g_array_append_val (obscurers, *above);
         }
 
-      while (tmp)
+      entry = NULL;
+      if (!screen_changed &&
+          g_hash_table_lookup_extended (old_by_window, visible_window->window,
+                                        NULL, &old_index))
         {
-          MetaEdge *edge = tmp->data;
-          switch (edge->side_type)
+          EdgeIndexEntry *old;
+
+          old = g_ptr_array_index (old_entries, GPOINTER_TO_UINT (old_index));
+          if (old != NULL &&
+              meta_rectangle_equal (&old->rect, &visible_window->rect) &&
+              obscurers_equal (old->obscurers, obscurers))
             {
-            case META_SIDE_LEFT:
-              num_left++;
-              break;
-            case META_SIDE_RIGHT:
-              num_right++;
-              break;
-            case META_SIDE_TOP:
-              num_top++;
-              break;
-            case META_SIDE_BOTTOM:
-              num_bottom++;
-              break;
-            default:
-              g_assert_not_reached ();
+              g_ptr_array_index (old_entries, GPOINTER_TO_UINT (old_index)) = NULL;
+              g_array_free (old->obscurers, TRUE);
+              entry = old;
+              n_reused++;
             }
-          tmp = tmp->next;
         }
+
+      if (entry == NULL)
+        {
+          entry = g_new (EdgeIndexEntry, 1);
+          entry->window = visible_window->window;
+          entry->rect = visible_window->rect;
+          entry->edges = compute_window_edges (&entry->rect,
+                                               &screen->rect,
+                                               obscurers,
+                                               NULL);
+        }
+      entry->obscurers = obscurers;
+      entry->position = i;
+
+      g_ptr_array_add (edge_index->entries, entry);
     }
 
-  /*
-   * 2nd: Allocate the edges
-   */
-  g_assert (display->grab_edge_resistance_data == NULL);
-  display->grab_edge_resistance_data = g_new (MetaEdgeResistanceData, 1);
-  edge_data = display->grab_edge_resistance_data;
-  edge_data->left_edges   = g_array_sized_new (FALSE,
-                                               FALSE,
-                                               sizeof(MetaEdge*),
-                                               num_left + num_right);
-  edge_data->right_edges  = g_array_sized_new (FALSE,
-                                               FALSE,
-                                               sizeof(MetaEdge*),
-                                               num_left + num_right);
-  edge_data->top_edges    = g_array_sized_new (FALSE,
-                                               FALSE,
-                                               sizeof(MetaEdge*),
-                                               num_top + num_bottom);
-  edge_data->bottom_edges = g_array_sized_new (FALSE,
-                                               FALSE,
-                                               sizeof(MetaEdge*),
-                                               num_top + num_bottom);
+  g_hash_table_destroy (old_by_window);
+  g_ptr_array_free (old_entries, TRUE);
 
   /*
-   * 3rd: Add the edges to the arrays
+   * 3rd: Sort all the edges by position for quick merging at grab time
    */
-  for (i = 0; i < 3; i++)
+  edge_index_sort_edges (edge_index);
+
+  meta_topic (META_DEBUG_EDGE_RESISTANCE,
+              "Rebuilt edge index of screen %d with %u windows, %d unchanged, "
+              "in %g ms\n",
+              screen->number, edge_index->entries->len, n_reused,
+              (g_get_monotonic_time () - start) / 1000.0);
+
+  g_array_free (edge_index->windows, TRUE);
+  edge_index->windows = visible;
+}
+
+static void
+recompute_entry (MetaEdgeIndex  *edge_index,
+                 EdgeIndexEntry *entry)
+{
+  EdgeIndexWindow *window;
+  guint i;
+
+  window = &g_array_index (edge_index->windows, EdgeIndexWindow,
+                           entry->position);
+  entry->rect = window->rect;
+
+  g_array_set_size (entry->obscurers, 0);
+  for (i = entry->position + 1; i < edge_index->windows->len; i++)
     {
-      tmp = NULL;
-      switch (i)
-        {
-        case 0:
-          tmp = window_edges;
-          break;
-        case 1:
-          tmp = xinerama_edges;
-          break;
-        case 2:
-          tmp = screen_edges;
+      EdgeIndexWindow *above;
+
+      above = &g_array_index (edge_index->windows, EdgeIndexWindow, i);
+      if (rects_touch (&entry->rect, &above->rect))
+        g_array_append_val (entry->obscurers, *above);
+    }
+
+  g_list_free_full (entry->edges, g_free);
+  entry->edges = compute_window_edges (&entry->rect,
+                                       &edge_index->screen_rect,
+                                       entry->obscurers,
+                                       NULL);
+}
+
+/* Brings the index up to date with windows that were only moved or
+ * resized: the stacking and the set of windows are unchanged, so only
+ * the edges of the moved windows and of the windows they covered or
+ * now cover need recomputing.
+ */
+static void
+edge_index_update_moved (MetaScreen *screen)
+{
+  MetaEdgeIndex *edge_index = screen->edge_index;
+  GHashTableIter iter;
+  gpointer key;
+  int n_recomputed;
+  guint i;
+  gint64 start;
+
+  g_assert (!edge_index_in_use (screen));
+
+  start = g_get_monotonic_time ();
+  n_recomputed = 0;
+
+  g_hash_table_iter_init (&iter, edge_index->moved);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      MetaWindow *window = key;
+      EdgeIndexWindow *moved;
+      MetaRectangle rect;
+      guint position;
+
+      /* Windows without relevant edges don't matter until they're shown
+       * or restacked, and that marks the index dirty.
+       */
+      for (position = 0; position < edge_index->windows->len; position++)
+        if (g_array_index (edge_index->windows, EdgeIndexWindow,
+                           position).window == window)
           break;
-        default:
-          g_assert_not_reached ();
-        }
+      if (position == edge_index->windows->len)
+        continue;
+
+      moved = &g_array_index (edge_index->windows, EdgeIndexWindow, position);
+      meta_window_get_outer_rect (window, &rect);
+      if (meta_rectangle_equal (&rect, &moved->rect))
+        continue;
+      moved->rect = rect;
 
-      while (tmp)
+      /* Only the window itself and the windows below it are affected */
+      for (i = 0; i < edge_index->entries->len; i++)
         {
-          MetaEdge *edge = tmp->data;
-          switch (edge->side_type)
+          EdgeIndexEntry *entry = g_ptr_array_index (edge_index->entries, i);
+
+          if (entry->position > position)
+            break;
+
+          if (entry->position == position ||
+              obscured_by (entry, window) ||
+              rects_touch (&entry->rect, &rect))
             {
-            case META_SIDE_LEFT:
-            case META_SIDE_RIGHT:
-              g_array_append_val (edge_data->left_edges, edge);
-              g_array_append_val (edge_data->right_edges, edge);
-              break;
-            case META_SIDE_TOP:
-            case META_SIDE_BOTTOM:
-              g_array_append_val (edge_data->top_edges, edge);
-              g_array_append_val (edge_data->bottom_edges, edge);
-              break;
-            default:
-              g_assert_not_reached ();
+              recompute_entry (edge_index, entry);
+              n_recomputed++;
             }
-          tmp = tmp->next;
         }
     }
+  g_hash_table_remove_all (edge_index->moved);
 
-  /*
-   * 4th: Sort the arrays (FIXME: This is kinda dumb since the arrays were
-   * individually sorted earlier and we could have done this faster and
-   * avoided this sort by sticking them into the array with some simple
-   * merging of the lists).
+  if (n_recomputed > 0)
+    edge_index_sort_edges (edge_index);
+
+  meta_topic (META_DEBUG_EDGE_RESISTANCE,
+              "Updated edge index of screen %d, recomputed %d of %u windows, "
+              "in %g ms\n",
+              screen->number, n_recomputed, edge_index->entries->len,
+              (g_get_monotonic_time () - start) / 1000.0);
+}
+
+static void
+edge_index_update (MetaScreen *screen)
+{
+  MetaEdgeIndex *edge_index = screen->edge_index;
+
+  if (edge_index->dirty)
+    edge_index_rebuild (screen);
+  else if (g_hash_table_size (edge_index->moved) > 0)
+    edge_index_update_moved (screen);
+}
+
+static gboolean
+edge_index_idle (gpointer data)
+{
+  MetaScreen *screen = data;
+  MetaEdgeIndex *edge_index = screen->edge_index;
+
+  edge_index->idle_id = 0;
+
+  if (!edge_index_in_use (screen))
+    edge_index_update (screen);
+
+  return FALSE;
+}
+
+static void
+edge_index_queue_idle (MetaScreen *screen)
+{
+  MetaEdgeIndex *edge_index = screen->edge_index;
+
+  /* A rebuild would free edges a grab is using; meta_display_cleanup_edges()
+   * queues it again once the grab is done with them.
    */
-  g_array_sort (display->grab_edge_resistance_data->left_edges,
-                stupid_sort_requiring_extra_pointer_dereference);
-  g_array_sort (display->grab_edge_resistance_data->right_edges,
-                stupid_sort_requiring_extra_pointer_dereference);
-  g_array_sort (display->grab_edge_resistance_data->top_edges,
-                stupid_sort_requiring_extra_pointer_dereference);
-  g_array_sort (display->grab_edge_resistance_data->bottom_edges,
-                stupid_sort_requiring_extra_pointer_dereference);
+  if (edge_index->idle_id == 0 && !edge_index_in_use (screen))
+    edge_index->idle_id = g_idle_add_full (META_PRIORITY_EDGE_INDEX,
+                                           edge_index_idle, screen, NULL);
+}
+
+static MetaEdgeIndex*
+ensure_edge_index (MetaScreen *screen)
+{
+  MetaEdgeIndex *edge_index;
+
+  if (screen->edge_index == NULL)
+    {
+      edge_index = g_new0 (MetaEdgeIndex, 1);
+      edge_index->windows = g_array_new (FALSE, FALSE, sizeof (EdgeIndexWindow));
+      edge_index->entries = g_ptr_array_new_with_free_func (free_edge_index_entry);
+      edge_index->moved = g_hash_table_new (NULL, NULL);
+      edge_index->vertical_edges = g_array_new (FALSE, FALSE, sizeof (MetaEdge*));
+      edge_index->horizontal_edges = g_array_new (FALSE, FALSE, sizeof (MetaEdge*));
+      edge_index->dirty = TRUE;
+      screen->edge_index = edge_index;
+    }
+
+  return screen->edge_index;
+}
+
+void
+meta_screen_queue_edge_index_rebuild (MetaScreen *screen)
+{
+  if (screen->closing)
+    return;
+
+  ensure_edge_index (screen)->dirty = TRUE;
+  edge_index_queue_idle (screen);
+}
+
+void
+meta_screen_queue_edge_index_update (MetaScreen *screen,
+                                     MetaWindow *window)
+{
+  if (screen->closing)
+    return;
+
+  /* While the window is being moved or resized by a grab, this only
+   * records it; the index is updated once the grab ends.
+   */
+  g_hash_table_add (ensure_edge_index (screen)->moved, window);
+  edge_index_queue_idle (screen);
+}
+
+void
+meta_screen_free_edge_index (MetaScreen *screen)
+{
+  MetaEdgeIndex *edge_index = screen->edge_index;
+
+  if (edge_index == NULL)
+    return;
+
+  if (edge_index_in_use (screen))
+    meta_display_cleanup_edges (screen->display);
+
+  if (edge_index->idle_id != 0)
+    g_source_remove (edge_index->idle_id);
+
+  g_array_free (edge_index->windows, TRUE);
+  g_ptr_array_free (edge_index->entries, TRUE);
+  g_hash_table_destroy (edge_index->moved);
+  g_array_free (edge_index->vertical_edges, TRUE);
+  g_array_free (edge_index->horizontal_edges, TRUE);
+  g_free (edge_index);
+  screen->edge_index = NULL;
+}
+
+/* Merges the edges of the index which aren't excluded with the other
+ * edges of the same orientation, keeping them sorted.
+ */
+static GArray*
+merge_edges (GArray     *index_edges,
+             GHashTable *excluded,
+             GList      *temp_edges,
+             GList      *xinerama_edges,
+             GList      *screen_edges,
+             gboolean    vertical)
+{
+  GArray *others, *merged;
+  GList *lists[3];
+  guint i, j;
+
+  lists[0] = temp_edges;
+  lists[1] = xinerama_edges;
+  lists[2] = screen_edges;
+
+  others = g_array_new (FALSE, FALSE, sizeof (MetaEdge*));
+  for (i = 0; i < G_N_ELEMENTS (lists); i++)
+    {
+      GList *tmp;
+
+      for (tmp = lists[i]; tmp != NULL; tmp = tmp->next)
+        {
+          MetaEdge *edge = tmp->data;
+          gboolean is_vertical;
+
+          is_vertical = edge->side_type == META_SIDE_LEFT ||
+                        edge->side_type == META_SIDE_RIGHT;
+          if (is_vertical == vertical)
+            g_array_append_val (others, edge);
+        }
+    }
+  g_array_sort (others, stupid_sort_requiring_extra_pointer_dereference);
+
+  merged = g_array_sized_new (FALSE, FALSE, sizeof (MetaEdge*),
+                              index_edges->len + others->len);
+  i = j = 0;
+  while (i < index_edges->len || j < others->len)
+    {
+      MetaEdge *edge;
+
+      if (j == others->len ||
+          (i < index_edges->len &&
+           meta_rectangle_edge_cmp_ignore_type (
+             g_array_index (index_edges, MetaEdge*, i),
+             g_array_index (others, MetaEdge*, j)) <= 0))
+        {
+          edge = g_array_index (index_edges, MetaEdge*, i++);
+          if (excluded != NULL && g_hash_table_contains (excluded, edge))
+            continue;
+        }
+      else
+        edge = g_array_index (others, MetaEdge*, j++);
+
+      g_array_append_val (merged, edge);
+    }
+
+  g_array_free (others, TRUE);
+
+  return merged;
 }
 
 static void
@@ -946,185 +1393,113 @@ initialize_grab_edge_resistance_data (MetaDisplay *display)
 static void
 compute_resistance_and_snapping_edges (MetaDisplay *display)
 {
-  GList *stacked_windows;
-  GList *cur_window_iter;
-  GList *edges;
-  /* Lists of window positions (rects) and their relative stacking positions */
-  int stack_position;
-  GSList *obscuring_windows, *window_stacking;
-  /* The portions of the above lists that still remain at the stacking position
-   * in the layer that we are working on
-   */
-  GSList *rem_windows, *rem_win_stacking;
+  MetaScreen *screen;
+  MetaWorkspace *workspace;
+  MetaEdgeIndex *edge_index;
+  MetaEdgeResistanceData *edge_data;
+  GHashTable *excluded;
+  GList *temp_edges;
+  int n_recomputed;
+  guint i;
 
   g_assert (display->grab_window != NULL);
   meta_topic (META_DEBUG_WINDOW_OPS,
               "Computing edges to resist-movement or snap-to for %s.\n",
               display->grab_window->desc);
 
-  /*
-   * 1st: Get the list of relevant windows, from bottom to top
-   */
-  stacked_windows =
-    meta_stack_list_windows (display->grab_screen->stack,
-                             display->grab_screen->active_workspace);
+  screen = display->grab_screen;
+  workspace = screen->active_workspace;
 
   /*
-   * 2nd: we need to separate that stacked list into a list of windows that
-   * can obscure other edges.  To make sure we only have windows obscuring
-   * those below it instead of going both ways, we also need to keep a
-   * counter list.  Messy, I know.
+   * 1st: Make sure the window edges are up to date; normally the idle
+   * has already taken care of that.
    */
-  obscuring_windows = window_stacking = NULL;
-  cur_window_iter = stacked_windows;
-  stack_position = 0;
-  while (cur_window_iter != NULL)
+  edge_index = ensure_edge_index (screen);
+  if (edge_index->idle_id != 0)
     {
-      MetaWindow *cur_window = cur_window_iter->data;
-      if (WINDOW_EDGES_RELEVANT (cur_window, display))
-        {
-          MetaRectangle *new_rect;
-          new_rect = g_new (MetaRectangle, 1);
-          meta_window_get_outer_rect (cur_window, new_rect);
-          obscuring_windows = g_slist_prepend (obscuring_windows, new_rect);
-          window_stacking =
-            g_slist_prepend (window_stacking, GINT_TO_POINTER (stack_position));
-        }
-
-      stack_position++;
-      cur_window_iter = cur_window_iter->next;
+      g_source_remove (edge_index->idle_id);
+      edge_index->idle_id = 0;
     }
-  /* Put 'em in bottom to top order */
-  rem_windows = obscuring_windows = g_slist_reverse (obscuring_windows);
-  rem_win_stacking = window_stacking = g_slist_reverse (window_stacking);
+  edge_index_update (screen);
 
   /*
-   * 3rd: loop over the windows again, this time getting the edges from
-   * them and removing intersections with the relevant obscuring_windows &
-   * obscuring_docks.
+   * 2nd: Leave out the edges of the window being moved, and recompute the
+   * edges of the windows below it as if it weren't there.
    */
-  edges = NULL;
-  stack_position = 0;
-  cur_window_iter = stacked_windows;
-  while (cur_window_iter != NULL)
+  excluded = NULL;
+  temp_edges = NULL;
+  n_recomputed = 0;
+  for (i = 0; i < edge_index->entries->len; i++)
     {
-      MetaRectangle  cur_rect;
-      MetaWindow    *cur_window = cur_window_iter->data;
-      meta_window_get_outer_rect (cur_window, &cur_rect);
+      EdgeIndexEntry *entry = g_ptr_array_index (edge_index->entries, i);
+      GList *tmp;
 
-      /* Check if we want to use this window's edges for edge
-       * resistance (note that dock edges are considered screen edges
-       * which are handled separately
-       */
-      if (WINDOW_EDGES_RELEVANT (cur_window, display) &&
-          cur_window->type != META_WINDOW_DOCK)
-        {
-          GList *new_edges;
-          MetaEdge *new_edge;
-          MetaRectangle reduced;
+      if (entry->window != display->grab_window &&
+          !obscured_by (entry, display->grab_window))
+        continue;
 
-          /* We don't care about snapping to any portion of the window that
-           * is offscreen (we also don't care about parts of edges covered
-           * by other windows or DOCKS, but that's handled below).
-           */
-          meta_rectangle_intersect (&cur_rect,
-                                    &display->grab_screen->rect,
-                                    &reduced);
+      if (excluded == NULL)
+        excluded = g_hash_table_new (NULL, NULL);
 
-          new_edges = NULL;
+      for (tmp = entry->edges; tmp != NULL; tmp = tmp->next)
+        g_hash_table_add (excluded, tmp->data);
 
-          /* Left side of this window is resistance for the right edge of
-           * the window being moved.
-           */
-          new_edge = g_new (MetaEdge, 1);
-          new_edge->rect = reduced;
-          new_edge->rect.width = 0;
-          new_edge->side_type = META_SIDE_RIGHT;
-          new_edge->edge_type = META_EDGE_WINDOW;
-          new_edges = g_list_prepend (new_edges, new_edge);
-
-          /* Right side of this window is resistance for the left edge of
-           * the window being moved.
-           */
-          new_edge = g_new (MetaEdge, 1);
-          new_edge->rect = reduced;
-          new_edge->rect.x += new_edge->rect.width;
-          new_edge->rect.width = 0;
-          new_edge->side_type = META_SIDE_LEFT;
-          new_edge->edge_type = META_EDGE_WINDOW;
-          new_edges = g_list_prepend (new_edges, new_edge);
-
-          /* Top side of this window is resistance for the bottom edge of
-           * the window being moved.
-           */
-          new_edge = g_new (MetaEdge, 1);
-          new_edge->rect = reduced;
-          new_edge->rect.height = 0;
-          new_edge->side_type = META_SIDE_BOTTOM;
-          new_edge->edge_type = META_EDGE_WINDOW;
-          new_edges = g_list_prepend (new_edges, new_edge);
-
-          /* Top side of this window is resistance for the bottom edge of
-           * the window being moved.
-           */
-          new_edge = g_new (MetaEdge, 1);
-          new_edge->rect = reduced;
-          new_edge->rect.y += new_edge->rect.height;
-          new_edge->rect.height = 0;
-          new_edge->side_type = META_SIDE_TOP;
-          new_edge->edge_type = META_EDGE_WINDOW;
-          new_edges = g_list_prepend (new_edges, new_edge);
-
-          /* Update the remaining windows to only those at a higher
-           * stacking position than this one.
-           */
-          while (rem_win_stacking &&
-                 stack_position >= GPOINTER_TO_INT (rem_win_stacking->data))
-            {
-              rem_windows      = rem_windows->next;
-              rem_win_stacking = rem_win_stacking->next;
-            }
-
-          /* Remove edge portions overlapped by rem_windows and rem_docks */
-          new_edges =
-            meta_rectangle_remove_intersections_with_boxes_from_edges (
-              new_edges,
-              rem_windows);
-
-          /* Save the new edges */
-          edges = g_list_concat (new_edges, edges);
+      if (entry->window != display->grab_window)
+        {
+          temp_edges = g_list_concat (compute_window_edges (&entry->rect,
+                                                            &screen->rect,
+                                                            entry->obscurers,
+                                                            display->grab_window),
+                                      temp_edges);
+          n_recomputed++;
         }
-
-      stack_position++;
-      cur_window_iter = cur_window_iter->next;
     }
 
   /*
-   * 4th: Free the extra memory not needed and sort the list
-   */
-  g_list_free (stacked_windows);
-  /* Free the memory used by the obscuring windows/docks lists */
-  g_slist_free (window_stacking);
-  g_slist_free_full (obscuring_windows, g_free);
-
-  /* Sort the list.  FIXME: Should I bother with this sorting?  I just
-   * sort again later in cache_edges() anyway...
-   */
-  edges = g_list_sort (edges, meta_rectangle_edge_cmp);
-
-  /*
-   * 5th: Cache the combination of these edges with the onscreen and
-   * xinerama edges in an array for quick access.  Free the edges since
-   * they've been cached elsewhere.
+   * 3rd: Merge the window edges with the onscreen and xinerama edges in
+   * arrays for quick access.
    */
-  cache_edges (display,
-               edges,
-               display->grab_screen->active_workspace->xinerama_edges,
-               display->grab_screen->active_workspace->screen_edges);
-  g_list_free (edges);
+  g_assert (display->grab_edge_resistance_data == NULL);
+  edge_data = g_new (MetaEdgeResistanceData, 1);
+  display->grab_edge_resistance_data = edge_data;
+  edge_data->screen = screen;
+  edge_data->temp_edges = temp_edges;
+
+  edge_data->left_edges = merge_edges (edge_index->vertical_edges,
+                                       excluded,
+                                       temp_edges,
+                                       workspace->xinerama_edges,
+                                       workspace->screen_edges,
+                                       TRUE);
+  edge_data->right_edges = g_array_sized_new (FALSE, FALSE, sizeof (MetaEdge*),
+                                              edge_data->left_edges->len);
+  g_array_append_vals (edge_data->right_edges,
+                       edge_data->left_edges->data,
+                       edge_data->left_edges->len);
+
+  edge_data->top_edges = merge_edges (edge_index->horizontal_edges,
+                                      excluded,
+                                      temp_edges,
+                                      workspace->xinerama_edges,
+                                      workspace->screen_edges,
+                                      FALSE);
+  edge_data->bottom_edges = g_array_sized_new (FALSE, FALSE, sizeof (MetaEdge*),
+                                               edge_data->top_edges->len);
+  g_array_append_vals (edge_data->bottom_edges,
+                       edge_data->top_edges->data,
+                       edge_data->top_edges->len);
+
+  if (excluded != NULL)
+    g_hash_table_destroy (excluded);
+
+  meta_topic (META_DEBUG_EDGE_RESISTANCE,
+              "Using %u vertical and %u horizontal edges, recomputed the "
+              "edges of %d windows below %s\n",
+              edge_data->left_edges->len, edge_data->top_edges->len,
+              n_recomputed, display->grab_window->desc);
 
   /*
-   * 6th: Initialize the resistance timeouts and buildups
+   * 4th: Initialize the resistance timeouts and buildups
    */
   initialize_grab_edge_resistance_data (display);
 }
@@ -1,6 +1,6 @@
 /* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
 
-/* Marco X event source for main loop */
+/* Marco X event intake: drops events that later queued events supersede */
 
 /*
  * Copyright (C) 2001 Havoc Pennington (based on GDK code (C) Owen
@@ -21,165 +21,363 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
  * 02110-1301, USA.  */
 
+#include <config.h>
 #include "eventqueue.h"
-#include <glib-object.h>
-#include <X11/Xlib.h>
-
-static gboolean eq_prepare  (GSource     *source,
-                             gint        *timeout);
-static gboolean eq_check    (GSource     *source);
-static gboolean eq_dispatch (GSource     *source,
-                             GSourceFunc  callback,
-                             gpointer     user_data);
-static void     eq_destroy  (GSource     *source);
-
-static GSourceFuncs eq_funcs = {
-  eq_prepare,
-  eq_check,
-  eq_dispatch,
-  eq_destroy
+#include "util.h"
+
+/* GDK reads the X connection and hands each event to the display's
+ * event callback in turn.  Bursts of some events are pointless to
+ * process one by one: only the last MotionNotify says where the pointer
+ * is, a damaged window is repaired as a whole, a property is reloaded
+ * from the server anyway, and of a run of ConfigureNotify events that
+ * move a window without restacking anything in between, the last one
+ * says where it ended up.  So before an event is dispatched, we look
+ * whether the Xlib queue holds a later event which supersedes it, and
+ * if so the callback can drop it.
+ *
+ * Scanning the queue for every event would be quadratic in the length
+ * of a burst, so the queue is scanned once per batch: for each key, we
+ * note in order which of the queued events with that key are
+ * superseded, and pop those notes as the events get dispatched.  When
+ * the whole batch has been dispatched, the next event starts a new
+ * batch.  Events that arrived after the scan have no notes, so they are
+ * always dispatched.
+ */
+
+typedef enum
+{
+  EVENT_KIND_CONFIGURE,
+  EVENT_KIND_MOTION,
+  EVENT_KIND_DAMAGE,
+  EVENT_KIND_PROPERTY,
+  N_EVENT_KINDS
+} EventKind;
+
+#ifdef WITH_VERBOSE_MODE
+static const char *event_kind_names[N_EVENT_KINDS] = {
+  "ConfigureNotify",
+  "MotionNotify",
+  "DamageNotify",
+  "PropertyNotify"
 };
+#endif
 
-struct _MetaEventQueue
+typedef struct
 {
-  GSource source;
+  int type;
+  Window window;
+  gulong detail;
+  gulong detail2;
+} EventKey;
+
+/* The queued events with one key which the last scan saw, in order;
+ * superseded[i] says whether a later event supersedes the ith one.
+ */
+typedef struct
+{
+  EventKey key;
+  GArray *superseded;
+  guint next;
+  /* Pointer and key events the scan had seen at the last one */
+  guint n_input_events;
+} PendingEvents;
 
+struct _MetaEventQueue
+{
   Display *display;
-  GPollFD poll_fd;
-  int connection_fd;
-  GQueue *events;
+  int damage_event_type;
+
+  MetaEventQueueFunc can_drop_func;
+  gpointer data;
+
+  /* Set of PendingEvents, looked up by their EventKey */
+  GHashTable *pending;
+  /* Events the last scan saw which haven't been dispatched yet */
+  guint n_scanned;
+  /* While scanning, parent window -> PendingEvents of the last
+   * ConfigureNotify seen for a child of it
+   */
+  GHashTable *last_configures;
+  /* While scanning, button, key and crossing events seen so far */
+  guint n_input_events;
+
+  /* Events dropped in the current batch, and overall */
+  guint n_batch_dropped;
+  gulong n_events;
+  gulong n_dropped[N_EVENT_KINDS];
 };
 
-MetaEventQueue*
-meta_event_queue_new (Display *display, MetaEventQueueFunc func, gpointer data)
+static guint
+event_key_hash (gconstpointer v)
 {
-  GSource *source;
-  MetaEventQueue *eq;
-
-  source = g_source_new (&eq_funcs, sizeof (MetaEventQueue));
-  eq = (MetaEventQueue*) source;
-
-  eq->connection_fd = ConnectionNumber (display);
-  eq->poll_fd.fd = eq->connection_fd;
-  eq->poll_fd.events = G_IO_IN;
+  const EventKey *key = v;
 
-  eq->events = g_queue_new ();
-
-  eq->display = display;
+  return key->type ^ (guint) key->window ^
+         ((guint) key->detail << 7) ^ ((guint) key->detail2 << 13);
+}
 
-  g_source_set_priority (source, G_PRIORITY_DEFAULT);
-  g_source_add_poll (source, &eq->poll_fd);
-  g_source_set_can_recurse (source, TRUE);
+static gboolean
+event_key_equal (gconstpointer a,
+                 gconstpointer b)
+{
+  const EventKey *key_a = a;
+  const EventKey *key_b = b;
 
-  g_source_set_callback (source, G_SOURCE_FUNC (func), data, NULL);
+  return key_a->type == key_b->type &&
+         key_a->window == key_b->window &&
+         key_a->detail == key_b->detail &&
+         key_a->detail2 == key_b->detail2;
+}
 
-  g_source_attach (source, NULL);
-  g_source_unref (source);
+static void
+pending_events_free (gpointer data)
+{
+  PendingEvents *pending = data;
 
-  return eq;
+  g_array_free (pending->superseded, TRUE);
+  g_free (pending);
 }
 
-void
-meta_event_queue_free (MetaEventQueue *eq)
+/* Fills in the key of an event that can be superseded, and returns
+ * its kind, or N_EVENT_KINDS for events that are always dispatched.
+ */
+static EventKind
+get_event_key (MetaEventQueue *eq,
+               XEvent         *event,
+               EventKey       *key)
 {
-  GSource *source;
+  EventKind kind;
 
-  source = (GSource*) eq;
+  key->type = event->type;
+  key->window = event->xany.window;
+  key->detail = 0;
+  key->detail2 = 0;
 
-  g_source_destroy (source);
-}
+  switch (event->type)
+    {
+    case ConfigureNotify:
+      /* The same configure is reported to the window and its parent;
+       * a change of sibling is a restack, which must not be skipped.
+       */
+      key->detail = event->xconfigure.window;
+      key->detail2 = event->xconfigure.above;
+      kind = EVENT_KIND_CONFIGURE;
+      break;
+    case MotionNotify:
+      /* Don't skip a change of the button and modifier state */
+      key->detail = event->xmotion.state;
+      kind = EVENT_KIND_MOTION;
+      break;
+    case PropertyNotify:
+      key->detail = event->xproperty.atom;
+      kind = EVENT_KIND_PROPERTY;
+      break;
+    default:
+      /* xany.window of a DamageNotify is the damaged drawable */
+      if (eq->damage_event_type != 0 && event->type == eq->damage_event_type)
+        kind = EVENT_KIND_DAMAGE;
+      else
+        kind = N_EVENT_KINDS;
+      break;
+    }
 
-static gboolean
-eq_events_pending (MetaEventQueue *eq)
-{
-  return eq->events->length > 0 || XPending (eq->display);
+  return kind;
 }
 
-static void
-eq_queue_events (MetaEventQueue *eq)
+static Bool
+scan_predicate (Display  *display,
+                XEvent   *event,
+                XPointer  arg)
 {
-  XEvent xevent;
+  MetaEventQueue *eq = (MetaEventQueue*) arg;
+  EventKind kind;
+  EventKey key;
+  PendingEvents *pending;
+  gboolean superseded;
+
+  eq->n_scanned += 1;
 
-  while (XPending (eq->display))
+  switch (event->type)
     {
-      XEvent *copy;
+    case ButtonPress:
+    case ButtonRelease:
+    case KeyPress:
+    case KeyRelease:
+    case EnterNotify:
+    case LeaveNotify:
+      eq->n_input_events += 1;
+      break;
+    }
 
-      XNextEvent (eq->display, &xevent);
+  kind = get_event_key (eq, event, &key);
+  if (kind == N_EVENT_KINDS)
+    return False;
 
-      copy = g_new (XEvent, 1);
-      *copy = xevent;
+  pending = g_hash_table_lookup (eq->pending, &key);
 
-      g_queue_push_tail (eq->events, copy);
+  if (kind == EVENT_KIND_CONFIGURE)
+    {
+      PendingEvents *last;
+
+      /* Only a run of configures of the same window supersedes; if
+       * another child of the parent was configured in between, it may
+       * have been stacked relative to the earlier position.
+       */
+      last = g_hash_table_lookup (eq->last_configures,
+                                  GUINT_TO_POINTER (key.window));
+      superseded = pending != NULL && last == pending;
     }
-}
+  else if (kind == EVENT_KIND_MOTION)
+    {
+      /* Keep the pointer position at each click or crossing */
+      superseded = pending != NULL &&
+                   pending->n_input_events == eq->n_input_events;
+    }
+  else
+    superseded = pending != NULL;
 
-static gboolean
-eq_prepare (GSource *source, gint *timeout)
-{
-  MetaEventQueue *eq;
+  if (superseded)
+    g_array_index (pending->superseded, gboolean,
+                   pending->superseded->len - 1) = TRUE;
 
-  eq = (MetaEventQueue*) source;
+  if (pending == NULL)
+    {
+      pending = g_new (PendingEvents, 1);
+      pending->key = key;
+      pending->superseded = g_array_new (FALSE, FALSE, sizeof (gboolean));
+      pending->next = 0;
+      g_hash_table_add (eq->pending, pending);
+    }
+
+  superseded = FALSE;
+  g_array_append_val (pending->superseded, superseded);
+  pending->n_input_events = eq->n_input_events;
 
-  *timeout = -1;
+  if (kind == EVENT_KIND_CONFIGURE)
+    g_hash_table_insert (eq->last_configures,
+                         GUINT_TO_POINTER (key.window), pending);
 
-  return eq_events_pending (eq);
+  /* Never remove anything from the queue */
+  return False;
 }
 
-static gboolean
-eq_check (GSource  *source)
+static void
+scan_queue (MetaEventQueue *eq)
 {
-  MetaEventQueue *eq;
+  XEvent useless;
 
-  eq = (MetaEventQueue*) source;
+  if (eq->n_batch_dropped > 0)
+    meta_topic (META_DEBUG_EVENTS,
+                "Dropped %u superseded events in the last batch\n",
+                eq->n_batch_dropped);
+  eq->n_batch_dropped = 0;
 
-  if (eq->poll_fd.revents & G_IO_IN)
-    return eq_events_pending (eq);
-  else
-    return FALSE;
+  g_hash_table_remove_all (eq->pending);
+  eq->n_scanned = 0;
+  eq->n_input_events = 0;
+
+  /* Read whatever the server has sent, so a burst is seen as a whole */
+  if (XEventsQueued (eq->display, QueuedAfterReading) == 0)
+    return;
+
+  /* "useless" isn't filled in because the predicate never returns True */
+  XCheckIfEvent (eq->display, &useless, scan_predicate, (XPointer) eq);
+
+  g_hash_table_remove_all (eq->last_configures);
 }
 
-static gboolean
-eq_dispatch (GSource *source, GSourceFunc callback, gpointer user_data)
+MetaEventQueue*
+meta_event_queue_new (Display            *display,
+                      int                 damage_event_type,
+                      MetaEventQueueFunc  can_drop_func,
+                      gpointer            data)
 {
   MetaEventQueue *eq;
 
-  eq = (MetaEventQueue*) source;
+  eq = g_new0 (MetaEventQueue, 1);
 
-  eq_queue_events (eq);
+  eq->display = display;
+  eq->damage_event_type = damage_event_type;
+  eq->can_drop_func = can_drop_func;
+  eq->data = data;
+  eq->pending = g_hash_table_new_full (event_key_hash, event_key_equal,
+                                       pending_events_free, NULL);
+  eq->last_configures = g_hash_table_new (NULL, NULL);
 
-  if (eq->events->length > 0)
-    {
-      XEvent *event;
-      MetaEventQueueFunc func;
+  return eq;
+}
 
-      event = g_queue_pop_head (eq->events);
-      func = (MetaEventQueueFunc) G_CALLBACK (callback);
+void
+meta_event_queue_free (MetaEventQueue *eq)
+{
+#ifdef WITH_VERBOSE_MODE
+  int i;
+
+  for (i = 0; i < N_EVENT_KINDS; i++)
+    meta_topic (META_DEBUG_EVENTS,
+                "Dropped %lu superseded %s events\n",
+                eq->n_dropped[i], event_kind_names[i]);
+  meta_topic (META_DEBUG_EVENTS,
+              "Event queue saw %lu events\n", eq->n_events);
+#endif
+
+  g_hash_table_destroy (eq->pending);
+  g_hash_table_destroy (eq->last_configures);
+  g_free (eq);
+}
+
+/**
+ * Returns whether an event should be dropped because a later queued
+ * event supersedes it.  This has to be called for every event, in the
+ * order they come off the Xlib queue, for the notes to stay in step.
+ *
+ * \param eq     The event queue
+ * \param event  The event about to be dispatched
+ */
+gboolean
+meta_event_queue_drop_event (MetaEventQueue *eq,
+                             XEvent         *event)
+{
+  EventKind kind;
+  EventKey key;
+  PendingEvents *pending;
+  gboolean superseded;
 
-      (* func) (event, user_data);
+  eq->n_events += 1;
 
-      g_free (event);
+  /* This event has left the queue, so it starts a new batch of the
+   * events behind it.
+   */
+  if (eq->n_scanned == 0)
+    {
+      scan_queue (eq);
+      return FALSE;
     }
 
-  return TRUE;
-}
+  eq->n_scanned -= 1;
 
-static void
-eq_destroy (GSource *source)
-{
-  MetaEventQueue *eq;
+  kind = get_event_key (eq, event, &key);
+  if (kind == N_EVENT_KINDS)
+    return FALSE;
 
-  eq = (MetaEventQueue*) source;
+  pending = g_hash_table_lookup (eq->pending, &key);
+  if (pending == NULL)
+    return FALSE;
 
-  while (eq->events->length > 0)
-    {
-      XEvent *event;
+  superseded = g_array_index (pending->superseded, gboolean, pending->next);
+  pending->next += 1;
+  if (pending->next == pending->superseded->len)
+    g_hash_table_remove (eq->pending, &key);
 
-      event = g_queue_pop_head (eq->events);
+  if (!superseded)
+    return FALSE;
 
-      g_free (event);
-    }
+  if (eq->can_drop_func != NULL &&
+      !(* eq->can_drop_func) (event, eq->data))
+    return FALSE;
 
-  g_queue_free (eq->events);
+  eq->n_dropped[kind] += 1;
+  eq->n_batch_dropped += 1;
 
-  /* source itself is freed by glib */
+  return TRUE;
 }
@@ -1,6 +1,6 @@
 /* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
 
-/* Marco X event source for main loop */
+/* Marco X event intake: drops events that later queued events supersede */
 
 /*
  * Copyright (C) 2001 Havoc Pennington
@@ -29,12 +29,16 @@
 
 typedef struct _MetaEventQueue MetaEventQueue;
 
-typedef void   (* MetaEventQueueFunc) (XEvent         *event,
-                                       gpointer        data);
-
-MetaEventQueue* meta_event_queue_new  (Display            *display,
-                                       MetaEventQueueFunc  func,
-                                       gpointer            data);
-void            meta_event_queue_free (MetaEventQueue     *eq);
+/* Returns whether an event which a later one supersedes may be dropped */
+typedef gboolean (* MetaEventQueueFunc) (XEvent         *event,
+                                         gpointer        data);
+
+MetaEventQueue* meta_event_queue_new        (Display            *display,
+                                             int                 damage_event_type,
+                                             MetaEventQueueFunc  can_drop_func,
+                                             gpointer            data);
+void            meta_event_queue_free       (MetaEventQueue     *eq);
+gboolean        meta_event_queue_drop_event (MetaEventQueue     *eq,
+                                             XEvent             *event);
 
 #endif
@@ -187,8 +187,17 @@ remove_window_from_group (MetaWindow *window)
 void
 meta_window_group_leader_changed (MetaWindow *window)
 {
+  /* The stacking constraints of dialogs transient for the old
+   * and new groups both depend on this window
+   */
+  meta_stack_freeze (window->screen->stack);
+  meta_stack_update_transient (window->screen->stack, window);
+
   remove_window_from_group (window);
   meta_window_compute_group (window);
+
+  meta_stack_update_transient (window->screen->stack, window);
+  meta_stack_thaw (window->screen->stack);
 }
 
 void
@@ -26,6 +26,7 @@
 #include "ui.h"
 #include "errors.h"
 #include "window-private.h"
+#include "async-getprop.h"
 
 #include <X11/Xatom.h>
 
@@ -52,85 +53,162 @@ get_fallback_icons (MetaScreen     *screen,
   return FALSE;
 }
 
+/* How much of _NET_WM_ICON we fetch before looking at it; if the
+ * property is any bigger, we only fetch the headers and the two
+ * images we end up using.
+ */
+#define ICON_PROBE_LENGTH (16 * 1024)
+
+typedef struct
+{
+  int    width;
+  int    height;
+  gulong offset; /* of the first pixel, in longs */
+} IconSize;
+
 static gboolean
-find_largest_sizes (gulong *data,
-                    gulong  nitems,
-                    int    *width,
-                    int    *height)
+get_icon_range (MetaDisplay *display,
+                Window       xwindow,
+                gulong       offset,
+                gulong       length,
+                gulong     **data,
+                gulong      *nitems,
+                gulong      *bytes_after)
+{
+  Atom type;
+  int format;
+  int result, err;
+  guchar *prop;
+
+  meta_error_trap_push (display);
+  type = None;
+  prop = NULL;
+  result = XGetWindowProperty (display->xdisplay,
+                               xwindow,
+                               display->atom__NET_WM_ICON,
+                               offset, length,
+                               False, XA_CARDINAL, &type, &format, nitems,
+                               bytes_after, &prop);
+  err = meta_error_trap_pop_with_return (display, TRUE);
+
+  if (err != Success ||
+      result != Success)
+    return FALSE;
+
+  if (type != XA_CARDINAL)
+    {
+      if (prop)
+        XFree (prop);
+      return FALSE;
+    }
+
+  *data = (gulong *) prop;
+
+  return TRUE;
+}
+
+/* Lists the images in the icon, reading headers that aren't in
+ * the probe data with small requests of their own.
+ */
+static GArray *
+list_icon_sizes (MetaDisplay *display,
+                 Window       xwindow,
+                 gulong      *probe,
+                 gulong       n_probe,
+                 gulong       total)
 {
-  *width = 0;
-  *height = 0;
+  GArray *sizes;
+  gulong offset;
 
-  while (nitems > 0)
+  sizes = g_array_new (FALSE, FALSE, sizeof (IconSize));
+
+  offset = 0;
+  while (offset < total)
     {
-      int w, h;
+      IconSize size;
+
+      if (total - offset < 3)
+        goto malformed; /* no space for w, h */
+
+      if (offset + 2 <= n_probe)
+        {
+          size.width = probe[offset];
+          size.height = probe[offset + 1];
+        }
+      else
+        {
+          gulong *header;
+          gulong nitems, bytes_after;
 
-      if (nitems < 3)
-        return FALSE; /* no space for w, h */
+          if (!get_icon_range (display, xwindow, offset, 2,
+                               &header, &nitems, &bytes_after))
+            goto malformed;
+
+          if (nitems < 2)
+            {
+              XFree (header);
+              goto malformed;
+            }
+
+          size.width = header[0];
+          size.height = header[1];
+          XFree (header);
+        }
 
-      w = data[0];
-      h = data[1];
+      size.offset = offset + 2;
 
-      if (nitems < ((gulong)(w * h) + 2))
-        return FALSE; /* not enough data */
+      if (size.width <= 0 || size.height <= 0 ||
+          (gulong) size.width * size.height > total - size.offset)
+        goto malformed; /* not enough data */
 
-      *width = MAX (w, *width);
-      *height = MAX (h, *height);
+      g_array_append_val (sizes, size);
 
-      data += (w * h) + 2;
-      nitems -= (w * h) + 2;
+      offset = size.offset + (gulong) size.width * size.height;
     }
 
-  return TRUE;
+  return sizes;
+
+ malformed:
+  g_array_free (sizes, TRUE);
+  return NULL;
 }
 
-static gboolean
-find_best_size (gulong  *data,
-                gulong   nitems,
-                int      ideal_width,
-                int      ideal_height,
-                int     *width,
-                int     *height,
-                gulong **start)
-{
-  int best_w;
-  int best_h;
-  gulong *best_start;
-  int max_width, max_height;
-
-  *width = 0;
-  *height = 0;
-  *start = NULL;
-
-  if (!find_largest_sizes (data, nitems, &max_width, &max_height))
-    return FALSE;
+static const IconSize *
+find_best_size (GArray *sizes,
+                int     ideal_width,
+                int     ideal_height)
+{
+  const IconSize *best;
+  guint i;
 
-  if (ideal_width < 0)
-    ideal_width = max_width;
-  if (ideal_height < 0)
-    ideal_height = max_height;
+  if (ideal_width < 0 || ideal_height < 0)
+    {
+      int max_width, max_height;
 
-  best_w = 0;
-  best_h = 0;
-  best_start = NULL;
+      max_width = 0;
+      max_height = 0;
+      for (i = 0; i < sizes->len; i++)
+        {
+          max_width = MAX (g_array_index (sizes, IconSize, i).width, max_width);
+          max_height = MAX (g_array_index (sizes, IconSize, i).height, max_height);
+        }
+
+      if (ideal_width < 0)
+        ideal_width = max_width;
+      if (ideal_height < 0)
+        ideal_height = max_height;
+    }
 
-  while (nitems > 0)
+  best = NULL;
+
+  for (i = 0; i < sizes->len; i++)
     {
-      int w, h;
+      const IconSize *this = &g_array_index (sizes, IconSize, i);
       gboolean replace;
 
       replace = FALSE;
 
-      if (nitems < 3)
-        return FALSE; /* no space for w, h */
-
-      w = data[0];
-      h = data[1];
-
-      if (nitems < ((gulong)(w * h) + 2))
-        break; /* not enough data */
-
-      if (best_start == NULL)
+      if (best == NULL)
         {
           replace = TRUE;
         }
@@ -138,8 +216,8 @@ find_best_size (gulong  *data,
         {
           /* work with averages */
           const int ideal_size = (ideal_width + ideal_height) / 2;
-          int best_size = (best_w + best_h) / 2;
-          int this_size = (w + h) / 2;
+          int best_size = (best->width + best->height) / 2;
+          int this_size = (this->width + this->height) / 2;
 
           /* larger than desired is always better than smaller */
           if (best_size < ideal_size &&
@@ -159,136 +237,269 @@ find_best_size (gulong  *data,
         }
 
       if (replace)
-        {
-          best_start = data + 2;
-          best_w = w;
-          best_h = h;
-        }
-
-      data += (w * h) + 2;
-      nitems -= (w * h) + 2;
+        best = this;
     }
 
-  if (best_start)
-    {
-      *start = best_start;
-      *width = best_w;
-      *height = best_h;
-      return TRUE;
-    }
-  else
-    return FALSE;
+  return best;
 }
 
 static void
 argbdata_to_pixdata (gulong *argb_data, int len, guchar **pixdata)
 {
-  guchar *p;
+  guint32 *p;
   int i;
 
   *pixdata = g_new (guchar, len * 4);
-  p = *pixdata;
+  p = (guint32 *) *pixdata;
 
-  /* One could speed this up a lot. */
-  i = 0;
-  while (i < len)
+  /* Written as plain word operations with no dependencies between
+   * iterations, so the compiler can vectorize it.  The pixbuf wants
+   * R, G, B, A in memory order.
+   */
+  for (i = 0; i < len; i++)
     {
-      guint argb;
-      guint rgba;
+      guint32 argb = argb_data[i];
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+      p[i] = (argb & 0xff00ff00) |
+             ((argb >> 16) & 0xff) |
+             ((argb & 0xff) << 16);
+#else
+      p[i] = (argb << 8) | (argb >> 24);
+#endif
+    }
+}
 
-      argb = argb_data[i];
-      rgba = (argb << 8) | (argb >> 24);
+/* Gets the pixels of one image, from the probe data if it's
+ * in there, otherwise from the reply to "task".
+ */
+static gboolean
+get_icon_pixels (const IconSize    *size,
+                 gulong            *probe,
+                 gulong             n_probe,
+                 AgGetPropertyTask *task,
+                 guchar           **pixdata)
+{
+  Atom type;
+  int format;
+  gulong nitems, bytes_after;
+  guchar *data;
 
-      *p = rgba >> 24;
-      ++p;
-      *p = (rgba >> 16) & 0xff;
-      ++p;
-      *p = (rgba >> 8) & 0xff;
-      ++p;
-      *p = rgba & 0xff;
-      ++p;
+  if (task == NULL)
+    {
+      argbdata_to_pixdata (probe + size->offset,
+                           size->width * size->height, pixdata);
+      return TRUE;
+    }
 
-      ++i;
+  if (ag_task_get_reply_and_free (task, &type, &format, &nitems,
+                                  &bytes_after, &data) != Success ||
+      type != XA_CARDINAL ||
+      nitems < (gulong) size->width * size->height)
+    {
+      if (data)
+        XFree (data);
+      return FALSE;
     }
+
+  argbdata_to_pixdata ((gulong *) data, size->width * size->height, pixdata);
+  XFree (data);
+
+  return TRUE;
 }
 
+/* Asks for the pixels of one image unless the probe data has them,
+ * in which case *task is NULL.  Returns FALSE if the request couldn't
+ * be made.
+ */
 static gboolean
-read_rgb_icon (MetaDisplay   *display,
-               Window         xwindow,
-               int            ideal_width,
-               int            ideal_height,
-               int            ideal_mini_width,
-               int            ideal_mini_height,
-               int           *width,
-               int           *height,
-               guchar       **pixdata,
-               int           *mini_width,
-               int           *mini_height,
-               guchar       **mini_pixdata)
+request_icon_pixels (MetaDisplay        *display,
+                     Window              xwindow,
+                     const IconSize     *size,
+                     gulong              n_probe,
+                     AgGetPropertyTask **task)
+{
+  gulong length;
+
+  length = (gulong) size->width * size->height;
+
+  *task = NULL;
+
+  if (size->offset + length <= n_probe)
+    return TRUE;
+
+  *task = ag_task_create (display->xdisplay, xwindow,
+                          display->atom__NET_WM_ICON,
+                          size->offset, length,
+                          False, XA_CARDINAL);
+
+  return *task != NULL;
+}
+
+/* The two images start_rgb_icon_fetch() picked, while their pixels
+ * are on the way.  An image that was in the probe data already has
+ * its pixdata and no task.
+ */
+struct _MetaIconFetch
+{
+  IconSize           size;
+  IconSize           mini_size;
+  AgGetPropertyTask *task;
+  AgGetPropertyTask *mini_task;
+  guchar            *pixdata;
+  guchar            *mini_pixdata;
+};
+
+static void
+discard_task (AgGetPropertyTask *task)
 {
   Atom type;
   int format;
-  gulong nitems;
-  gulong bytes_after;
-  int result, err;
+  gulong nitems, bytes_after;
   guchar *data;
-  gulong *best;
-  int w, h;
-  gulong *best_mini;
-  int mini_w, mini_h;
-  gulong *data_as_long;
 
-  meta_error_trap_push (display);
-  type = None;
-  data = NULL;
-  result = XGetWindowProperty (display->xdisplay,
-			       xwindow,
-                               display->atom__NET_WM_ICON,
-			       0, G_MAXLONG,
-			       False, XA_CARDINAL, &type, &format, &nitems,
-			       &bytes_after, &data);
-  err = meta_error_trap_pop_with_return (display, TRUE);
+  ag_task_get_reply_and_free (task, &type, &format, &nitems,
+                              &bytes_after, &data);
+  if (data)
+    XFree (data);
+}
 
-  if (err != Success ||
-      result != Success)
-    return FALSE;
+static void
+free_icon_fetch (MetaIconFetch *fetch)
+{
+  if (fetch->task)
+    discard_task (fetch->task);
+  if (fetch->mini_task)
+    discard_task (fetch->mini_task);
+
+  g_free (fetch->pixdata);
+  g_free (fetch->mini_pixdata);
+  g_free (fetch);
+}
 
-  if (type != XA_CARDINAL)
+static gboolean
+icon_fetch_ready (MetaIconFetch *fetch)
+{
+  return (fetch->task == NULL || ag_task_have_reply (fetch->task)) &&
+         (fetch->mini_task == NULL || ag_task_have_reply (fetch->mini_task));
+}
+
+/* Picks the images to use and asks for whichever of them weren't
+ * in the probe data, without waiting for the replies.
+ */
+static MetaIconFetch *
+start_rgb_icon_fetch (MetaDisplay   *display,
+                      Window         xwindow,
+                      int            ideal_width,
+                      int            ideal_height,
+                      int            ideal_mini_width,
+                      int            ideal_mini_height)
+{
+  gulong *probe;
+  gulong n_probe;
+  gulong bytes_after;
+  GArray *sizes;
+  const IconSize *best;
+  const IconSize *best_mini;
+  MetaIconFetch *fetch;
+  gboolean ok;
+
+  if (!get_icon_range (display, xwindow, 0, ICON_PROBE_LENGTH,
+                       &probe, &n_probe, &bytes_after))
+    return NULL;
+
+  sizes = list_icon_sizes (display, xwindow, probe, n_probe,
+                           n_probe + bytes_after / 4);
+  if (sizes == NULL)
     {
-      XFree (data);
-      return FALSE;
+      XFree (probe);
+      return NULL;
     }
 
-  data_as_long = (gulong *)data;
+  best = find_best_size (sizes, ideal_width, ideal_height);
+  best_mini = find_best_size (sizes, ideal_mini_width, ideal_mini_height);
 
-  if (!find_best_size (data_as_long, nitems,
-                       ideal_width, ideal_height,
-                       &w, &h, &best))
+  if (best == NULL || best_mini == NULL)
     {
-      XFree (data);
-      return FALSE;
+      g_array_free (sizes, TRUE);
+      XFree (probe);
+      return NULL;
     }
 
-  if (!find_best_size (data_as_long, nitems,
-                       ideal_mini_width, ideal_mini_height,
-                       &mini_w, &mini_h, &best_mini))
+  fetch = g_new0 (MetaIconFetch, 1);
+  fetch->size = *best;
+  fetch->mini_size = *best_mini;
+
+  /* Both requests go out in the same flush */
+  ok = request_icon_pixels (display, xwindow, best, n_probe,
+                            &fetch->task);
+  ok = request_icon_pixels (display, xwindow, best_mini, n_probe,
+                            &fetch->mini_task) && ok;
+
+  if (ok && fetch->task == NULL)
+    get_icon_pixels (best, probe, n_probe, NULL, &fetch->pixdata);
+  if (ok && fetch->mini_task == NULL)
+    get_icon_pixels (best_mini, probe, n_probe, NULL, &fetch->mini_pixdata);
+
+  g_array_free (sizes, TRUE);
+  XFree (probe);
+
+  if (!ok)
     {
-      XFree (data);
-      return FALSE;
+      free_icon_fetch (fetch);
+      return NULL;
     }
 
-  *width = w;
-  *height = h;
+  return fetch;
+}
 
-  *mini_width = mini_w;
-  *mini_height = mini_h;
+/* Collects the replies to a fetch that icon_fetch_ready() says are
+ * in, and frees it.
+ */
+static gboolean
+finish_rgb_icon_fetch (MetaIconFetch *fetch,
+                       int           *width,
+                       int           *height,
+                       guchar       **pixdata,
+                       int           *mini_width,
+                       int           *mini_height,
+                       guchar       **mini_pixdata)
+{
+  gboolean ok;
 
-  argbdata_to_pixdata (best, w * h, pixdata);
-  argbdata_to_pixdata (best_mini, mini_w * mini_h, mini_pixdata);
+  ok = TRUE;
 
-  XFree (data);
+  if (fetch->task != NULL)
+    {
+      ok = get_icon_pixels (&fetch->size, NULL, 0, fetch->task,
+                            &fetch->pixdata);
+      fetch->task = NULL;
+    }
 
-  return TRUE;
+  if (fetch->mini_task != NULL)
+    {
+      ok = get_icon_pixels (&fetch->mini_size, NULL, 0, fetch->mini_task,
+                            &fetch->mini_pixdata) && ok;
+      fetch->mini_task = NULL;
+    }
+
+  if (ok)
+    {
+      *width = fetch->size.width;
+      *height = fetch->size.height;
+      *pixdata = fetch->pixdata;
+
+      *mini_width = fetch->mini_size.width;
+      *mini_height = fetch->mini_size.height;
+      *mini_pixdata = fetch->mini_pixdata;
+
+      fetch->pixdata = NULL;
+      fetch->mini_pixdata = NULL;
+    }
+
+  free_icon_fetch (fetch);
+
+  return ok;
 }
 
 static void
@@ -517,6 +728,7 @@ meta_icon_cache_init (MetaIconCache *icon_cache)
   icon_cache->origin = USING_NO_ICON;
   icon_cache->prev_pixmap = None;
   icon_cache->prev_mask = None;
+  icon_cache->fetch = NULL;
 #if 0
   icon_cache->icon = NULL;
   icon_cache->mini_icon = NULL;
@@ -561,10 +773,21 @@ clear_icon_cache (MetaIconCache *icon_cache,
     }
 }
 
+static void
+discard_fetch (MetaIconCache *icon_cache)
+{
+  if (icon_cache->fetch)
+    {
+      free_icon_fetch (icon_cache->fetch);
+      icon_cache->fetch = NULL;
+    }
+}
+
 void
 meta_icon_cache_free (MetaIconCache *icon_cache)
 {
   clear_icon_cache (icon_cache, FALSE);
+  discard_fetch (icon_cache);
 }
 
 void
@@ -620,6 +843,15 @@ meta_icon_cache_get_icon_invalidated (MetaIconCache *icon_cache)
     return FALSE;
 }
 
+/* TRUE while the replies to a _NET_WM_ICON fetch are still on the
+ * way; the icon should be updated again once they're in.
+ */
+gboolean
+meta_icon_cache_is_fetching (MetaIconCache *icon_cache)
+{
+  return icon_cache->fetch != NULL && !icon_fetch_ready (icon_cache->fetch);
+}
+
 static void
 replace_cache (MetaIconCache *icon_cache,
                IconOrigin     origin,
@@ -699,6 +931,144 @@ scaled_from_pixdata (guchar *pixdata,
   return dest;
 }
 
+/* Decoded _NET_WM_ICONs, keyed by a checksum of their pixels and
+ * of the sizes they were scaled to, so that windows with identical
+ * icons (say, a lot of terminals) share one pair of pixbufs.  The
+ * store holds no references; an entry goes away with its pixbufs.
+ */
+typedef struct
+{
+  char      *key;
+  GdkPixbuf *icon;
+  GdkPixbuf *mini_icon;
+} IconStoreEntry;
+
+static GHashTable *icon_store = NULL;
+
+static void
+free_icon_store_entry (gpointer data)
+{
+  IconStoreEntry *entry = data;
+
+  g_free (entry->key);
+  g_free (entry);
+}
+
+static void
+icon_store_entry_gone (gpointer  data,
+                       GObject  *where_the_object_was)
+{
+  IconStoreEntry *entry = data;
+
+  /* Stop watching whichever of the pair is still around */
+  if ((GObject *) entry->icon != where_the_object_was)
+    g_object_weak_unref (G_OBJECT (entry->icon),
+                         icon_store_entry_gone, entry);
+  if ((GObject *) entry->mini_icon != where_the_object_was)
+    g_object_weak_unref (G_OBJECT (entry->mini_icon),
+                         icon_store_entry_gone, entry);
+
+  g_hash_table_remove (icon_store, entry->key);
+}
+
+static char *
+icon_store_key (guchar *pixdata,
+                int     w,
+                int     h,
+                int     ideal_width,
+                int     ideal_height,
+                guchar *mini_pixdata,
+                int     mini_w,
+                int     mini_h,
+                int     ideal_mini_width,
+                int     ideal_mini_height)
+{
+  GChecksum *checksum;
+  int sizes[8];
+  char *key;
+
+  sizes[0] = w;
+  sizes[1] = h;
+  sizes[2] = ideal_width;
+  sizes[3] = ideal_height;
+  sizes[4] = mini_w;
+  sizes[5] = mini_h;
+  sizes[6] = ideal_mini_width;
+  sizes[7] = ideal_mini_height;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_checksum_update (checksum, (guchar *) sizes, sizeof (sizes));
+  g_checksum_update (checksum, pixdata, w * h * 4);
+  g_checksum_update (checksum, mini_pixdata, mini_w * mini_h * 4);
+  key = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  return key;
+}
+
+/* Takes ownership of both pixdatas */
+static void
+shared_from_pixdata (guchar     *pixdata,
+                     int         w,
+                     int         h,
+                     guchar     *mini_pixdata,
+                     int         mini_w,
+                     int         mini_h,
+                     GdkPixbuf **iconp,
+                     int         ideal_width,
+                     int         ideal_height,
+                     GdkPixbuf **mini_iconp,
+                     int         ideal_mini_width,
+                     int         ideal_mini_height)
+{
+  IconStoreEntry *entry;
+  char *key;
+
+  if (icon_store == NULL)
+    icon_store = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        NULL, free_icon_store_entry);
+
+  key = icon_store_key (pixdata, w, h, ideal_width, ideal_height,
+                        mini_pixdata, mini_w, mini_h,
+                        ideal_mini_width, ideal_mini_height);
+
+  entry = g_hash_table_lookup (icon_store, key);
+  if (entry != NULL)
+    {
+      meta_verbose ("Sharing stored icon %s\n", key);
+
+      g_free (key);
+      g_free (pixdata);
+      g_free (mini_pixdata);
+
+      *iconp = g_object_ref (entry->icon);
+      *mini_iconp = g_object_ref (entry->mini_icon);
+      return;
+    }
+
+  *iconp = scaled_from_pixdata (pixdata, w, h,
+                                ideal_width, ideal_height);
+
+  *mini_iconp = scaled_from_pixdata (mini_pixdata, mini_w, mini_h,
+                                     ideal_mini_width, ideal_mini_height);
+
+  if (*iconp == NULL || *mini_iconp == NULL)
+    {
+      g_free (key);
+      return;
+    }
+
+  entry = g_new (IconStoreEntry, 1);
+  entry->key = key;
+  entry->icon = *iconp;
+  entry->mini_icon = *mini_iconp;
+
+  g_object_weak_ref (G_OBJECT (entry->icon), icon_store_entry_gone, entry);
+  g_object_weak_ref (G_OBJECT (entry->mini_icon), icon_store_entry_gone, entry);
+
+  g_hash_table_insert (icon_store, entry->key, entry);
+}
+
 gboolean
 meta_read_icons (MetaScreen     *screen,
                  Window          xwindow,
@@ -740,7 +1110,18 @@ meta_read_icons (MetaScreen     *screen,
   icon_cache->ideal_mini_height = ideal_mini_height;
 #endif
 
-  if (!meta_icon_cache_get_icon_invalidated (icon_cache))
+  if (icon_cache->fetch != NULL)
+    {
+      if (!icon_fetch_ready (icon_cache->fetch))
+        return FALSE; /* not until the images are in */
+
+      /* The property changed again since we asked */
+      if (icon_cache->net_wm_icon_dirty)
+        discard_fetch (icon_cache);
+    }
+
+  if (!meta_icon_cache_get_icon_invalidated (icon_cache) &&
+      icon_cache->fetch == NULL)
     return FALSE; /* we have no new info to use */
 
   pixdata = NULL;
@@ -765,6 +1146,7 @@ meta_read_icons (MetaScreen     *screen,
 
       if (*iconp && *mini_iconp)
         {
+          discard_fetch (icon_cache);
           replace_cache (icon_cache, USING_G_DESKTOP_APP,
                          *iconp, *mini_iconp);
 
@@ -781,21 +1163,38 @@ meta_read_icons (MetaScreen     *screen,
 
   if (icon_cache->origin <= USING_NET_WM_ICON &&
       icon_cache->net_wm_icon_dirty)
-
     {
       icon_cache->net_wm_icon_dirty = FALSE;
 
-      if (read_rgb_icon (screen->display, xwindow,
-                         ideal_width, ideal_height,
-                         ideal_mini_width, ideal_mini_height,
-                         &w, &h, &pixdata,
-                         &mini_w, &mini_h, &mini_pixdata))
-        {
-          *iconp = scaled_from_pixdata (pixdata, w, h,
-                                        ideal_width, ideal_height);
+      /* Images that weren't in the probe aren't waited for here;
+       * the caller updates the icon again once
+       * meta_icon_cache_is_fetching() says they're in.
+       */
+      icon_cache->fetch = start_rgb_icon_fetch (screen->display, xwindow,
+                                                ideal_width, ideal_height,
+                                                ideal_mini_width,
+                                                ideal_mini_height);
+
+      if (icon_cache->fetch != NULL &&
+          !icon_fetch_ready (icon_cache->fetch))
+        return FALSE;
+    }
+
+  if (icon_cache->fetch != NULL)
+    {
+      MetaIconFetch *fetch;
+
+      fetch = icon_cache->fetch;
+      icon_cache->fetch = NULL;
 
-          *mini_iconp = scaled_from_pixdata (mini_pixdata, mini_w, mini_h,
-                                             ideal_mini_width, ideal_mini_height);
+      if (finish_rgb_icon_fetch (fetch,
+                                 &w, &h, &pixdata,
+                                 &mini_w, &mini_h, &mini_pixdata))
+        {
+          shared_from_pixdata (pixdata, w, h,
+                               mini_pixdata, mini_w, mini_h,
+                               iconp, ideal_width, ideal_height,
+                               mini_iconp, ideal_mini_width, ideal_mini_height);
 
           if (*iconp && *mini_iconp)
             {
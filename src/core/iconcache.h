@@ -27,6 +27,7 @@
 #include "screen-private.h"
 
 typedef struct _MetaIconCache MetaIconCache;
+typedef struct _MetaIconFetch MetaIconFetch;
 
 typedef enum
 {
@@ -47,6 +48,8 @@ struct _MetaIconCache
   int origin;
   Pixmap prev_pixmap;
   Pixmap prev_mask;
+  /* _NET_WM_ICON images we've asked for but not collected */
+  MetaIconFetch *fetch;
   guint want_fallback : 1;
   /* TRUE if these props have changed */
   guint wm_hints_dirty : 1;
@@ -66,6 +69,7 @@ void           meta_icon_cache_property_changed     (MetaIconCache *icon_cache,
                                                      MetaDisplay   *display,
                                                      Atom           atom);
 gboolean       meta_icon_cache_get_icon_invalidated (MetaIconCache *icon_cache);
+gboolean       meta_icon_cache_is_fetching          (MetaIconCache *icon_cache);
 
 gboolean meta_read_icons         (MetaScreen     *screen,
                                   Window          xwindow,
@@ -130,8 +130,13 @@ struct _MetaKeyBinding
   unsigned int mask;
   MetaVirtualModifier modifiers;
   const MetaKeyHandler *handler;
+  MetaKeyBindingAction action;
 };
 
+/* Key of a binding in display->key_binding_index */
+#define BINDING_INDEX_KEY(keycode, mask) \
+  GUINT_TO_POINTER (((guint) (keycode) << 16) | ((mask) & 0xffff))
+
 #define keybind(name, handler, param, flags) \
    { #name, handler, param, flags },
 static const MetaKeyHandler key_handlers[] = {
@@ -281,6 +286,39 @@ reload_keycodes (MetaDisplay *display)
     }
 }
 
+/* Indexes the binding table by keycode and devirtualized mask, so that
+ * a key event only looks at the bindings that can match it.  Each entry
+ * lists the matching bindings in table order.  This depends on keycodes
+ * and masks, so it is rebuilt whenever the modifiers are reloaded, which
+ * is always the last step after the table or the keymap changed.
+ */
+static void
+rebuild_binding_index (MetaDisplay *display)
+{
+  int i;
+
+  if (display->key_binding_index)
+    g_hash_table_remove_all (display->key_binding_index);
+  else
+    display->key_binding_index =
+      g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) g_slist_free);
+
+  i = display->n_key_bindings - 1;
+  while (i >= 0)
+    {
+      MetaKeyBinding *binding = &display->key_bindings[i];
+      gpointer key = BINDING_INDEX_KEY (binding->keycode, binding->mask);
+      GSList *list;
+
+      list = g_hash_table_lookup (display->key_binding_index, key);
+      g_hash_table_steal (display->key_binding_index, key);
+      g_hash_table_insert (display->key_binding_index, key,
+                           g_slist_prepend (list, binding));
+
+      --i;
+    }
+}
+
 static void
 reload_modifiers (MetaDisplay *display)
 {
@@ -307,6 +345,8 @@ reload_modifiers (MetaDisplay *display)
           ++i;
         }
     }
+
+  rebuild_binding_index (display);
 }
 
 static int
@@ -390,9 +430,11 @@ rebuild_binding_table (MetaDisplay        *display,
           if (combo && (combo->keysym != None || combo->keycode != 0))
             {
               const MetaKeyHandler *handler = find_handler (key_handlers, prefs[src].name);
+              MetaKeyBindingAction action = meta_prefs_get_keybinding_action (prefs[src].name);
 
               (*bindings_p)[dest].name = prefs[src].name;
               (*bindings_p)[dest].handler = handler;
+              (*bindings_p)[dest].action = action;
               (*bindings_p)[dest].keysym = combo->keysym;
               (*bindings_p)[dest].keycode = combo->keycode;
               (*bindings_p)[dest].modifiers = combo->modifiers;
@@ -409,6 +451,7 @@ rebuild_binding_table (MetaDisplay        *display,
 
                   (*bindings_p)[dest].name = prefs[src].name;
                   (*bindings_p)[dest].handler = handler;
+                  (*bindings_p)[dest].action = action;
                   (*bindings_p)[dest].keysym = combo->keysym;
                   (*bindings_p)[dest].keycode = combo->keycode;
                   (*bindings_p)[dest].modifiers = combo->modifiers |
@@ -443,6 +486,11 @@ rebuild_key_binding_table (MetaDisplay *display)
   meta_topic (META_DEBUG_KEYBINDINGS,
               "Rebuilding key binding table from preferences\n");
 
+  /* The index points into the old table; it is rebuilt once the new
+   * table has its keycodes and modifiers, see rebuild_binding_index() */
+  if (display->key_binding_index)
+    g_hash_table_remove_all (display->key_binding_index);
+
   meta_prefs_get_key_bindings (&prefs, &n_prefs);
   rebuild_binding_table (display,
                          &display->key_bindings,
@@ -491,22 +539,28 @@ display_get_keybinding_action (MetaDisplay  *display,
                                unsigned int  keycode,
                                unsigned long mask)
 {
-  int i;
+  MetaKeyBindingAction action;
+  GSList *tmp;
 
-  i = display->n_key_bindings - 1;
-  while (i >= 0)
+  if (display->key_binding_index == NULL)
+    return META_KEYBINDING_ACTION_NONE;
+
+  /* The last binding in the table wins */
+  action = META_KEYBINDING_ACTION_NONE;
+  tmp = g_hash_table_lookup (display->key_binding_index,
+                             BINDING_INDEX_KEY (keycode, mask));
+  while (tmp)
     {
-      if (display->key_bindings[i].keysym == keysym &&
-          display->key_bindings[i].keycode == keycode &&
-          display->key_bindings[i].mask == mask)
-        {
-          return meta_prefs_get_keybinding_action (display->key_bindings[i].name);
-        }
+      MetaKeyBinding *binding = tmp->data;
 
-      --i;
+      if (binding->keysym == keysym &&
+          binding->mask == mask)
+        action = binding->action;
+
+      tmp = tmp->next;
     }
 
-  return META_KEYBINDING_ACTION_NONE;
+  return action;
 }
 
 void
@@ -601,6 +655,7 @@ meta_display_init_keys (MetaDisplay *display)
   display->meta_mask = 0;
   display->key_bindings = NULL;
   display->n_key_bindings = 0;
+  display->key_binding_index = NULL;
 
   XDisplayKeycodes (display->xdisplay,
                     &display->min_keycode,
@@ -644,6 +699,8 @@ meta_display_shutdown_keys (MetaDisplay *display)
 
   if (display->modmap)
     XFreeModifiermap (display->modmap);
+  if (display->key_binding_index)
+    g_hash_table_destroy (display->key_binding_index);
   g_free (display->key_bindings);
 }
 
@@ -1200,33 +1257,32 @@ primary_modifier_still_pressed (MetaDisplay *display,
 
 /* now called from only one place, may be worth merging */
 static gboolean
-process_event (MetaKeyBinding       *bindings,
-               int                   n_bindings,
-               MetaDisplay          *display,
+process_event (MetaDisplay          *display,
                MetaScreen           *screen,
                MetaWindow           *window,
                XEvent               *event,
                gboolean              on_window)
 {
-  int i;
+  unsigned int mask;
+  GSList *tmp;
 
   /* we used to have release-based bindings but no longer. */
-  if (event->type == KeyRelease)
+  if (event->type != KeyPress)
     return FALSE;
 
-  /*
-   * TODO: This would be better done with a hash table;
-   * it doesn't suit to use O(n) for such a common operation.
-   */
-  for (i=0; i<n_bindings; i++)
+  if (display->key_binding_index == NULL)
+    return FALSE;
+
+  mask = event->xkey.state & 0xff & ~(display->ignored_modifier_mask);
+  tmp = g_hash_table_lookup (display->key_binding_index,
+                             BINDING_INDEX_KEY (event->xkey.keycode, mask));
+
+  for (; tmp; tmp = tmp->next)
     {
-      const MetaKeyHandler *handler = bindings[i].handler;
+      MetaKeyBinding *binding = tmp->data;
+      const MetaKeyHandler *handler = binding->handler;
 
-      if ((!on_window && handler->flags & BINDING_PER_WINDOW) ||
-          event->type != KeyPress ||
-          bindings[i].keycode != event->xkey.keycode ||
-          ((event->xkey.state & 0xff & ~(display->ignored_modifier_mask)) !=
-           bindings[i].mask))
+      if (!on_window && handler->flags & BINDING_PER_WINDOW)
         continue;
 
       /*
@@ -1237,15 +1293,15 @@ process_event (MetaKeyBinding       *bindings,
 
       meta_topic (META_DEBUG_KEYBINDINGS,
                   "Binding keycode 0x%x mask 0x%x matches event 0x%x state 0x%x\n",
-                  bindings[i].keycode, bindings[i].mask,
+                  binding->keycode, binding->mask,
                   event->xkey.keycode, event->xkey.state);
 
       if (handler == NULL)
-        meta_bug ("Binding %s has no handler\n", bindings[i].name);
+        meta_bug ("Binding %s has no handler\n", binding->name);
       else
         meta_topic (META_DEBUG_KEYBINDINGS,
                     "Running handler for %s\n",
-                    bindings[i].name);
+                    binding->name);
 
       /* Global keybindings count as a let-the-terminal-lose-focus
        * due to new window mapping until the user starts
@@ -1254,9 +1310,9 @@ process_event (MetaKeyBinding       *bindings,
       display->allow_terminal_deactivation = TRUE;
 
       (* handler->func) (display, screen,
-                         bindings[i].handler->flags & BINDING_PER_WINDOW? window: NULL,
+                         handler->flags & BINDING_PER_WINDOW? window: NULL,
                          event,
-                         &bindings[i]);
+                         binding);
       return TRUE;
     }
 
@@ -1422,9 +1478,7 @@ meta_display_process_key_event (MetaDisplay *display,
         }
       }
   /* Do the normal keybindings */
-  process_event (display->key_bindings,
-                 display->n_key_bindings,
-                 display, screen, window, event,
+  process_event (display, screen, window, event,
                  !all_keys_grabbed && window);
 }
 
@@ -3041,10 +3095,13 @@ do_choose_window (MetaDisplay    *display,
 {
   MetaTabList type = binding->handler->data;
   MetaWindow *initial_selection;
+  guint n_window_lists;
 
   meta_topic (META_DEBUG_KEYBINDINGS,
               "Tab list = %u show_popup = %d\n", type, show_popup);
 
+  n_window_lists = display->n_window_lists;
+
   /* reverse direction if shift is down */
   if (event->xkey.state & ShiftMask)
     backward = !backward;
@@ -3127,6 +3184,10 @@ do_choose_window (MetaDisplay    *display,
             }
         }
     }
+
+  meta_topic (META_DEBUG_KEYBINDINGS,
+              "Built %u window lists to start cycling windows\n",
+              display->n_window_lists - n_window_lists);
 }
 
 static void
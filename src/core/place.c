@@ -415,99 +415,307 @@ avoid_being_obscured_as_second_modal_dialog (MetaWindow       *window,
     }
 }
 
+/* An index of the outer rectangles of the windows a new window should
+ * not overlap, within a work area.  The edges of the windows cut the
+ * work area into a grid of cells each of which is either entirely
+ * covered by windows or entirely free; a summed-area table over the
+ * covered cells then tells whether any rectangle is free with four
+ * lookups, however many windows there are.
+ */
+typedef struct
+{
+  MetaRectangle  work_area;
+
+  /* The distinct window edges within the work area, and the work area
+   * edges, sorted
+   */
+  int           *xs;
+  int            n_xs;
+  int           *ys;
+  int            n_ys;
+
+  /* covered[j * n_xs + i] is the number of covered cells from xs[0]
+   * to xs[i + 1] and from ys[0] to ys[j + 1]
+   */
+  int           *covered;
+} PlacementIndex;
+
 static gboolean
-rectangle_overlaps_some_window (MetaRectangle *rect,
-                                GList         *windows)
+window_avoided_by_placement (MetaWindow *window)
 {
-  GList *tmp;
-  MetaRectangle dest;
+  switch (window->type)
+    {
+    case META_WINDOW_DOCK:
+    case META_WINDOW_SPLASHSCREEN:
+    case META_WINDOW_DESKTOP:
+    case META_WINDOW_DIALOG:
+    case META_WINDOW_MODAL_DIALOG:
+      return FALSE;
 
-  tmp = windows;
-  while (tmp != NULL)
+    case META_WINDOW_NORMAL:
+    case META_WINDOW_UTILITY:
+    case META_WINDOW_TOOLBAR:
+    case META_WINDOW_MENU:
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static int
+intcmp (const void *a, const void *b)
+{
+  const int *ai = a;
+  const int *bi = b;
+
+  return (*ai > *bi) - (*ai < *bi);
+}
+
+static int
+sort_unique (int *values,
+             int  n_values)
+{
+  int i, n_unique;
+
+  qsort (values, n_values, sizeof (int), intcmp);
+
+  n_unique = 0;
+  for (i = 0; i < n_values; i++)
+    if (n_unique == 0 || values[i] != values[n_unique - 1])
+      values[n_unique++] = values[i];
+
+  return n_unique;
+}
+
+/* Index of the last of the sorted values not greater than value, with
+ * values[0] being at most value
+ */
+static int
+find_value_at_or_before (const int *values,
+                         int        n_values,
+                         int        value)
+{
+  int low, high;
+
+  low = 0;
+  high = n_values - 1;
+  while (low < high)
     {
-      MetaWindow *other = tmp->data;
-      MetaRectangle other_rect;
+      int mid = low + (high - low + 1) / 2;
 
-      switch (other->type)
-        {
-        case META_WINDOW_DOCK:
-        case META_WINDOW_SPLASHSCREEN:
-        case META_WINDOW_DESKTOP:
-        case META_WINDOW_DIALOG:
-        case META_WINDOW_MODAL_DIALOG:
-          break;
+      if (values[mid] <= value)
+        low = mid;
+      else
+        high = mid - 1;
+    }
 
-        case META_WINDOW_NORMAL:
-        case META_WINDOW_UTILITY:
-        case META_WINDOW_TOOLBAR:
-        case META_WINDOW_MENU:
-          meta_window_get_outer_rect (other, &other_rect);
+  return low;
+}
 
-          if (meta_rectangle_intersect (rect, &other_rect, &dest))
-            return TRUE;
-          break;
-        }
+/* Index of the first of the sorted values not less than value, with
+ * values[n_values - 1] being at least value
+ */
+static int
+find_value_at_or_after (const int *values,
+                        int        n_values,
+                        int        value)
+{
+  int low, high;
 
-      tmp = tmp->next;
+  low = 0;
+  high = n_values - 1;
+  while (low < high)
+    {
+      int mid = low + (high - low) / 2;
+
+      if (values[mid] >= value)
+        high = mid;
+      else
+        low = mid + 1;
     }
 
-  return FALSE;
+  return low;
 }
 
-static gint
-leftmost_cmp (gconstpointer a, gconstpointer b)
+static void
+placement_index_init (PlacementIndex      *index,
+                      const MetaRectangle *work_area,
+                      GList               *windows)
 {
-  MetaWindow *aw = (gpointer) a;
-  MetaWindow *bw = (gpointer) b;
-  int ax, bx;
+  GArray *rects;
+  GList *tmp;
+  int *count;
+  guint n;
+  int i, j;
 
-  /* we're interested in the frame position for cascading,
-   * not meta_window_get_position()
+  index->work_area = *work_area;
+
+  /* Only the parts of windows within the work area matter */
+  rects = g_array_new (FALSE, FALSE, sizeof (MetaRectangle));
+  for (tmp = windows; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWindow *other = tmp->data;
+      MetaRectangle outer_rect, clipped;
+
+      if (!window_avoided_by_placement (other))
+        continue;
+
+      meta_window_get_outer_rect (other, &outer_rect);
+      if (meta_rectangle_intersect (&outer_rect, work_area, &clipped))
+        g_array_append_val (rects, clipped);
+    }
+
+  index->xs = g_new (int, 2 * rects->len + 2);
+  index->ys = g_new (int, 2 * rects->len + 2);
+  index->xs[0] = BOX_LEFT (*work_area);
+  index->xs[1] = BOX_RIGHT (*work_area);
+  index->ys[0] = BOX_TOP (*work_area);
+  index->ys[1] = BOX_BOTTOM (*work_area);
+  for (n = 0; n < rects->len; n++)
+    {
+      MetaRectangle *rect = &g_array_index (rects, MetaRectangle, n);
+
+      index->xs[2 * n + 2] = BOX_LEFT (*rect);
+      index->xs[2 * n + 3] = BOX_RIGHT (*rect);
+      index->ys[2 * n + 2] = BOX_TOP (*rect);
+      index->ys[2 * n + 3] = BOX_BOTTOM (*rect);
+    }
+  index->n_xs = sort_unique (index->xs, 2 * rects->len + 2);
+  index->n_ys = sort_unique (index->ys, 2 * rects->len + 2);
+
+  /* Count the windows covering each cell: mark the corners of each
+   * window and sum them up.  Then turn the counts into the summed-area
+   * table of covered cells in place.
    */
-  if (aw->frame)
-    ax = aw->frame->rect.x;
-  else
-    ax = aw->rect.x;
+  count = g_new0 (int, index->n_xs * index->n_ys);
+  for (n = 0; n < rects->len; n++)
+    {
+      MetaRectangle *rect = &g_array_index (rects, MetaRectangle, n);
+      int i0, i1, j0, j1;
+
+      i0 = find_value_at_or_after (index->xs, index->n_xs, BOX_LEFT (*rect));
+      i1 = find_value_at_or_after (index->xs, index->n_xs, BOX_RIGHT (*rect));
+      j0 = find_value_at_or_after (index->ys, index->n_ys, BOX_TOP (*rect));
+      j1 = find_value_at_or_after (index->ys, index->n_ys, BOX_BOTTOM (*rect));
+
+      count[j0 * index->n_xs + i0] += 1;
+      count[j0 * index->n_xs + i1] -= 1;
+      count[j1 * index->n_xs + i0] -= 1;
+      count[j1 * index->n_xs + i1] += 1;
+    }
 
-  if (bw->frame)
-    bx = bw->frame->rect.x;
-  else
-    bx = bw->rect.x;
+  for (j = 0; j < index->n_ys; j++)
+    for (i = 0; i < index->n_xs; i++)
+      {
+        if (i > 0)
+          count[j * index->n_xs + i] += count[j * index->n_xs + i - 1];
+        if (j > 0)
+          count[j * index->n_xs + i] += count[(j - 1) * index->n_xs + i];
+        if (i > 0 && j > 0)
+          count[j * index->n_xs + i] -= count[(j - 1) * index->n_xs + i - 1];
+      }
 
-  if (ax < bx)
-    return -1;
-  else if (ax > bx)
-    return 1;
-  else
+  for (j = 0; j < index->n_ys; j++)
+    for (i = 0; i < index->n_xs; i++)
+      {
+        int *cell = &count[j * index->n_xs + i];
+
+        *cell = *cell > 0;
+        if (i > 0)
+          *cell += count[j * index->n_xs + i - 1];
+        if (j > 0)
+          *cell += count[(j - 1) * index->n_xs + i];
+        if (i > 0 && j > 0)
+          *cell -= count[(j - 1) * index->n_xs + i - 1];
+      }
+
+  index->covered = count;
+  g_array_free (rects, TRUE);
+}
+
+static void
+placement_index_free (PlacementIndex *index)
+{
+  g_free (index->xs);
+  g_free (index->ys);
+  g_free (index->covered);
+}
+
+/* The number of covered cells before column i and row j */
+static int
+placement_index_covered_before (PlacementIndex *index,
+                                int             i,
+                                int             j)
+{
+  if (i == 0 || j == 0)
     return 0;
+
+  return index->covered[(j - 1) * index->n_xs + (i - 1)];
 }
 
-static gint
-topmost_cmp (gconstpointer a, gconstpointer b)
+/* Whether rect lies within the work area and overlaps no window */
+static gboolean
+placement_index_rect_is_free (PlacementIndex      *index,
+                              const MetaRectangle *rect)
 {
-  MetaWindow *aw = (gpointer) a;
-  MetaWindow *bw = (gpointer) b;
-  int ay, by;
+  int i0, i1, j0, j1;
+  int n_covered;
 
-  /* we're interested in the frame position for cascading,
-   * not meta_window_get_position()
-   */
-  if (aw->frame)
-    ay = aw->frame->rect.y;
-  else
-    ay = aw->rect.y;
+  if (!meta_rectangle_contains_rect (&index->work_area, rect))
+    return FALSE;
 
-  if (bw->frame)
-    by = bw->frame->rect.y;
-  else
-    by = bw->rect.y;
+  i0 = find_value_at_or_before (index->xs, index->n_xs, BOX_LEFT (*rect));
+  i1 = find_value_at_or_after (index->xs, index->n_xs, BOX_RIGHT (*rect));
+  j0 = find_value_at_or_before (index->ys, index->n_ys, BOX_TOP (*rect));
+  j1 = find_value_at_or_after (index->ys, index->n_ys, BOX_BOTTOM (*rect));
 
-  if (ay < by)
-    return -1;
-  else if (ay > by)
-    return 1;
-  else
-    return 0;
+  n_covered = placement_index_covered_before (index, i1, j1) -
+              placement_index_covered_before (index, i1, j0) -
+              placement_index_covered_before (index, i0, j1) +
+              placement_index_covered_before (index, i0, j0);
+
+  return n_covered == 0;
+}
+
+/* Finds the leftmost, then topmost, free position for rect.  A window
+ * that fits somewhere can be slid left and up until it meets the edge
+ * of a window or of the work area, so only positions on the grid need
+ * to be tried.
+ */
+static gboolean
+placement_index_find_free_position (PlacementIndex *index,
+                                    MetaRectangle  *rect)
+{
+  int i, i1, j, j1;
+
+  for (i = 0; i < index->n_xs; i++)
+    {
+      rect->x = index->xs[i];
+      if (BOX_RIGHT (*rect) > BOX_RIGHT (index->work_area))
+        break;
+
+      i1 = find_value_at_or_after (index->xs, index->n_xs, BOX_RIGHT (*rect));
+
+      /* The bottom edge only moves down the grid as the top does */
+      j1 = 0;
+      for (j = 0; j < index->n_ys; j++)
+        {
+          rect->y = index->ys[j];
+          if (BOX_BOTTOM (*rect) > BOX_BOTTOM (index->work_area))
+            break;
+
+          while (index->ys[j1] < BOX_BOTTOM (*rect))
+            j1++;
+
+          if (placement_index_covered_before (index, i1, j1) -
+              placement_index_covered_before (index, i1, j) -
+              placement_index_covered_before (index, i, j1) +
+              placement_index_covered_before (index, i, j) == 0)
+            return TRUE;
+        }
+    }
+
+  return FALSE;
 }
 
 static void
@@ -555,32 +763,18 @@ find_first_fit (MetaWindow       *window,
                 int              *new_x,
                 int              *new_y)
 {
-  /* This algorithm is limited - it just brute-force tries
-   * to fit the window in a small number of locations that are aligned
-   * with existing windows. It tries to place the window on
-   * the bottom of each existing window, and then to the right
-   * of each existing window, aligned with the left/top of the
-   * existing window in each of those cases.
+  /* The centered (or tiled) position is tried first; failing that, the
+   * work area is searched for free space, which finds a place whenever
+   * the window fits anywhere without overlapping others.
    */
   int retval;
-  GList *below_sorted;
-  GList *right_sorted;
-  GList *tmp;
+  PlacementIndex index;
   MetaRectangle rect;
   MetaRectangle work_area;
+  gint64 start;
 
   retval = FALSE;
 
-  /* Below each window */
-  below_sorted = g_list_copy (windows);
-  below_sorted = g_list_sort (below_sorted, leftmost_cmp);
-  below_sorted = g_list_sort (below_sorted, topmost_cmp);
-
-  /* To the right of each window */
-  right_sorted = g_list_copy (windows);
-  right_sorted = g_list_sort (right_sorted, topmost_cmp);
-  right_sorted = g_list_sort (right_sorted, leftmost_cmp);
-
   rect.width = window->rect.width;
   rect.height = window->rect.height;
 
@@ -603,6 +797,9 @@ find_first_fit (MetaWindow       *window,
 
     meta_window_get_work_area_for_xinerama (window, xinerama, &work_area);
 
+    start = g_get_monotonic_time ();
+    placement_index_init (&index, &work_area, windows);
+
     if (meta_prefs_get_center_new_windows ())
       center_rect_in_area (&rect, &work_area);
     else
@@ -610,7 +807,20 @@ find_first_fit (MetaWindow       *window,
 
     if (meta_rectangle_contains_rect (&work_area, &rect) &&
         (meta_prefs_get_center_new_windows () ||
-         !rectangle_overlaps_some_window (&rect, windows)))
+         placement_index_rect_is_free (&index, &rect)))
+      retval = TRUE;
+    else
+      retval = placement_index_find_free_position (&index, &rect);
+
+    meta_topic (META_DEBUG_PLACEMENT,
+                "First fit for %s over a %dx%d grid: %s in %g ms\n",
+                window->desc, index.n_xs, index.n_ys,
+                retval ? "found" : "none",
+                (g_get_monotonic_time () - start) / 1000.0);
+
+    placement_index_free (&index);
+
+    if (retval)
       {
         *new_x = rect.x;
         *new_y = rect.y;
@@ -619,78 +829,8 @@ find_first_fit (MetaWindow       *window,
             *new_x += borders->visible.left;
             *new_y += borders->visible.top;
           }
-
-        retval = TRUE;
-
-        goto out;
       }
 
-    /* try below each window */
-    tmp = below_sorted;
-    while (tmp != NULL)
-      {
-        MetaWindow *w = tmp->data;
-        MetaRectangle outer_rect;
-
-        meta_window_get_outer_rect (w, &outer_rect);
-
-        rect.x = outer_rect.x;
-        rect.y = outer_rect.y + outer_rect.height;
-
-        if (meta_rectangle_contains_rect (&work_area, &rect) &&
-            !rectangle_overlaps_some_window (&rect, below_sorted))
-          {
-            *new_x = rect.x;
-            *new_y = rect.y;
-            if (borders)
-              {
-                *new_x += borders->visible.left;
-                *new_y += borders->visible.top;
-              }
-
-            retval = TRUE;
-
-            goto out;
-          }
-
-        tmp = tmp->next;
-      }
-
-    /* try to the right of each window */
-    tmp = right_sorted;
-    while (tmp != NULL)
-      {
-        MetaWindow *w = tmp->data;
-        MetaRectangle outer_rect;
-
-        meta_window_get_outer_rect (w, &outer_rect);
-
-        rect.x = outer_rect.x + outer_rect.width;
-        rect.y = outer_rect.y;
-
-        if (meta_rectangle_contains_rect (&work_area, &rect) &&
-            !rectangle_overlaps_some_window (&rect, right_sorted))
-          {
-            *new_x = rect.x;
-            *new_y = rect.y;
-            if (borders)
-              {
-                *new_x += borders->visible.left;
-                *new_y += borders->visible.top;
-              }
-
-            retval = TRUE;
-
-            goto out;
-          }
-
-        tmp = tmp->next;
-      }
-
- out:
-
-  g_list_free (below_sorted);
-  g_list_free (right_sorted);
   return retval;
 }
 
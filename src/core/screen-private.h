@@ -39,6 +39,7 @@
 #include "ui.h"
 
 typedef struct _MetaXineramaScreenInfo MetaXineramaScreenInfo;
+typedef struct MetaEdgeIndex MetaEdgeIndex;
 
 struct _MetaXineramaScreenInfo
 {
@@ -95,8 +96,24 @@ struct _MetaScreen
 
   GList *workspaces;
 
+  /* Managed windows on all workspaces, whether or not they are also
+   * on one workspace's window list, see meta_screen_update_sticky_window().
+   */
+  GHashTable *sticky_windows;
+
+  /* Windows with struts, see meta_screen_update_strut_window() */
+  GHashTable *strut_windows;
+
+  /* All windows, most recently used first, for the tab list; see
+   * meta_screen_update_mru_window().
+   */
+  GQueue *mru_windows;
+
   MetaStack *stack;
 
+  /* Window edges for edge resistance, see edge-resistance.c */
+  MetaEdgeIndex *edge_index;
+
   MetaCursor current_cursor;
 
   Window flash_window;
@@ -124,6 +141,8 @@ struct _MetaScreen
 #endif
 
   guint work_area_idle;
+  /* Last value written to each work area property, by property name */
+  GHashTable *work_area_hints;
 
   int rows_of_workspaces;
   int columns_of_workspaces;
@@ -153,6 +172,14 @@ void          meta_screen_manage_all_windows  (MetaScreen                 *scree
 void          meta_screen_foreach_window      (MetaScreen                 *screen,
                                                MetaScreenWindowFunc        func,
                                                gpointer                    data);
+void          meta_screen_update_sticky_window (MetaScreen                *screen,
+                                                MetaWindow                *window);
+void          meta_screen_update_strut_window (MetaScreen                 *screen,
+                                               MetaWindow                 *window);
+void          meta_screen_update_mru_window   (MetaScreen                 *screen,
+                                               MetaWindow                 *window);
+void          meta_screen_remove_mru_window   (MetaScreen                 *screen,
+                                               MetaWindow                 *window);
 void          meta_screen_queue_frame_redraws (MetaScreen                 *screen);
 void          meta_screen_queue_window_resizes (MetaScreen                 *screen);
 
@@ -194,6 +221,10 @@ void          meta_screen_update_workspace_layout (MetaScreen             *scree
 void          meta_screen_update_workspace_names  (MetaScreen             *screen);
 void          meta_screen_queue_workarea_recalc   (MetaScreen             *screen);
 void          meta_screen_update_dynamic_workspaces (MetaScreen           *screen);
+void          meta_screen_queue_edge_index_rebuild (MetaScreen            *screen);
+void          meta_screen_queue_edge_index_update (MetaScreen            *screen,
+                                                   MetaWindow            *window);
+void          meta_screen_free_edge_index         (MetaScreen             *screen);
 
 Window meta_create_offscreen_window (Display *xdisplay,
                                      Window   parent,
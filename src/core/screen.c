@@ -41,6 +41,7 @@
 #include "stack.h"
 #include "xprops.h"
 #include "compositor.h"
+#include "async-getprop.h"
 
 #ifdef HAVE_SOLARIS_XINERAMA
 #include <X11/extensions/xinerama.h>
@@ -166,7 +167,7 @@ reload_xinerama_infos (MetaScreen *screen)
       {
         MetaWorkspace *space = tmp->data;
 
-        meta_workspace_invalidate_work_area (space);
+        meta_workspace_discard_work_area (space);
 
         tmp = tmp->next;
       }
@@ -507,9 +508,16 @@ meta_screen_new (MetaDisplay *display,
                                                                  NoEventMask);
 #endif
   screen->work_area_idle = 0;
+  screen->work_area_hints = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free,
+                                                   (GDestroyNotify) g_bytes_unref);
 
   screen->active_workspace = NULL;
   screen->workspaces = NULL;
+  screen->sticky_windows = g_hash_table_new (NULL, NULL);
+  screen->strut_windows = g_hash_table_new (NULL, NULL);
+  screen->mru_windows = g_queue_new ();
+  screen->edge_index = NULL;
   screen->rows_of_workspaces = 1;
   screen->columns_of_workspaces = -1;
   screen->vertical_workspaces = FALSE;
@@ -694,8 +702,14 @@ meta_screen_free (MetaScreen *screen,
 
   meta_ui_free (screen->ui);
 
+  meta_screen_free_edge_index (screen);
+
   meta_stack_free (screen->stack);
 
+  g_hash_table_destroy (screen->sticky_windows);
+  g_hash_table_destroy (screen->strut_windows);
+  g_queue_free (screen->mru_windows);
+
   meta_error_trap_push (screen->display);
   XSelectInput (screen->display->xdisplay, screen->xroot, 0);
   if (meta_error_trap_pop_with_return (screen->display, FALSE) != Success)
@@ -709,6 +723,7 @@ meta_screen_free (MetaScreen *screen,
 
   if (screen->work_area_idle != 0)
     g_source_remove (screen->work_area_idle);
+  g_hash_table_destroy (screen->work_area_hints);
 
   if (XGetGCValues (screen->display->xdisplay,
                     screen->root_xor_gc,
@@ -742,31 +757,91 @@ typedef struct
 {
   Window		xwindow;
   XWindowAttributes	attrs;
+  gulong                wm_state;
 } WindowInfo;
 
 static GList *
-list_windows (MetaScreen *screen)
+list_windows (MetaScreen *screen,
+              gboolean    get_wm_state)
 {
+  MetaDisplay *display;
   Window ignored1, ignored2;
   Window *children;
   guint n_children, i;
+  AgGetAttributesTask **attr_tasks;
+  AgGetPropertyTask **state_tasks;
   GList *result;
 
-  XQueryTree (screen->display->xdisplay,
+  display = screen->display;
+
+  XQueryTree (display->xdisplay,
               screen->xroot,
               &ignored1, &ignored2, &children, &n_children);
 
+  /* Send the attribute (and WM_STATE) requests for every child
+   * up front, then collect all the replies after a single sync,
+   * instead of a round trip per window.
+   */
+  attr_tasks = g_new0 (AgGetAttributesTask*, n_children);
+  state_tasks = g_new0 (AgGetPropertyTask*, n_children);
+
+  for (i = 0; i < n_children; ++i)
+    {
+      attr_tasks[i] = ag_attributes_task_create (display->xdisplay,
+                                                 children[i]);
+
+      if (get_wm_state)
+        state_tasks[i] = ag_task_create (display->xdisplay, children[i],
+                                         display->atom_WM_STATE,
+                                         0, 1, False,
+                                         display->atom_WM_STATE);
+    }
+
+  meta_topic (META_DEBUG_SYNC, "Syncing to get attributes of %u windows in %s\n",
+              n_children, G_STRFUNC);
+  XSync (display->xdisplay, False);
+
   result = NULL;
   for (i = 0; i < n_children; ++i)
     {
       WindowInfo *info = g_new0 (WindowInfo, 1);
+      Status status;
 
-      meta_error_trap_push (screen->display);
+      info->wm_state = WithdrawnState;
 
-      XGetWindowAttributes (screen->display->xdisplay,
-                            children[i], &info->attrs);
+      if (state_tasks[i] != NULL)
+        {
+          Atom type;
+          int format;
+          gulong n_items, bytes_after;
+          guchar *data;
+
+          if (ag_task_get_reply_and_free (state_tasks[i], &type, &format,
+                                          &n_items, &bytes_after,
+                                          &data) == Success &&
+              type == display->atom_WM_STATE &&
+              format == 32 && n_items > 0)
+            info->wm_state = ((gulong*) data)[0];
+
+          if (data)
+            XFree (data);
+        }
+
+      if (attr_tasks[i] != NULL)
+        {
+          status = ag_attributes_task_get_reply_and_free (attr_tasks[i],
+                                                          &info->attrs);
+        }
+      else
+        {
+          /* Couldn't queue the request, do it the slow way */
+          meta_error_trap_push (display);
+          XGetWindowAttributes (display->xdisplay,
+                                children[i], &info->attrs);
+          status = meta_error_trap_pop_with_return (display, TRUE);
+        }
 
-      if (meta_error_trap_pop_with_return (screen->display, TRUE))
+      if (status != Success)
 	{
           meta_verbose ("Failed to get attributes for window 0x%lx\n",
                         children[i]);
@@ -779,6 +854,9 @@ list_windows (MetaScreen *screen)
 	}
     }
 
+  g_free (attr_tasks);
+  g_free (state_tasks);
+
   if (children)
     XFree (children);
 
@@ -790,10 +868,15 @@ meta_screen_manage_all_windows (MetaScreen *screen)
 {
   GList *windows;
   GList *list;
+  gint64 start;
+  int n_managed;
+
+  start = g_get_monotonic_time ();
+  n_managed = 0;
 
   meta_display_grab (screen->display);
 
-  windows = list_windows (screen);
+  windows = list_windows (screen, TRUE);
 
   meta_stack_freeze (screen->stack);
   for (list = windows; list != NULL; list = list->next)
@@ -802,8 +885,18 @@ meta_screen_manage_all_windows (MetaScreen *screen)
       MetaWindow *window;
       gboolean test_window_owner;
 
-      window = meta_window_new_with_attrs (screen->display, info->xwindow, TRUE,
-                                           &info->attrs);
+      /* Unmapped windows without a WM_STATE were never managed by
+       * the previous window manager; don't bother grabbing the
+       * server and fetching their properties just to find that out.
+       */
+      if (info->attrs.map_state != IsViewable &&
+          info->wm_state != NormalState &&
+          info->wm_state != IconicState)
+        window = NULL;
+      else
+        window = meta_window_new_with_attrs (screen->display, info->xwindow, TRUE,
+                                             &info->attrs);
+
       test_window_owner = info->xwindow == screen->no_focus_window ||
        info->xwindow == screen->flash_window ||
        info->xwindow == screen->wm_sn_selection_window;
@@ -817,12 +910,19 @@ meta_screen_manage_all_windows (MetaScreen *screen)
         continue;
       }
 
+      if (window != NULL)
+        ++n_managed;
+
       if (screen->display->compositor)
         meta_compositor_add_window (screen->display->compositor, window,
                                     info->xwindow, &info->attrs);
     }
   meta_stack_thaw (screen->stack);
 
+  meta_verbose ("Took over %d of %u windows on screen %d in %g ms\n",
+                n_managed, g_list_length (windows), screen->number,
+                (g_get_monotonic_time () - start) / 1000.0);
+
   g_list_free_full (windows, g_free);
 
   meta_display_ungrab (screen->display);
@@ -839,7 +939,7 @@ meta_screen_composite_all_windows (MetaScreen *screen)
   if (!display->compositor)
     return;
 
-  windows = list_windows (screen);
+  windows = list_windows (screen, FALSE);
 
   meta_stack_freeze (screen->stack);
 
@@ -991,64 +1091,103 @@ get_screen_name (MetaDisplay *display,
   return scr;
 }
 
-static gint
-ptrcmp (gconstpointer a, gconstpointer b)
+void
+meta_screen_foreach_window (MetaScreen *screen,
+                            MetaScreenWindowFunc func,
+                            gpointer data)
 {
-  if (a < b)
-    return -1;
-  else if (a > b)
-    return 1;
-  else
-    return 0;
-}
+  GSList *winlist;
+  GSList *tmp;
 
-static void
-listify_func (gpointer key, gpointer value, gpointer data)
-{
-  GSList **listp;
+  /* Work with a copy, the function may unmanage windows */
+  winlist = meta_display_list_windows (screen->display);
+
+  for (tmp = winlist; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWindow *window = tmp->data;
 
-  listp = data;
+      if (window->screen == screen)
+        (* func) (screen, window, data);
+    }
 
-  *listp = g_slist_prepend (*listp, value);
+  g_slist_free (winlist);
 }
 
 void
-meta_screen_foreach_window (MetaScreen *screen,
-                            MetaScreenWindowFunc func,
-                            gpointer data)
+meta_screen_update_sticky_window (MetaScreen *screen,
+                                  MetaWindow *window)
 {
-  GSList *winlist;
-  GSList *tmp;
+  if (window->on_all_workspaces && !window->unmanaging)
+    g_hash_table_add (screen->sticky_windows, window);
+  else
+    g_hash_table_remove (screen->sticky_windows, window);
+}
 
-  /* If we end up doing this often, just keeping a list
-   * of windows might be sensible.
-   */
+void
+meta_screen_update_strut_window (MetaScreen *screen,
+                                 MetaWindow *window)
+{
+  if (window->struts)
+    g_hash_table_add (screen->strut_windows, window);
+  else
+    g_hash_table_remove (screen->strut_windows, window);
+}
 
-  winlist = NULL;
-  g_hash_table_foreach (screen->display->window_ids,
-                        listify_func,
-                        &winlist);
+/* Moves a window to its place in the MRU list, which is ordered by
+ * user time, most recent first.  A new user time is usually the most
+ * recent one, so this is typically a move to the front.
+ */
+void
+meta_screen_update_mru_window (MetaScreen *screen,
+                               MetaWindow *window)
+{
+  guint32 user_time;
+  GList *sibling;
 
-  winlist = g_slist_sort (winlist, ptrcmp);
+  user_time = meta_window_get_user_time (window);
 
-  tmp = winlist;
-  while (tmp != NULL)
+  if (window->mru_link != NULL)
     {
-      /* If the next node doesn't contain this window
-       * a second time, delete the window.
-       */
-      if (tmp->next == NULL ||
-          (tmp->next && tmp->next->data != tmp->data))
-        {
-          MetaWindow *window = tmp->data;
+      GList *prev = window->mru_link->prev;
+      GList *next = window->mru_link->next;
 
-          if (window->screen == screen)
-            (* func) (screen, window, data);
-        }
+      /* Still in order? */
+      if ((prev == NULL ||
+           meta_window_get_user_time (prev->data) >= user_time) &&
+          (next == NULL ||
+           meta_window_get_user_time (next->data) <= user_time))
+        return;
 
-      tmp = tmp->next;
+      g_queue_delete_link (screen->mru_windows, window->mru_link);
+      window->mru_link = NULL;
     }
-  g_slist_free (winlist);
+
+  sibling = screen->mru_windows->head;
+  while (sibling != NULL &&
+         meta_window_get_user_time (sibling->data) > user_time)
+    sibling = sibling->next;
+
+  if (sibling != NULL)
+    {
+      g_queue_insert_before (screen->mru_windows, sibling, window);
+      window->mru_link = sibling->prev;
+    }
+  else
+    {
+      g_queue_push_tail (screen->mru_windows, window);
+      window->mru_link = screen->mru_windows->tail;
+    }
+}
+
+void
+meta_screen_remove_mru_window (MetaScreen *screen,
+                               MetaWindow *window)
+{
+  if (window->mru_link == NULL)
+    return;
+
+  g_queue_delete_link (screen->mru_windows, window->mru_link);
+  window->mru_link = NULL;
 }
 
 static void
@@ -2350,6 +2489,44 @@ meta_create_offscreen_window (Display *xdisplay,
                         &attrs);
 }
 
+/* Sets a work area property on the root window, unless it already has
+ * this value.  Takes ownership of data.  Pass None as the atom to have
+ * it looked up from the name, which only happens when the value changed.
+ * last_request_was_roundtrip is passed on to meta_error_trap_pop().
+ */
+static void
+set_work_area_property (MetaScreen    *screen,
+                        const char    *name,
+                        Atom           atom,
+                        unsigned long *data,
+                        int            n_values,
+                        gboolean       last_request_was_roundtrip)
+{
+  GBytes *value, *last_value;
+
+  value = g_bytes_new_take (data, n_values * sizeof (unsigned long));
+
+  last_value = g_hash_table_lookup (screen->work_area_hints, name);
+  if (last_value != NULL && g_bytes_equal (value, last_value))
+    {
+      meta_topic (META_DEBUG_WORKAREA,
+                  "%s is unchanged, not setting it\n", name);
+      g_bytes_unref (value);
+      return;
+    }
+
+  if (atom == None)
+    atom = XInternAtom (screen->display->xdisplay, name, False);
+
+  meta_error_trap_push (screen->display);
+  XChangeProperty (screen->display->xdisplay, screen->xroot, atom,
+                   XA_CARDINAL, 32, PropModeReplace,
+                   (guchar*) data, n_values);
+  meta_error_trap_pop (screen->display, last_request_was_roundtrip);
+
+  g_hash_table_replace (screen->work_area_hints, g_strdup (name), value);
+}
+
 static void
 set_workspace_work_area_hint (MetaWorkspace *workspace,
                               MetaScreen    *screen)
@@ -2358,7 +2535,6 @@ set_workspace_work_area_hint (MetaWorkspace *workspace,
   unsigned long *tmp;
   int i;
   gchar *workarea_name;
-  Atom workarea_atom;
 
   data = g_new (unsigned long, screen->n_xinerama_infos * 4);
   tmp = data;
@@ -2380,16 +2556,10 @@ set_workspace_work_area_hint (MetaWorkspace *workspace,
   workarea_name = g_strdup_printf ("_GTK_WORKAREAS_D%d",
                                    meta_workspace_index (workspace));
 
-  workarea_atom = XInternAtom (screen->display->xdisplay, workarea_name, False);
-  g_free (workarea_name);
+  set_work_area_property (screen, workarea_name, None,
+                          data, screen->n_xinerama_infos * 4, TRUE);
 
-  meta_error_trap_push (screen->display);
-  XChangeProperty (screen->display->xdisplay, screen->xroot, workarea_atom,
-                   XA_CARDINAL, 32, PropModeReplace,
-                   (guchar*) data, screen->n_xinerama_infos * 4);
-  meta_error_trap_pop (screen->display, TRUE);
-
-  g_free (data);
+  g_free (workarea_name);
 }
 
 static void
@@ -2424,13 +2594,9 @@ set_work_area_hint (MetaScreen *screen)
       tmp_list = tmp_list->next;
     }
 
-  meta_error_trap_push (screen->display);
-  XChangeProperty (screen->display->xdisplay, screen->xroot,
-		   screen->display->atom__NET_WORKAREA,
-		   XA_CARDINAL, 32, PropModeReplace,
-		   (guchar*) data, num_workspaces*4);
-  g_free (data);
-  meta_error_trap_pop (screen->display, FALSE);
+  set_work_area_property (screen, "_NET_WORKAREA",
+                          screen->display->atom__NET_WORKAREA,
+                          data, num_workspaces*4, FALSE);
 }
 
 static gboolean
@@ -2780,6 +2946,8 @@ meta_screen_resize (MetaScreen *screen,
 
   /* Queue a resize on all the windows */
   meta_screen_foreach_window (screen, meta_screen_resize_func, 0);
+
+  meta_screen_queue_edge_index_rebuild (screen);
 }
 
 void
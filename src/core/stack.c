@@ -37,6 +37,8 @@
 
 #include <X11/Xatom.h>
 
+#include <string.h>
+
 #define WINDOW_HAS_TRANSIENT_TYPE(w)                    \
           (w->type == META_WINDOW_DIALOG ||             \
 	   w->type == META_WINDOW_MODAL_DIALOG ||       \
@@ -62,6 +64,15 @@ static void stack_do_resort           (MetaStack *stack);
 
 static void stack_ensure_sorted (MetaStack *stack);
 
+static void invalidate_constraints    (MetaStack  *stack,
+                                       MetaWindow *window);
+static void invalidate_transients     (MetaStack  *stack,
+                                       GList      *windows,
+                                       MetaWindow *parent);
+static void remove_window_constraints (MetaStack  *stack,
+                                       MetaWindow *window);
+static void free_constraints          (MetaStack  *stack);
+
 MetaStack*
 meta_stack_new (MetaScreen *screen)
 {
@@ -78,6 +89,9 @@ meta_stack_new (MetaScreen *screen)
 
   stack->freeze_count = 0;
   stack->last_root_children_stacked = NULL;
+  stack->last_client_list = NULL;
+  stack->last_client_list_stacking = NULL;
+  stack->n_restack_requests = 0;
 
   stack->n_positions = 0;
 
@@ -85,6 +99,10 @@ meta_stack_new (MetaScreen *screen)
   stack->need_relayer = FALSE;
   stack->need_constrain = FALSE;
 
+  stack->constraints = g_hash_table_new (NULL, NULL);
+  stack->constraint_parents = g_hash_table_new (NULL, NULL);
+  stack->constraints_dirty = g_hash_table_new (NULL, NULL);
+
   return stack;
 }
 
@@ -99,6 +117,12 @@ meta_stack_free (MetaStack *stack)
 
   if (stack->last_root_children_stacked)
     g_array_free (stack->last_root_children_stacked, TRUE);
+  if (stack->last_client_list)
+    g_array_free (stack->last_client_list, TRUE);
+  if (stack->last_client_list_stacking)
+    g_array_free (stack->last_client_list_stacking, TRUE);
+
+  free_constraints (stack);
 
   g_free (stack);
 }
@@ -120,6 +144,13 @@ meta_stack_add (MetaStack  *stack,
               "Window %s has stack_position initialized to %d\n",
               window->desc, window->stack_position);
 
+  /* Transients that came into the stack before their parent can
+   * now be constrained above it
+   */
+  invalidate_constraints (stack, window);
+  invalidate_transients (stack, stack->sorted, window);
+  invalidate_transients (stack, stack->added, window);
+
   stack_sync_to_server (stack);
 }
 
@@ -141,6 +172,8 @@ meta_stack_remove (MetaStack  *stack,
   window->stack_position = -1;
   stack->n_positions -= 1;
 
+  remove_window_constraints (stack, window);
+
   /* We don't know if it's been moved from "added" to "stack" yet */
   stack->added = g_list_remove (stack->added, window);
   stack->sorted = g_list_remove (stack->sorted, window);
@@ -164,6 +197,9 @@ meta_stack_update_layer (MetaStack  *stack,
 {
   stack->need_relayer = TRUE;
 
+  /* The window type may have changed along with the layer */
+  invalidate_constraints (stack, window);
+
   stack_sync_to_server (stack);
 }
 
@@ -173,6 +209,8 @@ meta_stack_update_transient (MetaStack  *stack,
 {
   stack->need_constrain = TRUE;
 
+  invalidate_constraints (stack, window);
+
   stack_sync_to_server (stack);
 }
 
@@ -464,213 +502,296 @@ struct Constraint
    */
   Constraint *next;
 
-  /* used to create the graph. */
-  GSList *next_nodes;
-
   /* constraint has been applied, used
    * to detect cycles.
    */
   unsigned int applied : 1;
 
-  /* constraint has a previous node in the graph,
-   * used to find places to start in the graph.
-   * (I think this also has the side effect
-   * of preventing cycles, since cycles will
-   * have no starting point - so maybe
-   * the "applied" flag isn't needed.)
+  /* constraint was not found again while its
+   * window's constraints were being updated
    */
-  unsigned int has_prev : 1;
+  unsigned int stale : 1;
 };
 
-/* We index the array of constraints by window
- * stack positions, just because the stack
- * positions are a convenient index.
+/* The graph is kept in the stack between restacks rather than
+ * rebuilt each time: stack->constraints maps each window to the
+ * list of constraints with it below, and stack->constraint_parents
+ * maps each window to the constraints with it above.
+ *
+ * The next nodes of AB are then simply the constraints in the list
+ * for B, and AB has a previous node if A is above anything.
  */
-static void
-add_constraint (Constraint **constraints,
-                MetaWindow  *above,
-                MetaWindow  *below)
+static gboolean
+add_constraint (MetaStack  *stack,
+                MetaWindow *above,
+                MetaWindow *below)
 {
+  Constraint *head;
   Constraint *c;
+  GSList *parents;
 
   g_assert (above->screen == below->screen);
 
   /* check if constraint is a duplicate */
-  c = constraints[below->stack_position];
-  while (c != NULL)
+  head = g_hash_table_lookup (stack->constraints, below);
+  for (c = head; c != NULL; c = c->next)
     {
       if (c->above == above)
-        return;
-      c = c->next;
+        {
+          c->stale = FALSE;
+          return FALSE;
+        }
     }
 
   /* if not, add the constraint */
   c = g_new (Constraint, 1);
   c->above = above;
   c->below = below;
-  c->next = constraints[below->stack_position];
-  c->next_nodes = NULL;
+  c->next = head;
   c->applied = FALSE;
-  c->has_prev = FALSE;
+  c->stale = FALSE;
+
+  g_hash_table_insert (stack->constraints, below, c);
 
-  constraints[below->stack_position] = c;
+  parents = g_hash_table_lookup (stack->constraint_parents, above);
+  g_hash_table_insert (stack->constraint_parents, above,
+                       g_slist_prepend (parents, c));
+
+  return TRUE;
 }
 
 static void
-create_constraints (Constraint **constraints,
-                    GList       *windows)
+remove_constraint (MetaStack  *stack,
+                   Constraint *c)
 {
-  GList *tmp;
+  Constraint *head;
+  Constraint **link;
+  GSList *parents;
+
+  head = g_hash_table_lookup (stack->constraints, c->below);
+  link = &head;
+  while (*link != c)
+    link = &(*link)->next;
+  *link = c->next;
+
+  if (head != NULL)
+    g_hash_table_insert (stack->constraints, c->below, head);
+  else
+    g_hash_table_remove (stack->constraints, c->below);
 
-  tmp = windows;
-  while (tmp != NULL)
-    {
-      MetaWindow *w = tmp->data;
+  parents = g_hash_table_lookup (stack->constraint_parents, c->above);
+  parents = g_slist_remove (parents, c);
 
-      if (!WINDOW_IN_STACK (w))
-        {
-          meta_topic (META_DEBUG_STACK, "Window %s not in the stack, not constraining it\n",
-                      w->desc);
-          tmp = tmp->next;
-          continue;
-        }
+  if (parents != NULL)
+    g_hash_table_insert (stack->constraint_parents, c->above, parents);
+  else
+    g_hash_table_remove (stack->constraint_parents, c->above);
 
-      if (WINDOW_TRANSIENT_FOR_WHOLE_GROUP (w))
-        {
-          GSList *group_windows;
-          GSList *tmp2;
-          MetaGroup *group;
+  g_free (c);
+}
 
-          group = meta_window_get_group (w);
+/* Drops every constraint involving window, for when it leaves the stack */
+static void
+remove_window_constraints (MetaStack  *stack,
+                           MetaWindow *window)
+{
+  GSList *parents;
+  Constraint *c;
 
-          if (group != NULL)
-            group_windows = meta_group_list_windows (group);
-          else
-            group_windows = NULL;
+  while ((parents = g_hash_table_lookup (stack->constraint_parents, window)))
+    remove_constraint (stack, parents->data);
 
-          tmp2 = group_windows;
+  while ((c = g_hash_table_lookup (stack->constraints, window)))
+    remove_constraint (stack, c);
 
-          while (tmp2 != NULL)
-            {
-              MetaWindow *group_window = tmp2->data;
+  g_hash_table_remove (stack->constraints_dirty, window);
+}
 
-              if (!WINDOW_IN_STACK (group_window) ||
-                  w->screen != group_window->screen)
-                {
-                  tmp2 = tmp2->next;
-                  continue;
-                }
+/* Recomputes the constraints with window above, returning whether
+ * they changed
+ */
+static gboolean
+update_window_constraints (MetaStack  *stack,
+                           MetaWindow *w)
+{
+  GSList *parents;
+  GSList *tmp;
+  gboolean changed;
+
+  changed = FALSE;
+
+  parents = g_hash_table_lookup (stack->constraint_parents, w);
+  for (tmp = parents; tmp != NULL; tmp = tmp->next)
+    ((Constraint *) tmp->data)->stale = TRUE;
+
+  if (!WINDOW_IN_STACK (w))
+    {
+      meta_topic (META_DEBUG_STACK, "Window %s not in the stack, not constraining it\n",
+                  w->desc);
+    }
+  else if (WINDOW_TRANSIENT_FOR_WHOLE_GROUP (w))
+    {
+      GSList *group_windows;
+      GSList *tmp2;
+      MetaGroup *group;
+
+      group = meta_window_get_group (w);
+
+      if (group != NULL)
+        group_windows = meta_group_list_windows (group);
+      else
+        group_windows = NULL;
+
+      tmp2 = group_windows;
+
+      while (tmp2 != NULL)
+        {
+          MetaWindow *group_window = tmp2->data;
+
+          if (!WINDOW_IN_STACK (group_window) ||
+              w->screen != group_window->screen)
+            {
+              tmp2 = tmp2->next;
+              continue;
+            }
 
 #if 0
-              /* old way of doing it */
-              if (!(meta_window_is_ancestor_of_transient (w, group_window)) &&
-                  !WINDOW_TRANSIENT_FOR_WHOLE_GROUP (group_window))  /* note */;/*note*/
+          /* old way of doing it */
+          if (!(meta_window_is_ancestor_of_transient (w, group_window)) &&
+              !WINDOW_TRANSIENT_FOR_WHOLE_GROUP (group_window))  /* note */;/*note*/
 #else
-              /* better way I think, so transient-for-group are constrained
-               * only above non-transient-type windows in their group
-               */
-              if (!WINDOW_HAS_TRANSIENT_TYPE (group_window))
+          /* better way I think, so transient-for-group are constrained
+           * only above non-transient-type windows in their group
+           */
+          if (!WINDOW_HAS_TRANSIENT_TYPE (group_window))
 #endif
-                {
-                  meta_topic (META_DEBUG_STACK, "Constraining %s above %s as it's transient for its group\n",
-                              w->desc, group_window->desc);
-                  add_constraint (constraints, w, group_window);
-                }
-
-              tmp2 = tmp2->next;
+            {
+              meta_topic (META_DEBUG_STACK, "Constraining %s above %s as it's transient for its group\n",
+                          w->desc, group_window->desc);
+              changed |= add_constraint (stack, w, group_window);
             }
 
-          g_slist_free (group_windows);
+          tmp2 = tmp2->next;
         }
-      else if (w->xtransient_for != None &&
-               !w->transient_parent_is_root_window)
-        {
-          MetaWindow *parent;
 
-          parent =
-            meta_display_lookup_x_window (w->display, w->xtransient_for);
+      g_slist_free (group_windows);
+    }
+  else if (w->xtransient_for != None &&
+           !w->transient_parent_is_root_window)
+    {
+      MetaWindow *parent;
 
-          if (parent && WINDOW_IN_STACK (parent) &&
-              parent->screen == w->screen)
-            {
-              meta_topic (META_DEBUG_STACK, "Constraining %s above %s due to transiency\n",
-                          w->desc, parent->desc);
-              add_constraint (constraints, w, parent);
-            }
+      parent =
+        meta_display_lookup_x_window (w->display, w->xtransient_for);
+
+      if (parent && WINDOW_IN_STACK (parent) &&
+          parent->screen == w->screen)
+        {
+          meta_topic (META_DEBUG_STACK, "Constraining %s above %s due to transiency\n",
+                      w->desc, parent->desc);
+          changed |= add_constraint (stack, w, parent);
         }
+    }
+
+  /* Anything not found again no longer applies */
+  tmp = g_hash_table_lookup (stack->constraint_parents, w);
+  while (tmp != NULL)
+    {
+      Constraint *c = tmp->data;
 
       tmp = tmp->next;
+
+      if (c->stale)
+        {
+          remove_constraint (stack, c);
+          changed = TRUE;
+        }
     }
+
+  return changed;
 }
 
+/* Queues the constraints that depend on window for updating on
+ * the next restack: its own, and those of any windows in its group
+ * that are transient for the whole group.
+ */
 static void
-graph_constraints (Constraint **constraints,
-                   int          n_constraints)
+invalidate_constraints (MetaStack  *stack,
+                        MetaWindow *window)
 {
-  int i;
+  MetaGroup *group;
 
-  i = 0;
-  while (i < n_constraints)
+  if (!WINDOW_IN_STACK (window))
+    return;
+
+  g_hash_table_add (stack->constraints_dirty, window);
+
+  group = meta_window_get_group (window);
+  if (group != NULL)
     {
-      Constraint *c;
+      GSList *group_windows;
+      GSList *tmp;
 
-      /* If we have "A below B" and "B below C" then AB -> BC so we
-       * add BC to next_nodes in AB.
-       */
+      group_windows = meta_group_list_windows (group);
 
-      c = constraints[i];
-      while (c != NULL)
+      for (tmp = group_windows; tmp != NULL; tmp = tmp->next)
         {
-          Constraint *n;
+          MetaWindow *group_window = tmp->data;
 
-          g_assert (c->below->stack_position == i);
+          if (WINDOW_IN_STACK (group_window) &&
+              group_window->screen == window->screen &&
+              WINDOW_TRANSIENT_FOR_WHOLE_GROUP (group_window))
+            g_hash_table_add (stack->constraints_dirty, group_window);
+        }
 
-          /* Constraints where ->above is below are our
-           * next_nodes and we are their previous
-           */
-          n = constraints[c->above->stack_position];
-          while (n != NULL)
-            {
-              c->next_nodes = g_slist_prepend (c->next_nodes,
-                                               n);
-              /* c is a previous node of n */
-              n->has_prev = TRUE;
+      g_slist_free (group_windows);
+    }
+}
 
-              n = n->next;
-            }
+static void
+invalidate_transients (MetaStack  *stack,
+                       GList      *windows,
+                       MetaWindow *parent)
+{
+  GList *tmp;
 
-          c = c->next;
-        }
+  for (tmp = windows; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWindow *w = tmp->data;
 
-      ++i;
+      if (w != parent && w->xtransient_for == parent->xwindow)
+        g_hash_table_add (stack->constraints_dirty, w);
     }
 }
 
 static void
-free_constraints (Constraint **constraints,
-                  int          n_constraints)
+free_constraints (MetaStack *stack)
 {
-  int i;
+  GHashTableIter iter;
+  gpointer value;
 
-  i = 0;
-  while (i < n_constraints)
+  g_hash_table_iter_init (&iter, stack->constraints);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
     {
-      Constraint *c;
+      Constraint *c = value;
 
-      c = constraints[i];
       while (c != NULL)
         {
           Constraint *next = c->next;
 
-          g_slist_free (c->next_nodes);
-
           g_free (c);
 
           c = next;
         }
-
-      ++i;
     }
+
+  g_hash_table_iter_init (&iter, stack->constraint_parents);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    g_slist_free (value);
+
+  g_hash_table_destroy (stack->constraints);
+  g_hash_table_destroy (stack->constraint_parents);
+  g_hash_table_destroy (stack->constraints_dirty);
 }
 
 static void
@@ -684,6 +805,7 @@ ensure_above (MetaWindow *above,
 		  "Promoting window %s from layer %u to %u due to contraint\n",
 		  above->desc, above->layer, below->layer);
       above->layer = below->layer;
+      above->screen->stack->need_resort = TRUE;
     }
 
   if (above->stack_position < below->stack_position)
@@ -698,9 +820,10 @@ ensure_above (MetaWindow *above,
 }
 
 static void
-traverse_constraint (Constraint *c)
+traverse_constraint (MetaStack  *stack,
+                     Constraint *c)
 {
-  GSList *tmp;
+  Constraint *n;
 
   if (c->applied)
     return;
@@ -708,49 +831,62 @@ traverse_constraint (Constraint *c)
   ensure_above (c->above, c->below);
   c->applied = TRUE;
 
-  tmp = c->next_nodes;
-  while (tmp != NULL)
+  /* Constraints where ->above is below are our next nodes */
+  n = g_hash_table_lookup (stack->constraints, c->above);
+  while (n != NULL)
     {
-      traverse_constraint (tmp->data);
+      traverse_constraint (stack, n);
 
-      tmp = tmp->next;
+      n = n->next;
     }
 }
 
+static int
+compare_constraint_position (gconstpointer a,
+                             gconstpointer b)
+{
+  const Constraint *constraint_a = a;
+  const Constraint *constraint_b = b;
+
+  /* Topmost first */
+  return constraint_b->below->stack_position -
+    constraint_a->below->stack_position;
+}
+
 static void
-apply_constraints (Constraint **constraints,
-                   int          n_constraints)
+apply_constraints (MetaStack *stack)
 {
+  GHashTableIter iter;
+  gpointer value;
   GSList *heads;
   GSList *tmp;
-  int i;
 
   /* List all heads in an ordered constraint chain */
   heads = NULL;
-  i = 0;
-  while (i < n_constraints)
+  g_hash_table_iter_init (&iter, stack->constraints);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
     {
       Constraint *c;
 
-      c = constraints[i];
-      while (c != NULL)
+      for (c = value; c != NULL; c = c->next)
         {
-          if (!c->has_prev)
-            heads = g_slist_prepend (heads, c);
+          c->applied = FALSE;
 
-          c = c->next;
+          if (!g_hash_table_contains (stack->constraint_parents, c->below))
+            heads = g_slist_prepend (heads, c);
         }
-
-      ++i;
     }
 
+  /* Hash table order is arbitrary, so keep to stacking order */
+  heads = g_slist_sort (heads, compare_constraint_position);
+
   /* Now traverse the chain and apply constraints */
   tmp = heads;
   while (tmp != NULL)
     {
       Constraint *c = tmp->data;
 
-      traverse_constraint (c);
+      traverse_constraint (stack, c);
 
       tmp = tmp->next;
     }
@@ -806,6 +942,31 @@ stack_do_window_deletions (MetaStack *stack)
   stack->removed = NULL;
 }
 
+static void
+stack_relayer_window (MetaStack  *stack,
+                      MetaWindow *w)
+{
+  MetaStackLayer old_layer;
+
+  old_layer = w->layer;
+
+  compute_layer (w);
+
+  if (w->layer != old_layer)
+    {
+      meta_topic (META_DEBUG_STACK,
+                  "Window %s moved from layer %u to %u\n",
+                  w->desc, old_layer, w->layer);
+
+      stack->need_resort = TRUE;
+      stack->need_constrain = TRUE;
+      /* don't need to constrain as constraining
+       * purely operates in terms of stack_position
+       * not layer
+       */
+    }
+}
+
 static void
 stack_do_window_additions (MetaStack *stack)
 {
@@ -851,7 +1012,46 @@ stack_do_window_additions (MetaStack *stack)
 
       stack->need_resort = TRUE; /* may not be needed as we add to top */
       stack->need_constrain = TRUE;
-      stack->need_relayer = TRUE;
+
+      /* Only the new windows, and dialogs transient for their
+       * groups, can have changed layer; anything else that moves
+       * layers goes through meta_stack_update_layer()
+       */
+      if (!stack->need_relayer)
+        {
+          tmp = stack->added;
+          while (tmp != NULL)
+            {
+              MetaWindow *w = tmp->data;
+              MetaGroup *group;
+
+              stack_relayer_window (stack, w);
+
+              group = meta_window_get_group (w);
+              if (group != NULL)
+                {
+                  GSList *group_windows;
+                  GSList *tmp2;
+
+                  group_windows = meta_group_list_windows (group);
+
+                  for (tmp2 = group_windows; tmp2 != NULL; tmp2 = tmp2->next)
+                    {
+                      MetaWindow *group_window = tmp2->data;
+
+                      if (group_window != w &&
+                          WINDOW_IN_STACK (group_window) &&
+                          group_window->screen == w->screen &&
+                          WINDOW_TRANSIENT_FOR_WHOLE_GROUP (group_window))
+                        stack_relayer_window (stack, group_window);
+                    }
+
+                  g_slist_free (group_windows);
+                }
+
+              tmp = tmp->next;
+            }
+        }
     }
 
   g_list_free (stack->added);
@@ -876,27 +1076,7 @@ stack_do_relayer (MetaStack *stack)
 
   while (tmp != NULL)
     {
-      MetaWindow *w;
-      MetaStackLayer old_layer;
-
-      w = tmp->data;
-      old_layer = w->layer;
-
-      compute_layer (w);
-
-      if (w->layer != old_layer)
-        {
-          meta_topic (META_DEBUG_STACK,
-                      "Window %s moved from layer %u to %u\n",
-                      w->desc, old_layer, w->layer);
-
-          stack->need_resort = TRUE;
-          stack->need_constrain = TRUE;
-          /* don't need to constrain as constraining
-           * purely operates in terms of stack_position
-           * not layer
-           */
-        }
+      stack_relayer_window (stack, tmp->data);
 
       tmp = tmp->next;
     }
@@ -911,9 +1091,24 @@ stack_do_relayer (MetaStack *stack)
 static void
 stack_do_constrain (MetaStack *stack)
 {
-  Constraint **constraints;
+  if (g_hash_table_size (stack->constraints_dirty) > 0)
+    {
+      GHashTableIter iter;
+      gpointer key;
+
+      meta_topic (META_DEBUG_STACK,
+                  "Updating constraints of %u windows\n",
+                  g_hash_table_size (stack->constraints_dirty));
 
-  /* It'd be nice if this were all faster, probably */
+      g_hash_table_iter_init (&iter, stack->constraints_dirty);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        {
+          if (update_window_constraints (stack, key))
+            stack->need_constrain = TRUE;
+        }
+
+      g_hash_table_remove_all (stack->constraints_dirty);
+    }
 
   if (!stack->need_constrain)
     return;
@@ -921,17 +1116,7 @@ stack_do_constrain (MetaStack *stack)
   meta_topic (META_DEBUG_STACK,
               "Reapplying constraints\n");
 
-  constraints = g_new0 (Constraint*,
-                        stack->n_positions);
-
-  create_constraints (constraints, stack->sorted);
-
-  graph_constraints (constraints, stack->n_positions);
-
-  apply_constraints (constraints, stack->n_positions);
-
-  free_constraints (constraints, stack->n_positions);
-  g_free (constraints);
+  apply_constraints (stack);
 
   stack->need_constrain = FALSE;
 }
@@ -1073,12 +1258,119 @@ raise_window_relative_to_managed_windows (MetaScreen *screen,
     XFree (children);
 }
 
+/**
+ * Finds the windows of new_stack that can stay where they are when going
+ * from old_stack to new_stack: the longest run of windows whose relative
+ * order is the same in both, found as the longest increasing subsequence
+ * of their old positions.  Every other window needs exactly one move.
+ */
+static void
+find_stable_windows (const Window *old_stack,
+                     int           old_len,
+                     const Window *new_stack,
+                     int           new_len,
+                     gboolean     *stable)
+{
+  GHashTable *old_positions;
+  int *positions;
+  int *tails;
+  int *prev;
+  int n_tails;
+  int i;
+
+  old_positions = g_hash_table_new (NULL, NULL);
+  for (i = 0; i < old_len; i++)
+    g_hash_table_insert (old_positions, GUINT_TO_POINTER (old_stack[i]),
+                         GINT_TO_POINTER (i + 1));
+
+  positions = g_new (int, new_len);
+  tails = g_new (int, new_len);
+  prev = g_new (int, new_len);
+
+  for (i = 0; i < new_len; i++)
+    {
+      positions[i] = GPOINTER_TO_INT (g_hash_table_lookup (old_positions,
+                                                           GUINT_TO_POINTER (new_stack[i]))) - 1;
+      stable[i] = FALSE;
+    }
+
+  g_hash_table_destroy (old_positions);
+
+  /* tails[k] is the index of the smallest last element of an
+   * increasing subsequence of length k + 1 found so far
+   */
+  n_tails = 0;
+  for (i = 0; i < new_len; i++)
+    {
+      int low, high;
+
+      /* New windows always need to be moved into place */
+      if (positions[i] < 0)
+        continue;
+
+      low = 0;
+      high = n_tails;
+      while (low < high)
+        {
+          int mid = (low + high) / 2;
+
+          if (positions[tails[mid]] < positions[i])
+            low = mid + 1;
+          else
+            high = mid;
+        }
+
+      prev[i] = low > 0 ? tails[low - 1] : -1;
+      tails[low] = i;
+
+      if (low == n_tails)
+        ++n_tails;
+    }
+
+  if (n_tails > 0)
+    {
+      for (i = tails[n_tails - 1]; i >= 0; i = prev[i])
+        stable[i] = TRUE;
+    }
+
+  g_free (positions);
+  g_free (tails);
+  g_free (prev);
+}
+
+static void
+set_window_list_property (MetaStack *stack,
+                          Atom       atom,
+                          GArray    *list,
+                          GArray   **last_list)
+{
+  if (*last_list != NULL &&
+      (*last_list)->len == list->len &&
+      memcmp ((*last_list)->data, list->data, list->len * sizeof (Window)) == 0)
+    return;
+
+  XChangeProperty (stack->screen->display->xdisplay,
+                   stack->screen->xroot,
+                   atom,
+                   XA_WINDOW,
+                   32, PropModeReplace,
+                   (unsigned char *)list->data,
+                   list->len);
+
+  if (*last_list == NULL)
+    *last_list = g_array_new (FALSE, FALSE, sizeof (Window));
+
+  g_array_set_size (*last_list, list->len);
+  if (list->len > 0)
+    memcpy ((*last_list)->data, list->data, list->len * sizeof (Window));
+}
+
 /**
  * Order the windows on the X server to be the same as in our structure.
  * We do this using XRestackWindows if we don't know the previous order,
- * or XConfigureWindow on a few particular windows if we do and can figure
- * out the minimum set of changes.  After that, we set __NET_CLIENT_LIST
- * and __NET_CLIENT_LIST_STACKING.
+ * or XConfigureWindow on the smallest set of windows that have to move if
+ * we do.  After that, we set __NET_CLIENT_LIST and
+ * __NET_CLIENT_LIST_STACKING if they changed.
  */
 static void
 stack_sync_to_server (MetaStack *stack)
@@ -1086,6 +1378,8 @@ stack_sync_to_server (MetaStack *stack)
   GArray *stacked;
   GArray *root_children_stacked;
   GList *tmp;
+  guint n_windows, i;
+  guint n_restack_requests;
 
   /* Bail out if frozen */
   if (stack->freeze_count > 0)
@@ -1100,12 +1394,16 @@ stack_sync_to_server (MetaStack *stack)
    * _NET hints, and "root_children_stacked" is in top-to-bottom
    * order for XRestackWindows()
    */
-  stacked = g_array_new (FALSE, FALSE, sizeof (Window));
-  root_children_stacked = g_array_new (FALSE, FALSE, sizeof (Window));
+  n_windows = g_list_length (stack->sorted);
+  stacked = g_array_sized_new (FALSE, FALSE, sizeof (Window), n_windows);
+  root_children_stacked = g_array_sized_new (FALSE, FALSE, sizeof (Window), n_windows);
+  g_array_set_size (stacked, n_windows);
+  g_array_set_size (root_children_stacked, n_windows);
 
   meta_topic (META_DEBUG_STACK, "Top to bottom: ");
   meta_push_no_msg_prefix ();
 
+  i = 0;
   tmp = stack->sorted;
   while (tmp != NULL)
     {
@@ -1114,16 +1412,17 @@ stack_sync_to_server (MetaStack *stack)
       w = tmp->data;
 
       /* remember, stacked is in reverse order (bottom to top) */
-      g_array_prepend_val (stacked, w->xwindow);
+      g_array_index (stacked, Window, n_windows - i - 1) = w->xwindow;
 
       /* build XRestackWindows() array from top to bottom */
       if (w->frame)
-        g_array_append_val (root_children_stacked, w->frame->xwindow);
+        g_array_index (root_children_stacked, Window, i) = w->frame->xwindow;
       else
-        g_array_append_val (root_children_stacked, w->xwindow);
+        g_array_index (root_children_stacked, Window, i) = w->xwindow;
 
       meta_topic (META_DEBUG_STACK, "%u:%d - %s ", w->layer, w->stack_position, w->desc);
 
+      ++i;
       tmp = tmp->next;
     }
 
@@ -1142,6 +1441,8 @@ stack_sync_to_server (MetaStack *stack)
 
   meta_error_trap_push (stack->screen->display);
 
+  n_restack_requests = stack->n_restack_requests;
+
   if (stack->last_root_children_stacked == NULL)
     {
       /* Just impose our stack, we don't know the previous state.
@@ -1150,13 +1451,16 @@ stack_sync_to_server (MetaStack *stack)
       meta_topic (META_DEBUG_STACK, "Don't know last stack state, restacking everything\n");
 
       if (root_children_stacked->len > 0)
-        XRestackWindows (stack->screen->display->xdisplay,
-                         (Window *) root_children_stacked->data,
-                         root_children_stacked->len);
+        {
+          XRestackWindows (stack->screen->display->xdisplay,
+                           (Window *) root_children_stacked->data,
+                           root_children_stacked->len);
+          stack->n_restack_requests++;
+        }
     }
   else if (root_children_stacked->len > 0)
     {
-      /* Try to do minimal window moves to get the stack in order */
+      /* Do the minimal window moves to get the stack in order */
       /* A point of note: these arrays include frames not client windows,
        * so if a client window has changed frame since last_root_children_stacked
        * was saved, then we may have inefficiency, but I don't think things
@@ -1166,80 +1470,53 @@ stack_sync_to_server (MetaStack *stack)
       const Window *new_stack = (Window *) root_children_stacked->data;
       const int old_len = stack->last_root_children_stacked->len;
       const int new_len = root_children_stacked->len;
-      const Window *oldp = old_stack;
-      const Window *newp = new_stack;
-      const Window *old_end = old_stack + old_len;
-      const Window *new_end = new_stack + new_len;
       Window last_window = None;
+      gboolean *stable;
+      int j;
+
+      stable = g_new (gboolean, new_len);
+      find_stable_windows (old_stack, old_len, new_stack, new_len, stable);
 
-      while (oldp != old_end &&
-             newp != new_end)
+      for (j = 0; j < new_len; j++)
         {
-          if (*oldp == *newp)
+          if (stable[j])
             {
-              /* Stacks are the same here, move on */
-              ++oldp;
-              last_window = *newp;
-              ++newp;
+              /* Already in the right place relative to the stable windows */
             }
-          else if (meta_display_lookup_x_window (stack->screen->display,
-                                                 *oldp) == NULL)
+          else if (last_window == None)
             {
-              /* *oldp is no longer known to us (probably destroyed),
-               * so we can just skip it
-               */
-              ++oldp;
+              meta_topic (META_DEBUG_STACK, "Using window 0x%lx as topmost (but leaving it in-place)\n", new_stack[j]);
+
+              raise_window_relative_to_managed_windows (stack->screen,
+                                                        new_stack[j]);
+              stack->n_restack_requests++;
             }
           else
             {
-              /* Move *newp below last_window */
-              if (last_window == None)
-                {
-                  meta_topic (META_DEBUG_STACK, "Using window 0x%lx as topmost (but leaving it in-place)\n", *newp);
-
-                  raise_window_relative_to_managed_windows (stack->screen,
-                                                            *newp);
-                }
-              else
-                {
-                  /* This means that if last_window is dead, but not
-                   * *newp, then we fail to restack *newp; but on
-                   * unmanaging last_window, we'll fix it up.
-                   */
-
-                  XWindowChanges changes;
+              /* This means that if last_window is dead, but not
+               * new_stack[j], then we fail to restack new_stack[j];
+               * but on unmanaging last_window, we'll fix it up.
+               */
 
-                  changes.sibling = last_window;
-                  changes.stack_mode = Below;
+              XWindowChanges changes;
 
-                  meta_topic (META_DEBUG_STACK, "Placing window 0x%lx below 0x%lx\n",
-                              *newp, last_window);
+              changes.sibling = last_window;
+              changes.stack_mode = Below;
 
-                  XConfigureWindow (stack->screen->display->xdisplay,
-                                    *newp,
-                                    CWSibling | CWStackMode,
-                                    &changes);
-                }
+              meta_topic (META_DEBUG_STACK, "Placing window 0x%lx below 0x%lx\n",
+                          new_stack[j], last_window);
 
-              last_window = *newp;
-              ++newp;
+              XConfigureWindow (stack->screen->display->xdisplay,
+                                new_stack[j],
+                                CWSibling | CWStackMode,
+                                &changes);
+              stack->n_restack_requests++;
             }
-        }
 
-      if (newp != new_end)
-        {
-          /* Restack remaining windows */
-          meta_topic (META_DEBUG_STACK, "Restacking remaining %d windows\n",
-                        (int) (new_end - newp));
-          /* We need to include an already-stacked window
-           * in the restack call, so we get in the proper position
-           * with respect to it.
-           */
-          if (newp != new_stack)
-            --newp;
-          XRestackWindows (stack->screen->display->xdisplay,
-                           (Window *) newp, new_end - newp);
+          last_window = new_stack[j];
         }
+
+      g_free (stable);
     }
 
   meta_error_trap_pop (stack->screen->display, FALSE);
@@ -1248,22 +1525,23 @@ stack_sync_to_server (MetaStack *stack)
    * and we'll fix stacking at that time.
    */
 
-  /* Sync _NET_CLIENT_LIST and _NET_CLIENT_LIST_STACKING */
+  meta_topic (META_DEBUG_STACK, "Sent %u restack requests (%u in total)\n",
+              stack->n_restack_requests - n_restack_requests,
+              stack->n_restack_requests);
 
-  XChangeProperty (stack->screen->display->xdisplay,
-                   stack->screen->xroot,
-                   stack->screen->display->atom__NET_CLIENT_LIST,
-                   XA_WINDOW,
-                   32, PropModeReplace,
-                   (unsigned char *)stack->windows->data,
-                   stack->windows->len);
-  XChangeProperty (stack->screen->display->xdisplay,
-                   stack->screen->xroot,
-                   stack->screen->display->atom__NET_CLIENT_LIST_STACKING,
-                   XA_WINDOW,
-                   32, PropModeReplace,
-                   (unsigned char *)stacked->data,
-                   stacked->len);
+  /* Sync _NET_CLIENT_LIST and _NET_CLIENT_LIST_STACKING; these only
+   * change when client windows are added, removed or restacked, not
+   * when just their frames moved.
+   */
+
+  set_window_list_property (stack,
+                            stack->screen->display->atom__NET_CLIENT_LIST,
+                            stack->windows,
+                            &stack->last_client_list);
+  set_window_list_property (stack,
+                            stack->screen->display->atom__NET_CLIENT_LIST_STACKING,
+                            stacked,
+                            &stack->last_client_list_stacking);
 
   g_array_free (stacked, TRUE);
 
@@ -1271,6 +1549,8 @@ stack_sync_to_server (MetaStack *stack)
     g_array_free (stack->last_root_children_stacked, TRUE);
   stack->last_root_children_stacked = root_children_stacked;
 
+  meta_screen_queue_edge_index_rebuild (stack->screen);
+
   /* That was scary... */
 }
 
@@ -1633,10 +1913,38 @@ meta_stack_set_positions (MetaStack *stack,
   stack_sync_to_server (stack);
 }
 
+/**
+ * Moves window to its place in an otherwise sorted stack->sorted.
+ * Returns FALSE if it's not in the list yet.
+ */
+static gboolean
+stack_splice_window (MetaStack  *stack,
+                     MetaWindow *window)
+{
+  GList *link;
+  GList *tmp;
+
+  link = g_list_find (stack->sorted, window);
+  if (link == NULL)
+    return FALSE;
+
+  stack->sorted = g_list_delete_link (stack->sorted, link);
+
+  tmp = stack->sorted;
+  while (tmp != NULL &&
+         compare_window_position (tmp->data, window) < 0)
+    tmp = tmp->next;
+
+  stack->sorted = g_list_insert_before (stack->sorted, tmp, window);
+
+  return TRUE;
+}
+
 void
 meta_window_set_stack_position_no_sync (MetaWindow *window,
                                         int         position)
 {
+  MetaStack *stack;
   int low, high, delta;
   GList *tmp;
 
@@ -1645,6 +1953,8 @@ meta_window_set_stack_position_no_sync (MetaWindow *window,
   g_return_if_fail (position >= 0);
   g_return_if_fail (position < window->screen->stack->n_positions);
 
+  stack = window->screen->stack;
+
   if (position == window->stack_position)
     {
       meta_topic (META_DEBUG_STACK, "Window %s already has position %d\n",
@@ -1652,8 +1962,7 @@ meta_window_set_stack_position_no_sync (MetaWindow *window,
       return;
     }
 
-  window->screen->stack->need_resort = TRUE;
-  window->screen->stack->need_constrain = TRUE;
+  stack->need_constrain = TRUE;
 
   if (position < window->stack_position)
     {
@@ -1668,7 +1977,7 @@ meta_window_set_stack_position_no_sync (MetaWindow *window,
       delta = -1;
     }
 
-  tmp = window->screen->stack->sorted;
+  tmp = stack->sorted;
   while (tmp != NULL)
     {
       MetaWindow *w = tmp->data;
@@ -1682,6 +1991,12 @@ meta_window_set_stack_position_no_sync (MetaWindow *window,
 
   window->stack_position = position;
 
+  /* The other windows all kept their relative order, so if the list
+   * was sorted we only have to move this one into place
+   */
+  if (!stack->need_resort && !stack_splice_window (stack, window))
+    stack->need_resort = TRUE;
+
   meta_topic (META_DEBUG_STACK,
               "Window %s had stack_position set to %d\n",
               window->desc, window->stack_position);
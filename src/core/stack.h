@@ -116,6 +116,32 @@ struct _MetaStack
    */
   GArray *last_root_children_stacked;
 
+  /**
+   * The contents of _NET_CLIENT_LIST and _NET_CLIENT_LIST_STACKING as last
+   * set on the root window, so that they are only rewritten on change.
+   */
+  GArray *last_client_list;
+  GArray *last_client_list_stacking;
+
+  /** Number of restacking requests sent to the server, for debugging. */
+  guint n_restack_requests;
+
+  /**
+   * The transiency constraints between windows, kept up to date as windows
+   * come and go rather than rebuilt on every restack.  Maps each MetaWindow
+   * to the chain of constraints keeping other windows above it.
+   */
+  GHashTable *constraints;
+
+  /**
+   * Maps each MetaWindow to a GSList of the constraints keeping it above
+   * other windows.
+   */
+  GHashTable *constraint_parents;
+
+  /** The set of MetaWindows whose constraints need recomputing. */
+  GHashTable *constraints_dirty;
+
   /**
    * Number of stack positions; same as the length of added, but
    * kept for quick reference.
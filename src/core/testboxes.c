@@ -28,6 +28,7 @@
 #include <X11/Xutil.h> /* Just for the definition of the various gravities */
 #include <time.h>      /* To initialize random seed */
 #include <math.h>
+#include <string.h>
 
 #define NUM_RANDOM_RUNS 10000
 
@@ -367,6 +368,112 @@ get_xinerama_edges (int which_xinerama_set, int which_strut_set)
   return ret;
 }
 
+/* Times the spanning set and edge computations for a row of xineramas
+ * with a panel along the top and bottom of each and many partial struts
+ * along their sides, as workspace.c would do after a strut change.
+ */
+static void
+benchmark_regions (int n_struts, int n_xineramas, int n_runs)
+{
+  MetaRectangle screen_rect;
+  MetaRectangle *xinerama_rects;
+  GList *xinerama_list;
+  GSList *struts;
+  GRand *rand;
+  gint64 start, elapsed;
+  int n_rects;
+  int i, run;
+
+  rand = g_rand_new_with_seed (42);
+
+  screen_rect = meta_rect (0, 0, 1920 * n_xineramas, 1200);
+  xinerama_rects = g_new (MetaRectangle, n_xineramas);
+  xinerama_list = NULL;
+  struts = NULL;
+  for (i = 0; i < n_xineramas; i++)
+    {
+      MetaStrut *strut;
+
+      xinerama_rects[i] = meta_rect (1920 * i, 0, 1920, 1200);
+      xinerama_list = g_list_prepend (xinerama_list, &xinerama_rects[i]);
+
+      strut = new_meta_strut (1920 * i, 0, 1920, 24, META_SIDE_TOP);
+      strut->edge = META_EDGE_XINERAMA;
+      struts = g_slist_prepend (struts, strut);
+
+      strut = new_meta_strut (1920 * i, 1176, 1920, 24, META_SIDE_BOTTOM);
+      strut->edge = META_EDGE_XINERAMA;
+      struts = g_slist_prepend (struts, strut);
+    }
+
+  for (i = 0; i < n_struts; i++)
+    {
+      int xinerama = g_rand_int_range (rand, 0, n_xineramas);
+      int thickness = g_rand_int_range (rand, 8, 64);
+      int y = g_rand_int_range (rand, 24, 1000);
+      int height = g_rand_int_range (rand, 20, 1176 - y);
+      MetaStrut *strut;
+
+      if (g_rand_boolean (rand))
+        strut = new_meta_strut (1920 * xinerama, y, thickness, height,
+                                META_SIDE_LEFT);
+      else
+        strut = new_meta_strut (1920 * (xinerama + 1) - thickness, y,
+                                thickness, height, META_SIDE_RIGHT);
+      strut->edge = META_EDGE_XINERAMA;
+      struts = g_slist_prepend (struts, strut);
+    }
+
+  n_rects = 0;
+  start = g_get_monotonic_time ();
+  for (run = 0; run < n_runs; run++)
+    {
+      GList *region;
+
+      for (i = 0; i < n_xineramas; i++)
+        {
+          region = meta_rectangle_get_minimal_spanning_set_for_region (
+                     &xinerama_rects[i], struts, FALSE);
+          n_rects += g_list_length (region);
+          g_list_free_full (region, g_free);
+        }
+
+      region = meta_rectangle_get_minimal_spanning_set_for_region (
+                 &screen_rect, struts, TRUE);
+      n_rects += g_list_length (region);
+      g_list_free_full (region, g_free);
+    }
+  elapsed = g_get_monotonic_time () - start;
+
+  printf ("Spanning sets for %d struts on %d xineramas: %g ms per strut "
+          "change (%d rectangles)\n",
+          n_struts + 2 * n_xineramas, n_xineramas,
+          elapsed / 1000.0 / n_runs, n_rects / n_runs);
+
+  start = g_get_monotonic_time ();
+  for (run = 0; run < n_runs; run++)
+    {
+      GList *edges;
+
+      edges = meta_rectangle_find_onscreen_edges (&screen_rect, struts);
+      g_list_free_full (edges, g_free);
+
+      edges = meta_rectangle_find_nonintersected_xinerama_edges (&screen_rect,
+                                                                 xinerama_list,
+                                                                 struts);
+      g_list_free_full (edges, g_free);
+    }
+  elapsed = g_get_monotonic_time () - start;
+
+  printf ("Screen and xinerama edges: %g ms per strut change\n",
+          elapsed / 1000.0 / n_runs);
+
+  free_strut_list (struts);
+  g_list_free (xinerama_list);
+  g_free (xinerama_rects);
+  g_rand_free (rand);
+}
+
 #if 0
 static void
 test_merge_regions ()
@@ -1399,8 +1506,25 @@ test_find_closest_point_to_line (void)
 }
 
 int
-main(void)
+main (int argc, char **argv)
 {
+  if (argc > 1 && strcmp (argv[1], "--benchmark") == 0)
+    {
+      int n_struts    = argc > 2 ? atoi (argv[2]) : 100;
+      int n_xineramas = argc > 3 ? atoi (argv[3]) : 3;
+
+      if (n_struts < 0 || n_xineramas < 1)
+        {
+          fprintf (stderr,
+                   "Usage: %s --benchmark [N_STRUTS [N_XINERAMAS]]\n",
+                   argv[0]);
+          return 1;
+        }
+
+      benchmark_regions (n_struts, n_xineramas, 20);
+      return 0;
+    }
+
   init_random_ness ();
   test_area ();
   test_intersect ();
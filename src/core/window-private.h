@@ -104,6 +104,10 @@ struct _MetaWindow
   MetaDisplay *display;
   MetaScreen *screen;
   MetaWorkspace *workspace;
+  /* our node in display->managed_windows */
+  GList *managed_link;
+  /* our node in screen->mru_windows */
+  GList *mru_link;
   Window xwindow;
   /* may be NULL! not all windows get decorated */
   MetaFrame *frame;
@@ -353,6 +357,10 @@ struct _MetaWindow
   XSyncCounter sync_request_counter;
   guint sync_request_serial;
   gint64 sync_request_time;
+  /* Running average of how long the client takes to answer a sync
+   * request, in ms; 0 until it answered one
+   */
+  double sync_request_latency;
 #endif
 
   /* Number of UnmapNotify that are caused by us, if
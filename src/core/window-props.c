@@ -46,6 +46,7 @@
 #include "xprops.h"
 #include "frame-private.h"
 #include "group.h"
+#include "async-getprop.h"
 #include <X11/Xatom.h>
 #include <X11/extensions/XRes.h>
 #include <unistd.h>
@@ -74,8 +75,25 @@ typedef struct MetaWindowPropHooks
   Atom              property;
   MetaPropValueType type;
   ReloadValueFunc   reload_func;
+  /* Whether a PropertyNotify may be handled without waiting for the
+   * new value; only for things nothing else in event handling reads.
+   */
+  gboolean          async;
 } MetaWindowPropHooks;
 
+/* A reload whose GetProperty request has been sent but whose
+ * hook hasn't run yet.  With no hooks, it's waiting for the
+ * window's icon cache to get the _NET_WM_ICON images it asked for.
+ */
+typedef struct
+{
+  MetaWindow          *window; /* NULL if the window went away */
+  Window               xwindow;
+  MetaWindowPropHooks *hooks;
+  AgGetPropertyTask   *task;
+  MetaPropValue        value;
+} PendingReload;
+
 static MetaWindowPropHooks* find_hooks (MetaDisplay *display,
                                         Atom         property);
 
@@ -119,25 +137,26 @@ meta_window_reload_properties_from_xwindow (MetaWindow *window,
 {
   int i;
   MetaPropValue *values;
+  MetaWindowPropHooks **hooks;
 
   g_return_if_fail (properties != NULL);
   g_return_if_fail (n_properties > 0);
 
   values = g_new0 (MetaPropValue, n_properties);
+  hooks = g_new (MetaWindowPropHooks*, n_properties);
 
   for (i=0; i<n_properties; i++)
     {
-      MetaWindowPropHooks *hooks = find_hooks (window->display,
-                                               properties[i]);
+      hooks[i] = find_hooks (window->display, properties[i]);
 
-      if (!hooks || hooks->type == META_PROP_VALUE_INVALID)
+      if (!hooks[i] || hooks[i]->type == META_PROP_VALUE_INVALID)
         {
           values[i].type = META_PROP_VALUE_INVALID;
           values[i].atom = None;
         }
       else
         {
-          values[i].type = hooks->type;
+          values[i].type = hooks[i]->type;
           values[i].atom = properties[i];
         }
     }
@@ -145,18 +164,177 @@ meta_window_reload_properties_from_xwindow (MetaWindow *window,
   meta_prop_get_values (window->display, xwindow,
                         values, n_properties);
 
+  /* Anything queued before us has its reply by now, and must be
+   * applied first so that we don't end up with its older value.
+   */
+  meta_display_dispatch_property_reloads (window->display);
+
   for (i=0; i<n_properties; i++)
     {
-      MetaWindowPropHooks *hooks = find_hooks (window->display,
-                                               properties[i]);
-
-      if (hooks && hooks->reload_func != NULL)
-        (* hooks->reload_func) (window, &values[i], initial);
+      if (hooks[i] && hooks[i]->reload_func != NULL)
+        (* hooks[i]->reload_func) (window, &values[i], initial);
     }
 
   meta_prop_free_values (values, n_properties);
 
   g_free (values);
+  g_free (hooks);
+}
+
+static void
+maybe_send_reload_ping (MetaDisplay *display)
+{
+  if (display->prop_reload_ping_serial != 0 &&
+      LastKnownRequestProcessed (display->xdisplay) >= display->prop_reload_ping_serial)
+    display->prop_reload_ping_serial = 0;
+
+  if (display->prop_reload_ping_serial != 0 ||
+      g_queue_is_empty (display->pending_prop_reloads))
+    return;
+
+  /* The PropertyNotify this generates is read after the replies to
+   * everything queued so far, and event_callback() dispatches
+   * reloads on every event; so it wakes us up once they're in.
+   * It uses its own property so that timestamp roundtrips, which
+   * append to XA_PRIMARY on the same window, can tell it apart.
+   */
+  display->prop_reload_ping_serial = NextRequest (display->xdisplay);
+  XChangeProperty (display->xdisplay,
+                   display->timestamp_pinging_window,
+                   display->atom__MARCO_RELOAD_PING, XA_STRING, 8,
+                   PropModeAppend, NULL, 0);
+}
+
+void
+meta_window_queue_property_reloads (MetaWindow *window,
+                                    Window      xwindow,
+                                    const Atom *properties,
+                                    int         n_properties)
+{
+  MetaDisplay *display;
+  int i;
+
+  display = window->display;
+
+  for (i = 0; i < n_properties; i++)
+    {
+      MetaWindowPropHooks *hooks;
+      PendingReload *reload;
+
+      hooks = find_hooks (display, properties[i]);
+
+      if (hooks == NULL)
+        continue;
+
+      if (!hooks->async || hooks->type == META_PROP_VALUE_INVALID)
+        {
+          meta_window_reload_properties_from_xwindow (window, xwindow,
+                                                      &properties[i], 1,
+                                                      FALSE);
+          continue;
+        }
+
+      reload = g_new0 (PendingReload, 1);
+      reload->window = window;
+      reload->xwindow = xwindow;
+      reload->hooks = hooks;
+      reload->value.type = hooks->type;
+      reload->value.atom = properties[i];
+      reload->task = meta_prop_request_value (display, xwindow,
+                                              &reload->value);
+
+      g_queue_push_tail (display->pending_prop_reloads, reload);
+    }
+
+  maybe_send_reload_ping (display);
+}
+
+void
+meta_display_dispatch_property_reloads (MetaDisplay *display)
+{
+  PendingReload *reload;
+
+  /* Replies come back in order, so stop at the first one
+   * that isn't in yet.
+   */
+  while ((reload = g_queue_peek_head (display->pending_prop_reloads)) != NULL)
+    {
+      if (reload->hooks == NULL)
+        {
+          if (reload->window != NULL &&
+              meta_icon_cache_is_fetching (&reload->window->icon_cache))
+            break;
+        }
+      else if (reload->task != NULL && !ag_task_have_reply (reload->task))
+        break;
+
+      g_queue_pop_head (display->pending_prop_reloads);
+
+      if (reload->hooks == NULL)
+        {
+          /* The icon cache collects the replies itself */
+          if (reload->window != NULL)
+            meta_window_queue (reload->window, META_QUEUE_UPDATE_ICON);
+        }
+      else
+        {
+          meta_prop_collect_value (display, reload->xwindow,
+                                   reload->task, &reload->value);
+
+          if (reload->window != NULL && reload->hooks->reload_func != NULL)
+            (* reload->hooks->reload_func) (reload->window, &reload->value,
+                                            FALSE);
+
+          meta_prop_free_values (&reload->value, 1);
+        }
+
+      g_free (reload);
+    }
+
+  maybe_send_reload_ping (display);
+}
+
+void
+meta_window_queue_icon_fetch (MetaWindow *window)
+{
+  MetaDisplay *display;
+  PendingReload *reload;
+  GList *l;
+
+  display = window->display;
+
+  /* One wait per window will do; it checks whichever fetch is
+   * current when it gets to the head of the queue.
+   */
+  for (l = display->pending_prop_reloads->head; l != NULL; l = l->next)
+    {
+      reload = l->data;
+
+      if (reload->hooks == NULL && reload->window == window)
+        return;
+    }
+
+  reload = g_new0 (PendingReload, 1);
+  reload->window = window;
+  reload->xwindow = window->xwindow;
+
+  g_queue_push_tail (display->pending_prop_reloads, reload);
+
+  maybe_send_reload_ping (display);
+}
+
+void
+meta_window_cancel_property_reloads (MetaWindow *window)
+{
+  GList *l;
+
+  for (l = window->display->pending_prop_reloads->head; l != NULL; l = l->next)
+    {
+      PendingReload *reload = l->data;
+
+      if (reload->window == window)
+        reload->window = NULL;
+    }
 }
 
 static void
@@ -778,7 +956,10 @@ reload_net_wm_state (MetaWindow    *window,
       else if (value->v.atom_list.atoms[i] == window->display->atom__NET_WM_STATE_DEMANDS_ATTENTION)
         window->wm_state_demands_attention = TRUE;
       else if (value->v.atom_list.atoms[i] == window->display->atom__NET_WM_STATE_STICKY)
-        window->on_all_workspaces = TRUE;
+        {
+          window->on_all_workspaces = TRUE;
+          meta_screen_update_sticky_window (window->screen, window);
+        }
 
       ++i;
     }
@@ -1668,19 +1849,19 @@ meta_display_init_window_prop_hooks (MetaDisplay *display)
 {
   MetaWindowPropHooks hooks[] = {
     { display->atom_WM_STATE,          META_PROP_VALUE_INVALID,  NULL },
-    { display->atom_WM_CLIENT_MACHINE, META_PROP_VALUE_STRING,   reload_wm_client_machine },
+    { display->atom_WM_CLIENT_MACHINE, META_PROP_VALUE_STRING,   reload_wm_client_machine, TRUE },
     { display->atom__NET_WM_PID,       META_PROP_VALUE_CARDINAL, reload_net_wm_pid },
     { display->atom__NET_WM_USER_TIME, META_PROP_VALUE_CARDINAL, reload_net_wm_user_time },
-    { display->atom__NET_WM_NAME,      META_PROP_VALUE_UTF8,     reload_net_wm_name },
-    { XA_WM_NAME,                      META_PROP_VALUE_TEXT_PROPERTY, reload_wm_name },
+    { display->atom__NET_WM_NAME,      META_PROP_VALUE_UTF8,     reload_net_wm_name, TRUE },
+    { XA_WM_NAME,                      META_PROP_VALUE_TEXT_PROPERTY, reload_wm_name, TRUE },
     { display->atom__NET_WM_ICON,      META_PROP_VALUE_INVALID,  reload_net_wm_icon },
     { display->atom__KWM_WIN_ICON,     META_PROP_VALUE_INVALID,  reload_kwm_win_icon },
-    { display->atom__NET_WM_ICON_NAME, META_PROP_VALUE_UTF8,     reload_net_wm_icon_name },
-    { XA_WM_ICON_NAME,                 META_PROP_VALUE_TEXT_PROPERTY, reload_wm_icon_name },
+    { display->atom__NET_WM_ICON_NAME, META_PROP_VALUE_UTF8,     reload_net_wm_icon_name, TRUE },
+    { XA_WM_ICON_NAME,                 META_PROP_VALUE_TEXT_PROPERTY, reload_wm_icon_name, TRUE },
     { display->atom__NET_WM_STATE,     META_PROP_VALUE_ATOM_LIST, reload_net_wm_state },
     { display->atom__MOTIF_WM_HINTS,   META_PROP_VALUE_MOTIF_HINTS, reload_mwm_hints },
     { display->atom__NET_WM_ICON_GEOMETRY, META_PROP_VALUE_INVALID, NULL },
-    { XA_WM_CLASS,                     META_PROP_VALUE_CLASS_HINT, reload_wm_class },
+    { XA_WM_CLASS,                     META_PROP_VALUE_CLASS_HINT, reload_wm_class, TRUE },
     { display->atom_WM_CLIENT_LEADER,  META_PROP_VALUE_INVALID, complain_about_broken_client },
     { display->atom_SM_CLIENT_ID,      META_PROP_VALUE_INVALID, complain_about_broken_client },
     { display->atom_WM_WINDOW_ROLE,    META_PROP_VALUE_INVALID, reload_wm_window_role },
@@ -1696,10 +1877,10 @@ meta_display_init_window_prop_hooks (MetaDisplay *display)
     { XA_WM_HINTS,                     META_PROP_VALUE_WM_HINTS,  reload_wm_hints },
     { XA_WM_TRANSIENT_FOR,             META_PROP_VALUE_WINDOW,    reload_transient_for },
     { display->atom__NET_WM_USER_TIME_WINDOW, META_PROP_VALUE_WINDOW, reload_net_wm_user_time_window },
-    { display->atom__GTK_THEME_VARIANT, META_PROP_VALUE_UTF8, reload_gtk_theme_variant, },
+    { display->atom__GTK_THEME_VARIANT, META_PROP_VALUE_UTF8, reload_gtk_theme_variant, TRUE },
     { display->atom__GTK_FRAME_EXTENTS, META_PROP_VALUE_CARDINAL_LIST, reload_gtk_frame_extents },
-    { display->atom__GTK_APPLICATION_ID, META_PROP_VALUE_UTF8, reload_gtk_application_id },
-    { display->atom__BAMF_DESKTOP_FILE, META_PROP_VALUE_STRING, reload_bamf_desktop_file },
+    { display->atom__GTK_APPLICATION_ID, META_PROP_VALUE_UTF8, reload_gtk_application_id, TRUE },
+    { display->atom__BAMF_DESKTOP_FILE, META_PROP_VALUE_STRING, reload_bamf_desktop_file, TRUE },
     { 0 },
   };
 
@@ -1716,6 +1897,8 @@ meta_display_init_window_prop_hooks (MetaDisplay *display)
 
   display->prop_hooks_table = (gpointer) table;
   display->prop_hooks = g_hash_table_new (NULL, NULL);
+  display->pending_prop_reloads = g_queue_new ();
+  display->prop_reload_ping_serial = 0;
 
   while (cursor->property)
     {
@@ -1733,6 +1916,21 @@ meta_display_init_window_prop_hooks (MetaDisplay *display)
 void
 meta_display_free_window_prop_hooks (MetaDisplay *display)
 {
+  if (!g_queue_is_empty (display->pending_prop_reloads))
+    {
+      GList *l;
+
+      /* Collect the outstanding replies without running any hooks */
+      for (l = display->pending_prop_reloads->head; l != NULL; l = l->next)
+        ((PendingReload*) l->data)->window = NULL;
+
+      XSync (display->xdisplay, False);
+      meta_display_dispatch_property_reloads (display);
+    }
+
+  g_queue_free (display->pending_prop_reloads);
+  display->pending_prop_reloads = NULL;
+
   g_hash_table_unref (display->prop_hooks);
   display->prop_hooks = NULL;
 
@@ -94,6 +94,48 @@ void meta_window_reload_properties_from_xwindow
                                     int         n_properties,
                                     gboolean    initial);
 
+/**
+ * Like meta_window_reload_properties_from_xwindow(), but sends the
+ * requests and returns without waiting for the replies; each hook runs
+ * when its reply has been read.  Calls for many windows in a row all
+ * go out in the same flush.  Properties that other event handling
+ * depends on are still reloaded straight away.
+ *
+ * \param window      The window the properties belong to.
+ * \param xwindow     The X handle for the window.
+ * \param properties  A pointer to a list of X atoms, "n_properties" long.
+ * \param n_properties  The length of the properties list.
+ */
+void meta_window_queue_property_reloads
+                                   (MetaWindow *window,
+                                    Window      xwindow,
+                                    const Atom *properties,
+                                    int         n_properties);
+
+/**
+ * Runs the hooks for queued reloads whose replies have arrived.
+ * Called for every event.
+ *
+ * \param display  The display.
+ */
+void meta_display_dispatch_property_reloads (MetaDisplay *display);
+
+/**
+ * Queues an icon update for when the _NET_WM_ICON images the
+ * window's icon cache asked for have arrived.
+ *
+ * \param window  The window.
+ */
+void meta_window_queue_icon_fetch (MetaWindow *window);
+
+/**
+ * Makes sure no queued reload runs its hook on a window
+ * that is being unmanaged.
+ *
+ * \param window  The window.
+ */
+void meta_window_cancel_property_reloads (MetaWindow *window);
+
 /**
  * Initialises the hooks used for the reload_propert* functions
  * on a particular display, and stores a pointer to them in the
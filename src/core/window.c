@@ -408,6 +408,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->sync_request_counter = None;
   window->sync_request_serial = 0;
   window->sync_request_time = 0;
+  window->sync_request_latency = 0;
 #endif
 
   window->screen = NULL;
@@ -590,6 +591,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->initial_timestamp = 0; /* not used */
 
   meta_display_register_x_window (display, &window->xwindow, window);
+  meta_display_add_managed_window (display, window);
 
   /* assign the window to its group, or create a new group if needed
    */
@@ -632,7 +634,14 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   update_sm_hints (window); /* must come after transient_for */
   meta_window_update_role (window);
   meta_window_update_net_wm_type (window);
-  meta_window_update_icon_now (window);
+
+  /* Reading the real icon can mean transferring a lot of data; start
+   * out with the default one and do that from the icon idle instead
+   * of while we're handling the map.
+   */
+  window->icon = meta_ui_get_default_window_icon (window->screen->ui);
+  window->mini_icon = meta_ui_get_default_mini_icon (window->screen->ui);
+  meta_window_queue (window, META_QUEUE_UPDATE_ICON);
 
   if (window->initially_iconic)
     {
@@ -689,6 +698,8 @@ meta_window_new_with_attrs (MetaDisplay       *display,
         meta_display_get_current_time_roundtrip (window->display);
   }
 
+  meta_screen_update_mru_window (window->screen, window);
+
   if (window->decorated)
     meta_window_ensure_frame (window);
 
@@ -918,6 +929,7 @@ meta_window_apply_session_info (MetaWindow *window,
   if (info->on_all_workspaces_set)
     {
       window->on_all_workspaces = info->on_all_workspaces;
+      meta_screen_update_sticky_window (window->screen, window);
       meta_topic (META_DEBUG_SM,
                   "Restoring sticky state %d for window %s\n",
                   window->on_all_workspaces, window->desc);
@@ -1080,6 +1092,7 @@ meta_window_free (MetaWindow  *window,
     {
       g_slist_free_full (window->struts, g_free);
       window->struts = NULL;
+      meta_screen_update_strut_window (window->screen, window);
 
       meta_topic (META_DEBUG_WORKAREA,
                   "Unmanaging window %s which has struts, so invalidating work areas\n",
@@ -1111,6 +1124,7 @@ meta_window_free (MetaWindow  *window,
   meta_window_unqueue (window, META_QUEUE_CALC_SHOWING |
                                META_QUEUE_MOVE_RESIZE |
                                META_QUEUE_UPDATE_ICON);
+  meta_window_cancel_property_reloads (window);
   meta_window_free_delete_dialog (window);
 
   if (window->workspace)
@@ -1133,6 +1147,9 @@ meta_window_free (MetaWindow  *window,
 
   meta_stack_remove (window->screen->stack, window);
 
+  /* The edge index may still list the window as moved */
+  meta_screen_queue_edge_index_rebuild (window->screen);
+
   if (window->frame)
     meta_window_destroy_frame (window);
 
@@ -1181,6 +1198,8 @@ meta_window_free (MetaWindow  *window,
   meta_display_ungrab_focus_window_button (window->display, window);
 
   meta_display_unregister_x_window (window->display, window->xwindow);
+  meta_display_remove_managed_window (window->display, window);
+  meta_screen_remove_mru_window (window->screen, window);
 
   meta_error_trap_push (window->display);
 
@@ -1490,6 +1509,8 @@ implement_showing (MetaWindow *window,
   meta_verbose ("Implement showing = %d for window %s\n",
                 showing, window->desc);
 
+  meta_screen_queue_edge_index_rebuild (window->screen);
+
   if (!showing)
     {
       gboolean on_workspace;
@@ -3898,6 +3919,8 @@ meta_window_move_resize_internal (MetaWindow          *window,
                   newx, newy, window->rect.width, window->rect.height,
                   window->user_rect.x, window->user_rect.y,
                   window->user_rect.width, window->user_rect.height);
+
+      meta_screen_queue_edge_index_update (window->screen, window);
     }
   else
     {
@@ -4570,6 +4593,7 @@ window_stick_impl (MetaWindow  *window)
    * toggled back off.
    */
   window->on_all_workspaces = TRUE;
+  meta_screen_update_sticky_window (window->screen, window);
 
   meta_window_frame_size_changed (window);
 
@@ -4602,6 +4626,7 @@ window_unstick_impl (MetaWindow  *window)
   /* Revert to window->workspaces */
 
   window->on_all_workspaces = FALSE;
+  meta_screen_update_sticky_window (window->screen, window);
 
   meta_window_frame_size_changed (window);
 
@@ -5870,7 +5895,7 @@ process_property_notify (MetaWindow     *window,
       xid = window->user_time_window;
     }
 
-  meta_window_reload_property_from_xwindow (window, xid, event->atom, FALSE);
+  meta_window_queue_property_reloads (window, xid, &event->atom, 1);
 
   return TRUE;
 }
@@ -6220,6 +6245,9 @@ meta_window_update_icon_now (MetaWindow *window)
       redraw_icon (window);
     }
 
+  if (meta_icon_cache_is_fetching (&window->icon_cache))
+    meta_window_queue_icon_fetch (window);
+
   g_free (desktop_id);
 
   g_assert (window->icon);
@@ -6544,6 +6572,7 @@ meta_window_update_struts (MetaWindow *window)
   /* Update appropriately */
   g_slist_free_full (old_struts, g_free);
   window->struts = new_struts;
+  meta_screen_update_strut_window (window->screen, window);
   if (changed)
     {
       meta_topic (META_DEBUG_WORKAREA,
@@ -6624,6 +6653,9 @@ recalc_window_type (MetaWindow *window)
       /* update stacking constraints */
       meta_window_update_layer (window);
 
+      /* desktops, menus and splashscreens don't have edges */
+      meta_screen_queue_edge_index_rebuild (window->screen);
+
       meta_window_grab_keys (window);
     }
 }
@@ -7305,12 +7337,81 @@ time_diff (const gint64 first,
   return (first - second) / 1000.0;
 }
 
+/* Clients that can't tell us when they have redrawn aren't resized
+ * more often than this
+ */
+#define MAX_UNSYNCED_RESIZES_PER_SECOND 25.0
+
+/* Assumed frame rate when no compositor paces the screen */
+#define DEFAULT_FRAMES_PER_SECOND 60.0
+
+/* How long to wait for a client to answer a sync request, in multiples
+ * of its usual latency, and the bounds of that wait in ms
+ */
+#define SYNC_DEADLINE_FACTOR 4.0
+#define MIN_SYNC_DEADLINE 100.0
+#define MAX_SYNC_DEADLINE 1000.0
+
+/* How long after the deadline to check again, in ms.  It covers the
+ * timeout being truncated to whole ms and the main loop's clock being
+ * a little off the wall clock the deadline is measured with, while
+ * staying short next to MIN_SYNC_DEADLINE.
+ */
+#define SYNC_DEADLINE_SLACK 10.0
+
+/* Resizing faster than the screen is redrawn is wasted work, so the
+ * compositor's frame clock bounds the resize rate
+ */
+static double
+get_frame_interval (MetaWindow *window)
+{
+  gint64 interval;
+
+  interval = meta_compositor_get_frame_interval (window->display->compositor);
+  if (interval <= 0)
+    return 1000.0 / DEFAULT_FRAMES_PER_SECOND;
+
+  return interval / 1000.0;
+}
+
+static gboolean
+check_resize_interval (MetaWindow *window,
+                       gint64      current_time,
+                       double      interval,
+                       gdouble    *remaining)
+{
+  double elapsed;
+
+  elapsed = time_diff (current_time, window->display->grab_last_moveresize_time);
+
+  if (elapsed >= 0.0 && elapsed < interval)
+    {
+      meta_topic (META_DEBUG_RESIZING,
+                  "Delaying move/resize as only %g of %g ms elapsed\n",
+                  elapsed, interval);
+
+      if (remaining)
+        *remaining = (interval - elapsed);
+
+      return FALSE;
+    }
+
+  meta_topic (META_DEBUG_RESIZING,
+              " Checked moveresize freq, allowing move/resize now (%g of %g ms elapsed)\n",
+              elapsed, interval);
+
+  return TRUE;
+}
+
 static gboolean
 check_moveresize_frequency (MetaWindow *window,
 			    gdouble    *remaining)
 {
   gint64 current_time;
+  double interval;
+
   current_time = g_get_real_time ();
+  interval = get_frame_interval (window);
 
 #ifdef HAVE_XSYNC
   if (!window->disable_sync &&
@@ -7318,63 +7419,56 @@ check_moveresize_frequency (MetaWindow *window,
     {
       if (window->sync_request_time != 0)
         {
-          double elapsed =
-            time_diff (current_time, window->sync_request_time);
+          double elapsed, deadline;
 
-	  if (elapsed < 1000.0)
+          elapsed = time_diff (current_time, window->sync_request_time);
+
+          /* Give the client a few times its usual latency to answer */
+          if (window->sync_request_latency > 0)
+            deadline = CLAMP (SYNC_DEADLINE_FACTOR * window->sync_request_latency,
+                              MIN_SYNC_DEADLINE, MAX_SYNC_DEADLINE);
+          else
+            deadline = MAX_SYNC_DEADLINE;
+
+	  if (elapsed < deadline)
 	    {
 	      /* We want to be sure that the timeout happens at
 	       * a time where elapsed will definitely be
-	       * greater than 1000, so we can disable sync
+	       * greater than the deadline, so we can disable sync
 	       */
 	      if (remaining)
-		*remaining = 1000.0 - elapsed + 100;
+		*remaining = deadline - elapsed + SYNC_DEADLINE_SLACK;
 
 	      return FALSE;
 	    }
 	  else
 	    {
-	      /* We have now waited for more than a second for the
-	       * application to respond to the sync request
+	      /* The application missed the deadline; resize without
+	       * waiting for it until it answers, which turns sync back on
+	       * and makes the deadline longer from then on.
 	       */
+              meta_topic (META_DEBUG_RESIZING,
+                          "%s missed a %g ms sync deadline, resizing without sync\n",
+                          window->desc, deadline);
 	      window->disable_sync = TRUE;
 	      return TRUE;
 	    }
 	}
       else
 	{
-	  /* No outstanding sync requests. Go ahead and resize
-	   */
-	  return TRUE;
+	  /* No outstanding sync requests; resize at most once a frame */
+	  return check_resize_interval (window, current_time, interval,
+	                                remaining);
 	}
     }
-  else
-#endif /* HAVE_XSYNC */
-    {
-      const double max_resizes_per_second = 25.0;
-      const double ms_between_resizes = 1000.0 / max_resizes_per_second;
-      double elapsed;
-
-      elapsed = time_diff (current_time, window->display->grab_last_moveresize_time);
-
-      if (elapsed >= 0.0 && elapsed < ms_between_resizes)
-	{
-	  meta_topic (META_DEBUG_RESIZING,
-		      "Delaying move/resize as only %g of %g ms elapsed\n",
-		      elapsed, ms_between_resizes);
 
-	  if (remaining)
-	    *remaining = (ms_between_resizes - elapsed);
-
-	  return FALSE;
-	}
+  /* Without sync, keep to the client's measured latency if it has one */
+  interval = MAX (interval, window->sync_request_latency);
+#endif /* HAVE_XSYNC */
 
-      meta_topic (META_DEBUG_RESIZING,
-		  " Checked moveresize freq, allowing move/resize now (%g of %g seconds elapsed)\n",
-		  elapsed / 1000.0, 1.0 / max_resizes_per_second);
+  interval = MAX (interval, 1000.0 / MAX_UNSYNCED_RESIZES_PER_SECOND);
 
-      return TRUE;
-    }
+  return check_resize_interval (window, current_time, interval, remaining);
 }
 
 static gboolean
@@ -8112,6 +8206,30 @@ meta_window_handle_mouse_grab_op_event (MetaWindow *window,
        * the application has come to its senses (maybe it was just
        * busy with a pagefault or a long computation).
        */
+      if (window->sync_request_time != 0)
+        {
+          double latency;
+
+          /* Keep a running average of how long the client takes to
+           * redraw, so a slow client gets resized less often and a
+           * client that usually answers quickly is given up on sooner.
+           */
+          latency = time_diff (g_get_real_time (), window->sync_request_time);
+          if (latency >= 0.0)
+            {
+              if (window->sync_request_latency > 0)
+                window->sync_request_latency =
+                  (3 * window->sync_request_latency + latency) / 4;
+              else
+                window->sync_request_latency = latency;
+
+              meta_topic (META_DEBUG_RESIZING,
+                          "%s answered sync request in %g ms (average %g ms)\n",
+                          window->desc, latency,
+                          window->sync_request_latency);
+            }
+        }
+
       window->disable_sync = FALSE;
       window->sync_request_time = 0;
 
@@ -8134,12 +8252,14 @@ meta_window_handle_mouse_grab_op_event (MetaWindow *window,
         case META_GRAB_OP_KEYBOARD_RESIZING_NE:
         case META_GRAB_OP_KEYBOARD_RESIZING_SW:
         case META_GRAB_OP_KEYBOARD_RESIZING_NW:
-          /* no pointer round trip here, to keep in sync */
+          /* no pointer round trip here, to keep in sync; the client
+           * is ready, but don't configure it again before the next frame
+           */
           update_resize (window,
                          window->display->grab_last_user_action_was_snap != FALSE,
                          window->display->grab_latest_motion_x,
                          window->display->grab_latest_motion_y,
-                         TRUE);
+                         FALSE);
           break;
 
         default:
@@ -9006,6 +9126,8 @@ meta_window_set_user_time (MetaWindow *window,
                   window->desc, timestamp);
       window->net_wm_user_time_set = TRUE;
       window->net_wm_user_time = timestamp;
+      if (window->mru_link != NULL)
+        meta_screen_update_mru_window (window->screen, window);
       if (XSERVER_TIME_IS_BEFORE (window->display->last_user_time, timestamp))
         window->display->last_user_time = timestamp;
 
@@ -9150,6 +9272,12 @@ meta_window_is_shaded (MetaWindow *window)
   return window->shaded;
 }
 
+gboolean
+meta_window_has_shape (MetaWindow *window)
+{
+  return window->has_shape;
+}
+
 MetaRectangle *
 meta_window_get_rect (MetaWindow *window)
 {
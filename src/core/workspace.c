@@ -107,12 +107,45 @@ workspace_free_struts (MetaWorkspace *workspace)
   workspace->all_struts = NULL;
 }
 
+/**
+ * Frees the cached work areas, regions and edges of a workspace.
+ *
+ * \param workspace  The workspace.
+ */
+static void
+workspace_free_work_areas (MetaWorkspace *workspace)
+{
+  int i;
+
+  /* If we are in the middle of a resize or move operation, we
+   * might have cached pointers to the workspace's edges */
+  if (workspace == workspace->screen->active_workspace)
+    meta_display_cleanup_edges (workspace->screen->display);
+
+  g_free (workspace->work_area_xinerama);
+  workspace->work_area_xinerama = NULL;
+
+  workspace_free_struts (workspace);
+
+  if (workspace->xinerama_region != NULL)
+    {
+      for (i = 0; i < workspace->screen->n_xinerama_infos; i++)
+        g_list_free_full (workspace->xinerama_region[i], g_free);
+      g_free (workspace->xinerama_region);
+    }
+  g_list_free_full (workspace->screen_region, g_free);
+  g_list_free_full (workspace->screen_edges, g_free);
+  g_list_free_full (workspace->xinerama_edges, g_free);
+  workspace->xinerama_region = NULL;
+  workspace->screen_region = NULL;
+  workspace->screen_edges = NULL;
+  workspace->xinerama_edges = NULL;
+}
+
 void
 meta_workspace_free (MetaWorkspace *workspace)
 {
   GList *tmp;
-  MetaScreen *screen;
-  int i;
 
   g_return_if_fail (workspace != workspace->screen->active_workspace);
 
@@ -136,33 +169,16 @@ meta_workspace_free (MetaWorkspace *workspace)
 
   g_assert (workspace->windows == NULL);
 
-  screen = workspace->screen;
-
   workspace->screen->workspaces =
     g_list_remove (workspace->screen->workspaces, workspace);
 
-  g_free (workspace->work_area_xinerama);
-
   g_list_free (workspace->mru_list);
   g_list_free (workspace->list_containing_self);
 
-  /* screen.c:update_num_workspaces(), which calls us, removes windows from
-   * workspaces first, which can cause the workareas on the workspace to be
-   * invalidated (and hence for struts/regions/edges to be freed).
-   * So, no point trying to double free it; that causes a crash
-   * anyway.  #361804.
+  /* Invalidating the work areas keeps them around to be updated, so
+   * they need freeing whether or not they are valid.
    */
-
-  if (!workspace->work_areas_invalid)
-    {
-      workspace_free_struts (workspace);
-      for (i = 0; i < screen->n_xinerama_infos; i++)
-        g_list_free_full (workspace->xinerama_region[i], g_free);
-      g_free (workspace->xinerama_region);
-      g_list_free_full (workspace->screen_region, g_free);
-      g_list_free_full (workspace->screen_edges, g_free);
-      g_list_free_full (workspace->xinerama_edges, g_free);
-    }
+  workspace_free_work_areas (workspace);
 
   g_free (workspace);
 
@@ -203,6 +219,7 @@ meta_workspace_add_window (MetaWorkspace *workspace,
 
   workspace->windows = g_list_prepend (workspace->windows, window);
   window->workspace = workspace;
+  meta_screen_update_sticky_window (workspace->screen, window);
 
   meta_window_set_current_workspace_hint (window);
 
@@ -231,6 +248,7 @@ meta_workspace_remove_window (MetaWorkspace *workspace,
 
   workspace->windows = g_list_remove (workspace->windows, window);
   window->workspace = NULL;
+  meta_screen_update_sticky_window (workspace->screen, window);
 
   /* If the window is on all workspaces, we don't want to remove it
    * from the MRU list unless this causes it to be removed from all
@@ -379,6 +397,7 @@ meta_workspace_activate_with_focus (MetaWorkspace *workspace,
 {
   MetaWorkspace *old;
   MetaWindow *move_window;
+  guint n_window_lists;
 
   meta_verbose ("Activating workspace %d\n",
                 meta_workspace_index (workspace));
@@ -386,6 +405,8 @@ meta_workspace_activate_with_focus (MetaWorkspace *workspace,
   if (workspace->screen->active_workspace == workspace)
     return;
 
+  n_window_lists = workspace->screen->display->n_window_lists;
+
   if (workspace->screen->active_workspace)
     workspace_switch_sound(workspace->screen->active_workspace, workspace);
 
@@ -401,6 +422,8 @@ meta_workspace_activate_with_focus (MetaWorkspace *workspace,
 
   workspace->screen->active_workspace = workspace;
 
+  meta_screen_queue_edge_index_rebuild (workspace->screen);
+
   set_active_space_hint (workspace->screen);
 
   /* If the "show desktop" mode is active for either the old workspace
@@ -459,6 +482,10 @@ meta_workspace_activate_with_focus (MetaWorkspace *workspace,
       meta_topic (META_DEBUG_FOCUS, "Focusing default window on new workspace\n");
       meta_workspace_focus_default_window (workspace, NULL, timestamp);
     }
+
+  meta_verbose ("Built %u window lists switching to workspace %d\n",
+                workspace->screen->display->n_window_lists - n_window_lists,
+                meta_workspace_index (workspace));
 }
 
 void
@@ -487,27 +514,24 @@ meta_workspace_index (MetaWorkspace *workspace)
 GList*
 meta_workspace_list_windows (MetaWorkspace *workspace)
 {
-  GSList *display_windows;
-  GSList *tmp;
   GList *workspace_windows;
+  GHashTableIter iter;
+  gpointer key;
 
-  display_windows = meta_display_list_windows (workspace->screen->display);
+  workspace_windows = g_list_copy (workspace->windows);
 
-  workspace_windows = NULL;
-  tmp = display_windows;
-  while (tmp != NULL)
+  /* Plus the windows on all workspaces that live on another one,
+   * or on none at all
+   */
+  g_hash_table_iter_init (&iter, workspace->screen->sticky_windows);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
     {
-      MetaWindow *window = tmp->data;
-
-      if (meta_window_located_on_workspace (window, workspace))
-        workspace_windows = g_list_prepend (workspace_windows,
-                                            window);
+      MetaWindow *window = key;
 
-      tmp = tmp->next;
+      if (window->workspace != workspace)
+        workspace_windows = g_list_prepend (workspace_windows, window);
     }
 
-  g_slist_free (display_windows);
-
   return workspace_windows;
 }
 
@@ -542,7 +566,6 @@ meta_workspace_invalidate_work_area (MetaWorkspace *workspace)
 {
   GList *tmp;
   GList *windows;
-  int i;
 
   if (workspace->work_areas_invalid)
     {
@@ -561,22 +584,10 @@ meta_workspace_invalidate_work_area (MetaWorkspace *workspace)
   if (workspace == workspace->screen->active_workspace)
     meta_display_cleanup_edges (workspace->screen->display);
 
-  g_free (workspace->work_area_xinerama);
-  workspace->work_area_xinerama = NULL;
-
-  workspace_free_struts (workspace);
-
-  for (i = 0; i < workspace->screen->n_xinerama_infos; i++)
-    g_list_free_full (workspace->xinerama_region[i], g_free);
-  g_free (workspace->xinerama_region);
-  g_list_free_full (workspace->screen_region, g_free);
-  g_list_free_full (workspace->screen_edges, g_free);
-  g_list_free_full (workspace->xinerama_edges, g_free);
-  workspace->xinerama_region = NULL;
-  workspace->screen_region = NULL;
-  workspace->screen_edges = NULL;
-  workspace->xinerama_edges = NULL;
-
+  /* The struts, regions and edges are kept, so that
+   * ensure_work_areas_validated() only has to redo what the changed
+   * struts affect.
+   */
   workspace->work_areas_invalid = TRUE;
 
   /* redo the size/position constraints on all windows */
@@ -596,55 +607,299 @@ meta_workspace_invalidate_work_area (MetaWorkspace *workspace)
   meta_screen_queue_workarea_recalc (workspace->screen);
 }
 
+/* Like meta_workspace_invalidate_work_area(), but also throws away the
+ * cached regions, for when the screen or xinerama geometry changes.
+ */
+void
+meta_workspace_discard_work_area (MetaWorkspace *workspace)
+{
+  meta_workspace_invalidate_work_area (workspace);
+
+  workspace_free_work_areas (workspace);
+}
+
+static int
+compare_struts (gconstpointer a,
+                gconstpointer b)
+{
+  const MetaStrut *strut_a = a;
+  const MetaStrut *strut_b = b;
+
+  if (strut_a->rect.x != strut_b->rect.x)
+    return strut_a->rect.x < strut_b->rect.x ? -1 : 1;
+  if (strut_a->rect.y != strut_b->rect.y)
+    return strut_a->rect.y < strut_b->rect.y ? -1 : 1;
+  if (strut_a->rect.width != strut_b->rect.width)
+    return strut_a->rect.width < strut_b->rect.width ? -1 : 1;
+  if (strut_a->rect.height != strut_b->rect.height)
+    return strut_a->rect.height < strut_b->rect.height ? -1 : 1;
+  if (strut_a->side != strut_b->side)
+    return strut_a->side < strut_b->side ? -1 : 1;
+  if (strut_a->edge != strut_b->edge)
+    return strut_a->edge < strut_b->edge ? -1 : 1;
+
+  return 0;
+}
+
+static gpointer
+copy_rect (gconstpointer src,
+           gpointer      data)
+{
+  MetaRectangle *cpy = g_new (MetaRectangle, 1);
+  *cpy = *((const MetaRectangle *)src);
+  return cpy;
+}
+
+static gpointer
+copy_edge (gconstpointer src,
+           gpointer      data)
+{
+  MetaEdge *cpy = g_new (MetaEdge, 1);
+  *cpy = *((const MetaEdge *)src);
+  return cpy;
+}
+
+static gpointer
+copy_strut (gconstpointer src,
+            gpointer      data)
+{
+  MetaStrut *cpy = g_new (MetaStrut, 1);
+  *cpy = *((const MetaStrut *)src);
+  return cpy;
+}
+
+/* Returns copies of the struts of the windows on the workspace, sorted
+ * with compare_struts() so that strut lists can be compared.
+ */
+static GSList*
+workspace_collect_struts (MetaWorkspace *workspace)
+{
+  GSList *struts;
+  GHashTableIter iter;
+  gpointer key;
+
+  struts = NULL;
+  g_hash_table_iter_init (&iter, workspace->screen->strut_windows);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      MetaWindow *win = key;
+      GSList *s_iter;
+
+      if (!meta_window_located_on_workspace (win, workspace))
+        continue;
+
+      for (s_iter = win->struts; s_iter != NULL; s_iter = s_iter->next)
+        {
+          struts = g_slist_prepend (struts, copy_strut (s_iter->data, NULL));
+        }
+    }
+
+  return g_slist_sort (struts, compare_struts);
+}
+
+/* Returns the struts in only one of two sorted strut lists; the list
+ * doesn't own them.
+ */
+static GSList*
+find_changed_struts (GSList *old_struts,
+                     GSList *new_struts)
+{
+  GSList *changed;
+
+  changed = NULL;
+  while (old_struts != NULL || new_struts != NULL)
+    {
+      int cmp;
+
+      if (old_struts == NULL)
+        cmp = 1;
+      else if (new_struts == NULL)
+        cmp = -1;
+      else
+        cmp = compare_struts (old_struts->data, new_struts->data);
+
+      if (cmp <= 0)
+        {
+          if (cmp < 0)
+            changed = g_slist_prepend (changed, old_struts->data);
+          old_struts = old_struts->next;
+        }
+      if (cmp >= 0)
+        {
+          if (cmp > 0)
+            changed = g_slist_prepend (changed, new_struts->data);
+          new_struts = new_struts->next;
+        }
+    }
+
+  return changed;
+}
+
+static gboolean
+struts_overlap_rect (GSList              *struts,
+                     const MetaRectangle *rect)
+{
+  for (; struts != NULL; struts = struts->next)
+    {
+      MetaStrut *strut = struts->data;
+
+      if (meta_rectangle_overlap (&strut->rect, rect))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Looks for another workspace with valid work areas for the same
+ * struts.  Panels are usually on all workspaces, so this saves
+ * recomputing the same regions for each of them.
+ */
+static MetaWorkspace*
+find_workspace_with_struts (MetaWorkspace *workspace,
+                            GSList        *struts)
+{
+  GList *tmp;
+
+  for (tmp = workspace->screen->workspaces; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWorkspace *other = tmp->data;
+      GSList *a, *b;
+
+      if (other == workspace || other->work_areas_invalid ||
+          other->xinerama_region == NULL)
+        continue;
+
+      a = other->all_struts;
+      b = struts;
+      while (a != NULL && b != NULL && compare_struts (a->data, b->data) == 0)
+        {
+          a = a->next;
+          b = b->next;
+        }
+
+      if (a == NULL && b == NULL)
+        return other;
+    }
+
+  return NULL;
+}
+
+static void
+copy_work_areas (MetaWorkspace *workspace,
+                 MetaWorkspace *source)
+{
+  int i, n_xineramas;
+
+  n_xineramas = workspace->screen->n_xinerama_infos;
+
+  workspace_free_work_areas (workspace);
+
+  workspace->all_struts = g_slist_copy_deep (source->all_struts,
+                                             copy_strut, NULL);
+  workspace->xinerama_region = g_new (GList*, n_xineramas);
+  for (i = 0; i < n_xineramas; i++)
+    workspace->xinerama_region[i] =
+      g_list_copy_deep (source->xinerama_region[i], copy_rect, NULL);
+  workspace->screen_region = g_list_copy_deep (source->screen_region,
+                                               copy_rect, NULL);
+  workspace->screen_edges = g_list_copy_deep (source->screen_edges,
+                                              copy_edge, NULL);
+  workspace->xinerama_edges = g_list_copy_deep (source->xinerama_edges,
+                                                copy_edge, NULL);
+
+  workspace->work_area_screen = source->work_area_screen;
+  workspace->work_area_xinerama = g_new (MetaRectangle, n_xineramas);
+  memcpy (workspace->work_area_xinerama, source->work_area_xinerama,
+          n_xineramas * sizeof (MetaRectangle));
+}
+
 static void
 ensure_work_areas_validated (MetaWorkspace *workspace)
 {
-  GList         *windows;
+  GSList        *struts;
+  GSList        *changed;
+  MetaWorkspace *source;
   GList         *tmp;
   MetaRectangle  work_area;
+  gboolean       have_regions;
+  int            n_recomputed;
   int            i;  /* C89 absolutely sucks... */
 
   if (!workspace->work_areas_invalid)
     return;
 
-  g_assert (workspace->all_struts == NULL);
-  g_assert (workspace->xinerama_region == NULL);
-  g_assert (workspace->screen_region == NULL);
-  g_assert (workspace->screen_edges == NULL);
-  g_assert (workspace->xinerama_edges == NULL);
+  /* STEP 1: Get the list of struts, and see which changed since the
+   *         regions were last computed.
+   */
+  struts = workspace_collect_struts (workspace);
 
-  /* STEP 1: Get the list of struts */
-  windows = meta_workspace_list_windows (workspace);
-  for (tmp = windows; tmp != NULL; tmp = tmp->next)
+  have_regions = workspace->xinerama_region != NULL;
+  changed = find_changed_struts (workspace->all_struts, struts);
+
+  if (have_regions && changed == NULL)
     {
-      MetaWindow *win = tmp->data;
-      GSList *s_iter;
+      meta_topic (META_DEBUG_WORKAREA,
+                  "Struts of workspace %d are unchanged, keeping its work areas\n",
+                  meta_workspace_index (workspace));
 
-      for (s_iter = win->struts; s_iter != NULL; s_iter = s_iter->next) {
-        MetaStrut *cpy = g_new (MetaStrut, 1);
-        *cpy = *((MetaStrut *)s_iter->data);
-        workspace->all_struts = g_slist_prepend (workspace->all_struts,
-                                                 cpy);
-      }
+      g_slist_free_full (struts, g_free);
+      workspace->work_areas_invalid = FALSE;
+      return;
+    }
+
+  source = find_workspace_with_struts (workspace, struts);
+  if (source != NULL)
+    {
+      meta_topic (META_DEBUG_WORKAREA,
+                  "Copying work areas of workspace %d to workspace %d\n",
+                  meta_workspace_index (source),
+                  meta_workspace_index (workspace));
+
+      g_slist_free (changed);
+      g_slist_free_full (struts, g_free);
+      copy_work_areas (workspace, source);
+      workspace->work_areas_invalid = FALSE;
+      return;
     }
-  g_list_free (windows);
 
   /* STEP 2: Get the maximal/spanning rects for the onscreen and
-   *         on-single-xinerama regions
+   *         on-single-xinerama regions, redoing only the xineramas
+   *         which a changed strut overlaps.
    */
-  g_assert (workspace->xinerama_region == NULL);
-  g_assert (workspace->screen_region   == NULL);
+  if (!have_regions)
+    workspace->xinerama_region = g_new0 (GList*,
+                                         workspace->screen->n_xinerama_infos);
 
-  workspace->xinerama_region = g_new (GList*,
-                                      workspace->screen->n_xinerama_infos);
+  n_recomputed = 0;
   for (i = 0; i < workspace->screen->n_xinerama_infos; i++)
     {
+      MetaRectangle *xinerama_rect = &workspace->screen->xinerama_infos[i].rect;
+
+      if (have_regions && !struts_overlap_rect (changed, xinerama_rect))
+        continue;
+
+      g_list_free_full (workspace->xinerama_region[i], g_free);
       workspace->xinerama_region[i] =
         meta_rectangle_get_minimal_spanning_set_for_region (
-          &workspace->screen->xinerama_infos[i].rect,
-          workspace->all_struts,
+          xinerama_rect,
+          struts,
           FALSE);
+      ++n_recomputed;
     }
+
+  meta_topic (META_DEBUG_WORKAREA,
+              "%d struts changed on workspace %d, recomputed %d of %d "
+              "xinerama regions\n",
+              g_slist_length (changed),
+              meta_workspace_index (workspace),
+              n_recomputed,
+              workspace->screen->n_xinerama_infos);
+
+  g_slist_free (changed);
+  workspace_free_struts (workspace);
+  workspace->all_struts = struts;
+
+  g_list_free_full (workspace->screen_region, g_free);
   workspace->screen_region =
     meta_rectangle_get_minimal_spanning_set_for_region (
       &workspace->screen->rect,
@@ -750,8 +1005,10 @@ ensure_work_areas_validated (MetaWorkspace *workspace)
     }
 
   /* STEP 5: Cache screen and xinerama edges for edge resistance and snapping */
-  g_assert (workspace->screen_edges    == NULL);
-  g_assert (workspace->xinerama_edges  == NULL);
+  if (workspace == workspace->screen->active_workspace)
+    meta_display_cleanup_edges (workspace->screen->display);
+  g_list_free_full (workspace->screen_edges, g_free);
+  g_list_free_full (workspace->xinerama_edges, g_free);
   workspace->screen_edges =
     meta_rectangle_find_onscreen_edges (&workspace->screen->rect,
                                         workspace->all_struts);
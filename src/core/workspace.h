@@ -96,6 +96,7 @@ int            meta_workspace_index         (MetaWorkspace *workspace);
 GList*         meta_workspace_list_windows  (MetaWorkspace *workspace);
 
 void meta_workspace_invalidate_work_area (MetaWorkspace *workspace);
+void meta_workspace_discard_work_area    (MetaWorkspace *workspace);
 
 void meta_workspace_get_work_area_for_xinerama  (MetaWorkspace *workspace,
                                                  int            which_xinerama,
@@ -976,244 +976,258 @@ latin1_to_utf8 (const char *text)
   return g_string_free (str, FALSE);
 }
 
-void
-meta_prop_get_values (MetaDisplay   *display,
-                      Window         xwindow,
-                      MetaPropValue *values,
-                      int            n_values)
+static void
+set_required_type (MetaDisplay   *display,
+                   MetaPropValue *value)
 {
-  int i;
-  AgGetPropertyTask **tasks;
-
-  meta_verbose ("Requesting %d properties of 0x%lx at once\n",
-                n_values, xwindow);
-
-  if (n_values == 0)
-    return;
-
-  tasks = g_new0 (AgGetPropertyTask*, n_values);
-
-  /* Start up tasks. The "values" array can have values
-   * with atom == None, which means to ignore that element.
-   */
-  i = 0;
-  while (i < n_values)
+  if (value->required_type == None)
     {
-      if (values[i].required_type == None)
-        {
-          switch (values[i].type)
-            {
-            case META_PROP_VALUE_INVALID:
-              /* This means we don't really want a value, e.g. got
-               * property notify on an atom we don't care about.
-               */
-              if (values[i].atom != None)
-                meta_bug ("META_PROP_VALUE_INVALID requested in %s\n", G_STRFUNC);
-              break;
-            case META_PROP_VALUE_UTF8_LIST:
-            case META_PROP_VALUE_UTF8:
-              values[i].required_type = display->atom_UTF8_STRING;
-              break;
-            case META_PROP_VALUE_STRING:
-            case META_PROP_VALUE_STRING_AS_UTF8:
-              values[i].required_type = XA_STRING;
-              break;
-            case META_PROP_VALUE_MOTIF_HINTS:
-              values[i].required_type = AnyPropertyType;
-              break;
-            case META_PROP_VALUE_CARDINAL_LIST:
-            case META_PROP_VALUE_CARDINAL:
-              values[i].required_type = XA_CARDINAL;
-              break;
-            case META_PROP_VALUE_WINDOW:
-              values[i].required_type = XA_WINDOW;
-              break;
-            case META_PROP_VALUE_ATOM_LIST:
-              values[i].required_type = XA_ATOM;
-              break;
-            case META_PROP_VALUE_TEXT_PROPERTY:
-              values[i].required_type = AnyPropertyType;
-              break;
-            case META_PROP_VALUE_WM_HINTS:
-              values[i].required_type = XA_WM_HINTS;
-              break;
-            case META_PROP_VALUE_CLASS_HINT:
-              values[i].required_type = XA_STRING;
-              break;
-            case META_PROP_VALUE_SIZE_HINTS:
-              values[i].required_type = XA_WM_SIZE_HINTS;
-              break;
-            case META_PROP_VALUE_SYNC_COUNTER:
-	      values[i].required_type = XA_CARDINAL;
-              break;
-            }
-        }
-
-      if (values[i].atom != None)
-        tasks[i] = get_task (display, xwindow,
-                             values[i].atom, values[i].required_type);
-
-      ++i;
-    }
-
-  /* Get replies for all our tasks */
-  meta_topic (META_DEBUG_SYNC, "Syncing to get %d GetProperty replies in %s\n",
-              n_values, G_STRFUNC);
-  XSync (display->xdisplay, False);
-
-  /* Collect results, should arrive in order requested */
-  i = 0;
-  while (i < n_values)
-    {
-      AgGetPropertyTask *task;
-      GetPropertyResults results;
-
-      if (tasks[i] == NULL)
-        {
-          /* Probably values[i].type was None, or ag_task_create()
-           * returned NULL.
-           */
-          values[i].type = META_PROP_VALUE_INVALID;
-          goto next;
-        }
-
-      task = ag_get_next_completed_task (display->xdisplay);
-      g_assert (task != NULL);
-      g_assert (ag_task_have_reply (task));
-
-      results.display = display;
-      results.xwindow = xwindow;
-      results.xatom = values[i].atom;
-      results.prop = NULL;
-      results.n_items = 0;
-      results.type = None;
-      results.bytes_after = 0;
-      results.format = 0;
-
-      if (ag_task_get_reply_and_free (task,
-                                      &results.type, &results.format,
-                                      &results.n_items,
-                                      &results.bytes_after,
-                                      &results.prop) != Success ||
-          results.type == None)
-        {
-          values[i].type = META_PROP_VALUE_INVALID;
-          if (results.prop)
-            {
-              XFree (results.prop);
-              results.prop = NULL;
-            }
-          goto next;
-        }
-
-      switch (values[i].type)
+      switch (value->type)
         {
         case META_PROP_VALUE_INVALID:
-          g_assert_not_reached ();
+          /* This means we don't really want a value, e.g. got
+           * property notify on an atom we don't care about.
+           */
+          if (value->atom != None)
+            meta_bug ("META_PROP_VALUE_INVALID requested in %s\n", G_STRFUNC);
           break;
         case META_PROP_VALUE_UTF8_LIST:
-          if (!utf8_list_from_results (&results,
-                                       &values[i].v.string_list.strings,
-                                       &values[i].v.string_list.n_strings))
-            values[i].type = META_PROP_VALUE_INVALID;
-          break;
         case META_PROP_VALUE_UTF8:
-          if (!utf8_string_from_results (&results,
-                                         &values[i].v.str))
-            values[i].type = META_PROP_VALUE_INVALID;
+          value->required_type = display->atom_UTF8_STRING;
           break;
         case META_PROP_VALUE_STRING:
-          if (!latin1_string_from_results (&results,
-                                           &values[i].v.str))
-            values[i].type = META_PROP_VALUE_INVALID;
-          break;
         case META_PROP_VALUE_STRING_AS_UTF8:
-          if (!latin1_string_from_results (&results,
-                                           &values[i].v.str))
-            values[i].type = META_PROP_VALUE_INVALID;
-          else
-            {
-              char *new_str;
-              char *xmalloc_new_str;
-
-              new_str = latin1_to_utf8 (values[i].v.str);
-              xmalloc_new_str = ag_Xmalloc (strlen (new_str) + 1);
-              if (xmalloc_new_str != NULL)
-                {
-                  g_strlcpy (xmalloc_new_str, new_str, (strlen (new_str) + 1));
-                  meta_XFree (values[i].v.str);
-                  values[i].v.str = xmalloc_new_str;
-                }
-
-              g_free (new_str);
-            }
+          value->required_type = XA_STRING;
           break;
         case META_PROP_VALUE_MOTIF_HINTS:
-          if (!motif_hints_from_results (&results,
-                                         &values[i].v.motif_hints))
-            values[i].type = META_PROP_VALUE_INVALID;
+          value->required_type = AnyPropertyType;
           break;
         case META_PROP_VALUE_CARDINAL_LIST:
-          if (!cardinal_list_from_results (&results,
-                                           &values[i].v.cardinal_list.cardinals,
-                                           &values[i].v.cardinal_list.n_cardinals))
-            values[i].type = META_PROP_VALUE_INVALID;
-          break;
         case META_PROP_VALUE_CARDINAL:
-          if (!cardinal_with_atom_type_from_results (&results,
-                                                     values[i].required_type,
-                                                     &values[i].v.cardinal))
-            values[i].type = META_PROP_VALUE_INVALID;
+          value->required_type = XA_CARDINAL;
           break;
         case META_PROP_VALUE_WINDOW:
-          if (!window_from_results (&results,
-                                    &values[i].v.xwindow))
-            values[i].type = META_PROP_VALUE_INVALID;
+          value->required_type = XA_WINDOW;
           break;
         case META_PROP_VALUE_ATOM_LIST:
-          if (!atom_list_from_results (&results,
-                                       &values[i].v.atom_list.atoms,
-                                       &values[i].v.atom_list.n_atoms))
-            values[i].type = META_PROP_VALUE_INVALID;
+          value->required_type = XA_ATOM;
           break;
         case META_PROP_VALUE_TEXT_PROPERTY:
-          if (!text_property_from_results (&results, &values[i].v.str))
-            values[i].type = META_PROP_VALUE_INVALID;
+          value->required_type = AnyPropertyType;
           break;
         case META_PROP_VALUE_WM_HINTS:
-          if (!wm_hints_from_results (&results, &values[i].v.wm_hints))
-            values[i].type = META_PROP_VALUE_INVALID;
+          value->required_type = XA_WM_HINTS;
           break;
         case META_PROP_VALUE_CLASS_HINT:
-          if (!class_hint_from_results (&results, &values[i].v.class_hint))
-            values[i].type = META_PROP_VALUE_INVALID;
+          value->required_type = XA_STRING;
           break;
         case META_PROP_VALUE_SIZE_HINTS:
-          if (!size_hints_from_results (&results,
-                                        &values[i].v.size_hints.hints,
-                                        &values[i].v.size_hints.flags))
-            values[i].type = META_PROP_VALUE_INVALID;
+          value->required_type = XA_WM_SIZE_HINTS;
           break;
         case META_PROP_VALUE_SYNC_COUNTER:
-#ifdef HAVE_XSYNC
-          if (!counter_from_results (&results,
-                                     &values[i].v.xcounter))
-            values[i].type = META_PROP_VALUE_INVALID;
-#else
-          values[i].type = META_PROP_VALUE_INVALID;
-          if (results.prop)
-            {
-              XFree (results.prop);
-              results.prop = NULL;
-            }
-#endif
+          value->required_type = XA_CARDINAL;
           break;
         }
+    }
+}
 
-    next:
-      ++i;
+AgGetPropertyTask*
+meta_prop_request_value (MetaDisplay   *display,
+                         Window         xwindow,
+                         MetaPropValue *value)
+{
+  set_required_type (display, value);
+
+  if (value->atom == None)
+    return NULL;
+
+  return get_task (display, xwindow,
+                   value->atom, value->required_type);
+}
+
+void
+meta_prop_collect_value (MetaDisplay       *display,
+                         Window             xwindow,
+                         AgGetPropertyTask *task,
+                         MetaPropValue     *value)
+{
+  GetPropertyResults results;
+
+  if (task == NULL)
+    {
+      /* Probably value->type was None, or ag_task_create()
+       * returned NULL.
+       */
+      value->type = META_PROP_VALUE_INVALID;
+      return;
+    }
+
+  g_assert (ag_task_have_reply (task));
+
+  results.display = display;
+  results.xwindow = xwindow;
+  results.xatom = value->atom;
+  results.prop = NULL;
+  results.n_items = 0;
+  results.type = None;
+  results.bytes_after = 0;
+  results.format = 0;
+
+  if (ag_task_get_reply_and_free (task,
+                                  &results.type, &results.format,
+                                  &results.n_items,
+                                  &results.bytes_after,
+                                  &results.prop) != Success ||
+      results.type == None)
+    {
+      value->type = META_PROP_VALUE_INVALID;
+      if (results.prop)
+        {
+          XFree (results.prop);
+          results.prop = NULL;
+        }
+      return;
     }
 
+  switch (value->type)
+    {
+    case META_PROP_VALUE_INVALID:
+      g_assert_not_reached ();
+      break;
+    case META_PROP_VALUE_UTF8_LIST:
+      if (!utf8_list_from_results (&results,
+                                   &value->v.string_list.strings,
+                                   &value->v.string_list.n_strings))
+        value->type = META_PROP_VALUE_INVALID;
+      break;
+    case META_PROP_VALUE_UTF8:
+      if (!utf8_string_from_results (&results,
+                                     &value->v.str))
+        value->type = META_PROP_VALUE_INVALID;
+      break;
+    case META_PROP_VALUE_STRING:
+      if (!latin1_string_from_results (&results,
+                                       &value->v.str))
+        value->type = META_PROP_VALUE_INVALID;
+      break;
+    case META_PROP_VALUE_STRING_AS_UTF8:
+      if (!latin1_string_from_results (&results,
+                                       &value->v.str))
+        value->type = META_PROP_VALUE_INVALID;
+      else
+        {
+          char *new_str;
+          char *xmalloc_new_str;
+
+          new_str = latin1_to_utf8 (value->v.str);
+          xmalloc_new_str = ag_Xmalloc (strlen (new_str) + 1);
+          if (xmalloc_new_str != NULL)
+            {
+              g_strlcpy (xmalloc_new_str, new_str, (strlen (new_str) + 1));
+              meta_XFree (value->v.str);
+              value->v.str = xmalloc_new_str;
+            }
+
+          g_free (new_str);
+        }
+      break;
+    case META_PROP_VALUE_MOTIF_HINTS:
+      if (!motif_hints_from_results (&results,
+                                     &value->v.motif_hints))
+        value->type = META_PROP_VALUE_INVALID;
+      break;
+    case META_PROP_VALUE_CARDINAL_LIST:
+      if (!cardinal_list_from_results (&results,
+                                       &value->v.cardinal_list.cardinals,
+                                       &value->v.cardinal_list.n_cardinals))
+        value->type = META_PROP_VALUE_INVALID;
+      break;
+    case META_PROP_VALUE_CARDINAL:
+      if (!cardinal_with_atom_type_from_results (&results,
+                                                 value->required_type,
+                                                 &value->v.cardinal))
+        value->type = META_PROP_VALUE_INVALID;
+      break;
+    case META_PROP_VALUE_WINDOW:
+      if (!window_from_results (&results,
+                                &value->v.xwindow))
+        value->type = META_PROP_VALUE_INVALID;
+      break;
+    case META_PROP_VALUE_ATOM_LIST:
+      if (!atom_list_from_results (&results,
+                                   &value->v.atom_list.atoms,
+                                   &value->v.atom_list.n_atoms))
+        value->type = META_PROP_VALUE_INVALID;
+      break;
+    case META_PROP_VALUE_TEXT_PROPERTY:
+      if (!text_property_from_results (&results, &value->v.str))
+        value->type = META_PROP_VALUE_INVALID;
+      break;
+    case META_PROP_VALUE_WM_HINTS:
+      if (!wm_hints_from_results (&results, &value->v.wm_hints))
+        value->type = META_PROP_VALUE_INVALID;
+      break;
+    case META_PROP_VALUE_CLASS_HINT:
+      if (!class_hint_from_results (&results, &value->v.class_hint))
+        value->type = META_PROP_VALUE_INVALID;
+      break;
+    case META_PROP_VALUE_SIZE_HINTS:
+      if (!size_hints_from_results (&results,
+                                    &value->v.size_hints.hints,
+                                    &value->v.size_hints.flags))
+        value->type = META_PROP_VALUE_INVALID;
+      break;
+    case META_PROP_VALUE_SYNC_COUNTER:
+#ifdef HAVE_XSYNC
+      if (!counter_from_results (&results,
+                                 &value->v.xcounter))
+        value->type = META_PROP_VALUE_INVALID;
+#else
+      value->type = META_PROP_VALUE_INVALID;
+      if (results.prop)
+        {
+          XFree (results.prop);
+          results.prop = NULL;
+        }
+#endif
+      break;
+    }
+}
+
+void
+meta_prop_get_values (MetaDisplay   *display,
+                      Window         xwindow,
+                      MetaPropValue *values,
+                      int            n_values)
+{
+  int i;
+  AgGetPropertyTask **tasks;
+
+  meta_verbose ("Requesting %d properties of 0x%lx at once\n",
+                n_values, xwindow);
+
+  if (n_values == 0)
+    return;
+
+  tasks = g_new0 (AgGetPropertyTask*, n_values);
+
+  /* Start up tasks. The "values" array can have values
+   * with atom == None, which means to ignore that element.
+   */
+  for (i = 0; i < n_values; i++)
+    tasks[i] = meta_prop_request_value (display, xwindow, &values[i]);
+
+  /* Get replies for all our tasks */
+  meta_topic (META_DEBUG_SYNC, "Syncing to get %d GetProperty replies in %s\n",
+              n_values, G_STRFUNC);
+  XSync (display->xdisplay, False);
+
+  /* Collect results; other tasks may have completed in the
+   * meantime, so go by our own list rather than the completed queue.
+   */
+  for (i = 0; i < n_values; i++)
+    meta_prop_collect_value (display, xwindow, tasks[i], &values[i]);
+
   g_free (tasks);
 }
 
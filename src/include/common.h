@@ -345,6 +345,7 @@ void meta_frame_borders_clear (MetaFrameBorders *self);
 
 #define META_PRIORITY_PREFS_NOTIFY   (G_PRIORITY_DEFAULT_IDLE + 10)
 #define META_PRIORITY_WORK_AREA_HINT (G_PRIORITY_DEFAULT_IDLE + 15)
+#define META_PRIORITY_EDGE_INDEX     (G_PRIORITY_DEFAULT_IDLE + 20)
 
 #define POINT_IN_RECT(xcoord, ycoord, rect) \
  ((xcoord) >= (rect).x &&                   \
@@ -72,4 +72,5 @@ void meta_compositor_maximize_window   (MetaCompositor *compositor,
                                         MetaWindow     *window);
 void meta_compositor_unmaximize_window (MetaCompositor *compositor,
                                         MetaWindow     *window);
+gint64 meta_compositor_get_frame_interval (MetaCompositor *compositor);
 #endif
@@ -51,6 +51,7 @@ typedef enum
   META_CORE_GET_THEME_VARIANT,
   META_CORE_GET_SCREEN_WIDTH,
   META_CORE_GET_SCREEN_HEIGHT,
+  META_CORE_GET_FRAME_OBSCURED_REGION,
 } MetaCoreGetType;
 
 /* General information function about the given window. Pass in a sequence of
@@ -38,6 +38,7 @@ G_DECLARE_FINAL_TYPE (MetaWindow, meta_window, META, WINDOW, GObject)
 MetaFrame *meta_window_get_frame (MetaWindow *window);
 gboolean meta_window_has_focus (MetaWindow *window);
 gboolean meta_window_is_shaded (MetaWindow *window);
+gboolean meta_window_has_shape (MetaWindow *window);
 MetaRectangle *meta_window_get_rect (MetaWindow *window);
 MetaScreen *meta_window_get_screen (MetaWindow *window);
 MetaDisplay *meta_window_get_display (MetaWindow *window);
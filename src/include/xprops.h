@@ -220,5 +220,20 @@ void meta_prop_get_values (MetaDisplay   *display,
 void meta_prop_free_values (MetaPropValue *values,
                             int            n_values);
 
+/* The two halves of meta_prop_get_values(), for callers that want to
+ * send requests now and pick up the replies later.  The value's type
+ * and atom are initialized as above; the task returned by
+ * meta_prop_request_value() (possibly NULL) must be handed to
+ * meta_prop_collect_value() once it has its reply.
+ */
+struct _AgGetPropertyTask* meta_prop_request_value (MetaDisplay   *display,
+                                                    Window         xwindow,
+                                                    MetaPropValue *value);
+
+void meta_prop_collect_value (MetaDisplay               *display,
+                              Window                     xwindow,
+                              struct _AgGetPropertyTask *task,
+                              MetaPropValue             *value);
+
 #endif
 
@@ -76,9 +76,12 @@ static gboolean meta_frames_leave_notify_event    (GtkWidget           *widget,
 static void meta_frames_attach_style (MetaFrames  *frames,
                                       MetaUIFrame *frame);
 
-static void meta_frames_paint_to_drawable (MetaFrames   *frames,
-                                           MetaUIFrame  *frame,
-                                           cairo_t      *cr);
+static void meta_frames_paint_to_drawable (MetaFrames      *frames,
+                                           MetaUIFrame     *frame,
+                                           cairo_t         *cr,
+                                           MetaButtonState *button_states);
+static void get_button_states (MetaUIFrame     *frame,
+                               MetaButtonState *button_states);
 
 static void meta_frames_calc_geometry (MetaFrames        *frames,
                                        MetaUIFrame         *frame,
@@ -101,6 +104,10 @@ static MetaFrameControl get_control  (MetaFrames        *frames,
                                       int                y);
 static void clear_tip (MetaFrames *frames);
 static void invalidate_all_caches (MetaFrames *frames);
+static void free_cached_piece (gpointer data);
+static guint cached_piece_hash (gconstpointer key);
+static gboolean cached_piece_equal (gconstpointer a,
+                                    gconstpointer b);
 static void invalidate_whole_window (MetaFrames *frames,
                                      MetaUIFrame *frame);
 
@@ -257,9 +264,13 @@ meta_frames_init (MetaFrames *frames)
 
   frames->expose_delay_count = 0;
 
-  frames->invalidate_cache_timeout_id = 0;
-  frames->invalidate_frames = NULL;
-  frames->cache = g_hash_table_new (g_direct_hash, g_direct_equal);
+  frames->piece_cache = g_hash_table_new_full (cached_piece_hash,
+                                               cached_piece_equal,
+                                               NULL, free_cached_piece);
+  frames->piece_lru = g_queue_new ();
+  frames->piece_cache_size = 0;
+  frames->piece_cache_theme = NULL;
+  frames->corner_rows = g_hash_table_new_full (NULL, NULL, NULL, g_free);
   frames->style_variants = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                   g_free, g_object_unref);
   update_style_contexts (frames);
@@ -328,86 +339,182 @@ meta_frames_finalize (GObject *object)
   g_hash_table_destroy (frames->text_heights);
 
   invalidate_all_caches (frames);
-  if (frames->invalidate_cache_timeout_id)
-    g_source_remove (frames->invalidate_cache_timeout_id);
 
   g_assert (g_hash_table_size (frames->frames) == 0);
   g_hash_table_destroy (frames->frames);
-  g_hash_table_destroy (frames->cache);
+  g_hash_table_destroy (frames->piece_cache);
+  g_queue_free (frames->piece_lru);
+  g_hash_table_destroy (frames->corner_rows);
 
   G_OBJECT_CLASS (meta_frames_parent_class)->finalize (object);
 }
 
+/* Upper bound on the memory used by rendered frame pieces */
+#define MAX_PIECE_CACHE_SIZE (16 * 1024 * 1024)
+
+/* Everything that goes into rendering a piece of a frame.  Frames
+ * which agree on all of it look the same, so they can share the
+ * rendered pieces; the title, icons and buttons are only ever drawn
+ * in the titlebar, so they are left out for the other pieces.
+ */
 typedef struct
 {
-  cairo_rectangle_int_t rect;
-  cairo_surface_t *pixmap;
-} CachedFramePiece;
+  MetaTheme *theme;
+  MetaFrameStyle *style;
+  GtkStyleContext *style_context;
+  MetaFrameType type;
+  MetaFrameFlags flags;
+  int width;
+  int height;
+  int text_height;
+  int scale;
+  /* Order: top (titlebar), left, right, bottom. */
+  int piece;
+
+  /* Only set for the titlebar.  The buttons are cached in their
+   * normal state; a prelit or pressed one is painted over the piece.
+   */
+  char *title;
+  GdkPixbuf *mini_icon;
+  GdkPixbuf *icon;
+  MetaButtonState button_states[META_BUTTON_TYPE_LAST];
+} CachedPieceKey;
 
 typedef struct
 {
-  /* Caches of the four rendered sides in a MetaFrame.
-   * Order: top (titlebar), left, right, bottom.
-   */
-  CachedFramePiece piece[4];
-} CachedPixels;
+  CachedPieceKey key;
+  cairo_surface_t *pixmap;
+  gsize size;
+
+  /* in frames->piece_lru */
+  GList *link;
+} CachedFramePiece;
 
-static CachedPixels *
-get_cache (MetaFrames *frames,
-           MetaUIFrame *frame)
+static guint
+cached_piece_hash (gconstpointer key)
 {
-  CachedPixels *pixels;
+  const CachedPieceKey *k = key;
+  guint hash;
+  int i;
 
-  pixels = g_hash_table_lookup (frames->cache, frame);
+  hash = GPOINTER_TO_UINT (k->style);
+  hash = hash * 31 + k->flags;
+  hash = hash * 31 + k->width;
+  hash = hash * 31 + k->height;
+  hash = hash * 31 + k->piece;
 
-  if (!pixels)
-    {
-      pixels = g_new0 (CachedPixels, 1);
-      g_hash_table_insert (frames->cache, frame, pixels);
-    }
+  if (k->title)
+    hash = hash * 31 + g_str_hash (k->title);
+
+  for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+    hash = hash * 3 + k->button_states[i];
+
+  return hash;
+}
 
-  return pixels;
+static gboolean
+cached_piece_equal (gconstpointer a,
+                    gconstpointer b)
+{
+  const CachedPieceKey *ka = a;
+  const CachedPieceKey *kb = b;
+
+  return ka->theme == kb->theme &&
+    ka->style == kb->style &&
+    ka->style_context == kb->style_context &&
+    ka->type == kb->type &&
+    ka->flags == kb->flags &&
+    ka->width == kb->width &&
+    ka->height == kb->height &&
+    ka->text_height == kb->text_height &&
+    ka->scale == kb->scale &&
+    ka->piece == kb->piece &&
+    g_strcmp0 (ka->title, kb->title) == 0 &&
+    ka->mini_icon == kb->mini_icon &&
+    ka->icon == kb->icon &&
+    memcmp (ka->button_states, kb->button_states,
+            sizeof (ka->button_states)) == 0;
 }
 
 static void
-invalidate_cache (MetaFrames *frames,
-                  MetaUIFrame *frame)
+free_cached_piece (gpointer data)
 {
-  CachedPixels *pixels = get_cache (frames, frame);
-  int i;
+  CachedFramePiece *piece = data;
 
-  for (i = 0; i < 4; i++)
-    if (pixels->piece[i].pixmap)
-      cairo_surface_destroy (pixels->piece[i].pixmap);
+  g_free (piece->key.title);
+
+  /* We hold references on the icons so that their addresses
+   * can't be reused for other icons while they're in a key
+   */
+  if (piece->key.mini_icon)
+    g_object_unref (piece->key.mini_icon);
+  if (piece->key.icon)
+    g_object_unref (piece->key.icon);
+
+  cairo_surface_destroy (piece->pixmap);
 
-  g_free (pixels);
-  g_hash_table_remove (frames->cache, frame);
+  g_free (piece);
+}
+
+static void
+remove_cached_piece (MetaFrames       *frames,
+                     CachedFramePiece *piece)
+{
+  g_queue_delete_link (frames->piece_lru, piece->link);
+  frames->piece_cache_size -= piece->size;
+
+  g_hash_table_remove (frames->piece_cache, &piece->key);
 }
 
 static void
 invalidate_all_caches (MetaFrames *frames)
 {
-  GList *l;
+  g_queue_clear (frames->piece_lru);
+  g_hash_table_remove_all (frames->piece_cache);
+  g_hash_table_remove_all (frames->corner_rows);
 
-  for (l = frames->invalidate_frames; l; l = l->next)
-    {
-      MetaUIFrame *frame = l->data;
+  frames->piece_cache_size = 0;
+}
+
+static CachedFramePiece *
+lookup_cached_piece (MetaFrames     *frames,
+                     CachedPieceKey *key)
+{
+  CachedFramePiece *piece;
+
+  piece = g_hash_table_lookup (frames->piece_cache, key);
 
-      invalidate_cache (frames, frame);
+  if (piece)
+    {
+      g_queue_unlink (frames->piece_lru, piece->link);
+      g_queue_push_head_link (frames->piece_lru, piece->link);
     }
 
-  g_list_free (frames->invalidate_frames);
-  frames->invalidate_frames = NULL;
+  return piece;
 }
 
-static gboolean
-invalidate_cache_timeout (gpointer data)
+static void
+insert_cached_piece (MetaFrames       *frames,
+                     CachedFramePiece *piece)
 {
-  MetaFrames *frames = data;
+  CachedPieceKey *key = &piece->key;
 
-  invalidate_all_caches (frames);
-  frames->invalidate_cache_timeout_id = 0;
-  return FALSE;
+  key->title = g_strdup (key->title);
+  if (key->mini_icon)
+    g_object_ref (key->mini_icon);
+  if (key->icon)
+    g_object_ref (key->icon);
+
+  g_queue_push_head (frames->piece_lru, piece);
+  piece->link = frames->piece_lru->head;
+  frames->piece_cache_size += piece->size;
+
+  g_hash_table_insert (frames->piece_cache, key, piece);
+
+  /* Evict least recently used pieces, but always keep the new one */
+  while (frames->piece_cache_size > MAX_PIECE_CACHE_SIZE &&
+         frames->piece_lru->tail->data != piece)
+    remove_cached_piece (frames, frames->piece_lru->tail->data);
 }
 
 static void
@@ -442,6 +549,8 @@ meta_frames_font_changed (MetaFrames *frames)
       frames->text_heights = g_hash_table_new (NULL, NULL);
     }
 
+  invalidate_all_caches (frames);
+
   /* Queue a draw/resize on all frames */
   g_hash_table_foreach (frames->frames,
                         queue_recalc_func, frames);
@@ -463,6 +572,8 @@ queue_draw_func (gpointer key, gpointer value, gpointer data)
 static void
 meta_frames_button_layout_changed (MetaFrames *frames)
 {
+  invalidate_all_caches (frames);
+
   g_hash_table_foreach (frames->frames,
                         queue_draw_func, frames);
 }
@@ -693,6 +804,8 @@ meta_frames_manage_window (MetaFrames *frames,
   frame->title = NULL;
   frame->expose_delayed = FALSE;
   frame->shape_applied = FALSE;
+  frame->visible_region = NULL;
+  frame->applied_shape = NULL;
   frame->prelit_control = META_FRAME_CONTROL_NONE;
 
   meta_core_grab_buttons (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), frame->xwindow);
@@ -712,11 +825,6 @@ meta_frames_unmanage_window (MetaFrames *frames,
 
   if (frame)
     {
-      /* invalidating all caches ensures the frame
-       * is not actually referenced anymore
-       */
-      invalidate_all_caches (frames);
-
       /* restore the cursor */
       meta_core_set_screen_cursor (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
                                    frame->xwindow,
@@ -739,6 +847,9 @@ meta_frames_unmanage_window (MetaFrames *frames,
       if (frame->title)
         g_free (frame->title);
 
+      g_clear_pointer (&frame->visible_region, cairo_region_destroy);
+      g_clear_pointer (&frame->applied_shape, cairo_region_destroy);
+
       g_free (frame);
     }
   else
@@ -930,6 +1041,38 @@ get_visible_frame_rect (MetaFrameGeometry     *fgeom,
   rect->height = window_height - fgeom->borders.invisible.bottom - rect->y;
 }
 
+/* The widths of the rows a rounded corner of the given radius cuts off
+ * the frame, outermost row first.  They only depend on the radius, so
+ * they are worked out once for each radius the current theme uses.
+ */
+static const int *
+get_corner_rows (MetaFrames *frames,
+                 int         corner)
+{
+  int *rows;
+
+  rows = g_hash_table_lookup (frames->corner_rows, GINT_TO_POINTER (corner));
+
+  if (rows == NULL)
+    {
+      const float radius = sqrt(corner) + corner;
+      int i;
+
+      rows = g_new (int, corner);
+
+      for (i=0; i<corner; i++)
+        rows[i] = floor(0.5 + radius - sqrt(radius*radius - (radius-(i+0.5))*(radius-(i+0.5))));
+
+      g_hash_table_insert (frames->corner_rows, GINT_TO_POINTER (corner), rows);
+    }
+
+  return rows;
+}
+
+/* Returns a reference to the frame's cached visible region, which is
+ * only rebuilt when the frame's size or corners change.  It is shared,
+ * so copy it before modifying it.
+ */
 static cairo_region_t *
 get_visible_region (MetaFrames        *frames,
                     MetaUIFrame       *frame,
@@ -941,9 +1084,10 @@ get_visible_region (MetaFrames        *frames,
   cairo_region_t *visible_region;
   cairo_rectangle_int_t rect;
   cairo_rectangle_int_t frame_rect;
+  int corners[4];
   gint scale;
+  int i, j;
 
-  corners_region = cairo_region_create ();
   scale = gdk_window_get_scale_factor (frame->window);
 
   fgeom->borders.invisible.top *= scale;
@@ -953,71 +1097,45 @@ get_visible_region (MetaFrames        *frames,
 
   get_visible_frame_rect (fgeom, window_width, window_height, &frame_rect);
 
-  if (fgeom->top_left_corner_rounded_radius != 0)
-    {
-      const int corner = fgeom->top_left_corner_rounded_radius * scale;
-      const float radius = sqrt(corner) + corner;
-      int i;
+  /* Order: top left, top right, bottom left, bottom right */
+  corners[0] = fgeom->top_left_corner_rounded_radius * scale;
+  corners[1] = fgeom->top_right_corner_rounded_radius * scale;
+  corners[2] = fgeom->bottom_left_corner_rounded_radius * scale;
+  corners[3] = fgeom->bottom_right_corner_rounded_radius * scale;
 
-      for (i=0; i<corner; i++)
-        {
-          const int width = floor(0.5 + radius - sqrt(radius*radius - (radius-(i+0.5))*(radius-(i+0.5))));
-          rect.x = frame_rect.x;
-          rect.y = frame_rect.y + i;
-          rect.width = width;
-          rect.height = 1;
+  if (frame->visible_region != NULL &&
+      frame->visible_region_rect.x == frame_rect.x &&
+      frame->visible_region_rect.y == frame_rect.y &&
+      frame->visible_region_rect.width == frame_rect.width &&
+      frame->visible_region_rect.height == frame_rect.height &&
+      memcmp (frame->visible_region_corners, corners, sizeof (corners)) == 0)
+    return cairo_region_reference (frame->visible_region);
 
-          cairo_region_union_rectangle (corners_region, &rect);
-        }
-    }
+  corners_region = cairo_region_create ();
 
-  if (fgeom->top_right_corner_rounded_radius != 0)
+  for (j = 0; j < 4; j++)
     {
-      const int corner = fgeom->top_right_corner_rounded_radius * scale;
-      const float radius = sqrt(corner) + corner;
-      int i;
+      const int *rows;
 
-      for (i=0; i<corner; i++)
-        {
-          const int width = floor(0.5 + radius - sqrt(radius*radius - (radius-(i+0.5))*(radius-(i+0.5))));
-          rect.x = frame_rect.x + frame_rect.width - width;
-          rect.y = frame_rect.y + i;
-          rect.width = width;
-          rect.height = 1;
-
-          cairo_region_union_rectangle (corners_region, &rect);
-        }
-    }
+      if (corners[j] == 0)
+        continue;
 
-  if (fgeom->bottom_left_corner_rounded_radius != 0)
-    {
-      const int corner = fgeom->bottom_left_corner_rounded_radius * scale;
-      const float radius = sqrt(corner) + corner;
-      int i;
+      rows = get_corner_rows (frames, corners[j]);
 
-      for (i=0; i<corner; i++)
+      for (i=0; i<corners[j]; i++)
         {
-          const int width = floor(0.5 + radius - sqrt(radius*radius - (radius-(i+0.5))*(radius-(i+0.5))));
-          rect.x = frame_rect.x;
-          rect.y = frame_rect.y + frame_rect.height - i - 1;
-          rect.width = width;
-          rect.height = 1;
+          const int width = rows[i];
 
-          cairo_region_union_rectangle (corners_region, &rect);
-        }
-    }
+          if (j == 0 || j == 2)
+            rect.x = frame_rect.x;
+          else
+            rect.x = frame_rect.x + frame_rect.width - width;
 
-  if (fgeom->bottom_right_corner_rounded_radius != 0)
-    {
-      const int corner = fgeom->bottom_right_corner_rounded_radius * scale;
-      const float radius = sqrt(corner) + corner;
-      int i;
+          if (j < 2)
+            rect.y = frame_rect.y + i;
+          else
+            rect.y = frame_rect.y + frame_rect.height - i - 1;
 
-      for (i=0; i<corner; i++)
-        {
-          const int width = floor(0.5 + radius - sqrt(radius*radius - (radius-(i+0.5))*(radius-(i+0.5))));
-          rect.x = frame_rect.x + frame_rect.width - width;
-          rect.y = frame_rect.y + frame_rect.height - i - 1;
           rect.width = width;
           rect.height = 1;
 
@@ -1029,6 +1147,13 @@ get_visible_region (MetaFrames        *frames,
   cairo_region_subtract (visible_region, corners_region);
   cairo_region_destroy (corners_region);
 
+  if (frame->visible_region != NULL)
+    cairo_region_destroy (frame->visible_region);
+
+  frame->visible_region = cairo_region_reference (visible_region);
+  frame->visible_region_rect = frame_rect;
+  memcpy (frame->visible_region_corners, corners, sizeof (corners));
+
   return visible_region;
 }
 
@@ -1084,25 +1209,31 @@ meta_frames_apply_shapes (MetaFrames  *frames,
 
   display = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
 
-  if (frame->shape_applied)
-    {
-      meta_topic (META_DEBUG_SHAPES,
-                  "Unsetting shape mask on frame 0x%lx\n",
-                  frame->xwindow);
-
-      XShapeCombineMask (display, frame->xwindow,
-                         ShapeBounding, 0, 0, None, ShapeSet);
-      frame->shape_applied = FALSE;
-    }
-
   meta_frames_calc_geometry (frames, frame, &fgeom);
 
   compositing_manager = meta_prefs_get_compositing_manager () &&
                         meta_display &&
                         !!(meta_display_get_compositor (meta_display));
 
+  /* Setting a shape replaces the old one, so the old one only needs
+   * unsetting when the frame is to have none.
+   */
   if (!window_has_shape && compositing_manager)
-    return;
+    {
+      if (frame->shape_applied)
+        {
+          meta_topic (META_DEBUG_SHAPES,
+                      "Unsetting shape mask on frame 0x%lx\n",
+                      frame->xwindow);
+
+          XShapeCombineMask (display, frame->xwindow,
+                             ShapeBounding, 0, 0, None, ShapeSet);
+          frame->shape_applied = FALSE;
+        }
+
+      g_clear_pointer (&frame->applied_shape, cairo_region_destroy);
+      return;
+    }
 
   window_region = get_visible_region (frames,
                                       frame,
@@ -1169,7 +1300,8 @@ meta_frames_apply_shapes (MetaFrames  *frames,
                                          new_window_width,
                                          new_window_height);
 
-      tmp_region = compositing_manager ? frame_region : window_region;
+      tmp_region = cairo_region_copy (compositing_manager ?
+                                      frame_region : window_region);
 
       cairo_region_subtract (tmp_region, client_region);
 
@@ -1178,6 +1310,7 @@ meta_frames_apply_shapes (MetaFrames  *frames,
       apply_cairo_region_to_window (display, shape_window,
                                     tmp_region, ShapeUnion);
 
+      cairo_region_destroy (tmp_region);
       cairo_region_destroy (frame_region);
 
       /* Now copy shape_window shape to the real frame */
@@ -1188,6 +1321,15 @@ meta_frames_apply_shapes (MetaFrames  *frames,
                           ShapeSet);
 
       XDestroyWindow (display, shape_window);
+
+      g_clear_pointer (&frame->applied_shape, cairo_region_destroy);
+    }
+  else if (frame->applied_shape != NULL &&
+           cairo_region_equal (frame->applied_shape, window_region))
+    {
+      meta_topic (META_DEBUG_SHAPES,
+                  "Frame 0x%lx already has this shape\n",
+                  frame->xwindow);
     }
   else
     {
@@ -1197,10 +1339,13 @@ meta_frames_apply_shapes (MetaFrames  *frames,
                   "Frame 0x%lx has shaped corners\n",
                   frame->xwindow);
 
-      if (!compositing_manager)
-        apply_cairo_region_to_window (display,
-                                      frame->xwindow, window_region,
-                                      ShapeSet);
+      apply_cairo_region_to_window (display,
+                                    frame->xwindow, window_region,
+                                    ShapeSet);
+
+      if (frame->applied_shape != NULL)
+        cairo_region_destroy (frame->applied_shape);
+      frame->applied_shape = cairo_region_reference (window_region);
     }
 
   frame->shape_applied = TRUE;
@@ -1473,7 +1618,6 @@ redraw_control (MetaFrames *frames,
   rect = control_rect (control, &fgeom);
 
   gdk_window_invalidate_rect (frame->window, rect, FALSE);
-  invalidate_cache (frames, frame);
 }
 
 static gboolean
@@ -2362,8 +2506,9 @@ meta_frames_destroy_event           (GtkWidget           *widget,
   return TRUE;
 }
 
-/* Returns a pixmap with a piece of the windows frame painted on it.
-*/
+/* Returns a pixmap with a piece of the windows frame painted on it,
+ * with all buttons in their normal state.
+ */
 static cairo_surface_t *
 generate_pixmap (MetaFrames            *frames,
                  MetaUIFrame           *frame,
@@ -2371,6 +2516,8 @@ generate_pixmap (MetaFrames            *frames,
 {
   cairo_surface_t *result;
   cairo_t *cr;
+  MetaButtonState button_states[META_BUTTON_TYPE_LAST];
+  int i;
 
   /* do not create a pixmap for nonexisting areas */
   if (rect->width <= 0 || rect->height <= 0)
@@ -2380,26 +2527,95 @@ generate_pixmap (MetaFrames            *frames,
                                               CAIRO_CONTENT_COLOR_ALPHA,
                                               rect->width, rect->height);
 
+  for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+    button_states[i] = META_BUTTON_STATE_NORMAL;
+
   cr = cairo_create (result);
   cairo_translate (cr, -rect->x, -rect->y);
 
-  meta_frames_paint_to_drawable (frames, frame, cr);
+  meta_frames_paint_to_drawable (frames, frame, cr, button_states);
 
   cairo_destroy (cr);
 
   return result;
 }
 
+/* The titlebar is cached with all buttons in their normal state, so
+ * draw the one that is prelit or pressed on top of it.  Only that
+ * button is drawn, which is also all redraw_control() invalidates
+ * when the pointer moves between buttons.
+ */
 static void
-populate_cache (MetaFrames *frames,
-                MetaUIFrame *frame)
+draw_prelit_control (MetaFrames      *frames,
+                     MetaUIFrame     *frame,
+                     cairo_t         *cr,
+                     cairo_region_t  *region,
+                     MetaButtonState *button_states)
+{
+  MetaFrameGeometry fgeom;
+  MetaFrameFlags flags;
+  MetaFrameType type;
+  MetaFrameStyle *style;
+  GdkPixbuf *mini_icon;
+  GdkPixbuf *icon;
+  GdkRectangle *rect;
+  int i;
+
+  meta_frames_calc_geometry (frames, frame, &fgeom);
+
+  rect = control_rect (frame->prelit_control, &fgeom);
+
+  if (rect == NULL || rect->width <= 0 || rect->height <= 0 ||
+      cairo_region_contains_rectangle (region, rect) ==
+      CAIRO_REGION_OVERLAP_OUT)
+    return;
+
+  meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), frame->xwindow,
+                 META_CORE_GET_FRAME_FLAGS, &flags,
+                 META_CORE_GET_FRAME_TYPE, &type,
+                 META_CORE_GET_MINI_ICON, &mini_icon,
+                 META_CORE_GET_ICON, &icon,
+                 META_CORE_GET_END);
+
+  style = meta_theme_get_frame_style (meta_theme_get_current (), type, flags);
+  if (style == NULL)
+    return;
+
+  for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+    if (button_states[i] != META_BUTTON_STATE_NORMAL)
+      meta_frame_style_draw_button_with_style (style,
+                                               frame->style,
+                                               cr,
+                                               &fgeom,
+                                               frame->text_layout,
+                                               i,
+                                               button_states[i],
+                                               mini_icon,
+                                               icon);
+}
+
+/* Paints the four visible frame borders from the cache, rendering any
+ * that aren't in it yet, and takes them out of region.  Borders that
+ * don't intersect region are left alone.
+ */
+static void
+draw_cached_pieces (MetaFrames     *frames,
+                    MetaUIFrame    *frame,
+                    cairo_t        *cr,
+                    cairo_region_t *region)
 {
   MetaFrameBorders borders;
   int width, height;
   int frame_width, frame_height, screen_width, screen_height;
-  CachedPixels *pixels;
+  cairo_rectangle_int_t rects[4];
+  CachedPieceKey key;
   MetaFrameType frame_type;
   MetaFrameFlags frame_flags;
+  GdkPixbuf *mini_icon;
+  GdkPixbuf *icon;
+  MetaTheme *theme;
+  MetaButtonState button_states[META_BUTTON_TYPE_LAST];
+  gboolean buttons_normal;
   int i;
 
   meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), frame->xwindow,
@@ -2411,6 +2627,8 @@ populate_cache (MetaFrames *frames,
                  META_CORE_GET_CLIENT_HEIGHT, &height,
                  META_CORE_GET_FRAME_TYPE, &frame_type,
                  META_CORE_GET_FRAME_FLAGS, &frame_flags,
+                 META_CORE_GET_MINI_ICON, &mini_icon,
+                 META_CORE_GET_ICON, &icon,
                  META_CORE_GET_END);
 
   /* don't cache extremely large windows */
@@ -2420,13 +2638,22 @@ populate_cache (MetaFrames *frames,
       return;
     }
 
-  meta_theme_get_frame_borders (meta_theme_get_current (),
+  theme = meta_theme_get_current ();
+
+  /* Styles belong to the theme, so start afresh when it changes */
+  if (theme != frames->piece_cache_theme)
+    {
+      invalidate_all_caches (frames);
+      frames->piece_cache_theme = theme;
+    }
+
+  meta_theme_get_frame_borders (theme,
                                 frame_type,
                                 frame->text_height,
                                 frame_flags,
                                 &borders);
 
-  pixels = get_cache (frames, frame);
+  meta_frames_ensure_layout (frames, frame);
 
   /* Setup the rectangles for the four visible frame borders. First top, then
    * left, right and bottom. Top and bottom extend to the invisible borders
@@ -2440,44 +2667,99 @@ populate_cache (MetaFrames *frames,
    * size without any border added. */
 
   /* top */
-  pixels->piece[0].rect.x = 0;
-  pixels->piece[0].rect.y = 0;
-  pixels->piece[0].rect.width = width + borders.total.left + borders.total.right;
-  pixels->piece[0].rect.height = borders.total.top;
+  rects[0].x = 0;
+  rects[0].y = 0;
+  rects[0].width = width + borders.total.left + borders.total.right;
+  rects[0].height = borders.total.top;
 
   /* left */
-  pixels->piece[1].rect.x = 0;
-  pixels->piece[1].rect.y = borders.total.top;
-  pixels->piece[1].rect.width = borders.total.left;
-  pixels->piece[1].rect.height = height;
+  rects[1].x = 0;
+  rects[1].y = borders.total.top;
+  rects[1].width = borders.total.left;
+  rects[1].height = height;
 
   /* right */
-  pixels->piece[2].rect.x = borders.total.left + width;
-  pixels->piece[2].rect.y = borders.total.top;
-  pixels->piece[2].rect.width = borders.total.right;
-  pixels->piece[2].rect.height = height;
+  rects[2].x = borders.total.left + width;
+  rects[2].y = borders.total.top;
+  rects[2].width = borders.total.right;
+  rects[2].height = height;
 
   /* bottom */
-  pixels->piece[3].rect.x = 0;
-  pixels->piece[3].rect.y = borders.total.top + height;
-  pixels->piece[3].rect.width = width + borders.total.left + borders.total.right;
-  pixels->piece[3].rect.height = borders.total.bottom;
+  rects[3].x = 0;
+  rects[3].y = borders.total.top + height;
+  rects[3].width = width + borders.total.left + borders.total.right;
+  rects[3].height = borders.total.bottom;
+
+  memset (&key, 0, sizeof (key));
+  key.theme = theme;
+  key.style = frame->cache_style;
+  key.style_context = frame->style;
+  key.type = frame_type;
+  key.flags = frame_flags;
+  key.width = width;
+  key.height = height;
+  key.text_height = frame->text_height;
+  key.scale = gdk_window_get_scale_factor (frame->window);
+
+  get_button_states (frame, button_states);
+  buttons_normal = TRUE;
+  for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+    if (button_states[i] != META_BUTTON_STATE_NORMAL)
+      buttons_normal = FALSE;
 
   for (i = 0; i < 4; i++)
     {
-      CachedFramePiece *piece = &pixels->piece[i];
-      if (!piece->pixmap)
-        piece->pixmap = generate_pixmap (frames, frame, &piece->rect);
-    }
+      CachedFramePiece *piece;
+      cairo_region_t *region_piece;
 
-  if (frames->invalidate_cache_timeout_id)
-    g_source_remove (frames->invalidate_cache_timeout_id);
+      /* do not create a pixmap for nonexisting areas */
+      if (rects[i].width <= 0 || rects[i].height <= 0)
+        continue;
 
-  frames->invalidate_cache_timeout_id = g_timeout_add (1000, invalidate_cache_timeout, frames);
+      /* nor paint ones that aren't exposed */
+      if (cairo_region_contains_rectangle (region, &rects[i]) ==
+          CAIRO_REGION_OVERLAP_OUT)
+        continue;
 
-  if (!g_list_find (frames->invalidate_frames, frame))
-    frames->invalidate_frames =
-      g_list_prepend (frames->invalidate_frames, frame);
+      key.piece = i;
+
+      if (i == 0)
+        {
+          key.title = (char *) pango_layout_get_text (frame->text_layout);
+          key.mini_icon = mini_icon;
+          key.icon = icon;
+        }
+      else
+        {
+          key.title = NULL;
+          key.mini_icon = NULL;
+          key.icon = NULL;
+        }
+
+      piece = lookup_cached_piece (frames, &key);
+
+      if (!piece)
+        {
+          piece = g_new (CachedFramePiece, 1);
+          piece->key = key;
+          piece->pixmap = generate_pixmap (frames, frame, &rects[i]);
+          piece->size = (gsize) rects[i].width * rects[i].height *
+                        key.scale * key.scale * 4;
+
+          insert_cached_piece (frames, piece);
+        }
+
+      cairo_set_source_surface (cr, piece->pixmap,
+                                rects[i].x, rects[i].y);
+      cairo_paint (cr);
+
+      if (i == 0 && !buttons_normal)
+        draw_prelit_control (frames, frame, cr, region, button_states);
+
+      region_piece = cairo_region_create_rectangle (&rects[i]);
+      cairo_region_subtract (region, region_piece);
+      cairo_region_destroy (region_piece);
+    }
 }
 
 static void
@@ -2544,30 +2826,44 @@ subtract_client_area (cairo_region_t *region,
   cairo_region_destroy (tmp_region);
 }
 
-static void
-cached_pixels_draw (CachedPixels   *pixels,
-                    cairo_t        *cr,
-                    cairo_region_t *region)
+/* The exact area an expose asks for, rather than its extents */
+static cairo_region_t *
+get_clip_region (cairo_t *cr)
 {
-  cairo_region_t *region_piece;
+  cairo_rectangle_list_t *list;
+  cairo_region_t *region;
   int i;
 
-  for (i = 0; i < 4; i++)
+  list = cairo_copy_clip_rectangle_list (cr);
+
+  if (list->status != CAIRO_STATUS_SUCCESS)
     {
-      CachedFramePiece *piece;
-      piece = &pixels->piece[i];
+      cairo_rectangle_int_t clip;
 
-      if (piece->pixmap)
-        {
-          cairo_set_source_surface (cr, piece->pixmap,
-                                    piece->rect.x, piece->rect.y);
-          cairo_paint (cr);
+      cairo_rectangle_list_destroy (list);
 
-          region_piece = cairo_region_create_rectangle (&piece->rect);
-          cairo_region_subtract (region, region_piece);
-          cairo_region_destroy (region_piece);
-        }
+      gdk_cairo_get_clip_rectangle (cr, &clip);
+      return cairo_region_create_rectangle (&clip);
     }
+
+  region = cairo_region_create ();
+
+  for (i = 0; i < list->num_rectangles; i++)
+    {
+      cairo_rectangle_t *r = &list->rectangles[i];
+      cairo_rectangle_int_t area;
+
+      area.x = floor (r->x);
+      area.y = floor (r->y);
+      area.width = ceil (r->x + r->width) - area.x;
+      area.height = ceil (r->y + r->height) - area.y;
+
+      cairo_region_union_rectangle (region, &area);
+    }
+
+  cairo_rectangle_list_destroy (list);
+
+  return region;
 }
 
 static MetaUIFrame *
@@ -2591,13 +2887,12 @@ meta_frames_draw (GtkWidget *widget,
 {
   MetaUIFrame *frame;
   MetaFrames *frames;
-  CachedPixels *pixels;
   cairo_region_t *region;
-  cairo_rectangle_int_t clip;
+  cairo_region_t *obscured;
+  MetaButtonState button_states[META_BUTTON_TYPE_LAST];
   int i, n_areas;
 
   frames = META_FRAMES (widget);
-  gdk_cairo_get_clip_rectangle (cr, &clip);
 
   frame = find_frame_to_draw (frames, cr);
 
@@ -2611,19 +2906,44 @@ meta_frames_draw (GtkWidget *widget,
       return TRUE;
     }
 
-  populate_cache (frames, frame);
+  region = get_clip_region (cr);
 
-  region = cairo_region_create_rectangle (&clip);
+  /* Leave out whatever other windows cover.  The stack works in device
+   * pixels, so only do this when they are the same as ours.
+   */
+  if (gdk_window_get_scale_factor (frame->window) == 1)
+    {
+      obscured = NULL;
+      meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
+                     frame->xwindow,
+                     META_CORE_GET_FRAME_OBSCURED_REGION, &obscured,
+                     META_CORE_GET_END);
+
+      if (obscured != NULL)
+        {
+          cairo_region_subtract (region, obscured);
+          cairo_region_destroy (obscured);
+        }
+    }
+
+  if (cairo_region_is_empty (region))
+    {
+      cairo_region_destroy (region);
+      return TRUE;
+    }
 
-  pixels = get_cache (frames, frame);
+  gdk_cairo_region (cr, region);
+  cairo_clip (cr);
 
-  cached_pixels_draw (pixels, cr, region);
+  draw_cached_pieces (frames, frame, cr, region);
 
   clip_to_screen (region, frame);
   subtract_client_area (region, frame);
 
   n_areas = cairo_region_num_rectangles (region);
 
+  get_button_states (frame, button_states);
+
   for (i = 0; i < n_areas; i++)
     {
       cairo_rectangle_int_t area;
@@ -2637,7 +2957,7 @@ meta_frames_draw (GtkWidget *widget,
 
       cairo_push_group (cr);
 
-      meta_frames_paint_to_drawable (frames, frame, cr);
+      meta_frames_paint_to_drawable (frames, frame, cr, button_states);
 
       cairo_pop_group_to_source (cr);
       cairo_paint (cr);
@@ -2656,20 +2976,12 @@ meta_frames_draw (GtkWidget *widget,
 #define DECORATING_BORDER 100
 
 static void
-meta_frames_paint_to_drawable (MetaFrames   *frames,
-                               MetaUIFrame  *frame,
-                               cairo_t      *cr)
+get_button_states (MetaUIFrame     *frame,
+                   MetaButtonState *button_states)
 {
-  MetaFrameFlags flags;
-  MetaFrameType type;
-  GdkPixbuf *mini_icon;
-  GdkPixbuf *icon;
-  int w, h, scale;
-  MetaButtonState button_states[META_BUTTON_TYPE_LAST];
   Window grab_frame;
-  int i;
-  MetaButtonLayout button_layout;
   MetaGrabOp grab_op;
+  int i;
 
   for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
     button_states[i] = META_BUTTON_STATE_NORMAL;
@@ -2759,6 +3071,20 @@ meta_frames_paint_to_drawable (MetaFrames   *frames,
     default:
       break;
     }
+}
+
+static void
+meta_frames_paint_to_drawable (MetaFrames      *frames,
+                               MetaUIFrame     *frame,
+                               cairo_t         *cr,
+                               MetaButtonState *button_states)
+{
+  MetaFrameFlags flags;
+  MetaFrameType type;
+  GdkPixbuf *mini_icon;
+  GdkPixbuf *icon;
+  int w, h, scale;
+  MetaButtonLayout button_layout;
 
   meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), frame->xwindow,
                  META_CORE_GET_FRAME_FLAGS, &flags,
@@ -3107,5 +3433,4 @@ invalidate_whole_window (MetaFrames *frames,
                          MetaUIFrame *frame)
 {
   gdk_window_invalidate_rect (frame->window, NULL, FALSE);
-  invalidate_cache (frames, frame);
 }
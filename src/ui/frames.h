@@ -85,6 +85,18 @@ struct _MetaUIFrame
   guint expose_delayed : 1;
   guint shape_applied : 1;
 
+  /* The last region get_visible_region() built, and the visible frame
+   * rectangle and corner radii, in device pixels, that it was built for
+   */
+  cairo_region_t *visible_region;
+  cairo_rectangle_int_t visible_region_rect;
+  int visible_region_corners[4];
+
+  /* The rounded shape last set on the frame, or NULL if the shape was
+   * unset or merged with the client's
+   */
+  cairo_region_t *applied_shape;
+
   /* FIXME get rid of this, it can just be in the MetaFrames struct */
   MetaFrameControl prelit_control;
 };
@@ -104,9 +116,16 @@ struct _MetaFrames
   GHashTable *style_variants;
   int expose_delay_count;
 
-  int invalidate_cache_timeout_id;
-  GList *invalidate_frames;
-  GHashTable *cache;
+  /* Rendered frame pieces shared between all frames, most recently
+   * used first in piece_lru, and the theme they were rendered with
+   */
+  GHashTable *piece_cache;
+  GQueue *piece_lru;
+  gsize piece_cache_size;
+  MetaTheme *piece_cache_theme;
+
+  /* Row widths of a rounded corner, keyed by its radius in pixels */
+  GHashTable *corner_rows;
 };
 
 struct _MetaFramesClass
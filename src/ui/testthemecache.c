@@ -0,0 +1,1037 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Marco theme cache test program */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * Loads each theme of a themes directory, which parses it and writes
+ * it to the cache, then loads it back from the cache and checks that
+ * both themes are the same, down to which objects are shared.  Then
+ * checks that a cache that is truncated, damaged or for another
+ * version of the theme file is refused.
+ *
+ * Usage: testthemecache [THEMES_DIR]
+ *
+ * Loading images needs a display; without one the test is skipped.
+ */
+
+#include <config.h>
+#include "theme.h"
+#include "theme-cache.h"
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Exit status for a skipped test */
+#define SKIP 77
+
+/* Objects of the parsed theme already matched with an object of the
+ * cached one, so that shared objects have to be shared the same way
+ */
+static GHashTable *matched = NULL;
+
+static const char *current_object = NULL;
+
+static gboolean
+differs (const char *what)
+{
+  g_printerr ("  %s: %s differs\n", current_object, what);
+  return FALSE;
+}
+
+#define SAME(field) \
+  (a->field == b->field || differs (#field))
+
+/* Whether a and b may be the same object: both missing, or matched
+ * with each other.  *compare is set if they still need comparing.
+ */
+static gboolean
+match (gconstpointer a,
+       gconstpointer b,
+       gboolean     *compare)
+{
+  gpointer old;
+
+  *compare = FALSE;
+
+  if (a == NULL || b == NULL)
+    return a == b;
+
+  if (g_hash_table_lookup_extended (matched, a, NULL, &old))
+    return old == b;
+
+  g_hash_table_insert (matched, (gpointer) a, (gpointer) b);
+  *compare = TRUE;
+
+  return TRUE;
+}
+
+static gboolean
+compare_rgba (const GdkRGBA *a,
+              const GdkRGBA *b)
+{
+  return SAME (red) && SAME (green) && SAME (blue) && SAME (alpha);
+}
+
+static gboolean
+compare_border (const GtkBorder *a,
+                const GtkBorder *b)
+{
+  return SAME (left) && SAME (right) && SAME (top) && SAME (bottom);
+}
+
+static gboolean
+compare_color_spec (const MetaColorSpec *a,
+                    const MetaColorSpec *b)
+{
+  if (a == NULL || b == NULL)
+    return a == b || differs ("color spec");
+
+  if (!SAME (type))
+    return FALSE;
+
+  switch (a->type)
+    {
+    case META_COLOR_SPEC_BASIC:
+      return compare_rgba (&a->data.basic.color, &b->data.basic.color);
+
+    case META_COLOR_SPEC_GTK:
+      return SAME (data.gtk.component) && SAME (data.gtk.state);
+
+    case META_COLOR_SPEC_GTK_CUSTOM:
+      return (g_strcmp0 (a->data.gtkcustom.color_name,
+                         b->data.gtkcustom.color_name) == 0 ||
+              differs ("data.gtkcustom.color_name")) &&
+             compare_color_spec (a->data.gtkcustom.fallback,
+                                 b->data.gtkcustom.fallback);
+
+    case META_COLOR_SPEC_BLEND:
+      return compare_color_spec (a->data.blend.foreground,
+                                 b->data.blend.foreground) &&
+             compare_color_spec (a->data.blend.background,
+                                 b->data.blend.background) &&
+             SAME (data.blend.alpha) &&
+             compare_rgba (&a->data.blend.color, &b->data.blend.color);
+
+    case META_COLOR_SPEC_SHADE:
+      return compare_color_spec (a->data.shade.base, b->data.shade.base) &&
+             SAME (data.shade.factor) &&
+             compare_rgba (&a->data.shade.color, &b->data.shade.color);
+    }
+
+  return differs ("color spec type");
+}
+
+static gboolean
+compare_gradient_spec (const MetaGradientSpec *a,
+                       const MetaGradientSpec *b)
+{
+  GSList *tmp_a, *tmp_b;
+
+  if (a == NULL || b == NULL)
+    return a == b || differs ("gradient spec");
+
+  if (!SAME (type))
+    return FALSE;
+
+  for (tmp_a = a->color_specs, tmp_b = b->color_specs;
+       tmp_a != NULL && tmp_b != NULL;
+       tmp_a = tmp_a->next, tmp_b = tmp_b->next)
+    if (!compare_color_spec (tmp_a->data, tmp_b->data))
+      return FALSE;
+
+  return tmp_a == tmp_b || differs ("color_specs");
+}
+
+static gboolean
+compare_alpha_spec (const MetaAlphaGradientSpec *a,
+                    const MetaAlphaGradientSpec *b)
+{
+  if (a == NULL || b == NULL)
+    return a == b || differs ("alpha spec");
+
+  return SAME (type) && SAME (n_alphas) &&
+         (memcmp (a->alphas, b->alphas, a->n_alphas) == 0 ||
+          differs ("alphas"));
+}
+
+static gboolean
+compare_draw_spec (const MetaDrawSpec *a,
+                   const MetaDrawSpec *b)
+{
+  int i;
+
+  if (a == NULL || b == NULL)
+    return a == b || differs ("draw spec");
+
+  if (!SAME (constant) || (a->constant && !SAME (value)) ||
+      !SAME (n_tokens) || !SAME (n_code))
+    return FALSE;
+
+  for (i = 0; i < a->n_tokens; i++)
+    {
+      if (!SAME (tokens[i].type))
+        return FALSE;
+
+      switch (a->tokens[i].type)
+        {
+        case POS_TOKEN_INT:
+          if (!SAME (tokens[i].d.i.val))
+            return FALSE;
+          break;
+
+        case POS_TOKEN_DOUBLE:
+          if (!SAME (tokens[i].d.d.val))
+            return FALSE;
+          break;
+
+        case POS_TOKEN_OPERATOR:
+          if (!SAME (tokens[i].d.o.op))
+            return FALSE;
+          break;
+
+        case POS_TOKEN_VARIABLE:
+          if (strcmp (a->tokens[i].d.v.name, b->tokens[i].d.v.name) != 0 ||
+              !SAME (tokens[i].d.v.name_quark))
+            return differs ("tokens[i].d.v.name");
+          break;
+
+        case POS_TOKEN_OPEN_PAREN:
+        case POS_TOKEN_CLOSE_PAREN:
+          break;
+        }
+    }
+
+  /* The code is compiled again from the cached tokens */
+  for (i = 0; i < a->n_code; i++)
+    {
+      if (!SAME (code[i].type))
+        return FALSE;
+
+      switch (a->code[i].type)
+        {
+        case POS_INSN_INT:
+          if (!SAME (code[i].d.int_val))
+            return FALSE;
+          break;
+
+        case POS_INSN_DOUBLE:
+          if (!SAME (code[i].d.double_val))
+            return FALSE;
+          break;
+
+        case POS_INSN_VARIABLE:
+          if (!SAME (code[i].d.var))
+            return FALSE;
+          break;
+
+        case POS_INSN_OPERATOR:
+          if (!SAME (code[i].d.op))
+            return FALSE;
+          break;
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+compare_pixbuf (GdkPixbuf *a,
+                GdkPixbuf *b)
+{
+  const guchar *pixels_a, *pixels_b;
+  int rowstride, row_length;
+  int i;
+
+  if (a == NULL || b == NULL)
+    return a == b || differs ("pixbuf");
+
+  if (gdk_pixbuf_get_width (a) != gdk_pixbuf_get_width (b) ||
+      gdk_pixbuf_get_height (a) != gdk_pixbuf_get_height (b) ||
+      gdk_pixbuf_get_n_channels (a) != gdk_pixbuf_get_n_channels (b) ||
+      gdk_pixbuf_get_rowstride (a) != gdk_pixbuf_get_rowstride (b))
+    return differs ("pixbuf size");
+
+  pixels_a = gdk_pixbuf_read_pixels (a);
+  pixels_b = gdk_pixbuf_read_pixels (b);
+  rowstride = gdk_pixbuf_get_rowstride (a);
+  row_length = gdk_pixbuf_get_width (a) * gdk_pixbuf_get_n_channels (a);
+
+  for (i = 0; i < gdk_pixbuf_get_height (a); i++)
+    if (memcmp (pixels_a + i * rowstride, pixels_b + i * rowstride,
+                row_length) != 0)
+      return differs ("pixbuf pixels");
+
+  return TRUE;
+}
+
+static gboolean compare_op_list (const MetaDrawOpList *a,
+                                 const MetaDrawOpList *b);
+
+static gboolean
+compare_draw_op (const MetaDrawOp *a,
+                 const MetaDrawOp *b)
+{
+  gboolean compare;
+
+  if (!match (a, b, &compare))
+    return differs ("draw op");
+  if (!compare)
+    return TRUE;
+
+  if (!SAME (type))
+    return FALSE;
+
+  switch (a->type)
+    {
+    case META_DRAW_LINE:
+      return compare_color_spec (a->data.line.color_spec,
+                                 b->data.line.color_spec) &&
+             SAME (data.line.dash_on_length) &&
+             SAME (data.line.dash_off_length) &&
+             SAME (data.line.width) &&
+             compare_draw_spec (a->data.line.x1, b->data.line.x1) &&
+             compare_draw_spec (a->data.line.y1, b->data.line.y1) &&
+             compare_draw_spec (a->data.line.x2, b->data.line.x2) &&
+             compare_draw_spec (a->data.line.y2, b->data.line.y2);
+
+    case META_DRAW_RECTANGLE:
+      return compare_color_spec (a->data.rectangle.color_spec,
+                                 b->data.rectangle.color_spec) &&
+             SAME (data.rectangle.filled) &&
+             compare_draw_spec (a->data.rectangle.x, b->data.rectangle.x) &&
+             compare_draw_spec (a->data.rectangle.y, b->data.rectangle.y) &&
+             compare_draw_spec (a->data.rectangle.width,
+                                b->data.rectangle.width) &&
+             compare_draw_spec (a->data.rectangle.height,
+                                b->data.rectangle.height);
+
+    case META_DRAW_ARC:
+      return compare_color_spec (a->data.arc.color_spec,
+                                 b->data.arc.color_spec) &&
+             SAME (data.arc.filled) &&
+             compare_draw_spec (a->data.arc.x, b->data.arc.x) &&
+             compare_draw_spec (a->data.arc.y, b->data.arc.y) &&
+             compare_draw_spec (a->data.arc.width, b->data.arc.width) &&
+             compare_draw_spec (a->data.arc.height, b->data.arc.height) &&
+             SAME (data.arc.start_angle) &&
+             SAME (data.arc.extent_angle);
+
+    case META_DRAW_CLIP:
+      return compare_draw_spec (a->data.clip.x, b->data.clip.x) &&
+             compare_draw_spec (a->data.clip.y, b->data.clip.y) &&
+             compare_draw_spec (a->data.clip.width, b->data.clip.width) &&
+             compare_draw_spec (a->data.clip.height, b->data.clip.height);
+
+    case META_DRAW_TINT:
+      return compare_color_spec (a->data.tint.color_spec,
+                                 b->data.tint.color_spec) &&
+             compare_alpha_spec (a->data.tint.alpha_spec,
+                                 b->data.tint.alpha_spec) &&
+             compare_draw_spec (a->data.tint.x, b->data.tint.x) &&
+             compare_draw_spec (a->data.tint.y, b->data.tint.y) &&
+             compare_draw_spec (a->data.tint.width, b->data.tint.width) &&
+             compare_draw_spec (a->data.tint.height, b->data.tint.height);
+
+    case META_DRAW_GRADIENT:
+      return compare_gradient_spec (a->data.gradient.gradient_spec,
+                                    b->data.gradient.gradient_spec) &&
+             compare_alpha_spec (a->data.gradient.alpha_spec,
+                                 b->data.gradient.alpha_spec) &&
+             compare_draw_spec (a->data.gradient.x, b->data.gradient.x) &&
+             compare_draw_spec (a->data.gradient.y, b->data.gradient.y) &&
+             compare_draw_spec (a->data.gradient.width,
+                                b->data.gradient.width) &&
+             compare_draw_spec (a->data.gradient.height,
+                                b->data.gradient.height);
+
+    case META_DRAW_IMAGE:
+      return compare_pixbuf (a->data.image.pixbuf, b->data.image.pixbuf) &&
+             compare_color_spec (a->data.image.colorize_spec,
+                                 b->data.image.colorize_spec) &&
+             compare_alpha_spec (a->data.image.alpha_spec,
+                                 b->data.image.alpha_spec) &&
+             compare_draw_spec (a->data.image.x, b->data.image.x) &&
+             compare_draw_spec (a->data.image.y, b->data.image.y) &&
+             compare_draw_spec (a->data.image.width, b->data.image.width) &&
+             compare_draw_spec (a->data.image.height,
+                                b->data.image.height) &&
+             SAME (data.image.fill_type) &&
+             SAME (data.image.vertical_stripes) &&
+             SAME (data.image.horizontal_stripes);
+
+    case META_DRAW_GTK_ARROW:
+      return SAME (data.gtk_arrow.state) &&
+             SAME (data.gtk_arrow.shadow) &&
+             SAME (data.gtk_arrow.arrow) &&
+             SAME (data.gtk_arrow.filled) &&
+             compare_draw_spec (a->data.gtk_arrow.x, b->data.gtk_arrow.x) &&
+             compare_draw_spec (a->data.gtk_arrow.y, b->data.gtk_arrow.y) &&
+             compare_draw_spec (a->data.gtk_arrow.width,
+                                b->data.gtk_arrow.width) &&
+             compare_draw_spec (a->data.gtk_arrow.height,
+                                b->data.gtk_arrow.height);
+
+    case META_DRAW_GTK_BOX:
+      return SAME (data.gtk_box.state) &&
+             SAME (data.gtk_box.shadow) &&
+             compare_draw_spec (a->data.gtk_box.x, b->data.gtk_box.x) &&
+             compare_draw_spec (a->data.gtk_box.y, b->data.gtk_box.y) &&
+             compare_draw_spec (a->data.gtk_box.width,
+                                b->data.gtk_box.width) &&
+             compare_draw_spec (a->data.gtk_box.height,
+                                b->data.gtk_box.height);
+
+    case META_DRAW_GTK_VLINE:
+      return SAME (data.gtk_vline.state) &&
+             compare_draw_spec (a->data.gtk_vline.x, b->data.gtk_vline.x) &&
+             compare_draw_spec (a->data.gtk_vline.y1, b->data.gtk_vline.y1) &&
+             compare_draw_spec (a->data.gtk_vline.y2, b->data.gtk_vline.y2);
+
+    case META_DRAW_ICON:
+      return compare_alpha_spec (a->data.icon.alpha_spec,
+                                 b->data.icon.alpha_spec) &&
+             compare_draw_spec (a->data.icon.x, b->data.icon.x) &&
+             compare_draw_spec (a->data.icon.y, b->data.icon.y) &&
+             compare_draw_spec (a->data.icon.width, b->data.icon.width) &&
+             compare_draw_spec (a->data.icon.height, b->data.icon.height) &&
+             SAME (data.icon.fill_type);
+
+    case META_DRAW_TITLE:
+      return compare_color_spec (a->data.title.color_spec,
+                                 b->data.title.color_spec) &&
+             compare_draw_spec (a->data.title.x, b->data.title.x) &&
+             compare_draw_spec (a->data.title.y, b->data.title.y) &&
+             compare_draw_spec (a->data.title.ellipsize_width,
+                                b->data.title.ellipsize_width);
+
+    case META_DRAW_OP_LIST:
+      return compare_op_list (a->data.op_list.op_list,
+                              b->data.op_list.op_list) &&
+             compare_draw_spec (a->data.op_list.x, b->data.op_list.x) &&
+             compare_draw_spec (a->data.op_list.y, b->data.op_list.y) &&
+             compare_draw_spec (a->data.op_list.width,
+                                b->data.op_list.width) &&
+             compare_draw_spec (a->data.op_list.height,
+                                b->data.op_list.height);
+
+    case META_DRAW_TILE:
+      return compare_op_list (a->data.tile.op_list, b->data.tile.op_list) &&
+             compare_draw_spec (a->data.tile.x, b->data.tile.x) &&
+             compare_draw_spec (a->data.tile.y, b->data.tile.y) &&
+             compare_draw_spec (a->data.tile.width, b->data.tile.width) &&
+             compare_draw_spec (a->data.tile.height, b->data.tile.height) &&
+             compare_draw_spec (a->data.tile.tile_xoffset,
+                                b->data.tile.tile_xoffset) &&
+             compare_draw_spec (a->data.tile.tile_yoffset,
+                                b->data.tile.tile_yoffset) &&
+             compare_draw_spec (a->data.tile.tile_width,
+                                b->data.tile.tile_width) &&
+             compare_draw_spec (a->data.tile.tile_height,
+                                b->data.tile.tile_height);
+    }
+
+  return differs ("draw op type");
+}
+
+static gboolean
+compare_op_list (const MetaDrawOpList *a,
+                 const MetaDrawOpList *b)
+{
+  gboolean compare;
+  int i;
+
+  if (!match (a, b, &compare))
+    return differs ("draw op list");
+  if (!compare)
+    return TRUE;
+
+  if (!SAME (n_ops) || !SAME (n_flat_ops))
+    return FALSE;
+
+  for (i = 0; i < a->n_ops; i++)
+    if (!compare_draw_op (a->ops[i], b->ops[i]))
+      return FALSE;
+
+  /* The flattened ops are the ops of this list and the lists it
+   * includes, so they have all been matched already.
+   */
+  for (i = 0; i < a->n_flat_ops; i++)
+    if (!compare_draw_op (a->flat_ops[i], b->flat_ops[i]))
+      return FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+compare_layout (const MetaFrameLayout *a,
+                const MetaFrameLayout *b)
+{
+  gboolean compare;
+
+  if (!match (a, b, &compare))
+    return differs ("layout");
+  if (!compare)
+    return TRUE;
+
+  return SAME (left_width) &&
+         SAME (right_width) &&
+         SAME (bottom_height) &&
+         compare_border (&a->invisible_resize_border,
+                         &b->invisible_resize_border) &&
+         compare_border (&a->title_border, &b->title_border) &&
+         SAME (title_vertical_pad) &&
+         SAME (right_titlebar_edge) &&
+         SAME (left_titlebar_edge) &&
+         SAME (button_sizing) &&
+         SAME (button_aspect) &&
+         SAME (button_width) &&
+         SAME (button_height) &&
+         compare_border (&a->button_border, &b->button_border) &&
+         SAME (title_scale) &&
+         SAME (has_title) &&
+         SAME (hide_buttons) &&
+         SAME (top_left_corner_rounded_radius) &&
+         SAME (top_right_corner_rounded_radius) &&
+         SAME (bottom_left_corner_rounded_radius) &&
+         SAME (bottom_right_corner_rounded_radius);
+}
+
+static gboolean
+compare_style (const MetaFrameStyle *a,
+               const MetaFrameStyle *b)
+{
+  gboolean compare;
+  int i, j;
+
+  if (!match (a, b, &compare))
+    return differs ("style");
+  if (!compare)
+    return TRUE;
+
+  if (!compare_style (a->parent, b->parent))
+    return FALSE;
+
+  for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+    for (j = 0; j < META_BUTTON_STATE_LAST; j++)
+      if (!compare_op_list (a->buttons[i][j], b->buttons[i][j]))
+        return FALSE;
+
+  for (i = 0; i < META_FRAME_PIECE_LAST; i++)
+    if (!compare_op_list (a->pieces[i], b->pieces[i]))
+      return FALSE;
+
+  return compare_layout (a->layout, b->layout) &&
+         compare_color_spec (a->window_background_color,
+                             b->window_background_color) &&
+         SAME (window_background_alpha);
+}
+
+static gboolean
+compare_style_set (const MetaFrameStyleSet *a,
+                   const MetaFrameStyleSet *b)
+{
+  gboolean compare;
+  int i, j;
+
+  if (!match (a, b, &compare))
+    return differs ("style set");
+  if (!compare)
+    return TRUE;
+
+  if (!compare_style_set (a->parent, b->parent))
+    return FALSE;
+
+  for (i = 0; i < META_FRAME_RESIZE_LAST; i++)
+    for (j = 0; j < META_FRAME_FOCUS_LAST; j++)
+      if (!compare_style (a->normal_styles[i][j], b->normal_styles[i][j]) ||
+          !compare_style (a->shaded_styles[i][j], b->shaded_styles[i][j]))
+        return FALSE;
+
+  for (j = 0; j < META_FRAME_FOCUS_LAST; j++)
+    if (!compare_style (a->maximized_styles[j],
+                        b->maximized_styles[j]) ||
+        !compare_style (a->tiled_left_styles[j],
+                        b->tiled_left_styles[j]) ||
+        !compare_style (a->tiled_right_styles[j],
+                        b->tiled_right_styles[j]) ||
+        !compare_style (a->maximized_and_shaded_styles[j],
+                        b->maximized_and_shaded_styles[j]) ||
+        !compare_style (a->tiled_left_and_shaded_styles[j],
+                        b->tiled_left_and_shaded_styles[j]) ||
+        !compare_style (a->tiled_right_and_shaded_styles[j],
+                        b->tiled_right_and_shaded_styles[j]))
+      return FALSE;
+
+  return TRUE;
+}
+
+typedef gboolean (*CompareFunc) (gconstpointer a,
+                                 gconstpointer b);
+
+/* Compares the objects of two tables by name; a missing table is
+ * the same as an empty one.
+ */
+static gboolean
+compare_by_name (const char  *kind,
+                 GHashTable  *a,
+                 GHashTable  *b,
+                 CompareFunc  func)
+{
+  GHashTableIter iter;
+  gpointer name, object;
+  guint size_a, size_b;
+  gboolean ok;
+  char *desc;
+
+  size_a = a ? g_hash_table_size (a) : 0;
+  size_b = b ? g_hash_table_size (b) : 0;
+
+  if (size_a != size_b)
+    {
+      g_printerr ("  %u %ss were parsed, %u were cached\n",
+                  size_a, kind, size_b);
+      return FALSE;
+    }
+
+  if (size_a == 0)
+    return TRUE;
+
+  ok = TRUE;
+
+  g_hash_table_iter_init (&iter, a);
+  while (g_hash_table_iter_next (&iter, &name, &object))
+    {
+      desc = g_strdup_printf ("%s \"%s\"", kind, (char *) name);
+      current_object = desc;
+
+      if (!(*func) (object, g_hash_table_lookup (b, name)))
+        ok = FALSE;
+
+      current_object = NULL;
+      g_free (desc);
+    }
+
+  return ok;
+}
+
+static gboolean
+compare_int_constant (gconstpointer a,
+                      gconstpointer b)
+{
+  return a == b || differs ("value");
+}
+
+static gboolean
+compare_float_constant (gconstpointer a,
+                        gconstpointer b)
+{
+  if (a == NULL || b == NULL)
+    return a == b || differs ("value");
+
+  return *(const double *) a == *(const double *) b || differs ("value");
+}
+
+static gboolean
+compare_color_constant (gconstpointer a,
+                        gconstpointer b)
+{
+  return g_strcmp0 (a, b) == 0 || differs ("value");
+}
+
+static gboolean
+compare_themes (MetaTheme *a,
+                MetaTheme *b)
+{
+  gboolean ok;
+  int i;
+
+  matched = g_hash_table_new (NULL, NULL);
+  current_object = "theme";
+
+  ok = SAME (format_version);
+
+  if (g_strcmp0 (a->readable_name, b->readable_name) != 0 ||
+      g_strcmp0 (a->author, b->author) != 0 ||
+      g_strcmp0 (a->copyright, b->copyright) != 0 ||
+      g_strcmp0 (a->date, b->date) != 0 ||
+      g_strcmp0 (a->description, b->description) != 0)
+    ok = differs ("metadata");
+
+  ok = compare_by_name ("integer constant", a->integer_constants,
+                        b->integer_constants, compare_int_constant) && ok;
+  ok = compare_by_name ("float constant", a->float_constants,
+                        b->float_constants, compare_float_constant) && ok;
+  ok = compare_by_name ("color constant", a->color_constants,
+                        b->color_constants, compare_color_constant) && ok;
+
+  ok = compare_by_name ("layout", a->layouts_by_name, b->layouts_by_name,
+                        (CompareFunc) compare_layout) && ok;
+  ok = compare_by_name ("draw op list", a->draw_op_lists_by_name,
+                        b->draw_op_lists_by_name,
+                        (CompareFunc) compare_op_list) && ok;
+  ok = compare_by_name ("style", a->styles_by_name, b->styles_by_name,
+                        (CompareFunc) compare_style) && ok;
+  ok = compare_by_name ("style set", a->style_sets_by_name,
+                        b->style_sets_by_name,
+                        (CompareFunc) compare_style_set) && ok;
+
+  current_object = "style set by frame type";
+  for (i = 0; i < META_FRAME_TYPE_LAST; i++)
+    ok = compare_style_set (a->style_sets_by_type[i],
+                            b->style_sets_by_type[i]) && ok;
+
+  current_object = NULL;
+  g_hash_table_destroy (matched);
+  matched = NULL;
+
+  return ok;
+}
+
+/* Removes a directory and everything in it, without following
+ * symbolic links.
+ */
+static void
+remove_tree (const char *path)
+{
+  GDir *dir;
+  const char *name;
+
+  if (!g_file_test (path, G_FILE_TEST_IS_SYMLINK) &&
+      g_file_test (path, G_FILE_TEST_IS_DIR))
+    {
+      dir = g_dir_open (path, 0, NULL);
+      if (dir != NULL)
+        {
+          while ((name = g_dir_read_name (dir)) != NULL)
+            {
+              char *child = g_build_filename (path, name, NULL);
+              remove_tree (child);
+              g_free (child);
+            }
+          g_dir_close (dir);
+        }
+      g_rmdir (path);
+    }
+  else
+    g_unlink (path);
+}
+
+/* The only file in the cache directory, which is emptied before each
+ * theme is loaded.
+ */
+static char *
+find_cache_file (const char *cache_dir)
+{
+  GDir *dir;
+  const char *name;
+  char *cache_file;
+
+  cache_file = NULL;
+
+  dir = g_dir_open (cache_dir, 0, NULL);
+  if (dir == NULL)
+    return NULL;
+
+  name = g_dir_read_name (dir);
+  if (name != NULL && g_dir_read_name (dir) == NULL)
+    cache_file = g_build_filename (cache_dir, name, NULL);
+
+  g_dir_close (dir);
+
+  return cache_file;
+}
+
+static gboolean
+cache_is_refused (MetaTheme  *theme,
+                  guint       major_version,
+                  const char *text,
+                  gsize       length,
+                  const char *what)
+{
+  MetaTheme *cached;
+
+  cached = meta_theme_cache_load (theme->name, theme->dirname,
+                                  theme->filename, major_version,
+                                  text, length);
+  if (cached == NULL)
+    return TRUE;
+
+  g_printerr ("  %s was loaded\n", what);
+  meta_theme_free (cached);
+
+  return FALSE;
+}
+
+static gboolean
+test_damaged_cache (MetaTheme  *theme,
+                    guint       major_version,
+                    const char *text,
+                    gsize       length,
+                    const char *cache_file)
+{
+  char *contents, *damaged, *what;
+  gsize cache_length, i, step;
+  MetaTheme *cached;
+  gboolean ok;
+
+  if (!g_file_get_contents (cache_file, &contents, &cache_length, NULL))
+    {
+      g_printerr ("  Could not read the cache\n");
+      return FALSE;
+    }
+
+  ok = TRUE;
+
+  /* The theme file changed */
+  damaged = g_strdup_printf ("%s ", text);
+  ok = cache_is_refused (theme, major_version, damaged, length + 1,
+                         "Cache of another theme file") && ok;
+  g_free (damaged);
+
+  /* Every read is checked, so any truncation is noticed */
+  step = cache_length / 100 + 1;
+  for (i = 0; i < cache_length; i += i + step < cache_length ? step : 1)
+    {
+      g_file_set_contents (cache_file, contents, i, NULL);
+
+      what = g_strdup_printf ("Cache truncated to %" G_GSIZE_FORMAT " bytes",
+                              i);
+      ok = cache_is_refused (theme, major_version, text, length, what) && ok;
+      g_free (what);
+    }
+
+  damaged = g_malloc (cache_length);
+  memcpy (damaged, contents, cache_length);
+
+  damaged[0] ^= 0xff;
+  g_file_set_contents (cache_file, damaged, cache_length, NULL);
+  ok = cache_is_refused (theme, major_version, text, length,
+                         "Cache with a damaged header") && ok;
+  damaged[0] ^= 0xff;
+
+  damaged[cache_length - 1] ^= 0xff;
+  g_file_set_contents (cache_file, damaged, cache_length, NULL);
+  ok = cache_is_refused (theme, major_version, text, length,
+                         "Cache with a damaged end") && ok;
+  damaged[cache_length - 1] ^= 0xff;
+
+  /* Damage in the middle may still read as a theme, but must not
+   * make loading crash.
+   */
+  for (i = cache_length / 4; i < cache_length / 2; i += step)
+    {
+      memset (damaged + i, 0xff, MIN (16, cache_length - i));
+      g_file_set_contents (cache_file, damaged, cache_length, NULL);
+
+      cached = meta_theme_cache_load (theme->name, theme->dirname,
+                                      theme->filename, major_version,
+                                      text, length);
+      if (cached)
+        meta_theme_free (cached);
+
+      memcpy (damaged + i, contents + i, MIN (16, cache_length - i));
+    }
+
+  /* Make sure the cache was refused for the damage */
+  g_file_set_contents (cache_file, contents, cache_length, NULL);
+  cached = meta_theme_cache_load (theme->name, theme->dirname,
+                                  theme->filename, major_version,
+                                  text, length);
+  if (cached)
+    meta_theme_free (cached);
+  else
+    {
+      g_printerr ("  Restored cache was not loaded\n");
+      ok = FALSE;
+    }
+
+  g_free (damaged);
+  g_free (contents);
+
+  return ok;
+}
+
+static gboolean
+test_theme (const char *theme_name,
+            const char *cache_dir)
+{
+  MetaTheme *parsed, *cached;
+  GError *error;
+  char *text, *basename, *cache_file;
+  gsize length;
+  guint major_version;
+  gboolean ok;
+
+  remove_tree (cache_dir);
+
+  error = NULL;
+  parsed = meta_theme_load (theme_name, &error);
+  if (parsed == NULL)
+    {
+      g_printerr ("  Failed to load theme: %s\n",
+                  error ? error->message : "not found");
+      g_clear_error (&error);
+      return FALSE;
+    }
+
+  basename = g_path_get_basename (parsed->filename);
+  if (sscanf (basename, "metacity-theme-%u.xml", &major_version) != 1 ||
+      !g_file_get_contents (parsed->filename, &text, &length, NULL))
+    {
+      g_printerr ("  Could not read %s\n", parsed->filename);
+      g_free (basename);
+      meta_theme_free (parsed);
+      return FALSE;
+    }
+  g_free (basename);
+
+  cache_file = find_cache_file (cache_dir);
+  cached = meta_theme_cache_load (parsed->name, parsed->dirname,
+                                  parsed->filename, major_version,
+                                  text, length);
+
+  if (cache_file == NULL || cached == NULL)
+    {
+      g_printerr ("  Theme was not cached\n");
+      ok = FALSE;
+    }
+  else
+    {
+      ok = compare_themes (parsed, cached);
+      ok = test_damaged_cache (parsed, major_version, text, length,
+                               cache_file) && ok;
+    }
+
+  if (cached)
+    meta_theme_free (cached);
+  meta_theme_free (parsed);
+  g_free (cache_file);
+  g_free (text);
+
+  return ok;
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *themes_dir;
+  char *tmp_dir, *data_home, *data_dir, *cache_home, *cache_dir;
+  GDir *dir;
+  const char *name;
+  int n_themes, n_failures;
+
+  /* Keep away from the user's themes and cache */
+  tmp_dir = g_dir_make_tmp ("marco-theme-cache-XXXXXX", NULL);
+  if (tmp_dir == NULL)
+    {
+      g_printerr ("Could not create a temporary directory\n");
+      return 1;
+    }
+
+  data_home = g_build_filename (tmp_dir, "data", NULL);
+  data_dir = g_build_filename (data_home, "themes", NULL);
+  cache_home = g_build_filename (tmp_dir, "cache", NULL);
+  cache_dir = g_build_filename (cache_home, "marco", "themes", NULL);
+  g_mkdir_with_parents (data_dir, 0755);
+
+  g_setenv ("HOME", tmp_dir, TRUE);
+  g_setenv ("XDG_DATA_HOME", data_home, TRUE);
+  g_setenv ("XDG_CACHE_HOME", cache_home, TRUE);
+
+  if (!gtk_init_check (&argc, &argv))
+    {
+      g_printerr ("Could not open the display, skipping\n");
+      remove_tree (tmp_dir);
+      return SKIP;
+    }
+
+  themes_dir = argc > 1 ? argv[1] : "themes";
+
+  dir = g_dir_open (themes_dir, 0, NULL);
+  if (dir == NULL)
+    {
+      g_printerr ("Could not open %s\n", themes_dir);
+      remove_tree (tmp_dir);
+      return 1;
+    }
+
+  n_themes = n_failures = 0;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      char *source, *link;
+
+      source = g_build_filename (themes_dir, name, NULL);
+      if (!g_file_test (source, G_FILE_TEST_IS_DIR))
+        {
+          g_free (source);
+          continue;
+        }
+
+      if (!g_path_is_absolute (source))
+        {
+          char *cwd = g_get_current_dir ();
+          char *absolute = g_build_filename (cwd, source, NULL);
+
+          g_free (source);
+          g_free (cwd);
+          source = absolute;
+        }
+
+      /* Installed themes have their files in a subdirectory */
+      link = g_build_filename (data_dir, name, NULL);
+      g_mkdir (link, 0755);
+      g_free (link);
+      link = g_build_filename (data_dir, name, "metacity-1", NULL);
+
+      if (symlink (source, link) != 0)
+        {
+          g_printerr ("Could not link %s to %s\n", link, source);
+          ++n_failures;
+        }
+      else
+        {
+          g_print ("Testing theme %s\n", name);
+
+          if (!test_theme (name, cache_dir))
+            ++n_failures;
+          ++n_themes;
+        }
+
+      g_free (link);
+      g_free (source);
+    }
+
+  g_dir_close (dir);
+
+  g_print ("%d of %d themes failed\n", n_failures, n_themes);
+
+  remove_tree (tmp_dir);
+  g_free (cache_dir);
+  g_free (cache_home);
+  g_free (data_dir);
+  g_free (data_home);
+  g_free (tmp_dir);
+
+  return n_failures > 0 ? 1 : 0;
+}
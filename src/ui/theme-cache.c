@@ -0,0 +1,1904 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Marco compiled theme cache */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * Parsing a theme file means going through the XML, then tokenising
+ * every expression and replacing its constants, and resolving every
+ * colour.  The result of all that only depends on the theme file, so
+ * once a theme has been parsed it is written out in a binary form to
+ * $XDG_CACHE_HOME/marco/themes, and the next time the same file is
+ * loaded the cache is mapped and the theme rebuilt straight from it.
+ *
+ * A cache file is named after a hash of the theme file's path, and is
+ * only used while the theme file has the checksum recorded in it, and
+ * for the marco version that wrote it.  Reading the file to check it
+ * is cheap next to parsing it, and unlike its mtime, the checksum
+ * can't miss an edit.  The cache holds everything but the images,
+ * which are loaded again by name, since they depend on the screen
+ * scale and may come from the icon theme.
+ *
+ * The format is native endian and not meant to be portable.  All
+ * objects that may be shared (frame layouts, draw op lists, styles
+ * and style sets) are written in tables, each object after the ones
+ * it refers to, and referred to by their index in their table.
+ */
+
+#include <config.h>
+#include "theme-cache.h"
+#include "util.h"
+#include <errno.h>
+#include <string.h>
+
+#define CACHE_MAGIC "MTC\n"
+#define CACHE_MAGIC_LEN 4
+#define CACHE_FORMAT_VERSION 2
+
+/* Stands for a missing object, string or table index */
+#define NO_OBJECT 0xffffffff
+#define NO_INDEX -1
+
+#define N_STYLE_SET_SLOTS \
+  (2 * META_FRAME_RESIZE_LAST * META_FRAME_FOCUS_LAST + 6 * META_FRAME_FOCUS_LAST)
+
+static void
+get_style_set_slots (MetaFrameStyleSet *style_set,
+                     MetaFrameStyle   **slots[N_STYLE_SET_SLOTS])
+{
+  int i, j, n;
+
+  n = 0;
+
+  for (i = 0; i < META_FRAME_RESIZE_LAST; i++)
+    for (j = 0; j < META_FRAME_FOCUS_LAST; j++)
+      {
+        slots[n++] = &style_set->normal_styles[i][j];
+        slots[n++] = &style_set->shaded_styles[i][j];
+      }
+
+  for (j = 0; j < META_FRAME_FOCUS_LAST; j++)
+    {
+      slots[n++] = &style_set->maximized_styles[j];
+      slots[n++] = &style_set->tiled_left_styles[j];
+      slots[n++] = &style_set->tiled_right_styles[j];
+      slots[n++] = &style_set->maximized_and_shaded_styles[j];
+      slots[n++] = &style_set->tiled_left_and_shaded_styles[j];
+      slots[n++] = &style_set->tiled_right_and_shaded_styles[j];
+    }
+
+  g_assert (n == N_STYLE_SET_SLOTS);
+}
+
+static char *
+get_cache_file (const char *theme_file,
+                guint       major_version)
+{
+  char *key;
+  char *hash;
+  char *basename;
+  char *cache_file;
+
+  key = g_strdup_printf ("%s\n%u", theme_file, major_version);
+  hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+  basename = g_strconcat (hash, ".cache", NULL);
+
+  cache_file = g_build_filename (g_get_user_cache_dir (),
+                                 "marco", "themes", basename, NULL);
+
+  g_free (basename);
+  g_free (hash);
+  g_free (key);
+
+  return cache_file;
+}
+
+static char *
+compute_theme_checksum (const char *text,
+                        gsize       length)
+{
+  return g_compute_checksum_for_data (G_CHECKSUM_SHA256,
+                                      (const guchar *) text, length);
+}
+
+/*
+ * Writing
+ */
+
+typedef struct
+{
+  /* object -> index + 1 */
+  GHashTable *indices;
+  GPtrArray  *objects;
+} ObjectTable;
+
+typedef struct
+{
+  GByteArray *data;
+  gboolean failed;
+
+  /* pixbuf -> the name it was loaded from */
+  GHashTable *image_names;
+
+  ObjectTable layouts;
+  ObjectTable op_lists;
+  ObjectTable styles;
+  ObjectTable style_sets;
+} CacheWriter;
+
+static void
+object_table_init (ObjectTable *table)
+{
+  table->indices = g_hash_table_new (NULL, NULL);
+  table->objects = g_ptr_array_new ();
+}
+
+static void
+object_table_free (ObjectTable *table)
+{
+  g_hash_table_destroy (table->indices);
+  g_ptr_array_free (table->objects, TRUE);
+}
+
+static gboolean
+object_table_contains (ObjectTable   *table,
+                       gconstpointer  object)
+{
+  return g_hash_table_contains (table->indices, object);
+}
+
+static void
+object_table_add (ObjectTable *table,
+                  gpointer     object)
+{
+  g_ptr_array_add (table->objects, object);
+  g_hash_table_insert (table->indices, object,
+                       GINT_TO_POINTER (table->objects->len));
+}
+
+static gint32
+object_table_index (ObjectTable   *table,
+                    gconstpointer  object)
+{
+  if (object == NULL)
+    return NO_INDEX;
+
+  return GPOINTER_TO_INT (g_hash_table_lookup (table->indices, object)) - 1;
+}
+
+static void
+write_bytes (CacheWriter   *w,
+             gconstpointer  bytes,
+             gsize          len)
+{
+  g_byte_array_append (w->data, bytes, len);
+}
+
+static void
+write_uint32 (CacheWriter *w,
+              guint32      val)
+{
+  write_bytes (w, &val, sizeof (val));
+}
+
+static void
+write_int32 (CacheWriter *w,
+             gint32       val)
+{
+  write_bytes (w, &val, sizeof (val));
+}
+
+static void
+write_double (CacheWriter *w,
+              double       val)
+{
+  write_bytes (w, &val, sizeof (val));
+}
+
+static void
+write_string (CacheWriter *w,
+              const char  *str)
+{
+  gsize len;
+
+  if (str == NULL)
+    {
+      write_uint32 (w, NO_OBJECT);
+      return;
+    }
+
+  len = strlen (str);
+  write_uint32 (w, len);
+  write_bytes (w, str, len + 1);
+}
+
+static void
+write_border (CacheWriter     *w,
+              const GtkBorder *border)
+{
+  write_int32 (w, border->left);
+  write_int32 (w, border->right);
+  write_int32 (w, border->top);
+  write_int32 (w, border->bottom);
+}
+
+static void
+write_rgba (CacheWriter   *w,
+            const GdkRGBA *color)
+{
+  write_double (w, color->red);
+  write_double (w, color->green);
+  write_double (w, color->blue);
+  write_double (w, color->alpha);
+}
+
+static void
+write_color_spec (CacheWriter         *w,
+                  const MetaColorSpec *spec)
+{
+  if (spec == NULL)
+    {
+      write_uint32 (w, NO_OBJECT);
+      return;
+    }
+
+  write_uint32 (w, spec->type);
+
+  switch (spec->type)
+    {
+    case META_COLOR_SPEC_BASIC:
+      write_rgba (w, &spec->data.basic.color);
+      break;
+
+    case META_COLOR_SPEC_GTK:
+      write_uint32 (w, spec->data.gtk.component);
+      write_uint32 (w, spec->data.gtk.state);
+      break;
+
+    case META_COLOR_SPEC_GTK_CUSTOM:
+      write_string (w, spec->data.gtkcustom.color_name);
+      write_color_spec (w, spec->data.gtkcustom.fallback);
+      break;
+
+    case META_COLOR_SPEC_BLEND:
+      write_color_spec (w, spec->data.blend.foreground);
+      write_color_spec (w, spec->data.blend.background);
+      write_double (w, spec->data.blend.alpha);
+      write_rgba (w, &spec->data.blend.color);
+      break;
+
+    case META_COLOR_SPEC_SHADE:
+      write_color_spec (w, spec->data.shade.base);
+      write_double (w, spec->data.shade.factor);
+      write_rgba (w, &spec->data.shade.color);
+      break;
+    }
+}
+
+static void
+write_gradient_spec (CacheWriter            *w,
+                     const MetaGradientSpec *spec)
+{
+  GSList *tmp;
+
+  if (spec == NULL)
+    {
+      write_uint32 (w, NO_OBJECT);
+      return;
+    }
+
+  write_uint32 (w, spec->type);
+  write_uint32 (w, g_slist_length (spec->color_specs));
+
+  for (tmp = spec->color_specs; tmp != NULL; tmp = tmp->next)
+    write_color_spec (w, tmp->data);
+}
+
+static void
+write_alpha_spec (CacheWriter                 *w,
+                  const MetaAlphaGradientSpec *spec)
+{
+  if (spec == NULL)
+    {
+      write_uint32 (w, NO_OBJECT);
+      return;
+    }
+
+  write_uint32 (w, spec->type);
+  write_uint32 (w, spec->n_alphas);
+  write_bytes (w, spec->alphas, spec->n_alphas);
+}
+
+static void
+write_draw_spec (CacheWriter        *w,
+                 const MetaDrawSpec *spec)
+{
+  int i;
+
+  if (spec == NULL)
+    {
+      write_uint32 (w, NO_OBJECT);
+      return;
+    }
+
+  write_uint32 (w, spec->n_tokens);
+  write_uint32 (w, spec->constant);
+  write_int32 (w, spec->constant ? spec->value : 0);
+
+  for (i = 0; i < spec->n_tokens; i++)
+    {
+      const PosToken *t = &spec->tokens[i];
+
+      write_uint32 (w, t->type);
+
+      switch (t->type)
+        {
+        case POS_TOKEN_INT:
+          write_int32 (w, t->d.i.val);
+          break;
+
+        case POS_TOKEN_DOUBLE:
+          write_double (w, t->d.d.val);
+          break;
+
+        case POS_TOKEN_OPERATOR:
+          write_uint32 (w, t->d.o.op);
+          break;
+
+        case POS_TOKEN_VARIABLE:
+          write_string (w, t->d.v.name);
+          break;
+
+        case POS_TOKEN_OPEN_PAREN:
+        case POS_TOKEN_CLOSE_PAREN:
+          break;
+        }
+    }
+}
+
+static void
+write_draw_op (CacheWriter      *w,
+               const MetaDrawOp *op)
+{
+  write_uint32 (w, op->type);
+
+  switch (op->type)
+    {
+    case META_DRAW_LINE:
+      write_color_spec (w, op->data.line.color_spec);
+      write_int32 (w, op->data.line.dash_on_length);
+      write_int32 (w, op->data.line.dash_off_length);
+      write_int32 (w, op->data.line.width);
+      write_draw_spec (w, op->data.line.x1);
+      write_draw_spec (w, op->data.line.y1);
+      write_draw_spec (w, op->data.line.x2);
+      write_draw_spec (w, op->data.line.y2);
+      break;
+
+    case META_DRAW_RECTANGLE:
+      write_color_spec (w, op->data.rectangle.color_spec);
+      write_uint32 (w, op->data.rectangle.filled);
+      write_draw_spec (w, op->data.rectangle.x);
+      write_draw_spec (w, op->data.rectangle.y);
+      write_draw_spec (w, op->data.rectangle.width);
+      write_draw_spec (w, op->data.rectangle.height);
+      break;
+
+    case META_DRAW_ARC:
+      write_color_spec (w, op->data.arc.color_spec);
+      write_uint32 (w, op->data.arc.filled);
+      write_draw_spec (w, op->data.arc.x);
+      write_draw_spec (w, op->data.arc.y);
+      write_draw_spec (w, op->data.arc.width);
+      write_draw_spec (w, op->data.arc.height);
+      write_double (w, op->data.arc.start_angle);
+      write_double (w, op->data.arc.extent_angle);
+      break;
+
+    case META_DRAW_CLIP:
+      write_draw_spec (w, op->data.clip.x);
+      write_draw_spec (w, op->data.clip.y);
+      write_draw_spec (w, op->data.clip.width);
+      write_draw_spec (w, op->data.clip.height);
+      break;
+
+    case META_DRAW_TINT:
+      write_color_spec (w, op->data.tint.color_spec);
+      write_alpha_spec (w, op->data.tint.alpha_spec);
+      write_draw_spec (w, op->data.tint.x);
+      write_draw_spec (w, op->data.tint.y);
+      write_draw_spec (w, op->data.tint.width);
+      write_draw_spec (w, op->data.tint.height);
+      break;
+
+    case META_DRAW_GRADIENT:
+      write_gradient_spec (w, op->data.gradient.gradient_spec);
+      write_alpha_spec (w, op->data.gradient.alpha_spec);
+      write_draw_spec (w, op->data.gradient.x);
+      write_draw_spec (w, op->data.gradient.y);
+      write_draw_spec (w, op->data.gradient.width);
+      write_draw_spec (w, op->data.gradient.height);
+      break;
+
+    case META_DRAW_IMAGE:
+      {
+        const char *filename;
+
+        filename = g_hash_table_lookup (w->image_names,
+                                        op->data.image.pixbuf);
+        if (filename == NULL)
+          w->failed = TRUE;
+
+        write_string (w, filename);
+        write_color_spec (w, op->data.image.colorize_spec);
+        write_alpha_spec (w, op->data.image.alpha_spec);
+        write_draw_spec (w, op->data.image.x);
+        write_draw_spec (w, op->data.image.y);
+        write_draw_spec (w, op->data.image.width);
+        write_draw_spec (w, op->data.image.height);
+        write_uint32 (w, op->data.image.fill_type);
+      }
+      break;
+
+    case META_DRAW_GTK_ARROW:
+      write_uint32 (w, op->data.gtk_arrow.state);
+      write_uint32 (w, op->data.gtk_arrow.shadow);
+      write_uint32 (w, op->data.gtk_arrow.arrow);
+      write_uint32 (w, op->data.gtk_arrow.filled);
+      write_draw_spec (w, op->data.gtk_arrow.x);
+      write_draw_spec (w, op->data.gtk_arrow.y);
+      write_draw_spec (w, op->data.gtk_arrow.width);
+      write_draw_spec (w, op->data.gtk_arrow.height);
+      break;
+
+    case META_DRAW_GTK_BOX:
+      write_uint32 (w, op->data.gtk_box.state);
+      write_uint32 (w, op->data.gtk_box.shadow);
+      write_draw_spec (w, op->data.gtk_box.x);
+      write_draw_spec (w, op->data.gtk_box.y);
+      write_draw_spec (w, op->data.gtk_box.width);
+      write_draw_spec (w, op->data.gtk_box.height);
+      break;
+
+    case META_DRAW_GTK_VLINE:
+      write_uint32 (w, op->data.gtk_vline.state);
+      write_draw_spec (w, op->data.gtk_vline.x);
+      write_draw_spec (w, op->data.gtk_vline.y1);
+      write_draw_spec (w, op->data.gtk_vline.y2);
+      break;
+
+    case META_DRAW_ICON:
+      write_alpha_spec (w, op->data.icon.alpha_spec);
+      write_draw_spec (w, op->data.icon.x);
+      write_draw_spec (w, op->data.icon.y);
+      write_draw_spec (w, op->data.icon.width);
+      write_draw_spec (w, op->data.icon.height);
+      write_uint32 (w, op->data.icon.fill_type);
+      break;
+
+    case META_DRAW_TITLE:
+      write_color_spec (w, op->data.title.color_spec);
+      write_draw_spec (w, op->data.title.x);
+      write_draw_spec (w, op->data.title.y);
+      write_draw_spec (w, op->data.title.ellipsize_width);
+      break;
+
+    case META_DRAW_OP_LIST:
+      write_int32 (w, object_table_index (&w->op_lists,
+                                          op->data.op_list.op_list));
+      write_draw_spec (w, op->data.op_list.x);
+      write_draw_spec (w, op->data.op_list.y);
+      write_draw_spec (w, op->data.op_list.width);
+      write_draw_spec (w, op->data.op_list.height);
+      break;
+
+    case META_DRAW_TILE:
+      write_int32 (w, object_table_index (&w->op_lists,
+                                          op->data.tile.op_list));
+      write_draw_spec (w, op->data.tile.x);
+      write_draw_spec (w, op->data.tile.y);
+      write_draw_spec (w, op->data.tile.width);
+      write_draw_spec (w, op->data.tile.height);
+      write_draw_spec (w, op->data.tile.tile_xoffset);
+      write_draw_spec (w, op->data.tile.tile_yoffset);
+      write_draw_spec (w, op->data.tile.tile_width);
+      write_draw_spec (w, op->data.tile.tile_height);
+      break;
+    }
+}
+
+static void
+write_layout (CacheWriter           *w,
+              const MetaFrameLayout *layout)
+{
+  write_int32 (w, layout->left_width);
+  write_int32 (w, layout->right_width);
+  write_int32 (w, layout->bottom_height);
+  write_border (w, &layout->invisible_resize_border);
+  write_border (w, &layout->title_border);
+  write_int32 (w, layout->title_vertical_pad);
+  write_int32 (w, layout->right_titlebar_edge);
+  write_int32 (w, layout->left_titlebar_edge);
+  write_uint32 (w, layout->button_sizing);
+  write_double (w, layout->button_aspect);
+  write_int32 (w, layout->button_width);
+  write_int32 (w, layout->button_height);
+  write_border (w, &layout->button_border);
+  write_double (w, layout->title_scale);
+  write_uint32 (w, layout->has_title);
+  write_uint32 (w, layout->hide_buttons);
+  write_uint32 (w, layout->top_left_corner_rounded_radius);
+  write_uint32 (w, layout->top_right_corner_rounded_radius);
+  write_uint32 (w, layout->bottom_left_corner_rounded_radius);
+  write_uint32 (w, layout->bottom_right_corner_rounded_radius);
+}
+
+static void
+write_op_list (CacheWriter          *w,
+               const MetaDrawOpList *op_list)
+{
+  int i;
+
+  write_uint32 (w, op_list->n_ops);
+
+  for (i = 0; i < op_list->n_ops; i++)
+    write_draw_op (w, op_list->ops[i]);
+}
+
+static void
+write_style (CacheWriter          *w,
+             const MetaFrameStyle *style)
+{
+  int i, j;
+
+  write_int32 (w, object_table_index (&w->styles, style->parent));
+
+  for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+    for (j = 0; j < META_BUTTON_STATE_LAST; j++)
+      write_int32 (w, object_table_index (&w->op_lists, style->buttons[i][j]));
+
+  for (i = 0; i < META_FRAME_PIECE_LAST; i++)
+    write_int32 (w, object_table_index (&w->op_lists, style->pieces[i]));
+
+  write_int32 (w, object_table_index (&w->layouts, style->layout));
+  write_color_spec (w, style->window_background_color);
+  write_uint32 (w, style->window_background_alpha);
+}
+
+static void
+write_style_set (CacheWriter       *w,
+                 MetaFrameStyleSet *style_set)
+{
+  MetaFrameStyle **slots[N_STYLE_SET_SLOTS];
+  int i;
+
+  write_int32 (w, object_table_index (&w->style_sets, style_set->parent));
+
+  get_style_set_slots (style_set, slots);
+  for (i = 0; i < N_STYLE_SET_SLOTS; i++)
+    write_int32 (w, object_table_index (&w->styles, *slots[i]));
+}
+
+/* The collect functions fill the tables so that every object comes
+ * after all the objects it refers to.
+ */
+static void
+collect_op_list (CacheWriter    *w,
+                 MetaDrawOpList *op_list)
+{
+  int i;
+
+  if (op_list == NULL || object_table_contains (&w->op_lists, op_list))
+    return;
+
+  for (i = 0; i < op_list->n_ops; i++)
+    {
+      if (op_list->ops[i]->type == META_DRAW_OP_LIST)
+        collect_op_list (w, op_list->ops[i]->data.op_list.op_list);
+      else if (op_list->ops[i]->type == META_DRAW_TILE)
+        collect_op_list (w, op_list->ops[i]->data.tile.op_list);
+    }
+
+  object_table_add (&w->op_lists, op_list);
+}
+
+static void
+collect_layout (CacheWriter     *w,
+                MetaFrameLayout *layout)
+{
+  if (layout == NULL || object_table_contains (&w->layouts, layout))
+    return;
+
+  object_table_add (&w->layouts, layout);
+}
+
+static void
+collect_style (CacheWriter    *w,
+               MetaFrameStyle *style)
+{
+  int i, j;
+
+  if (style == NULL || object_table_contains (&w->styles, style))
+    return;
+
+  collect_style (w, style->parent);
+  collect_layout (w, style->layout);
+
+  for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+    for (j = 0; j < META_BUTTON_STATE_LAST; j++)
+      collect_op_list (w, style->buttons[i][j]);
+
+  for (i = 0; i < META_FRAME_PIECE_LAST; i++)
+    collect_op_list (w, style->pieces[i]);
+
+  object_table_add (&w->styles, style);
+}
+
+static void
+collect_style_set (CacheWriter       *w,
+                   MetaFrameStyleSet *style_set)
+{
+  MetaFrameStyle **slots[N_STYLE_SET_SLOTS];
+  int i;
+
+  if (style_set == NULL || object_table_contains (&w->style_sets, style_set))
+    return;
+
+  collect_style_set (w, style_set->parent);
+
+  get_style_set_slots (style_set, slots);
+  for (i = 0; i < N_STYLE_SET_SLOTS; i++)
+    collect_style (w, *slots[i]);
+
+  object_table_add (&w->style_sets, style_set);
+}
+
+static void
+collect_one_layout (gpointer key,
+                    gpointer value,
+                    gpointer data)
+{
+  collect_layout (data, value);
+}
+
+static void
+collect_one_op_list (gpointer key,
+                     gpointer value,
+                     gpointer data)
+{
+  collect_op_list (data, value);
+}
+
+static void
+collect_one_style (gpointer key,
+                   gpointer value,
+                   gpointer data)
+{
+  collect_style (data, value);
+}
+
+static void
+collect_one_style_set (gpointer key,
+                       gpointer value,
+                       gpointer data)
+{
+  collect_style_set (data, value);
+}
+
+static void
+add_image_name (gpointer key,
+                gpointer value,
+                gpointer data)
+{
+  CacheWriter *w = data;
+
+  g_hash_table_insert (w->image_names, value, key);
+}
+
+static void
+write_names (CacheWriter *w,
+             GHashTable  *by_name,
+             ObjectTable *table)
+{
+  GHashTableIter iter;
+  gpointer name, object;
+
+  write_uint32 (w, g_hash_table_size (by_name));
+
+  g_hash_table_iter_init (&iter, by_name);
+  while (g_hash_table_iter_next (&iter, &name, &object))
+    {
+      write_string (w, name);
+      write_int32 (w, object_table_index (table, object));
+    }
+}
+
+static void
+write_int_constants (CacheWriter *w,
+                     GHashTable  *constants)
+{
+  GHashTableIter iter;
+  gpointer name, value;
+
+  if (constants == NULL)
+    {
+      write_uint32 (w, 0);
+      return;
+    }
+
+  write_uint32 (w, g_hash_table_size (constants));
+
+  g_hash_table_iter_init (&iter, constants);
+  while (g_hash_table_iter_next (&iter, &name, &value))
+    {
+      write_string (w, name);
+      write_int32 (w, GPOINTER_TO_INT (value));
+    }
+}
+
+static void
+write_float_constants (CacheWriter *w,
+                       GHashTable  *constants)
+{
+  GHashTableIter iter;
+  gpointer name, value;
+
+  if (constants == NULL)
+    {
+      write_uint32 (w, 0);
+      return;
+    }
+
+  write_uint32 (w, g_hash_table_size (constants));
+
+  g_hash_table_iter_init (&iter, constants);
+  while (g_hash_table_iter_next (&iter, &name, &value))
+    {
+      write_string (w, name);
+      write_double (w, *(double *) value);
+    }
+}
+
+static void
+write_color_constants (CacheWriter *w,
+                       GHashTable  *constants)
+{
+  GHashTableIter iter;
+  gpointer name, value;
+
+  if (constants == NULL)
+    {
+      write_uint32 (w, 0);
+      return;
+    }
+
+  write_uint32 (w, g_hash_table_size (constants));
+
+  g_hash_table_iter_init (&iter, constants);
+  while (g_hash_table_iter_next (&iter, &name, &value))
+    {
+      write_string (w, name);
+      write_string (w, value);
+    }
+}
+
+static void
+write_header (CacheWriter *w,
+              const char  *theme_file,
+              guint        major_version,
+              const char  *checksum)
+{
+  write_bytes (w, CACHE_MAGIC, CACHE_MAGIC_LEN);
+  write_uint32 (w, CACHE_FORMAT_VERSION);
+  write_string (w, PACKAGE_VERSION);
+
+  /* In case the theme structures change without the version changing */
+  write_uint32 (w, META_BUTTON_TYPE_LAST);
+  write_uint32 (w, META_BUTTON_STATE_LAST);
+  write_uint32 (w, META_FRAME_PIECE_LAST);
+  write_uint32 (w, META_FRAME_TYPE_LAST);
+  write_uint32 (w, N_STYLE_SET_SLOTS);
+
+  write_string (w, theme_file);
+  write_uint32 (w, major_version);
+  write_string (w, checksum);
+}
+
+/**
+ * Writes a theme that was just parsed to the cache, so that the next
+ * time its file is loaded it doesn't need to be parsed.  Failing to
+ * write the cache isn't an error, the theme is just parsed next time.
+ *
+ * \param theme  The theme, as parsed from theme->filename
+ * \param major_version  The major version of the theme format the
+ *                       file is for
+ * \param text  The contents of theme->filename that were parsed
+ * \param length  The length of text
+ */
+void
+meta_theme_cache_save (MetaTheme  *theme,
+                       guint       major_version,
+                       const char *text,
+                       gsize       length)
+{
+  CacheWriter w;
+  char *checksum;
+  char *cache_file;
+  char *cache_dir;
+  GError *error;
+  guint i;
+
+  w.data = g_byte_array_new ();
+  w.failed = FALSE;
+  w.image_names = g_hash_table_new (NULL, NULL);
+  object_table_init (&w.layouts);
+  object_table_init (&w.op_lists);
+  object_table_init (&w.styles);
+  object_table_init (&w.style_sets);
+
+  g_hash_table_foreach (theme->images_by_filename, add_image_name, &w);
+
+  g_hash_table_foreach (theme->layouts_by_name, collect_one_layout, &w);
+  g_hash_table_foreach (theme->draw_op_lists_by_name, collect_one_op_list, &w);
+  g_hash_table_foreach (theme->styles_by_name, collect_one_style, &w);
+  g_hash_table_foreach (theme->style_sets_by_name, collect_one_style_set, &w);
+  for (i = 0; i < META_FRAME_TYPE_LAST; i++)
+    collect_style_set (&w, theme->style_sets_by_type[i]);
+
+  checksum = compute_theme_checksum (text, length);
+  write_header (&w, theme->filename, major_version, checksum);
+  g_free (checksum);
+
+  write_uint32 (&w, theme->format_version);
+  write_string (&w, theme->readable_name);
+  write_string (&w, theme->author);
+  write_string (&w, theme->copyright);
+  write_string (&w, theme->date);
+  write_string (&w, theme->description);
+
+  write_int_constants (&w, theme->integer_constants);
+  write_float_constants (&w, theme->float_constants);
+  write_color_constants (&w, theme->color_constants);
+
+  write_uint32 (&w, w.layouts.objects->len);
+  for (i = 0; i < w.layouts.objects->len; i++)
+    write_layout (&w, g_ptr_array_index (w.layouts.objects, i));
+
+  write_uint32 (&w, w.op_lists.objects->len);
+  for (i = 0; i < w.op_lists.objects->len; i++)
+    write_op_list (&w, g_ptr_array_index (w.op_lists.objects, i));
+
+  write_uint32 (&w, w.styles.objects->len);
+  for (i = 0; i < w.styles.objects->len; i++)
+    write_style (&w, g_ptr_array_index (w.styles.objects, i));
+
+  write_uint32 (&w, w.style_sets.objects->len);
+  for (i = 0; i < w.style_sets.objects->len; i++)
+    write_style_set (&w, g_ptr_array_index (w.style_sets.objects, i));
+
+  write_names (&w, theme->layouts_by_name, &w.layouts);
+  write_names (&w, theme->draw_op_lists_by_name, &w.op_lists);
+  write_names (&w, theme->styles_by_name, &w.styles);
+  write_names (&w, theme->style_sets_by_name, &w.style_sets);
+
+  for (i = 0; i < META_FRAME_TYPE_LAST; i++)
+    write_int32 (&w, object_table_index (&w.style_sets,
+                                         theme->style_sets_by_type[i]));
+
+  write_bytes (&w, CACHE_MAGIC, CACHE_MAGIC_LEN);
+
+  cache_file = get_cache_file (theme->filename, major_version);
+  cache_dir = g_path_get_dirname (cache_file);
+  error = NULL;
+
+  if (w.failed)
+    {
+      meta_topic (META_DEBUG_THEMES,
+                  "Not caching theme file %s, it has an image we can't name\n",
+                  theme->filename);
+    }
+  else if (g_mkdir_with_parents (cache_dir, 0755) != 0)
+    {
+      meta_topic (META_DEBUG_THEMES,
+                  "Failed to create theme cache directory %s: %s\n",
+                  cache_dir, g_strerror (errno));
+    }
+  else if (!g_file_set_contents (cache_file, (const char *) w.data->data,
+                                 w.data->len, &error))
+    {
+      meta_topic (META_DEBUG_THEMES, "Failed to write theme cache: %s\n",
+                  error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      meta_topic (META_DEBUG_THEMES,
+                  "Cached theme file %s in %s (%u bytes)\n",
+                  theme->filename, cache_file, w.data->len);
+    }
+
+  g_free (cache_dir);
+  g_free (cache_file);
+
+  object_table_free (&w.style_sets);
+  object_table_free (&w.styles);
+  object_table_free (&w.op_lists);
+  object_table_free (&w.layouts);
+  g_hash_table_destroy (w.image_names);
+  g_byte_array_free (w.data, TRUE);
+}
+
+/*
+ * Reading
+ *
+ * Every read checks that it stays inside the file; once one fails
+ * all further reads return zeroes, and the whole cache is dropped at
+ * the end.  Whatever was built up to then is freed as usual, so
+ * objects are always left in a state their free function copes with.
+ */
+
+typedef struct
+{
+  const guchar *p;
+  const guchar *end;
+  gboolean failed;
+
+  MetaTheme *theme;
+
+  /* Each of these holds a reference to its objects */
+  GPtrArray *layouts;
+  GPtrArray *op_lists;
+  GPtrArray *styles;
+  GPtrArray *style_sets;
+} CacheReader;
+
+typedef gpointer (*ReadObjectFunc) (CacheReader *r);
+typedef void     (*RefObjectFunc)  (gpointer     object);
+
+static gboolean
+read_bytes (CacheReader *r,
+            gpointer     dest,
+            gsize        len)
+{
+  if (r->failed || (gsize) (r->end - r->p) < len)
+    {
+      r->failed = TRUE;
+      memset (dest, 0, len);
+      return FALSE;
+    }
+
+  memcpy (dest, r->p, len);
+  r->p += len;
+
+  return TRUE;
+}
+
+static guint32
+read_uint32 (CacheReader *r)
+{
+  guint32 val;
+
+  read_bytes (r, &val, sizeof (val));
+
+  return val;
+}
+
+static gint32
+read_int32 (CacheReader *r)
+{
+  gint32 val;
+
+  read_bytes (r, &val, sizeof (val));
+
+  return val;
+}
+
+static double
+read_double (CacheReader *r)
+{
+  double val;
+
+  read_bytes (r, &val, sizeof (val));
+
+  return val;
+}
+
+/* Reads the number of things that follow, each taking at least
+ * min_size bytes, so a broken count can't make us allocate much.
+ */
+static guint32
+read_count (CacheReader *r,
+            gsize        min_size)
+{
+  guint32 count;
+
+  count = read_uint32 (r);
+
+  if (r->failed || count > (gsize) (r->end - r->p) / min_size)
+    {
+      r->failed = TRUE;
+      return 0;
+    }
+
+  return count;
+}
+
+static gboolean
+read_is_null (CacheReader *r)
+{
+  guint32 marker;
+
+  if (r->failed || r->end - r->p < (gssize) sizeof (marker))
+    {
+      r->failed = TRUE;
+      return TRUE;
+    }
+
+  memcpy (&marker, r->p, sizeof (marker));
+  if (marker != NO_OBJECT)
+    return FALSE;
+
+  r->p += sizeof (marker);
+
+  return TRUE;
+}
+
+static char *
+read_string (CacheReader *r)
+{
+  guint32 len;
+  char *str;
+
+  if (read_is_null (r))
+    return NULL;
+
+  len = read_uint32 (r);
+
+  if (r->failed || (gsize) (r->end - r->p) <= len || r->p[len] != '\0')
+    {
+      r->failed = TRUE;
+      return NULL;
+    }
+
+  str = g_strndup ((const char *) r->p, len);
+  r->p += len + 1;
+
+  return str;
+}
+
+/* Whether the next string is the given one, without copying it */
+static gboolean
+read_string_is (CacheReader *r,
+                const char  *str)
+{
+  guint32 len;
+
+  len = read_uint32 (r);
+
+  if (r->failed || len != strlen (str) ||
+      (gsize) (r->end - r->p) <= len ||
+      memcmp (r->p, str, len + 1) != 0)
+    {
+      r->failed = TRUE;
+      return FALSE;
+    }
+
+  r->p += len + 1;
+
+  return TRUE;
+}
+
+/* Reads an index into one of the object tables, which must be for an
+ * object that was read already
+ */
+static gpointer
+read_object (CacheReader *r,
+             GPtrArray   *objects)
+{
+  gint32 index;
+
+  index = read_int32 (r);
+
+  if (r->failed || index == NO_INDEX)
+    return NULL;
+
+  if (index < 0 || (guint) index >= objects->len)
+    {
+      r->failed = TRUE;
+      return NULL;
+    }
+
+  return g_ptr_array_index (objects, index);
+}
+
+static void
+read_border (CacheReader *r,
+             GtkBorder   *border)
+{
+  border->left = read_int32 (r);
+  border->right = read_int32 (r);
+  border->top = read_int32 (r);
+  border->bottom = read_int32 (r);
+}
+
+static void
+read_rgba (CacheReader *r,
+           GdkRGBA     *color)
+{
+  color->red = read_double (r);
+  color->green = read_double (r);
+  color->blue = read_double (r);
+  color->alpha = read_double (r);
+}
+
+static MetaColorSpec *
+read_color_spec (CacheReader *r)
+{
+  MetaColorSpec *spec;
+  guint32 type;
+
+  if (read_is_null (r))
+    return NULL;
+
+  type = read_uint32 (r);
+
+  if (r->failed || type > META_COLOR_SPEC_SHADE)
+    {
+      r->failed = TRUE;
+      return NULL;
+    }
+
+  spec = meta_color_spec_new (type);
+
+  switch (spec->type)
+    {
+    case META_COLOR_SPEC_BASIC:
+      read_rgba (r, &spec->data.basic.color);
+      break;
+
+    case META_COLOR_SPEC_GTK:
+      spec->data.gtk.component = read_uint32 (r);
+      spec->data.gtk.state = read_uint32 (r);
+      if (spec->data.gtk.component >= META_GTK_COLOR_LAST)
+        r->failed = TRUE;
+      break;
+
+    case META_COLOR_SPEC_GTK_CUSTOM:
+      spec->data.gtkcustom.color_name = read_string (r);
+      spec->data.gtkcustom.fallback = read_color_spec (r);
+      break;
+
+    case META_COLOR_SPEC_BLEND:
+      spec->data.blend.foreground = read_color_spec (r);
+      spec->data.blend.background = read_color_spec (r);
+      spec->data.blend.alpha = read_double (r);
+      read_rgba (r, &spec->data.blend.color);
+      break;
+
+    case META_COLOR_SPEC_SHADE:
+      spec->data.shade.base = read_color_spec (r);
+      spec->data.shade.factor = read_double (r);
+      read_rgba (r, &spec->data.shade.color);
+      break;
+    }
+
+  return spec;
+}
+
+static MetaGradientSpec *
+read_gradient_spec (CacheReader *r)
+{
+  MetaGradientSpec *spec;
+  guint32 n_colors;
+  guint32 i;
+
+  if (read_is_null (r))
+    return NULL;
+
+  spec = meta_gradient_spec_new (read_uint32 (r));
+  n_colors = read_count (r, sizeof (guint32));
+
+  for (i = 0; i < n_colors; i++)
+    {
+      MetaColorSpec *color_spec;
+
+      color_spec = read_color_spec (r);
+      if (color_spec == NULL)
+        {
+          r->failed = TRUE;
+          break;
+        }
+
+      spec->color_specs = g_slist_prepend (spec->color_specs, color_spec);
+    }
+
+  spec->color_specs = g_slist_reverse (spec->color_specs);
+
+  return spec;
+}
+
+static MetaAlphaGradientSpec *
+read_alpha_spec (CacheReader *r)
+{
+  MetaAlphaGradientSpec *spec;
+  MetaGradientType type;
+  guint32 n_alphas;
+
+  if (read_is_null (r))
+    return NULL;
+
+  type = read_uint32 (r);
+  n_alphas = read_count (r, 1);
+
+  if (n_alphas == 0)
+    {
+      r->failed = TRUE;
+      return NULL;
+    }
+
+  spec = meta_alpha_gradient_spec_new (type, n_alphas);
+  read_bytes (r, spec->alphas, n_alphas);
+
+  return spec;
+}
+
+static MetaDrawSpec *
+read_draw_spec (CacheReader *r)
+{
+  PosToken *tokens;
+  guint32 n_tokens;
+  gboolean constant;
+  int value;
+  guint32 i;
+
+  if (read_is_null (r))
+    return NULL;
+
+  n_tokens = read_count (r, sizeof (guint32));
+  constant = read_uint32 (r) != 0;
+  value = read_int32 (r);
+
+  tokens = g_new0 (PosToken, MAX (n_tokens, 1));
+
+  for (i = 0; i < n_tokens; i++)
+    {
+      PosToken *t = &tokens[i];
+
+      t->type = read_uint32 (r);
+
+      switch (t->type)
+        {
+        case POS_TOKEN_INT:
+          t->d.i.val = read_int32 (r);
+          break;
+
+        case POS_TOKEN_DOUBLE:
+          t->d.d.val = read_double (r);
+          break;
+
+        case POS_TOKEN_OPERATOR:
+          t->d.o.op = read_uint32 (r);
+          if (t->d.o.op == POS_OP_NONE || t->d.o.op > POS_OP_MIN)
+            {
+              t->d.o.op = POS_OP_NONE;
+              r->failed = TRUE;
+            }
+          break;
+
+        case POS_TOKEN_VARIABLE:
+          t->d.v.name = read_string (r);
+          if (t->d.v.name == NULL)
+            {
+              /* So that freeing the tokens doesn't go past this one */
+              t->type = POS_TOKEN_OPEN_PAREN;
+              r->failed = TRUE;
+            }
+          else
+            t->d.v.name_quark = g_quark_from_string (t->d.v.name);
+          break;
+
+        case POS_TOKEN_OPEN_PAREN:
+        case POS_TOKEN_CLOSE_PAREN:
+          break;
+
+        default:
+          t->type = POS_TOKEN_OPEN_PAREN;
+          r->failed = TRUE;
+          break;
+        }
+
+      if (r->failed)
+        {
+          n_tokens = i + 1;
+          break;
+        }
+    }
+
+  /* Don't bother compiling what is going to be thrown away */
+  return meta_draw_spec_new_from_tokens (tokens, n_tokens,
+                                         constant || r->failed, value);
+}
+
+static MetaDrawOpList *
+read_op_list_ref (CacheReader *r)
+{
+  MetaDrawOpList *op_list;
+
+  op_list = read_object (r, r->op_lists);
+  if (op_list)
+    meta_draw_op_list_ref (op_list);
+
+  return op_list;
+}
+
+static void
+read_image (CacheReader *r,
+            MetaDrawOp  *op)
+{
+  GdkPixbuf *pixbuf;
+  GError *error;
+  char *filename;
+
+  filename = read_string (r);
+  if (filename == NULL)
+    {
+      r->failed = TRUE;
+      return;
+    }
+
+  error = NULL;
+  pixbuf = meta_theme_load_image (r->theme, filename, 64, &error);
+
+  if (pixbuf == NULL)
+    {
+      /* Let the parser report it */
+      meta_topic (META_DEBUG_THEMES,
+                  "Failed to load cached theme image %s: %s\n",
+                  filename, error ? error->message : "unknown error");
+      g_clear_error (&error);
+      r->failed = TRUE;
+    }
+  else
+    meta_draw_op_set_image (op, pixbuf);
+
+  g_free (filename);
+}
+
+static MetaDrawOp *
+read_draw_op (CacheReader *r)
+{
+  MetaDrawOp *op;
+  guint32 type;
+
+  type = read_uint32 (r);
+
+  if (r->failed || type > META_DRAW_TILE)
+    {
+      r->failed = TRUE;
+      return NULL;
+    }
+
+  op = meta_draw_op_new (type);
+
+  switch (op->type)
+    {
+    case META_DRAW_LINE:
+      op->data.line.color_spec = read_color_spec (r);
+      op->data.line.dash_on_length = read_int32 (r);
+      op->data.line.dash_off_length = read_int32 (r);
+      op->data.line.width = read_int32 (r);
+      op->data.line.x1 = read_draw_spec (r);
+      op->data.line.y1 = read_draw_spec (r);
+      op->data.line.x2 = read_draw_spec (r);
+      op->data.line.y2 = read_draw_spec (r);
+      break;
+
+    case META_DRAW_RECTANGLE:
+      op->data.rectangle.color_spec = read_color_spec (r);
+      op->data.rectangle.filled = read_uint32 (r);
+      op->data.rectangle.x = read_draw_spec (r);
+      op->data.rectangle.y = read_draw_spec (r);
+      op->data.rectangle.width = read_draw_spec (r);
+      op->data.rectangle.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_ARC:
+      op->data.arc.color_spec = read_color_spec (r);
+      op->data.arc.filled = read_uint32 (r);
+      op->data.arc.x = read_draw_spec (r);
+      op->data.arc.y = read_draw_spec (r);
+      op->data.arc.width = read_draw_spec (r);
+      op->data.arc.height = read_draw_spec (r);
+      op->data.arc.start_angle = read_double (r);
+      op->data.arc.extent_angle = read_double (r);
+      break;
+
+    case META_DRAW_CLIP:
+      op->data.clip.x = read_draw_spec (r);
+      op->data.clip.y = read_draw_spec (r);
+      op->data.clip.width = read_draw_spec (r);
+      op->data.clip.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_TINT:
+      op->data.tint.color_spec = read_color_spec (r);
+      op->data.tint.alpha_spec = read_alpha_spec (r);
+      op->data.tint.x = read_draw_spec (r);
+      op->data.tint.y = read_draw_spec (r);
+      op->data.tint.width = read_draw_spec (r);
+      op->data.tint.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_GRADIENT:
+      op->data.gradient.gradient_spec = read_gradient_spec (r);
+      op->data.gradient.alpha_spec = read_alpha_spec (r);
+      op->data.gradient.x = read_draw_spec (r);
+      op->data.gradient.y = read_draw_spec (r);
+      op->data.gradient.width = read_draw_spec (r);
+      op->data.gradient.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_IMAGE:
+      read_image (r, op);
+      op->data.image.colorize_spec = read_color_spec (r);
+      op->data.image.alpha_spec = read_alpha_spec (r);
+      op->data.image.x = read_draw_spec (r);
+      op->data.image.y = read_draw_spec (r);
+      op->data.image.width = read_draw_spec (r);
+      op->data.image.height = read_draw_spec (r);
+      op->data.image.fill_type = read_uint32 (r);
+      break;
+
+    case META_DRAW_GTK_ARROW:
+      op->data.gtk_arrow.state = read_uint32 (r);
+      op->data.gtk_arrow.shadow = read_uint32 (r);
+      op->data.gtk_arrow.arrow = read_uint32 (r);
+      op->data.gtk_arrow.filled = read_uint32 (r);
+      op->data.gtk_arrow.x = read_draw_spec (r);
+      op->data.gtk_arrow.y = read_draw_spec (r);
+      op->data.gtk_arrow.width = read_draw_spec (r);
+      op->data.gtk_arrow.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_GTK_BOX:
+      op->data.gtk_box.state = read_uint32 (r);
+      op->data.gtk_box.shadow = read_uint32 (r);
+      op->data.gtk_box.x = read_draw_spec (r);
+      op->data.gtk_box.y = read_draw_spec (r);
+      op->data.gtk_box.width = read_draw_spec (r);
+      op->data.gtk_box.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_GTK_VLINE:
+      op->data.gtk_vline.state = read_uint32 (r);
+      op->data.gtk_vline.x = read_draw_spec (r);
+      op->data.gtk_vline.y1 = read_draw_spec (r);
+      op->data.gtk_vline.y2 = read_draw_spec (r);
+      break;
+
+    case META_DRAW_ICON:
+      op->data.icon.alpha_spec = read_alpha_spec (r);
+      op->data.icon.x = read_draw_spec (r);
+      op->data.icon.y = read_draw_spec (r);
+      op->data.icon.width = read_draw_spec (r);
+      op->data.icon.height = read_draw_spec (r);
+      op->data.icon.fill_type = read_uint32 (r);
+      break;
+
+    case META_DRAW_TITLE:
+      op->data.title.color_spec = read_color_spec (r);
+      op->data.title.x = read_draw_spec (r);
+      op->data.title.y = read_draw_spec (r);
+      op->data.title.ellipsize_width = read_draw_spec (r);
+      break;
+
+    case META_DRAW_OP_LIST:
+      op->data.op_list.op_list = read_op_list_ref (r);
+      op->data.op_list.x = read_draw_spec (r);
+      op->data.op_list.y = read_draw_spec (r);
+      op->data.op_list.width = read_draw_spec (r);
+      op->data.op_list.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_TILE:
+      op->data.tile.op_list = read_op_list_ref (r);
+      op->data.tile.x = read_draw_spec (r);
+      op->data.tile.y = read_draw_spec (r);
+      op->data.tile.width = read_draw_spec (r);
+      op->data.tile.height = read_draw_spec (r);
+      op->data.tile.tile_xoffset = read_draw_spec (r);
+      op->data.tile.tile_yoffset = read_draw_spec (r);
+      op->data.tile.tile_width = read_draw_spec (r);
+      op->data.tile.tile_height = read_draw_spec (r);
+      break;
+    }
+
+  return op;
+}
+
+static MetaFrameLayout *
+read_layout (CacheReader *r)
+{
+  MetaFrameLayout *layout;
+
+  layout = meta_frame_layout_new ();
+
+  layout->left_width = read_int32 (r);
+  layout->right_width = read_int32 (r);
+  layout->bottom_height = read_int32 (r);
+  read_border (r, &layout->invisible_resize_border);
+  read_border (r, &layout->title_border);
+  layout->title_vertical_pad = read_int32 (r);
+  layout->right_titlebar_edge = read_int32 (r);
+  layout->left_titlebar_edge = read_int32 (r);
+  layout->button_sizing = read_uint32 (r);
+  layout->button_aspect = read_double (r);
+  layout->button_width = read_int32 (r);
+  layout->button_height = read_int32 (r);
+  read_border (r, &layout->button_border);
+  layout->title_scale = read_double (r);
+  layout->has_title = read_uint32 (r) != 0;
+  layout->hide_buttons = read_uint32 (r) != 0;
+  layout->top_left_corner_rounded_radius = read_uint32 (r);
+  layout->top_right_corner_rounded_radius = read_uint32 (r);
+  layout->bottom_left_corner_rounded_radius = read_uint32 (r);
+  layout->bottom_right_corner_rounded_radius = read_uint32 (r);
+
+  return layout;
+}
+
+static MetaDrawOpList *
+read_op_list (CacheReader *r)
+{
+  MetaDrawOpList *op_list;
+  guint32 n_ops;
+  guint32 i;
+
+  n_ops = read_count (r, sizeof (guint32));
+  op_list = meta_draw_op_list_new (MAX (n_ops, 1));
+
+  for (i = 0; i < n_ops && !r->failed; i++)
+    {
+      MetaDrawOp *op;
+
+      op = read_draw_op (r);
+      if (op)
+        meta_draw_op_list_append (op_list, op);
+    }
+
+  /* The lists it includes come before it, so they are flattened
+   * already, as when parsing
+   */
+  if (!r->failed)
+    meta_draw_op_list_validate (op_list, NULL);
+
+  return op_list;
+}
+
+static MetaFrameStyle *
+read_style (CacheReader *r)
+{
+  MetaFrameStyle *style;
+  int i, j;
+
+  style = meta_frame_style_new (read_object (r, r->styles));
+
+  for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+    for (j = 0; j < META_BUTTON_STATE_LAST; j++)
+      style->buttons[i][j] = read_op_list_ref (r);
+
+  for (i = 0; i < META_FRAME_PIECE_LAST; i++)
+    style->pieces[i] = read_op_list_ref (r);
+
+  style->layout = read_object (r, r->layouts);
+  if (style->layout)
+    meta_frame_layout_ref (style->layout);
+
+  style->window_background_color = read_color_spec (r);
+  style->window_background_alpha = read_uint32 (r);
+
+  return style;
+}
+
+static MetaFrameStyleSet *
+read_style_set (CacheReader *r)
+{
+  MetaFrameStyleSet *style_set;
+  MetaFrameStyle **slots[N_STYLE_SET_SLOTS];
+  int i;
+
+  style_set = meta_frame_style_set_new (read_object (r, r->style_sets));
+
+  get_style_set_slots (style_set, slots);
+  for (i = 0; i < N_STYLE_SET_SLOTS; i++)
+    {
+      *slots[i] = read_object (r, r->styles);
+      if (*slots[i])
+        meta_frame_style_ref (*slots[i]);
+    }
+
+  return style_set;
+}
+
+/* Reads a table of objects, each after the ones it refers to */
+static void
+read_objects (CacheReader    *r,
+              GPtrArray      *objects,
+              ReadObjectFunc  read_func)
+{
+  guint32 n_objects;
+  guint32 i;
+
+  n_objects = read_count (r, sizeof (guint32));
+
+  for (i = 0; i < n_objects && !r->failed; i++)
+    g_ptr_array_add (objects, read_func (r));
+}
+
+static void
+read_names (CacheReader   *r,
+            GHashTable    *by_name,
+            GPtrArray     *objects,
+            RefObjectFunc  ref_func)
+{
+  guint32 n_names;
+  guint32 i;
+
+  n_names = read_count (r, sizeof (guint32));
+
+  for (i = 0; i < n_names && !r->failed; i++)
+    {
+      char *name;
+      gpointer object;
+
+      name = read_string (r);
+      object = read_object (r, objects);
+
+      if (name == NULL || object == NULL)
+        {
+          g_free (name);
+          r->failed = TRUE;
+          break;
+        }
+
+      ref_func (object);
+      g_hash_table_replace (by_name, name, object);
+    }
+}
+
+static void
+read_constants (CacheReader *r)
+{
+  guint32 n_constants;
+  guint32 i;
+
+  n_constants = read_count (r, sizeof (guint32));
+  for (i = 0; i < n_constants && !r->failed; i++)
+    {
+      char *name = read_string (r);
+      int value = read_int32 (r);
+
+      if (name == NULL ||
+          !meta_theme_define_int_constant (r->theme, name, value, NULL))
+        r->failed = TRUE;
+
+      g_free (name);
+    }
+
+  n_constants = read_count (r, sizeof (guint32));
+  for (i = 0; i < n_constants && !r->failed; i++)
+    {
+      char *name = read_string (r);
+      double value = read_double (r);
+
+      if (name == NULL ||
+          !meta_theme_define_float_constant (r->theme, name, value, NULL))
+        r->failed = TRUE;
+
+      g_free (name);
+    }
+
+  n_constants = read_count (r, sizeof (guint32));
+  for (i = 0; i < n_constants && !r->failed; i++)
+    {
+      char *name = read_string (r);
+      char *value = read_string (r);
+
+      if (name == NULL || value == NULL ||
+          !meta_theme_define_color_constant (r->theme, name, value, NULL))
+        r->failed = TRUE;
+
+      g_free (name);
+      g_free (value);
+    }
+}
+
+static gboolean
+read_header (CacheReader *r,
+             const char  *theme_file,
+             guint        major_version,
+             const char  *checksum)
+{
+  char magic[CACHE_MAGIC_LEN];
+
+  return read_bytes (r, magic, CACHE_MAGIC_LEN) &&
+         memcmp (magic, CACHE_MAGIC, CACHE_MAGIC_LEN) == 0 &&
+         read_uint32 (r) == CACHE_FORMAT_VERSION &&
+         read_string_is (r, PACKAGE_VERSION) &&
+         read_uint32 (r) == META_BUTTON_TYPE_LAST &&
+         read_uint32 (r) == META_BUTTON_STATE_LAST &&
+         read_uint32 (r) == META_FRAME_PIECE_LAST &&
+         read_uint32 (r) == META_FRAME_TYPE_LAST &&
+         read_uint32 (r) == N_STYLE_SET_SLOTS &&
+         read_string_is (r, theme_file) &&
+         read_uint32 (r) == major_version &&
+         read_string_is (r, checksum) &&
+         !r->failed;
+}
+
+static void
+read_theme (CacheReader *r)
+{
+  MetaTheme *theme = r->theme;
+  char magic[CACHE_MAGIC_LEN];
+  int i;
+
+  /* Needed before the images are loaded */
+  theme->format_version = read_uint32 (r);
+
+  theme->readable_name = read_string (r);
+  theme->author = read_string (r);
+  theme->copyright = read_string (r);
+  theme->date = read_string (r);
+  theme->description = read_string (r);
+
+  read_constants (r);
+
+  read_objects (r, r->layouts, (ReadObjectFunc) read_layout);
+  read_objects (r, r->op_lists, (ReadObjectFunc) read_op_list);
+  read_objects (r, r->styles, (ReadObjectFunc) read_style);
+  read_objects (r, r->style_sets, (ReadObjectFunc) read_style_set);
+
+  read_names (r, theme->layouts_by_name, r->layouts,
+              (RefObjectFunc) meta_frame_layout_ref);
+  read_names (r, theme->draw_op_lists_by_name, r->op_lists,
+              (RefObjectFunc) meta_draw_op_list_ref);
+  read_names (r, theme->styles_by_name, r->styles,
+              (RefObjectFunc) meta_frame_style_ref);
+  read_names (r, theme->style_sets_by_name, r->style_sets,
+              (RefObjectFunc) meta_frame_style_set_ref);
+
+  for (i = 0; i < META_FRAME_TYPE_LAST; i++)
+    {
+      theme->style_sets_by_type[i] = read_object (r, r->style_sets);
+      if (theme->style_sets_by_type[i])
+        meta_frame_style_set_ref (theme->style_sets_by_type[i]);
+    }
+
+  if (!read_bytes (r, magic, CACHE_MAGIC_LEN) ||
+      memcmp (magic, CACHE_MAGIC, CACHE_MAGIC_LEN) != 0 ||
+      r->p != r->end)
+    r->failed = TRUE;
+}
+
+/**
+ * Loads a theme from the cache, if the theme file was cached as it
+ * is now.
+ *
+ * \param theme_name  The name of the theme
+ * \param theme_dir  The directory the theme file is in
+ * \param theme_file  The theme file
+ * \param major_version  The major version of the theme format the
+ *                       file is for
+ * \param text  The contents of theme_file
+ * \param length  The length of text
+ *
+ * \return The theme, or NULL if the theme file needs to be parsed
+ */
+MetaTheme*
+meta_theme_cache_load (const char *theme_name,
+                       const char *theme_dir,
+                       const char *theme_file,
+                       guint       major_version,
+                       const char *text,
+                       gsize       length)
+{
+  GMappedFile *mapped;
+  CacheReader r;
+  char *checksum;
+  char *cache_file;
+  GError *error;
+  MetaTheme *retval;
+
+  cache_file = get_cache_file (theme_file, major_version);
+
+  error = NULL;
+  mapped = g_mapped_file_new (cache_file, FALSE, &error);
+
+  if (mapped == NULL)
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        meta_topic (META_DEBUG_THEMES, "Failed to open theme cache: %s\n",
+                    error->message);
+
+      g_error_free (error);
+      g_free (cache_file);
+      return NULL;
+    }
+
+  r.p = (const guchar *) g_mapped_file_get_contents (mapped);
+  r.end = r.p + g_mapped_file_get_length (mapped);
+  r.failed = FALSE;
+  r.theme = NULL;
+  r.layouts = NULL;
+  r.op_lists = NULL;
+  r.styles = NULL;
+  r.style_sets = NULL;
+
+  retval = NULL;
+
+  checksum = compute_theme_checksum (text, length);
+  if (!read_header (&r, theme_file, major_version, checksum))
+    {
+      meta_topic (META_DEBUG_THEMES, "Theme cache %s is out of date\n",
+                  cache_file);
+      goto out;
+    }
+
+  r.theme = meta_theme_new ();
+  r.theme->name = g_strdup (theme_name);
+  r.theme->filename = g_strdup (theme_file);
+  r.theme->dirname = g_strdup (theme_dir);
+
+  r.layouts = g_ptr_array_new_with_free_func ((GDestroyNotify) meta_frame_layout_unref);
+  r.op_lists = g_ptr_array_new_with_free_func ((GDestroyNotify) meta_draw_op_list_unref);
+  r.styles = g_ptr_array_new_with_free_func ((GDestroyNotify) meta_frame_style_unref);
+  r.style_sets = g_ptr_array_new_with_free_func ((GDestroyNotify) meta_frame_style_set_unref);
+
+  read_theme (&r);
+
+  if (r.failed)
+    {
+      meta_topic (META_DEBUG_THEMES, "Theme cache %s is damaged\n",
+                  cache_file);
+      meta_theme_free (r.theme);
+    }
+  else
+    {
+      meta_topic (META_DEBUG_THEMES, "Loaded theme file %s from cache %s\n",
+                  theme_file, cache_file);
+      retval = r.theme;
+    }
+
+ out:
+  if (r.style_sets)
+    g_ptr_array_free (r.style_sets, TRUE);
+  if (r.styles)
+    g_ptr_array_free (r.styles, TRUE);
+  if (r.op_lists)
+    g_ptr_array_free (r.op_lists, TRUE);
+  if (r.layouts)
+    g_ptr_array_free (r.layouts, TRUE);
+
+  g_mapped_file_unref (mapped);
+  g_free (checksum);
+  g_free (cache_file);
+
+  return retval;
+}
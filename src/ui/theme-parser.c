@@ -25,6 +25,7 @@
 #include <glib/gi18n-lib.h>
 
 #include "theme-parser.h"
+#include "theme-cache.h"
 #include "util.h"
 #include <string.h>
 #include <stdlib.h>
@@ -2175,9 +2176,6 @@ parse_draw_op_element (GMarkupParseContext  *context,
       GdkPixbuf *pixbuf;
       MetaColorSpec *colorize_spec = NULL;
       MetaImageFillType fill_type_val;
-      int h, w, c;
-      int pixbuf_width, pixbuf_height, pixbuf_n_channels, pixbuf_rowstride;
-      guchar *pixbuf_pixels;
 
       if (!locate_attributes (context, element_name, attribute_names, attribute_values,
                               error,
@@ -2251,7 +2249,7 @@ parse_draw_op_element (GMarkupParseContext  *context,
 
       op = meta_draw_op_new (META_DRAW_IMAGE);
 
-      op->data.image.pixbuf = pixbuf;
+      meta_draw_op_set_image (op, pixbuf);
       op->data.image.colorize_spec = colorize_spec;
 
       op->data.image.x = meta_draw_spec_new (info->theme, x, NULL);
@@ -2262,67 +2260,6 @@ parse_draw_op_element (GMarkupParseContext  *context,
       op->data.image.alpha_spec = alpha_spec;
       op->data.image.fill_type = fill_type_val;
 
-      /* Check for vertical & horizontal stripes */
-      pixbuf_n_channels = gdk_pixbuf_get_n_channels(pixbuf);
-      pixbuf_width = gdk_pixbuf_get_width(pixbuf);
-      pixbuf_height = gdk_pixbuf_get_height(pixbuf);
-      pixbuf_rowstride = gdk_pixbuf_get_rowstride(pixbuf);
-      pixbuf_pixels = gdk_pixbuf_get_pixels(pixbuf);
-
-      /* Check for horizontal stripes */
-      for (h = 0; h < pixbuf_height; h++)
-        {
-          for (w = 1; w < pixbuf_width; w++)
-            {
-              for (c = 0; c < pixbuf_n_channels; c++)
-                {
-                  if (pixbuf_pixels[(h * pixbuf_rowstride) + c] !=
-                      pixbuf_pixels[(h * pixbuf_rowstride) + w + c])
-                    break;
-                }
-              if (c < pixbuf_n_channels)
-                break;
-            }
-          if (w < pixbuf_width)
-            break;
-        }
-
-      if (h >= pixbuf_height)
-        {
-          op->data.image.horizontal_stripes = TRUE;
-        }
-      else
-        {
-          op->data.image.horizontal_stripes = FALSE;
-        }
-
-      /* Check for vertical stripes */
-      for (w = 0; w < pixbuf_width; w++)
-        {
-          for (h = 1; h < pixbuf_height; h++)
-            {
-              for (c = 0; c < pixbuf_n_channels; c++)
-                {
-                  if (pixbuf_pixels[w + c] !=
-                      pixbuf_pixels[(h * pixbuf_rowstride) + w + c])
-                    break;
-                }
-              if (c < pixbuf_n_channels)
-                break;
-            }
-          if (h < pixbuf_height)
-            break;
-        }
-
-      if (w >= pixbuf_width)
-        {
-          op->data.image.vertical_stripes = TRUE;
-        }
-      else
-        {
-          op->data.image.vertical_stripes = FALSE;
-        }
-
       g_assert (info->op_list);
 
       meta_draw_op_list_append (info->op_list, op);
@@ -4284,6 +4221,12 @@ load_theme (const char *theme_dir,
   if (!g_file_get_contents (theme_file, &text, &length, error))
     goto out;
 
+  /* Skip parsing if we have the theme from the last time */
+  retval = meta_theme_cache_load (theme_name, theme_dir, theme_file,
+                                  major_version, text, length);
+  if (retval)
+    goto out;
+
   meta_topic (META_DEBUG_THEMES, "Parsing theme file %s\n", theme_file);
 
   parse_info_init (&info);
@@ -4305,6 +4248,8 @@ load_theme (const char *theme_dir,
   retval = info.theme;
   info.theme = NULL;
 
+  meta_theme_cache_save (retval, major_version, text, length);
+
  out:
   if (*error && !theme_error_is_fatal (*error))
     meta_topic (META_DEBUG_THEMES, "Failed to read theme from file %s: %s\n",
@@ -1014,12 +1014,66 @@ create_title_layout (GtkWidget *widget)
   return layout;
 }
 
+#define ITERATIONS 100
+
 static void
-run_theme_benchmark (void)
+draw_benchmark_frames (GtkWidget        *widget,
+                       PangoLayout      *layout,
+                       MetaFrameBorders *borders,
+                       MetaButtonLayout *button_layout,
+                       MetaButtonState  *button_states)
 {
-  GtkWidget* widget;
   cairo_surface_t *pixmap;
   cairo_t *cr;
+  int i;
+  int client_width;
+  int client_height;
+  int inc;
+
+  client_width = 50;
+  client_height = 50;
+  inc = 1000 / ITERATIONS; /* Increment to grow width/height,
+                            * eliminates caching effects.
+                            */
+
+  i = 0;
+  while (i < ITERATIONS)
+    {
+      /* Creating the pixmap in the loop is right, since
+       * GDK does the same with its double buffering.
+       */
+      pixmap = gdk_window_create_similar_surface (gtk_widget_get_window (widget),
+                                                  CAIRO_CONTENT_COLOR,
+                                                  client_width + borders->total.left + borders->total.right,
+                                                  client_height + borders->total.top + borders->total.bottom);
+      cr = cairo_create (pixmap);
+
+      meta_theme_draw_frame (global_theme,
+                             gtk_widget_get_style_context (widget),
+                             cr,
+                             META_FRAME_TYPE_NORMAL,
+                             get_flags (widget),
+                             client_width, client_height,
+                             layout,
+                             get_text_height (widget),
+                             button_layout,
+                             button_states,
+                             meta_preview_get_mini_icon (),
+                             meta_preview_get_icon ());
+
+      cairo_destroy (cr);
+      cairo_surface_destroy (pixmap);
+
+      ++i;
+      client_width += inc;
+      client_height += inc;
+    }
+}
+
+static void
+run_theme_benchmark (void)
+{
+  GtkWidget* widget;
   MetaFrameBorders borders;
   MetaButtonState button_states[META_BUTTON_TYPE_LAST] =
   {
@@ -1034,10 +1088,8 @@ run_theme_benchmark (void)
   GTimer *timer;
   int i;
   MetaButtonLayout button_layout;
-#define ITERATIONS 100
-  int client_width;
-  int client_height;
-  int inc;
+  double interpreted_milliseconds;
+  double unoptimized_milliseconds;
 
   widget = gtk_window_new (GTK_WINDOW_TOPLEVEL);
   gtk_widget_realize (widget);
@@ -1064,47 +1116,40 @@ run_theme_benchmark (void)
   button_layout.right_buttons[1] = META_BUTTON_FUNCTION_MAXIMIZE;
   button_layout.right_buttons[2] = META_BUTTON_FUNCTION_CLOSE;
 
+  /* First time the frames with position expressions evaluated from
+   * their tokens, and then with compiled expressions but without
+   * flattened draw op lists and cached colors, for comparison
+   */
+  meta_theme_set_compiled_expressions (FALSE);
+  meta_theme_set_optimized_drawing (FALSE);
+
   timer = g_timer_new ();
-  start = clock ();
 
-  client_width = 50;
-  client_height = 50;
-  inc = 1000 / ITERATIONS; /* Increment to grow width/height,
-                            * eliminates caching effects.
-                            */
+  draw_benchmark_frames (widget, layout, &borders,
+                         &button_layout, button_states);
 
-  i = 0;
-  while (i < ITERATIONS)
-    {
-      /* Creating the pixmap in the loop is right, since
-       * GDK does the same with its double buffering.
-       */
-      pixmap = gdk_window_create_similar_surface (gtk_widget_get_window (widget),
-                                                  CAIRO_CONTENT_COLOR,
-                                                  client_width + borders.total.left + borders.total.right,
-                                                  client_height + borders.total.top + borders.total.bottom);
-      cr = cairo_create (pixmap);
+  g_timer_stop (timer);
 
-      meta_theme_draw_frame (global_theme,
-                             gtk_widget_get_style_context (widget),
-                             cr,
-                             META_FRAME_TYPE_NORMAL,
-                             get_flags (widget),
-                             client_width, client_height,
-                             layout,
-                             get_text_height (widget),
-                             &button_layout,
-                             button_states,
-                             meta_preview_get_mini_icon (),
-                             meta_preview_get_icon ());
+  interpreted_milliseconds = (g_timer_elapsed (timer, NULL) / (double) ITERATIONS) * 1000;
 
-      cairo_destroy (cr);
-      cairo_surface_destroy (pixmap);
+  meta_theme_set_compiled_expressions (TRUE);
 
-      ++i;
-      client_width += inc;
-      client_height += inc;
-    }
+  g_timer_start (timer);
+
+  draw_benchmark_frames (widget, layout, &borders,
+                         &button_layout, button_states);
+
+  g_timer_stop (timer);
+
+  unoptimized_milliseconds = (g_timer_elapsed (timer, NULL) / (double) ITERATIONS) * 1000;
+
+  meta_theme_set_optimized_drawing (TRUE);
+
+  g_timer_start (timer);
+  start = clock ();
+
+  draw_benchmark_frames (widget, layout, &borders,
+                         &button_layout, button_states);
 
   end = clock ();
   g_timer_stop (timer);
@@ -1118,10 +1163,17 @@ run_theme_benchmark (void)
            g_timer_elapsed (timer, NULL),
            milliseconds_to_draw_frame);
 
+  g_print (_("Drawing a frame took %g milliseconds with interpreted position expressions and %g milliseconds with compiled ones\n"),
+           interpreted_milliseconds,
+           unoptimized_milliseconds);
+
+  g_print (_("Drawing a frame took %g milliseconds with flattened draw op lists and cached colors\n"),
+           milliseconds_to_draw_frame);
+
   g_timer_destroy (timer);
   g_object_unref (G_OBJECT (layout));
   gtk_widget_destroy (widget);
+}
 
 #undef ITERATIONS
-}
 
@@ -1838,13 +1838,128 @@ meta_set_color_from_style (GdkRGBA               *color,
     }
 }
 
+static gboolean optimized_drawing = TRUE;
+
+void
+meta_theme_set_optimized_drawing (gboolean optimized)
+{
+  optimized_drawing = optimized;
+}
+
+/* The colors that have been looked up in a style context.  Looking
+ * them up again for every draw op is slow, and they can only change
+ * when the style context does, which is when the palette is emptied.
+ */
+typedef struct
+{
+  /* (component << 16 | state) -> GdkRGBA */
+  GHashTable *gtk_colors;
+  /* color name -> GdkRGBA, or NULL if the name isn't defined */
+  GHashTable *custom_colors;
+} MetaColorPalette;
+
+static void
+color_palette_free (gpointer data)
+{
+  MetaColorPalette *palette = data;
+
+  g_hash_table_destroy (palette->gtk_colors);
+  g_hash_table_destroy (palette->custom_colors);
+  g_free (palette);
+}
+
+static void
+color_palette_invalidate (GtkStyleContext  *context,
+                          MetaColorPalette *palette)
+{
+  g_hash_table_remove_all (palette->gtk_colors);
+  g_hash_table_remove_all (palette->custom_colors);
+}
+
+static MetaColorPalette *
+get_color_palette (GtkStyleContext *context)
+{
+  static GQuark palette_quark = 0;
+  MetaColorPalette *palette;
+
+  if (palette_quark == 0)
+    palette_quark = g_quark_from_static_string ("meta-color-palette");
+
+  palette = g_object_get_qdata (G_OBJECT (context), palette_quark);
+  if (palette == NULL)
+    {
+      palette = g_new (MetaColorPalette, 1);
+      palette->gtk_colors = g_hash_table_new_full (NULL, NULL, NULL,
+                                                   (GDestroyNotify) gdk_rgba_free);
+      palette->custom_colors = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                      g_free,
+                                                      (GDestroyNotify) gdk_rgba_free);
+
+      g_object_set_qdata_full (G_OBJECT (context), palette_quark,
+                               palette, color_palette_free);
+      g_signal_connect (context, "changed",
+                        G_CALLBACK (color_palette_invalidate), palette);
+    }
+
+  return palette;
+}
+
+static void
+meta_set_color_from_palette (GdkRGBA               *color,
+                             GtkStyleContext       *context,
+                             GtkStateFlags          state,
+                             MetaGtkColorComponent  component)
+{
+  MetaColorPalette *palette;
+  gpointer key;
+  GdkRGBA *cached;
+
+  palette = get_color_palette (context);
+  key = GUINT_TO_POINTER ((guint) component << 16 | (guint) state);
+
+  cached = g_hash_table_lookup (palette->gtk_colors, key);
+  if (cached == NULL)
+    {
+      meta_set_color_from_style (color, context, state, component);
+      g_hash_table_insert (palette->gtk_colors, key, gdk_rgba_copy (color));
+    }
+  else
+    *color = *cached;
+}
+
 static void
 meta_set_custom_color_from_style (GdkRGBA         *color,
                                   GtkStyleContext *context,
                                   char            *color_name,
                                   MetaColorSpec   *fallback)
 {
-  if (!gtk_style_context_lookup_color (context, color_name, color))
+  MetaColorPalette *palette;
+  GdkRGBA *cached;
+
+  if (!optimized_drawing)
+    {
+      if (!gtk_style_context_lookup_color (context, color_name, color))
+        meta_color_spec_render (fallback, context, color);
+      return;
+    }
+
+  palette = get_color_palette (context);
+
+  if (!g_hash_table_lookup_extended (palette->custom_colors, color_name,
+                                     NULL, (gpointer *) &cached))
+    {
+      if (gtk_style_context_lookup_color (context, color_name, color))
+        cached = gdk_rgba_copy (color);
+      else
+        cached = NULL;
+
+      g_hash_table_insert (palette->custom_colors,
+                           g_strdup (color_name), cached);
+    }
+
+  if (cached)
+    *color = *cached;
+  else
     meta_color_spec_render (fallback, context, color);
 }
 
@@ -1864,10 +1979,16 @@ meta_color_spec_render (MetaColorSpec *spec,
       break;
 
     case META_COLOR_SPEC_GTK:
-      meta_set_color_from_style (color,
-                                 style,
-                                 spec->data.gtk.state,
-                                 spec->data.gtk.component);
+      if (optimized_drawing)
+        meta_set_color_from_palette (color,
+                                     style,
+                                     spec->data.gtk.state,
+                                     spec->data.gtk.component);
+      else
+        meta_set_color_from_style (color,
+                                   style,
+                                   spec->data.gtk.state,
+                                   spec->data.gtk.component);
       break;
 
     case META_COLOR_SPEC_GTK_CUSTOM:
@@ -2725,9 +2846,9 @@ pos_eval_get_variable (PosToken                  *t,
  * \param env  The environment context in which to evaluate the expression.
  * \param[out] result  The current value of the expression
  *
- * \bug Yes, we really do reparse the expression every time it's evaluated.
- *      We should keep the parse tree around all the time and just
- *      run the new values through it.
+ * Expressions are normally evaluated from their compiled form by
+ * pos_exec(); this is for those which couldn't be compiled, and to
+ * report errors.
  * \ingroup parser
  */
 static gboolean
@@ -2885,6 +3006,426 @@ pos_eval_helper (PosToken                   *tokens,
   return TRUE;
 }
 
+static gboolean pos_use_compiled = TRUE;
+
+void
+meta_theme_set_compiled_expressions (gboolean compiled)
+{
+  pos_use_compiled = compiled;
+}
+
+static int
+op_precedence (PosOperatorType op)
+{
+  switch (op)
+    {
+    case POS_OP_MULTIPLY:
+    case POS_OP_DIVIDE:
+    case POS_OP_MOD:
+      return 2;
+    case POS_OP_ADD:
+    case POS_OP_SUBTRACT:
+      return 1;
+    case POS_OP_MAX:
+    case POS_OP_MIN:
+      return 0;
+    case POS_OP_NONE:
+      break;
+    }
+
+  g_assert_not_reached ();
+  return 0;
+}
+
+static gboolean
+pos_lookup_variable (const char  *name,
+                     PosVariable *var)
+{
+  static const struct {
+    const char *name;
+    PosVariable var;
+  } variables[] = {
+    { "width", POS_VAR_WIDTH },
+    { "height", POS_VAR_HEIGHT },
+    { "object_width", POS_VAR_OBJECT_WIDTH },
+    { "object_height", POS_VAR_OBJECT_HEIGHT },
+    { "left_width", POS_VAR_LEFT_WIDTH },
+    { "right_width", POS_VAR_RIGHT_WIDTH },
+    { "top_height", POS_VAR_TOP_HEIGHT },
+    { "bottom_height", POS_VAR_BOTTOM_HEIGHT },
+    { "mini_icon_width", POS_VAR_MINI_ICON_WIDTH },
+    { "mini_icon_height", POS_VAR_MINI_ICON_HEIGHT },
+    { "icon_width", POS_VAR_ICON_WIDTH },
+    { "icon_height", POS_VAR_ICON_HEIGHT },
+    { "title_width", POS_VAR_TITLE_WIDTH },
+    { "title_height", POS_VAR_TITLE_HEIGHT },
+    { "frame_x_center", POS_VAR_FRAME_X_CENTER },
+    { "frame_y_center", POS_VAR_FRAME_Y_CENTER }
+  };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (variables); i++)
+    {
+      if (strcmp (name, variables[i].name) == 0)
+        {
+          *var = variables[i].var;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/**
+ * Folds the operator that was just compiled if both of its operands
+ * are constants, as in "width - (2 * 3)", replacing the three
+ * instructions with the result.  Operations that fail, such as a
+ * division by zero, are left alone so that they are still reported
+ * when the expression is evaluated.
+ *
+ * \param code  The instructions compiled so far; the last one must be
+ *              an operator.
+ * \param[in,out] n_code_p  How many instructions there are.
+ * \ingroup parser
+ */
+static void
+pos_fold_operator (PosInsn *code,
+                   int     *n_code_p)
+{
+  PosInsn *a, *b;
+  PosExpr ea, eb;
+  int n_code;
+
+  n_code = *n_code_p;
+  if (n_code < 3)
+    return;
+
+  a = &code[n_code - 3];
+  b = &code[n_code - 2];
+
+  if ((a->type != POS_INSN_INT && a->type != POS_INSN_DOUBLE) ||
+      (b->type != POS_INSN_INT && b->type != POS_INSN_DOUBLE))
+    return;
+
+  ea.type = a->type == POS_INSN_INT ? POS_EXPR_INT : POS_EXPR_DOUBLE;
+  if (ea.type == POS_EXPR_INT)
+    ea.d.int_val = a->d.int_val;
+  else
+    ea.d.double_val = a->d.double_val;
+
+  eb.type = b->type == POS_INSN_INT ? POS_EXPR_INT : POS_EXPR_DOUBLE;
+  if (eb.type == POS_EXPR_INT)
+    eb.d.int_val = b->d.int_val;
+  else
+    eb.d.double_val = b->d.double_val;
+
+  if (!do_operation (&ea, &eb, code[n_code - 1].d.op, NULL))
+    return;
+
+  if (ea.type == POS_EXPR_INT)
+    {
+      a->type = POS_INSN_INT;
+      a->d.int_val = ea.d.int_val;
+    }
+  else
+    {
+      a->type = POS_INSN_DOUBLE;
+      a->d.double_val = ea.d.double_val;
+    }
+
+  *n_code_p = n_code - 2;
+}
+
+/**
+ * Compiles a list of tokens into postfix order, so that evaluating
+ * the expression needs neither parsing nor variable name lookups.
+ * This is the shunting-yard algorithm, with the precedences used by
+ * do_operations().  Operations on constants are done here rather than
+ * every time the expression is evaluated.
+ *
+ * \param tokens  A list of tokens to compile; any constants must
+ *                already have been replaced.
+ * \param n_tokens  How many tokens are in the list.
+ * \param[out] n_code_p  How many instructions were generated.
+ * \param[out] err  Set if the expression has more terms between a pair
+ *                 of parentheses than pos_eval_helper() allows.
+ *
+ * \return The instructions, or NULL if the expression is malformed or
+ *         uses an unknown variable; pos_eval_helper() reports those.
+ * \ingroup parser
+ */
+static PosInsn *
+pos_compile (PosToken  *tokens,
+             int        n_tokens,
+             int       *n_code_p,
+             GError   **err)
+{
+  PosInsn *code;
+  /* open parens are kept on the operator stack as POS_OP_NONE */
+  PosOperatorType ops[MAX_EXPRS];
+  /* terms at each level of parentheses, a group counting as one */
+  int n_terms[MAX_EXPRS + 1];
+  gboolean expect_operand;
+  int n_code;
+  int n_ops;
+  int paren_level;
+  int depth;
+  int i;
+
+#define EMIT_OPERATOR(operator)                 \
+  G_STMT_START {                                \
+    code[n_code].type = POS_INSN_OPERATOR;      \
+    code[n_code].d.op = (operator);             \
+    ++n_code;                                   \
+    --depth;                                    \
+    pos_fold_operator (code, &n_code);          \
+  } G_STMT_END
+
+  code = g_new (PosInsn, MAX (n_tokens, 1));
+  n_code = 0;
+  n_ops = 0;
+  depth = 0;
+  paren_level = 0;
+  n_terms[0] = 0;
+  expect_operand = TRUE;
+
+  for (i = 0; i < n_tokens; i++)
+    {
+      PosToken *t = &tokens[i];
+
+      /* The same limit as pos_eval_helper() */
+      if (t->type != POS_TOKEN_CLOSE_PAREN &&
+          ++n_terms[paren_level] > MAX_EXPRS)
+        {
+          g_set_error (err, META_THEME_ERROR,
+                       META_THEME_ERROR_FAILED,
+                       _("Coordinate expression parser overflowed its buffer."));
+          goto fail;
+        }
+
+      switch (t->type)
+        {
+        case POS_TOKEN_INT:
+        case POS_TOKEN_DOUBLE:
+        case POS_TOKEN_VARIABLE:
+          if (!expect_operand || depth == MAX_EXPRS)
+            goto fail;
+
+          if (t->type == POS_TOKEN_INT)
+            {
+              code[n_code].type = POS_INSN_INT;
+              code[n_code].d.int_val = t->d.i.val;
+            }
+          else if (t->type == POS_TOKEN_DOUBLE)
+            {
+              code[n_code].type = POS_INSN_DOUBLE;
+              code[n_code].d.double_val = t->d.d.val;
+            }
+          else
+            {
+              code[n_code].type = POS_INSN_VARIABLE;
+              if (!pos_lookup_variable (t->d.v.name, &code[n_code].d.var))
+                goto fail;
+            }
+
+          ++n_code;
+          ++depth;
+          expect_operand = FALSE;
+          break;
+
+        case POS_TOKEN_OPERATOR:
+          if (expect_operand)
+            goto fail;
+
+          /* All operators are left-associative */
+          while (n_ops > 0 && ops[n_ops - 1] != POS_OP_NONE &&
+                 op_precedence (ops[n_ops - 1]) >= op_precedence (t->d.o.op))
+            EMIT_OPERATOR (ops[--n_ops]);
+
+          if (n_ops == MAX_EXPRS)
+            goto fail;
+
+          ops[n_ops++] = t->d.o.op;
+          expect_operand = TRUE;
+          break;
+
+        case POS_TOKEN_OPEN_PAREN:
+          if (!expect_operand || n_ops == MAX_EXPRS)
+            goto fail;
+
+          ops[n_ops++] = POS_OP_NONE;
+          n_terms[++paren_level] = 0;
+          break;
+
+        case POS_TOKEN_CLOSE_PAREN:
+          if (expect_operand)
+            goto fail;
+
+          while (n_ops > 0 && ops[n_ops - 1] != POS_OP_NONE)
+            EMIT_OPERATOR (ops[--n_ops]);
+
+          if (n_ops == 0)
+            goto fail;
+
+          /* Drop the open paren */
+          --n_ops;
+          --paren_level;
+          break;
+        }
+    }
+
+  if (expect_operand)
+    goto fail;
+
+  while (n_ops > 0)
+    {
+      if (ops[n_ops - 1] == POS_OP_NONE)
+        goto fail;
+
+      EMIT_OPERATOR (ops[--n_ops]);
+    }
+
+  g_assert (depth == 1);
+
+#undef EMIT_OPERATOR
+
+  *n_code_p = n_code;
+  return code;
+
+ fail:
+  g_free (code);
+  *n_code_p = 0;
+  return NULL;
+}
+
+static gboolean
+pos_exec_get_variable (PosVariable                var,
+                       const MetaPositionExprEnv *env,
+                       int                       *result)
+{
+  switch (var)
+    {
+    case POS_VAR_WIDTH:
+      *result = env->rect.width;
+      break;
+    case POS_VAR_HEIGHT:
+      *result = env->rect.height;
+      break;
+    case POS_VAR_OBJECT_WIDTH:
+      if (env->object_width < 0)
+        return FALSE;
+      *result = env->object_width;
+      break;
+    case POS_VAR_OBJECT_HEIGHT:
+      if (env->object_height < 0)
+        return FALSE;
+      *result = env->object_height;
+      break;
+    case POS_VAR_LEFT_WIDTH:
+      *result = env->left_width;
+      break;
+    case POS_VAR_RIGHT_WIDTH:
+      *result = env->right_width;
+      break;
+    case POS_VAR_TOP_HEIGHT:
+      *result = env->top_height;
+      break;
+    case POS_VAR_BOTTOM_HEIGHT:
+      *result = env->bottom_height;
+      break;
+    case POS_VAR_MINI_ICON_WIDTH:
+      *result = env->mini_icon_width;
+      break;
+    case POS_VAR_MINI_ICON_HEIGHT:
+      *result = env->mini_icon_height;
+      break;
+    case POS_VAR_ICON_WIDTH:
+      *result = env->icon_width;
+      break;
+    case POS_VAR_ICON_HEIGHT:
+      *result = env->icon_height;
+      break;
+    case POS_VAR_TITLE_WIDTH:
+      *result = env->title_width;
+      break;
+    case POS_VAR_TITLE_HEIGHT:
+      *result = env->title_height;
+      break;
+    case POS_VAR_FRAME_X_CENTER:
+      *result = env->frame_x_center;
+      break;
+    case POS_VAR_FRAME_Y_CENTER:
+      *result = env->frame_y_center;
+      break;
+    }
+
+  return TRUE;
+}
+
+/**
+ * Runs a compiled expression within a particular environment context.
+ *
+ * \param spec  The expression to evaluate, which must have been compiled.
+ * \param env  The environment context in which to evaluate the expression.
+ * \param[out] result  The current value of the expression
+ *
+ * \return TRUE on success; on failure, which can only be division by
+ *         zero or a misused variable, the caller should go through
+ *         pos_eval_helper() to have the error reported.
+ * \ingroup parser
+ */
+static gboolean
+pos_exec (const MetaDrawSpec        *spec,
+          const MetaPositionExprEnv *env,
+          PosExpr                   *result)
+{
+  PosExpr stack[MAX_EXPRS];
+  int top;
+  int i;
+
+  top = 0;
+  for (i = 0; i < spec->n_code; i++)
+    {
+      const PosInsn *insn = &spec->code[i];
+
+      switch (insn->type)
+        {
+        case POS_INSN_INT:
+          stack[top].type = POS_EXPR_INT;
+          stack[top].d.int_val = insn->d.int_val;
+          ++top;
+          break;
+
+        case POS_INSN_DOUBLE:
+          stack[top].type = POS_EXPR_DOUBLE;
+          stack[top].d.double_val = insn->d.double_val;
+          ++top;
+          break;
+
+        case POS_INSN_VARIABLE:
+          stack[top].type = POS_EXPR_INT;
+          if (!pos_exec_get_variable (insn->d.var, env,
+                                      &stack[top].d.int_val))
+            return FALSE;
+          ++top;
+          break;
+
+        case POS_INSN_OPERATOR:
+          --top;
+          if (!do_operation (&stack[top - 1], &stack[top],
+                             insn->d.op, NULL))
+            return FALSE;
+          break;
+        }
+    }
+
+  g_assert (top == 1);
+
+  *result = stack[0];
+
+  return TRUE;
+}
+
 /*
  *   expr = int | double | expr * expr | expr / expr |
  *          expr + expr | expr - expr | (expr)
@@ -2917,7 +3458,9 @@ pos_eval (MetaDrawSpec              *spec,
 
   *val_p = 0;
 
-  if (pos_eval_helper (spec->tokens, spec->n_tokens, env, &expr, err))
+  if ((spec->code != NULL && pos_use_compiled &&
+       pos_exec (spec, env, &expr)) ||
+      pos_eval_helper (spec->tokens, spec->n_tokens, env, &expr, err))
     {
       switch (expr.type)
         {
@@ -3122,6 +3665,7 @@ meta_draw_spec_free (MetaDrawSpec *spec)
 {
   if (!spec) return;
   free_tokens (spec->tokens, spec->n_tokens);
+  g_free (spec->code);
   g_slice_free (MetaDrawSpec, spec);
 }
 
@@ -3146,6 +3690,52 @@ meta_draw_spec_new (MetaTheme  *theme,
           return NULL;
         }
     }
+  else
+    {
+      GError *compile_error = NULL;
+
+      spec->code = pos_compile (spec->tokens, spec->n_tokens,
+                                &spec->n_code, &compile_error);
+
+      if (compile_error != NULL)
+        {
+          g_propagate_error (error, compile_error);
+          meta_draw_spec_free (spec);
+          return NULL;
+        }
+    }
+
+  return spec;
+}
+
+/**
+ * Creates a spec from an expression that was tokenised, and had its
+ * constants replaced, by meta_draw_spec_new() earlier.
+ *
+ * \param tokens  The tokens of the expression; the spec takes them over
+ * \param n_tokens  How many tokens there are
+ * \param constant  Whether the expression has no variables
+ * \param value  The value of the expression, if it is constant
+ */
+MetaDrawSpec *
+meta_draw_spec_new_from_tokens (PosToken *tokens,
+                                int       n_tokens,
+                                gboolean  constant,
+                                int       value)
+{
+  MetaDrawSpec *spec;
+
+  spec = g_slice_new0 (MetaDrawSpec);
+
+  spec->tokens = tokens;
+  spec->n_tokens = n_tokens;
+  spec->constant = constant;
+
+  if (spec->constant)
+    spec->value = value;
+  else
+    spec->code = pos_compile (spec->tokens, spec->n_tokens, &spec->n_code,
+                              NULL);
 
   return spec;
 }
@@ -3380,6 +3970,88 @@ meta_draw_op_free (MetaDrawOp *op)
   g_free (op);
 }
 
+/**
+ * Gives an image draw op its image, and notes whether the image is
+ * made of stripes so that scaling it can be done by replicating rows
+ * or columns.
+ *
+ * \param op  An op of type META_DRAW_IMAGE
+ * \param pixbuf  The image; the op takes over the reference
+ */
+void
+meta_draw_op_set_image (MetaDrawOp *op,
+                        GdkPixbuf  *pixbuf)
+{
+  int h, w, c;
+  int pixbuf_width, pixbuf_height, pixbuf_n_channels, pixbuf_rowstride;
+  guchar *pixbuf_pixels;
+
+  g_return_if_fail (op->type == META_DRAW_IMAGE);
+
+  op->data.image.pixbuf = pixbuf;
+
+  /* Check for vertical & horizontal stripes */
+  pixbuf_n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+  pixbuf_width = gdk_pixbuf_get_width(pixbuf);
+  pixbuf_height = gdk_pixbuf_get_height(pixbuf);
+  pixbuf_rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+  pixbuf_pixels = gdk_pixbuf_get_pixels(pixbuf);
+
+  /* Check for horizontal stripes */
+  for (h = 0; h < pixbuf_height; h++)
+    {
+      for (w = 1; w < pixbuf_width; w++)
+        {
+          for (c = 0; c < pixbuf_n_channels; c++)
+            {
+              if (pixbuf_pixels[(h * pixbuf_rowstride) + c] !=
+                  pixbuf_pixels[(h * pixbuf_rowstride) + w + c])
+                break;
+            }
+          if (c < pixbuf_n_channels)
+            break;
+        }
+      if (w < pixbuf_width)
+        break;
+    }
+
+  if (h >= pixbuf_height)
+    {
+      op->data.image.horizontal_stripes = TRUE;
+    }
+  else
+    {
+      op->data.image.horizontal_stripes = FALSE;
+    }
+
+  /* Check for vertical stripes */
+  for (w = 0; w < pixbuf_width; w++)
+    {
+      for (h = 1; h < pixbuf_height; h++)
+        {
+          for (c = 0; c < pixbuf_n_channels; c++)
+            {
+              if (pixbuf_pixels[w + c] !=
+                  pixbuf_pixels[(h * pixbuf_rowstride) + w + c])
+                break;
+            }
+          if (c < pixbuf_n_channels)
+            break;
+        }
+      if (h < pixbuf_height)
+        break;
+    }
+
+  if (w >= pixbuf_width)
+    {
+      op->data.image.vertical_stripes = TRUE;
+    }
+  else
+    {
+      op->data.image.vertical_stripes = FALSE;
+    }
+}
+
 static GdkPixbuf*
 apply_alpha (GdkPixbuf             *pixbuf,
              MetaAlphaGradientSpec *spec,
@@ -3944,13 +4616,39 @@ fill_env (MetaPositionExprEnv *env,
  * the exact same pixel-aligned rectangle, rather than a rectangle with
  * fuzz around the edges.
  */
+
+/* Whether anything drawn within an area would be clipped away; ops
+ * that are slow to draw but stay within their area check this before
+ * drawing anything.
+ */
+static gboolean
+area_clipped_away (const GdkRectangle *clip,
+                   int                 x,
+                   int                 y,
+                   int                 width,
+                   int                 height)
+{
+  GdkRectangle area;
+
+  if (clip == NULL)
+    return FALSE;
+
+  area.x = x;
+  area.y = y;
+  area.width = width;
+  area.height = height;
+
+  return !gdk_rectangle_intersect (clip, &area, NULL);
+}
+
 static void
 meta_draw_op_draw_with_env (const MetaDrawOp    *op,
                             GtkStyleContext     *style_gtk,
                             cairo_t             *cr,
                             const MetaDrawInfo  *info,
                             MetaRectangle        rect,
-                            MetaPositionExprEnv *env)
+                            MetaPositionExprEnv *env,
+                            const GdkRectangle  *clip)
 {
   GdkRGBA color;
 
@@ -4123,6 +4821,9 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
         rwidth = parse_size_unchecked (op->data.tint.width, env);
         rheight = parse_size_unchecked (op->data.tint.height, env);
 
+        if (area_clipped_away (clip, rx, ry, rwidth, rheight))
+          break;
+
         if (!needs_alpha)
           {
             meta_color_spec_render (op->data.tint.color_spec, style_gtk, &color);
@@ -4158,6 +4859,9 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
         rwidth = parse_size_unchecked (op->data.gradient.width, env);
         rheight = parse_size_unchecked (op->data.gradient.height, env);
 
+        if (area_clipped_away (clip, rx, ry, rwidth, rheight))
+          break;
+
         meta_gradient_spec_render (op->data.gradient.gradient_spec,
                                    op->data.gradient.alpha_spec,
                                    cr, style_gtk, rx, ry, rwidth, rheight);
@@ -4181,14 +4885,17 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
 
         rwidth = parse_size_unchecked (op->data.image.width, env) * scale;
         rheight = parse_size_unchecked (op->data.image.height, env) * scale;
+        rx = parse_x_position_unchecked (op->data.image.x, env) * scale;
+        ry = parse_y_position_unchecked (op->data.image.y, env) * scale;
+
+        if (area_clipped_away (clip, rx / scale, ry / scale,
+                               rwidth / scale, rheight / scale))
+          break;
 
         surface = draw_op_as_surface (op, style_gtk, info, rwidth, rheight);
 
         if (surface)
           {
-            rx = parse_x_position_unchecked (op->data.image.x, env) * scale;
-            ry = parse_y_position_unchecked (op->data.image.y, env) * scale;
-
             cairo_set_source_surface (cr, surface, rx, ry);
 
             if (op->data.image.alpha_spec)
@@ -4286,14 +4993,17 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
 
         rwidth = parse_size_unchecked (op->data.icon.width, env) * scale;
         rheight = parse_size_unchecked (op->data.icon.height, env) * scale;
+        rx = parse_x_position_unchecked (op->data.icon.x, env) * scale;
+        ry = parse_y_position_unchecked (op->data.icon.y, env) * scale;
+
+        if (area_clipped_away (clip, rx / scale, ry / scale,
+                               rwidth / scale, rheight / scale))
+          break;
 
         surface = draw_op_as_surface (op, style_gtk, info, rwidth, rheight);
 
         if (surface)
           {
-            rx = parse_x_position_unchecked (op->data.icon.x, env) * scale;
-            ry = parse_y_position_unchecked (op->data.icon.y, env) * scale;
-
             cairo_set_source_surface (cr, surface, rx, ry);
 
             if (op->data.icon.alpha_spec)
@@ -4425,6 +5135,9 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
         rwidth = parse_size_unchecked (op->data.tile.width, env);
         rheight = parse_size_unchecked (op->data.tile.height, env);
 
+        if (area_clipped_away (clip, rx, ry, rwidth, rheight))
+          break;
+
         cairo_save (cr);
 
         cairo_rectangle (cr, rx, ry, rwidth, rheight);
@@ -4479,7 +5192,7 @@ meta_draw_op_draw_with_style (const MetaDrawOp    *op,
                               style_gtk,
                               cr,
                               info, logical_region,
-                              &env);
+                              &env, NULL);
 
 }
 
@@ -4509,6 +5222,8 @@ meta_draw_op_list_new (int n_preallocs)
   op_list->n_allocated = n_preallocs;
   op_list->ops = g_new (MetaDrawOp*, op_list->n_allocated);
   op_list->n_ops = 0;
+  op_list->flat_ops = NULL;
+  op_list->n_flat_ops = 0;
 
   return op_list;
 }
@@ -4537,6 +5252,7 @@ meta_draw_op_list_unref (MetaDrawOpList *op_list)
         meta_draw_op_free (op_list->ops[i]);
 
       g_free (op_list->ops);
+      g_free (op_list->flat_ops);
 
       DEBUG_FILL_STRUCT (op_list);
       g_free (op_list);
@@ -4554,8 +5270,23 @@ meta_draw_op_list_draw_with_style  (const MetaDrawOpList *op_list,
 
   int i;
   MetaPositionExprEnv env;
+  MetaDrawOp **ops;
+  int n_ops;
+  GdkRectangle clip;
+  gboolean visible;
+
+  if (optimized_drawing && op_list->flat_ops)
+    {
+      ops = op_list->flat_ops;
+      n_ops = op_list->n_flat_ops;
+    }
+  else
+    {
+      ops = op_list->ops;
+      n_ops = op_list->n_ops;
+    }
 
-  if (op_list->n_ops == 0)
+  if (n_ops == 0)
     return;
 
   fill_env (&env, info, rect);
@@ -4574,9 +5305,14 @@ meta_draw_op_list_draw_with_style  (const MetaDrawOpList *op_list,
 
   cairo_save (cr);
 
-  for (i = 0; i < op_list->n_ops; i++)
+  /* The ops don't change the clip, so it only needs fetching again
+   * after a clip op.
+   */
+  visible = gdk_cairo_get_clip_rectangle (cr, &clip);
+
+  for (i = 0; i < n_ops; i++)
     {
-      MetaDrawOp *op = op_list->ops[i];
+      MetaDrawOp *op = ops[i];
 
       if (op->type == META_DRAW_CLIP)
         {
@@ -4590,10 +5326,13 @@ meta_draw_op_list_draw_with_style  (const MetaDrawOpList *op_list,
           cairo_clip (cr);
 
           cairo_save (cr);
+
+          visible = gdk_cairo_get_clip_rectangle (cr, &clip);
         }
-      else if (gdk_cairo_get_clip_rectangle (cr, NULL))
+      else if (visible)
         {
-          meta_draw_op_draw_with_env (op, style_gtk, cr, info, rect, &env);
+          meta_draw_op_draw_with_env (op, style_gtk, cr, info, rect, &env,
+                                      optimized_drawing ? &clip : NULL);
         }
     }
 
@@ -4626,6 +5365,107 @@ meta_draw_op_list_append (MetaDrawOpList       *op_list,
 
   op_list->ops[op_list->n_ops] = op;
   op_list->n_ops += 1;
+
+  /* Until the list is validated again */
+  g_free (op_list->flat_ops);
+  op_list->flat_ops = NULL;
+  op_list->n_flat_ops = 0;
+}
+
+static gboolean
+draw_spec_is_variable (const MetaDrawSpec *spec,
+                       const char         *name)
+{
+  return !spec->constant &&
+         spec->n_tokens == 1 &&
+         spec->tokens[0].type == POS_TOKEN_VARIABLE &&
+         strcmp (spec->tokens[0].d.v.name, name) == 0;
+}
+
+static gboolean
+draw_spec_is_zero (const MetaDrawSpec *spec)
+{
+  return spec->constant && spec->value == 0;
+}
+
+/* Whether the ops of an included list can be drawn as part of the
+ * list that includes it.  That's the case if the list is drawn over
+ * the same area, which is the default for <include>, and its ops
+ * don't depend on having their own clip and expression environment.
+ * Drawing an image sets object_width and object_height for the rest
+ * of the list it's in.
+ */
+static gboolean
+can_inline_op_list (const MetaDrawOp *op,
+                    gboolean          after_image)
+{
+  const MetaDrawOpList *child;
+  int i;
+
+  child = op->data.op_list.op_list;
+
+  if (child->flat_ops == NULL || after_image)
+    return FALSE;
+
+  if (!draw_spec_is_zero (op->data.op_list.x) ||
+      !draw_spec_is_zero (op->data.op_list.y) ||
+      !draw_spec_is_variable (op->data.op_list.width, "width") ||
+      !draw_spec_is_variable (op->data.op_list.height, "height"))
+    return FALSE;
+
+  for (i = 0; i < child->n_flat_ops; i++)
+    {
+      if (child->flat_ops[i]->type == META_DRAW_CLIP ||
+          child->flat_ops[i]->type == META_DRAW_IMAGE)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Puts the ops of a list into flat_ops, with the ops of included
+ * lists in place of the include where they can be; if flat_ops is
+ * NULL, only counts them.
+ */
+static int
+flatten_ops (const MetaDrawOpList  *op_list,
+             MetaDrawOp           **flat_ops)
+{
+  gboolean after_image;
+  int n_flat_ops;
+  int i, j;
+
+  after_image = FALSE;
+  n_flat_ops = 0;
+
+  for (i = 0; i < op_list->n_ops; i++)
+    {
+      MetaDrawOp *op = op_list->ops[i];
+
+      if (op->type == META_DRAW_OP_LIST &&
+          can_inline_op_list (op, after_image))
+        {
+          const MetaDrawOpList *child = op->data.op_list.op_list;
+
+          for (j = 0; j < child->n_flat_ops; j++)
+            {
+              if (flat_ops)
+                flat_ops[n_flat_ops] = child->flat_ops[j];
+              ++n_flat_ops;
+            }
+        }
+      else
+        {
+          if (op->type == META_DRAW_IMAGE)
+            after_image = TRUE;
+
+          if (flat_ops)
+            flat_ops[n_flat_ops] = op;
+          ++n_flat_ops;
+        }
+    }
+
+  return n_flat_ops;
 }
 
 gboolean
@@ -4636,6 +5476,15 @@ meta_draw_op_list_validate (MetaDrawOpList    *op_list,
 
   /* empty lists are OK, nothing else to check really */
 
+  /* Lists are only included once they are complete, so the lists this
+   * one includes have been flattened already, and this only needs to
+   * go one level deep.
+   */
+  g_free (op_list->flat_ops);
+  op_list->n_flat_ops = flatten_ops (op_list, NULL);
+  op_list->flat_ops = g_new (MetaDrawOp*, MAX (op_list->n_flat_ops, 1));
+  flatten_ops (op_list, op_list->flat_ops);
+
   return TRUE;
 }
 
@@ -5258,6 +6107,60 @@ meta_frame_style_draw (MetaFrameStyle          *style,
                                     button_states, mini_icon, icon);
 }
 
+/* Draws one button in the given state and nothing else, for painting
+ * a prelit or pressed button over a frame drawn with it in its normal
+ * state.
+ */
+void
+meta_frame_style_draw_button_with_style (MetaFrameStyle          *style,
+                                         GtkStyleContext         *style_gtk,
+                                         cairo_t                 *cr,
+                                         const MetaFrameGeometry *fgeom,
+                                         PangoLayout             *title_layout,
+                                         MetaButtonType           type,
+                                         MetaButtonState          state,
+                                         GdkPixbuf               *mini_icon,
+                                         GdkPixbuf               *icon)
+{
+  MetaDrawOpList *op_list;
+  MetaDrawInfo draw_info;
+  PangoRectangle extents;
+  GdkRectangle rect;
+  MetaRectangle m_rect;
+
+  op_list = get_button (style, type, state);
+  if (op_list == NULL)
+    return;
+
+  get_button_rect (type, fgeom, 0, &rect);
+  if (rect.width <= 0 || rect.height <= 0)
+    return;
+
+  if (title_layout)
+    pango_layout_get_pixel_extents (title_layout,
+                                    NULL, &extents);
+
+  draw_info.mini_icon = mini_icon;
+  draw_info.icon = icon;
+  draw_info.title_layout = title_layout;
+  draw_info.title_layout_width = title_layout ? extents.width : 0;
+  draw_info.title_layout_height = title_layout ? extents.height : 0;
+  draw_info.fgeom = fgeom;
+
+  cairo_save (cr);
+  gdk_cairo_rectangle (cr, &rect);
+  cairo_clip (cr);
+
+  m_rect = meta_rect (rect.x, rect.y, rect.width, rect.height);
+  meta_draw_op_list_draw_with_style (op_list,
+                                     style_gtk,
+                                     cr,
+                                     &draw_info,
+                                     m_rect);
+
+  cairo_restore (cr);
+}
+
 MetaFrameStyleSet*
 meta_frame_style_set_new (MetaFrameStyleSet *parent)
 {
@@ -393,11 +393,65 @@ typedef struct
   } d;
 } PosToken;
 
+/**
+ * The variables an expression can refer to; each is a field of
+ * MetaPositionExprEnv.
+ *
+ * \ingroup parser
+ */
+typedef enum
+{
+  POS_VAR_WIDTH,
+  POS_VAR_HEIGHT,
+  POS_VAR_OBJECT_WIDTH,
+  POS_VAR_OBJECT_HEIGHT,
+  POS_VAR_LEFT_WIDTH,
+  POS_VAR_RIGHT_WIDTH,
+  POS_VAR_TOP_HEIGHT,
+  POS_VAR_BOTTOM_HEIGHT,
+  POS_VAR_MINI_ICON_WIDTH,
+  POS_VAR_MINI_ICON_HEIGHT,
+  POS_VAR_ICON_WIDTH,
+  POS_VAR_ICON_HEIGHT,
+  POS_VAR_TITLE_WIDTH,
+  POS_VAR_TITLE_HEIGHT,
+  POS_VAR_FRAME_X_CENTER,
+  POS_VAR_FRAME_Y_CENTER
+} PosVariable;
+
+typedef enum
+{
+  POS_INSN_INT,
+  POS_INSN_DOUBLE,
+  POS_INSN_VARIABLE,
+  POS_INSN_OPERATOR
+} PosInsnType;
+
+/**
+ * An instruction of a compiled expression.  Expressions are compiled
+ * into postfix order: operands push a value on a stack, operators
+ * replace the top two values with their result.
+ *
+ * \ingroup parser
+ */
+typedef struct
+{
+  PosInsnType type;
+
+  union
+  {
+    int int_val;
+    double double_val;
+    PosVariable var;
+    PosOperatorType op;
+  } d;
+} PosInsn;
+
 /**
  * A computed expression in our simple vector drawing language.
  * While it appears to take the form of a tree, this is actually
  * merely a list; concerns such as precedence of operators are
- * currently recomputed on every recalculation.
+ * resolved once, when the list is compiled.
  *
  * Created by meta_draw_spec_new(), destroyed by meta_draw_spec_free().
  * pos_eval() fills this with ...FIXME. Are tokens a tree or a list?
@@ -417,6 +471,16 @@ typedef struct _MetaDrawSpec
   /** How many tokens are in the tokens list. */
   int n_tokens;
 
+  /**
+   * The expression compiled to postfix form, or NULL if it is constant
+   * or could not be compiled; in the latter case the tokens are
+   * evaluated instead, which reports the problem.
+   */
+  PosInsn *code;
+
+  /** How many instructions are in the code. */
+  int n_code;
+
   /** Does the expression contain any variables? */
   gboolean constant : 1;
 } MetaDrawSpec;
@@ -584,6 +648,15 @@ struct _MetaDrawOpList
   MetaDrawOp **ops;
   int n_ops;
   int n_allocated;
+
+  /**
+   * The ops that are actually drawn: the ops above, with included
+   * lists put inline where that draws the same thing.  Set up by
+   * meta_draw_op_list_validate(); the ops belong to this list or
+   * to the included lists.
+   */
+  MetaDrawOp **flat_ops;
+  int n_flat_ops;
 };
 
 typedef enum
@@ -900,6 +973,10 @@ gboolean meta_parse_size_expression     (MetaDrawSpec               *spec,
 MetaDrawSpec* meta_draw_spec_new (MetaTheme  *theme,
                                   const char *expr,
                                   GError    **error);
+MetaDrawSpec* meta_draw_spec_new_from_tokens (PosToken *tokens,
+                                             int       n_tokens,
+                                             gboolean  constant,
+                                             int       value);
 void          meta_draw_spec_free (MetaDrawSpec *spec);
 
 MetaColorSpec* meta_color_spec_new             (MetaColorSpecType  type);
@@ -914,6 +991,8 @@ void           meta_color_spec_render          (MetaColorSpec     *spec,
 
 MetaDrawOp*    meta_draw_op_new  (MetaDrawType        type);
 void           meta_draw_op_free (MetaDrawOp          *op);
+void           meta_draw_op_set_image (MetaDrawOp     *op,
+                                       GdkPixbuf      *pixbuf);
 void           meta_draw_op_draw (const MetaDrawOp    *op,
                                   GtkWidget           *widget,
                                   cairo_t             *cr,
@@ -994,6 +1073,16 @@ void meta_frame_style_draw_with_style (MetaFrameStyle          *style,
                                        GdkPixbuf               *mini_icon,
                                        GdkPixbuf               *icon);
 
+void meta_frame_style_draw_button_with_style (MetaFrameStyle          *style,
+                                              GtkStyleContext         *style_gtk,
+                                              cairo_t                 *cr,
+                                              const MetaFrameGeometry *fgeom,
+                                              PangoLayout             *title_layout,
+                                              MetaButtonType           type,
+                                              MetaButtonState          state,
+                                              GdkPixbuf               *mini_icon,
+                                              GdkPixbuf               *icon);
+
 gboolean       meta_frame_style_validate (MetaFrameStyle    *style,
                                           guint              current_theme_version,
                                           GError           **error);
@@ -1116,6 +1205,10 @@ gboolean     meta_theme_replace_constants     (MetaTheme    *theme,
                                                int           n_tokens,
                                                GError      **err);
 
+/* Only for comparing against the unoptimized code in benchmarks */
+void         meta_theme_set_compiled_expressions (gboolean  compiled);
+void         meta_theme_set_optimized_drawing    (gboolean  optimized);
+
 /* random stuff */
 
 PangoFontDescription* meta_gtk_widget_get_font_desc        (GtkWidget            *widget,
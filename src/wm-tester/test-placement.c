@@ -0,0 +1,278 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xatom.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include "test-util.h"
+
+/* Times how long the window manager takes to place and manage windows
+ * mapped one after the other, and reports how much the placed windows
+ * overlap.  The windows don't ask for a position, so the placement
+ * policy decides where they go.  Run the window manager with
+ * MARCO_VERBOSE=1 to see the time spent in each first fit search.
+ *
+ * Smart placement puts a window where it overlaps nothing whenever it
+ * fits somewhere in the work area, so this fails if a window overlaps
+ * one placed before it although there was room for it.  That only
+ * holds with the default placement preferences and a single monitor.
+ */
+
+#define DEFAULT_N_WINDOWS 100
+
+static Atom net_client_list;
+static Atom net_frame_extents;
+static Atom net_workarea;
+
+/* The window's frame in root coordinates, as placement sees it */
+static void
+get_frame_rect (Display    *d,
+                Window      root,
+                Window      xwindow,
+                XRectangle *rect)
+{
+  Window child, ignored;
+  int x, y;
+  unsigned int width, height, border_width, depth;
+  gulong extents[4];
+
+  XGetGeometry (d, xwindow, &ignored, &x, &y, &width, &height,
+                &border_width, &depth);
+  XTranslateCoordinates (d, xwindow, root, 0, 0, &x, &y, &child);
+
+  /* left, right, top, bottom */
+  if (!test_get_cardinals (d, xwindow, net_frame_extents, extents, 4))
+    extents[0] = extents[1] = extents[2] = extents[3] = 0;
+
+  rect->x = x - extents[0];
+  rect->y = y - extents[2];
+  rect->width = width + extents[0] + extents[1];
+  rect->height = height + extents[2] + extents[3];
+}
+
+static int
+overlap_area (const XRectangle *a,
+              const XRectangle *b)
+{
+  int width, height;
+
+  width = MIN (a->x + a->width, b->x + b->width) - MAX (a->x, b->x);
+  height = MIN (a->y + a->height, b->y + b->height) - MAX (a->y, b->y);
+
+  return width > 0 && height > 0 ? width * height : 0;
+}
+
+/* Whether a width x height rectangle fits in the work area without
+ * overlapping any of rects.  If it fits anywhere, it also fits when
+ * pushed left and up until it touches the work area or a window, so
+ * only those positions need trying.
+ */
+static gboolean
+has_room (const XRectangle *work_area,
+          const XRectangle *rects,
+          int               n_rects,
+          int               width,
+          int               height)
+{
+  XRectangle try;
+  int i, j, k;
+
+  try.width = width;
+  try.height = height;
+
+  for (i = -1; i < n_rects; i++)
+    {
+      try.x = i < 0 ? work_area->x : rects[i].x + rects[i].width;
+
+      if (try.x < work_area->x ||
+          try.x + width > work_area->x + work_area->width)
+        continue;
+
+      for (j = -1; j < n_rects; j++)
+        {
+          try.y = j < 0 ? work_area->y : rects[j].y + rects[j].height;
+
+          if (try.y < work_area->y ||
+              try.y + height > work_area->y + work_area->height)
+            continue;
+
+          for (k = 0; k < n_rects; k++)
+            if (overlap_area (&try, &rects[k]) > 0)
+              break;
+
+          if (k == n_rects)
+            return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+int
+main (int argc, char **argv)
+{
+  Display *d;
+  Window root;
+  Window *windows;
+  Window *existing;
+  XRectangle *rects;
+  XRectangle work_area;
+  gulong workarea[4];
+  GRand *rand;
+  int n_windows, n_existing, n_obstacles;
+  int managed;
+  int n_overlapping, n_misplaced;
+  double overlapped, total_area;
+  int i, j;
+  gint64 elapsed, slowest;
+
+  n_windows = argc > 1 ? atoi (argv[1]) : DEFAULT_N_WINDOWS;
+
+  if (n_windows < 1)
+    {
+      fprintf (stderr, "Usage: %s [N_WINDOWS]\n", argv[0]);
+      exit (1);
+    }
+
+  d = XOpenDisplay (NULL);
+  if (d == NULL)
+    {
+      fprintf (stderr, "Could not open display\n");
+      exit (1);
+    }
+
+  root = DefaultRootWindow (d);
+  net_client_list = XInternAtom (d, "_NET_CLIENT_LIST", False);
+  net_frame_extents = XInternAtom (d, "_NET_FRAME_EXTENTS", False);
+  net_workarea = XInternAtom (d, "_NET_WORKAREA", False);
+
+  XSelectInput (d, root, PropertyChangeMask);
+
+  if (test_get_cardinals (d, root, net_workarea, workarea, 4))
+    {
+      work_area.x = workarea[0];
+      work_area.y = workarea[1];
+      work_area.width = workarea[2];
+      work_area.height = workarea[3];
+    }
+  else
+    {
+      work_area.x = 0;
+      work_area.y = 0;
+      work_area.width = DisplayWidth (d, DefaultScreen (d));
+      work_area.height = DisplayHeight (d, DefaultScreen (d));
+    }
+
+  /* Windows that are already showing take up room too */
+  existing = test_get_window_list (d, root, net_client_list, &n_existing);
+
+  rand = g_rand_new_with_seed (42);
+  windows = g_new (Window, n_windows);
+  rects = g_new (XRectangle, n_existing + n_windows);
+
+  n_obstacles = 0;
+  for (i = 0; i < n_existing; i++)
+    {
+      XWindowAttributes attrs;
+
+      if (XGetWindowAttributes (d, existing[i], &attrs) &&
+          attrs.map_state == IsViewable)
+        get_frame_rect (d, root, existing[i], &rects[n_obstacles++]);
+    }
+
+  managed = n_existing;
+  elapsed = slowest = 0;
+
+  for (i = 0; i < n_windows; i++)
+    {
+      gint64 mapped;
+
+      windows[i] = XCreateSimpleWindow (d, root, 0, 0,
+                                        g_rand_int_range (rand, 100, 500),
+                                        g_rand_int_range (rand, 80, 400), 0,
+                                        WhitePixel (d, DefaultScreen (d)),
+                                        BlackPixel (d, DefaultScreen (d)));
+
+      mapped = g_get_monotonic_time ();
+      XMapWindow (d, windows[i]);
+      XFlush (d);
+
+      while (test_count_windows (d, root, net_client_list, NULL) <= managed)
+        test_wait_for_property_change (d, root, net_client_list);
+      managed = test_count_windows (d, root, net_client_list, NULL);
+
+      mapped = g_get_monotonic_time () - mapped;
+      elapsed += mapped;
+      slowest = MAX (slowest, mapped);
+    }
+
+  /* See where the windows ended up */
+  for (i = 0; i < n_windows; i++)
+    get_frame_rect (d, root, windows[i], &rects[n_obstacles + i]);
+
+  n_overlapping = n_misplaced = 0;
+  overlapped = total_area = 0;
+  for (i = n_obstacles; i < n_obstacles + n_windows; i++)
+    {
+      gboolean overlaps = FALSE;
+
+      total_area += rects[i].width * (double) rects[i].height;
+
+      for (j = 0; j < n_obstacles + n_windows; j++)
+        {
+          int area;
+
+          if (i == j)
+            continue;
+
+          area = overlap_area (&rects[i], &rects[j]);
+
+          if (area > 0)
+            {
+              overlaps = TRUE;
+              if (j > i)
+                overlapped += area;
+            }
+        }
+
+      if (overlaps)
+        ++n_overlapping;
+
+      /* Each window was placed with the ones before it showing */
+      for (j = 0; j < i; j++)
+        if (overlap_area (&rects[i], &rects[j]) > 0)
+          break;
+
+      if (j < i && has_room (&work_area, rects, i,
+                             rects[i].width, rects[i].height))
+        {
+          fprintf (stderr,
+                   "Window %d at %d,%d %dx%d overlaps another although "
+                   "there was room for it\n",
+                   i - n_obstacles, rects[i].x, rects[i].y,
+                   rects[i].width, rects[i].height);
+          ++n_misplaced;
+        }
+    }
+
+  printf ("Placed %d windows in %g ms (%g ms per window, slowest %g ms)\n",
+          n_windows, elapsed / 1000.0, elapsed / 1000.0 / n_windows,
+          slowest / 1000.0);
+  printf ("%d windows overlap another; overlaps cover %.1f%% of the "
+          "window area\n",
+          n_overlapping, 100.0 * overlapped / total_area);
+
+  for (i = 0; i < n_windows; i++)
+    XDestroyWindow (d, windows[i]);
+
+  XCloseDisplay (d);
+
+  if (existing)
+    XFree (existing);
+  g_free (windows);
+  g_free (rects);
+  g_rand_free (rand);
+
+  return n_misplaced > 0 ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xatom.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include "test-util.h"
+
+/* Times how long the window manager takes to manage a large number
+ * of windows, a fifth of them with a transient, and then to raise
+ * them one by one.  A raise counts as done once the window shows up
+ * on top of _NET_CLIENT_LIST_STACKING; raising a parent puts its
+ * transient on top.  Fails if a transient is ever stacked below its
+ * parent.
+ */
+
+#define DEFAULT_N_WINDOWS 500
+#define DEFAULT_N_RAISES 1000
+
+static Atom net_client_list_stacking;
+
+/* Checks that every transient is above its parent, windows[i - 1]
+ * for each i % 5 == 1.
+ */
+static gboolean
+transients_are_above (Display *d,
+                      Window   root,
+                      Window  *windows,
+                      int      n_windows)
+{
+  Window *stacked;
+  GHashTable *positions;
+  int n_stacked;
+  gboolean ok;
+  int i;
+
+  stacked = test_get_window_list (d, root, net_client_list_stacking,
+                                  &n_stacked);
+
+  positions = g_hash_table_new (NULL, NULL);
+  for (i = 0; i < n_stacked; i++)
+    g_hash_table_insert (positions, GUINT_TO_POINTER (stacked[i]),
+                         GINT_TO_POINTER (i + 1));
+
+  ok = TRUE;
+  for (i = 1; i < n_windows; i += 5)
+    {
+      int parent, transient;
+
+      parent = GPOINTER_TO_INT (g_hash_table_lookup (positions,
+                                                     GUINT_TO_POINTER (windows[i - 1])));
+      transient = GPOINTER_TO_INT (g_hash_table_lookup (positions,
+                                                        GUINT_TO_POINTER (windows[i])));
+
+      if (transient < parent)
+        {
+          fprintf (stderr, "Transient 0x%lx is below its parent 0x%lx\n",
+                   windows[i], windows[i - 1]);
+          ok = FALSE;
+        }
+    }
+
+  g_hash_table_destroy (positions);
+  if (stacked)
+    XFree (stacked);
+
+  return ok;
+}
+
+static gboolean
+is_on_top (Display *d,
+           Window   root,
+           Window   xwindow)
+{
+  Window *stacked;
+  int n_stacked;
+  gboolean on_top;
+
+  stacked = test_get_window_list (d, root, net_client_list_stacking,
+                                  &n_stacked);
+
+  on_top = n_stacked > 0 && stacked[n_stacked - 1] == xwindow;
+
+  if (stacked)
+    XFree (stacked);
+
+  return on_top;
+}
+
+int
+main (int argc, char **argv)
+{
+  Display *d;
+  Window root;
+  Window *windows;
+  GHashTable *ours;
+  GRand *rand;
+  int n_windows, n_raises;
+  int last;
+  int n_failures;
+  int i;
+  gint64 start, elapsed;
+
+  n_windows = argc > 1 ? atoi (argv[1]) : DEFAULT_N_WINDOWS;
+  n_raises = argc > 2 ? atoi (argv[2]) : DEFAULT_N_RAISES;
+
+  if (n_windows < 10 || n_raises < 1)
+    {
+      fprintf (stderr, "Usage: %s [N_WINDOWS [N_RAISES]]\n", argv[0]);
+      exit (1);
+    }
+
+  d = XOpenDisplay (NULL);
+  if (d == NULL)
+    {
+      fprintf (stderr, "Could not open display\n");
+      exit (1);
+    }
+
+  root = DefaultRootWindow (d);
+  net_client_list_stacking = XInternAtom (d, "_NET_CLIENT_LIST_STACKING", False);
+
+  XSelectInput (d, root, PropertyChangeMask);
+
+  rand = g_rand_new_with_seed (42);
+  windows = g_new (Window, n_windows);
+  ours = g_hash_table_new (NULL, NULL);
+
+  for (i = 0; i < n_windows; i++)
+    {
+      windows[i] = XCreateSimpleWindow (d, root,
+                                        g_rand_int_range (rand, 0, 800),
+                                        g_rand_int_range (rand, 0, 600),
+                                        100, 100, 0,
+                                        WhitePixel (d, DefaultScreen (d)),
+                                        BlackPixel (d, DefaultScreen (d)));
+
+      /* Every fifth window gets a transient */
+      if (i % 5 == 1)
+        XSetTransientForHint (d, windows[i], windows[i - 1]);
+
+      g_hash_table_add (ours, GUINT_TO_POINTER (windows[i]));
+    }
+
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < n_windows; i++)
+    XMapWindow (d, windows[i]);
+  XFlush (d);
+
+  while (test_count_windows (d, root, net_client_list_stacking, ours) <
+         n_windows)
+    test_wait_for_property_change (d, root, net_client_list_stacking);
+
+  elapsed = g_get_monotonic_time () - start;
+  printf ("Managed %d windows in %g ms\n", n_windows, elapsed / 1000.0);
+
+  n_failures = transients_are_above (d, root, windows, n_windows) ? 0 : 1;
+
+  elapsed = 0;
+  last = -1;
+  for (i = 0; i < n_raises; i++)
+    {
+      Window top;
+      int j;
+
+      do
+        j = g_rand_int_range (rand, 0, n_windows);
+      while (j == last);
+      last = j;
+
+      /* A parent's transient stays above it */
+      if (j % 5 == 0 && j + 1 < n_windows)
+        top = windows[j + 1];
+      else
+        top = windows[j];
+
+      start = g_get_monotonic_time ();
+
+      XRaiseWindow (d, windows[j]);
+      XFlush (d);
+
+      while (!is_on_top (d, root, top))
+        test_wait_for_property_change (d, root, net_client_list_stacking);
+
+      elapsed += g_get_monotonic_time () - start;
+
+      if (!transients_are_above (d, root, windows, n_windows))
+        ++n_failures;
+    }
+
+  printf ("%d raises in %g ms (%g ms per raise)\n",
+          n_raises, elapsed / 1000.0, elapsed / 1000.0 / n_raises);
+
+  for (i = 0; i < n_windows; i++)
+    XDestroyWindow (d, windows[i]);
+
+  XCloseDisplay (d);
+
+  g_hash_table_destroy (ours);
+  g_free (windows);
+  g_rand_free (rand);
+
+  return n_failures > 0 ? 1 : 0;
+}
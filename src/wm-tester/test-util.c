@@ -0,0 +1,122 @@
+#include "test-util.h"
+
+#include <X11/Xatom.h>
+
+/* Returns the windows in a window list property such as
+ * _NET_CLIENT_LIST, to be freed with XFree(), or NULL if there are none.
+ */
+Window *
+test_get_window_list (Display *d,
+                      Window   xwindow,
+                      Atom     atom,
+                      int     *n_windows)
+{
+  Atom type;
+  int format;
+  unsigned long nitems, bytes_after;
+  unsigned char *data;
+
+  data = NULL;
+  *n_windows = 0;
+
+  if (XGetWindowProperty (d, xwindow, atom,
+                          0, G_MAXLONG, False, XA_WINDOW,
+                          &type, &format, &nitems, &bytes_after,
+                          &data) != Success ||
+      type != XA_WINDOW)
+    {
+      if (data)
+        XFree (data);
+      return NULL;
+    }
+
+  *n_windows = nitems;
+  return (Window *) data;
+}
+
+/* Counts the windows in a window list property, or only those in ours
+ * if it isn't NULL.
+ */
+int
+test_count_windows (Display    *d,
+                    Window      xwindow,
+                    Atom        atom,
+                    GHashTable *ours)
+{
+  Window *windows;
+  int n_windows;
+  int count;
+  int i;
+
+  windows = test_get_window_list (d, xwindow, atom, &n_windows);
+
+  if (ours == NULL)
+    count = n_windows;
+  else
+    {
+      count = 0;
+      for (i = 0; i < n_windows; i++)
+        if (g_hash_table_contains (ours, GUINT_TO_POINTER (windows[i])))
+          ++count;
+    }
+
+  if (windows)
+    XFree (windows);
+
+  return count;
+}
+
+/* Reads the first n_values of a CARDINAL property, failing if it has
+ * fewer than that.
+ */
+gboolean
+test_get_cardinals (Display *d,
+                    Window   xwindow,
+                    Atom     atom,
+                    gulong  *values,
+                    int      n_values)
+{
+  Atom type;
+  int format;
+  unsigned long nitems, bytes_after;
+  unsigned char *data;
+  gboolean ok;
+  int i;
+
+  data = NULL;
+  ok = XGetWindowProperty (d, xwindow, atom,
+                           0, n_values, False, XA_CARDINAL,
+                           &type, &format, &nitems, &bytes_after,
+                           &data) == Success &&
+       type == XA_CARDINAL && nitems >= (unsigned long) n_values;
+
+  if (ok)
+    for (i = 0; i < n_values; i++)
+      values[i] = ((unsigned long *) data)[i];
+
+  if (data)
+    XFree (data);
+
+  return ok;
+}
+
+/* Blocks until the property changes; the caller has to select
+ * PropertyChangeMask on xwindow.  Other events are dropped.
+ */
+void
+test_wait_for_property_change (Display *d,
+                               Window   xwindow,
+                               Atom     atom)
+{
+  XEvent event;
+
+  while (TRUE)
+    {
+      XNextEvent (d, &event);
+
+      if (event.type == PropertyNotify &&
+          event.xproperty.window == xwindow &&
+          event.xproperty.atom == atom)
+        return;
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <X11/Xlib.h>
+#include <glib.h>
+
+/* Property helpers shared by the wm-tester timing programs */
+
+Window   *test_get_window_list          (Display    *d,
+                                         Window      xwindow,
+                                         Atom        atom,
+                                         int        *n_windows);
+int       test_count_windows            (Display    *d,
+                                         Window      xwindow,
+                                         Atom        atom,
+                                         GHashTable *ours);
+gboolean  test_get_cardinals            (Display    *d,
+                                         Window      xwindow,
+                                         Atom        atom,
+                                         gulong     *values,
+                                         int         n_values);
+void      test_wait_for_property_change (Display    *d,
+                                         Window      xwindow,
+                                         Atom        atom);
+
+#endif
@@ -0,0 +1,221 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xatom.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include "test-util.h"
+
+/* Times workspace switches with a large number of windows spread
+ * over the workspaces.  A switch counts as done once
+ * _NET_CURRENT_DESKTOP has the new value.  Run the window manager
+ * with MARCO_VERBOSE=1 to see how many window lists each switch,
+ * and each alt-tab, builds.
+ *
+ * Afterwards it visits every workspace and fails unless exactly the
+ * windows on it, and the sticky ones, are showing.
+ */
+
+#define DEFAULT_N_WINDOWS 500
+#define DEFAULT_N_SWITCHES 200
+
+#define ALL_DESKTOPS 0xFFFFFFFF
+
+static Atom net_current_desktop;
+static Atom net_number_of_desktops;
+static Atom net_wm_desktop;
+static Atom net_client_list;
+
+static void
+switch_to (Display *d,
+           Window   root,
+           int      desktop)
+{
+  XEvent xev;
+
+  xev.xclient.type = ClientMessage;
+  xev.xclient.serial = 0;
+  xev.xclient.send_event = True;
+  xev.xclient.display = d;
+  xev.xclient.window = root;
+  xev.xclient.message_type = net_current_desktop;
+  xev.xclient.format = 32;
+  xev.xclient.data.l[0] = desktop;
+  xev.xclient.data.l[1] = CurrentTime;
+  xev.xclient.data.l[2] = 0;
+  xev.xclient.data.l[3] = 0;
+  xev.xclient.data.l[4] = 0;
+
+  XSendEvent (d, root, False,
+              SubstructureRedirectMask | SubstructureNotifyMask,
+              &xev);
+  XFlush (d);
+}
+
+static void
+switch_and_wait (Display *d,
+                 Window   root,
+                 gulong   desktop)
+{
+  gulong now;
+
+  switch_to (d, root, desktop);
+
+  do
+    test_wait_for_property_change (d, root, net_current_desktop);
+  while (!test_get_cardinals (d, root, net_current_desktop, &now, 1) ||
+         now != desktop);
+}
+
+/* Windows are shown and hidden shortly after the switch, so this
+ * gives them a second to get there.
+ */
+static gboolean
+check_showing (Display *d,
+               Window  *windows,
+               gulong  *desktops,
+               int      n_windows,
+               gulong   desktop)
+{
+  int attempt;
+  int i;
+
+  for (attempt = 0; attempt < 100; attempt++)
+    {
+      XSync (d, False);
+
+      for (i = 0; i < n_windows; i++)
+        {
+          XWindowAttributes attrs;
+          gboolean expected;
+
+          expected = desktops[i] == ALL_DESKTOPS || desktops[i] == desktop;
+
+          if (XGetWindowAttributes (d, windows[i], &attrs) &&
+              (attrs.map_state == IsViewable) != expected)
+            break;
+        }
+
+      if (i == n_windows)
+        return TRUE;
+
+      g_usleep (10000);
+    }
+
+  fprintf (stderr, "Window 0x%lx on desktop %ld is %s on desktop %lu\n",
+           windows[i], (long) desktops[i],
+           desktops[i] == ALL_DESKTOPS || desktops[i] == desktop ?
+           "hidden" : "showing",
+           desktop);
+
+  return FALSE;
+}
+
+int
+main (int argc, char **argv)
+{
+  Display *d;
+  Window root;
+  Window *windows;
+  gulong *desktops;
+  int n_windows, n_switches;
+  gulong n_desktops, current;
+  int initial_managed;
+  int n_failures;
+  int i;
+  gint64 start, elapsed;
+
+  n_windows = argc > 1 ? atoi (argv[1]) : DEFAULT_N_WINDOWS;
+  n_switches = argc > 2 ? atoi (argv[2]) : DEFAULT_N_SWITCHES;
+
+  if (n_windows < 1 || n_switches < 1)
+    {
+      fprintf (stderr, "Usage: %s [N_WINDOWS [N_SWITCHES]]\n", argv[0]);
+      exit (1);
+    }
+
+  d = XOpenDisplay (NULL);
+  if (d == NULL)
+    {
+      fprintf (stderr, "Could not open display\n");
+      exit (1);
+    }
+
+  root = DefaultRootWindow (d);
+  net_current_desktop = XInternAtom (d, "_NET_CURRENT_DESKTOP", False);
+  net_number_of_desktops = XInternAtom (d, "_NET_NUMBER_OF_DESKTOPS", False);
+  net_wm_desktop = XInternAtom (d, "_NET_WM_DESKTOP", False);
+  net_client_list = XInternAtom (d, "_NET_CLIENT_LIST", False);
+
+  if (!test_get_cardinals (d, root, net_number_of_desktops, &n_desktops, 1) ||
+      n_desktops < 2)
+    {
+      fprintf (stderr, "Need a window manager with at least two workspaces\n");
+      exit (1);
+    }
+
+  XSelectInput (d, root, PropertyChangeMask);
+
+  initial_managed = test_count_windows (d, root, net_client_list, NULL);
+
+  windows = g_new (Window, n_windows);
+  desktops = g_new (gulong, n_windows);
+
+  for (i = 0; i < n_windows; i++)
+    {
+      windows[i] = XCreateSimpleWindow (d, root,
+                                        (i * 13) % 800, (i * 7) % 600,
+                                        100, 100, 0,
+                                        WhitePixel (d, DefaultScreen (d)),
+                                        BlackPixel (d, DefaultScreen (d)));
+
+      /* Spread the windows over the workspaces, a few of them sticky */
+      desktops[i] = i % 20 == 0 ? ALL_DESKTOPS : i % n_desktops;
+      XChangeProperty (d, windows[i], net_wm_desktop, XA_CARDINAL, 32,
+                       PropModeReplace, (unsigned char *) &desktops[i], 1);
+
+      XMapWindow (d, windows[i]);
+    }
+  XFlush (d);
+
+  while (test_count_windows (d, root, net_client_list, NULL) <
+         initial_managed + n_windows)
+    test_wait_for_property_change (d, root, net_client_list);
+
+  if (!test_get_cardinals (d, root, net_current_desktop, &current, 1))
+    current = 0;
+
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < n_switches; i++)
+    {
+      current = (current + 1) % n_desktops;
+      switch_and_wait (d, root, current);
+    }
+
+  elapsed = g_get_monotonic_time () - start;
+  printf ("%d workspace switches with %d windows in %g ms (%g ms per switch)\n",
+          n_switches, n_windows, elapsed / 1000.0,
+          elapsed / 1000.0 / n_switches);
+
+  n_failures = 0;
+  for (i = 0; i < (int) n_desktops; i++)
+    {
+      current = (current + 1) % n_desktops;
+      switch_and_wait (d, root, current);
+
+      if (!check_showing (d, windows, desktops, n_windows, current))
+        ++n_failures;
+    }
+
+  for (i = 0; i < n_windows; i++)
+    XDestroyWindow (d, windows[i]);
+
+  XCloseDisplay (d);
+
+  g_free (windows);
+  g_free (desktops);
+
+  return n_failures > 0 ? 1 : 0;
+}